@@ -0,0 +1,295 @@
+#include <algorithm>
+
+#include <math.h>
+#include <string.h>
+
+#include "AudioTap.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// Reported for silence.
+static const float kFloorDb = -120.0f;
+
+// A sample at or above this magnitude is counted as clipped.
+static const float kClipLevel = 32767.0f / 32768.0f;
+
+static float toDb(double aPower)
+{
+    if (aPower <= 1.0e-12)
+    {
+        return kFloorDb;
+    }
+
+    return std::max((float)(10.0 * log10(aPower)), kFloorDb);
+}
+
+AudioTap::AudioTap()
+    : iSequence(0)
+    , iLease(0)
+    , iSpectrumLease(0)
+    , iMeasuring(false)
+    , iSampleRate(0)
+    , iChannels(0)
+    , iWindowFrames(0)
+    , iFrames(0)
+    , iSpectrumCount(0)
+    , iFft(kSpectrumFrames / 2)
+{
+    static_assert(sizeof(Snapshot) % 4 == 0, "Snapshot is not whole words");
+
+    for (TUint i=0; i<kSnapshotWords; i++)
+    {
+        iWords[i].store(0, std::memory_order_relaxed);
+    }
+
+    memset(&iSnapshot, 0, sizeof(iSnapshot));
+}
+
+void AudioTap::Observe(TBool aSpectrum, TUint aLeaseMs)
+{
+    TUint windows = std::max((aLeaseMs * kWindowsPerSecond) / 1000, 1u);
+
+    iLease.store(windows, std::memory_order_relaxed);
+
+    if (aSpectrum)
+    {
+        iSpectrumLease.store(windows, std::memory_order_relaxed);
+    }
+}
+
+TBool AudioTap::Read(Snapshot& aSnapshot) const
+{
+    TUint32 words[kSnapshotWords];
+
+    for (TUint attempt=0; attempt<kMaxReadAttempts; attempt++)
+    {
+        TUint32 before = iSequence.load(std::memory_order_acquire);
+
+        if ((before & 1) != 0)
+        {
+            continue;
+        }
+
+        for (TUint i=0; i<kSnapshotWords; i++)
+        {
+            words[i] = iWords[i].load(std::memory_order_relaxed);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (iSequence.load(std::memory_order_relaxed) == before)
+        {
+            memcpy(&aSnapshot, words, sizeof(aSnapshot));
+
+            return (aSnapshot.iWindow != 0);
+        }
+    }
+
+    return false;
+}
+
+TBool AudioTap::Observed() const
+{
+    return iMeasuring || (iLease.load(std::memory_order_relaxed) != 0);
+}
+
+// Measure interleaved S16_LE or S32_LE audio.
+void AudioTap::Process(const TByte* aData, TUint aFrames, TUint aChannels,
+                       TUint aSubsampleBytes, TUint aSampleRate)
+{
+    if ((aChannels == 0) || (aChannels > kMaxChannels) ||
+        (aSampleRate == 0))
+    {
+        return;
+    }
+
+    // Clip counts accumulate from the start of observation, or the format.
+    if (! iMeasuring || (aChannels != iChannels) ||
+        (aSampleRate != iSampleRate))
+    {
+        memset(iSnapshot.iClipped, 0, sizeof(iSnapshot.iClipped));
+
+        iMeasuring = true;
+
+        startWindow(aChannels, aSampleRate);
+    }
+
+    const float scale = (aSubsampleBytes == 2) ? 1.0f / 32768.0f
+                                               : 1.0f / 2147483648.0f;
+
+    for (TUint f=0; f<aFrames; f++)
+    {
+        float mix = 0.0f;
+
+        for (TUint c=0; c<iChannels; c++)
+        {
+            TUint index = (f * iChannels) + c;
+            float x     = (aSubsampleBytes == 2)
+                              ? ((const TInt16 *)aData)[index] * scale
+                              : ((const TInt32 *)aData)[index] * scale;
+            float a     = fabsf(x);
+
+            iPeak[c]     = std::max(iPeak[c], a);
+            iSquares[c] += x * x;
+            mix         += x;
+
+            if (a >= kClipLevel)
+            {
+                iSnapshot.iClipped[c]++;
+            }
+        }
+
+        if (iSpectrumCount < kSpectrumFrames)
+        {
+            iSpectrum[iSpectrumCount++] = mix / iChannels;
+        }
+
+        if (++iFrames == iWindowFrames)
+        {
+            publish();
+
+            // Stop once the lease expires, unless renewed meanwhile.
+            TUint lease = iLease.load(std::memory_order_relaxed);
+
+            while ((lease > 0) &&
+                   ! iLease.compare_exchange_weak(lease, lease - 1,
+                                                  std::memory_order_relaxed))
+            {
+            }
+
+            if (lease <= 1)
+            {
+                iMeasuring = false;
+                return;
+            }
+
+            startWindow(iChannels, iSampleRate);
+        }
+    }
+}
+
+void AudioTap::startWindow(TUint aChannels, TUint aSampleRate)
+{
+    TUint spectrumLease = iSpectrumLease.load(std::memory_order_relaxed);
+
+    iChannels     = aChannels;
+    iSampleRate   = aSampleRate;
+    iWindowFrames = std::max(aSampleRate / kWindowsPerSecond, 1u);
+    iFrames       = 0;
+
+    for (TUint c=0; c<kMaxChannels; c++)
+    {
+        iPeak[c]    = 0.0f;
+        iSquares[c] = 0.0;
+    }
+
+    // Capture the first block of the window for the spectrum, if wanted.
+    iSpectrumCount = kSpectrumFrames;
+
+    while (spectrumLease > 0)
+    {
+        if (iSpectrumLease.compare_exchange_weak(spectrumLease,
+                                                 spectrumLease - 1,
+                                                 std::memory_order_relaxed))
+        {
+            iSpectrumCount = 0;
+            break;
+        }
+    }
+}
+
+// Publish the window through the seqlock. Each word is stored atomically,
+// so a reader racing the update sees the sequence change and retries.
+void AudioTap::publish()
+{
+    iSnapshot.iWindow++;
+    iSnapshot.iSampleRate = iSampleRate;
+    iSnapshot.iChannels   = iChannels;
+
+    for (TUint c=0; c<kMaxChannels; c++)
+    {
+        if (c < iChannels)
+        {
+            iSnapshot.iPeakDb[c] = toDb((double)iPeak[c] * iPeak[c]);
+            iSnapshot.iRmsDb[c]  = toDb(iSquares[c] / iFrames);
+        }
+        else
+        {
+            iSnapshot.iPeakDb[c] = kFloorDb;
+            iSnapshot.iRmsDb[c]  = kFloorDb;
+        }
+    }
+
+    iSnapshot.iSpectrumValid = 0;
+
+    if (iSpectrumCount == kSpectrumFrames)
+    {
+        analyseSpectrum();
+    }
+
+    TUint32 words[kSnapshotWords];
+    TUint32 sequence = iSequence.load(std::memory_order_relaxed);
+
+    memcpy(words, &iSnapshot, sizeof(words));
+
+    iSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (TUint i=0; i<kSnapshotWords; i++)
+    {
+        iWords[i].store(words[i], std::memory_order_relaxed);
+    }
+
+    iSequence.store(sequence + 2, std::memory_order_release);
+}
+
+// Measure the captured block over a Hann window, summing the bins into
+// log spaced bands.
+void AudioTap::analyseSpectrum()
+{
+    const TUint  bins  = kSpectrumFrames / 2;
+    const double binHz = (double)iSampleRate / kSpectrumFrames;
+    const double low   = 20.0;
+    const double top   = std::min(20000.0, 0.45 * iSampleRate);
+
+    // The Hann window spreads a sine over three bins, whose powers sum to
+    // 1.5 times that of the centre bin, an amplitude of a quarter the
+    // block. A full scale sine then reads 0dB.
+    const double scale = 1.0 / (1.5 * (kSpectrumFrames / 4.0) *
+                                (kSpectrumFrames / 4.0));
+
+    for (TUint n=0; n<kSpectrumFrames; n++)
+    {
+        iSpectrum[n] *= 0.5f - 0.5f * cosf((2.0f * (float)M_PI * n) /
+                                           kSpectrumFrames);
+    }
+
+    iFft.Forward(iSpectrum, iSpectrumRe, iSpectrumIm);
+
+    for (TUint b=0; b<kSpectrumBands; b++)
+    {
+        const double lowHz  = low * pow(top / low,
+                                        (double)b / kSpectrumBands);
+        const double highHz = low * pow(top / low,
+                                        (double)(b + 1) / kSpectrumBands);
+        TUint        first  = (TUint)ceil(lowHz / binHz);
+        TUint        last   = (TUint)ceil(highHz / binHz);
+        double       power  = 0.0;
+
+        // A band narrower than a bin takes the nearest bin.
+        first = std::min(std::max(first, 1u), bins - 1);
+        last  = std::min(std::max(last, first + 1), bins);
+
+        for (TUint k=first; k<last; k++)
+        {
+            power += ((double)iSpectrumRe[k] * iSpectrumRe[k]) +
+                     ((double)iSpectrumIm[k] * iSpectrumIm[k]);
+        }
+
+        iSnapshot.iBandHz[b] = (float)sqrt(lowHz * highHz);
+        iSnapshot.iBandDb[b] = toDb(power * scale);
+    }
+
+    iSnapshot.iSpectrumValid = 1;
+}
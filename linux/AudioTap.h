@@ -0,0 +1,95 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+
+#include <atomic>
+
+#include "RealFft.h"
+
+namespace OpenHome {
+namespace Media {
+
+// Level meter and spectrum of the audio played by the default ALSA device.
+//
+// DriverAlsa measures the peak and RMS level of each channel over windows
+// of 100ms, and publishes them to readers through a seqlock, so neither
+// side ever waits for the other. It only measures while a reader has
+// called Observe() within its lease, so an unobserved tap costs one atomic
+// load per write. The spectrum is optional, the first block of each window
+// transformed and summed into log spaced bands.
+class AudioTap
+{
+public:
+    static const TUint kMaxChannels   = 8;
+    static const TUint kSpectrumBands = 32;
+
+    struct Snapshot
+    {
+        TUint32 iWindow;         // Count of windows measured.
+        TUint32 iSampleRate;
+        TUint32 iChannels;
+        float   iPeakDb[kMaxChannels];
+        float   iRmsDb[kMaxChannels];
+        TUint32 iClipped[kMaxChannels];  // Samples at full scale, in all
+                                         // windows since observed.
+        TUint32 iSpectrumValid;
+        float   iBandHz[kSpectrumBands];
+        float   iBandDb[kSpectrumBands];
+    };
+private:
+    AudioTap();
+
+    // Stop the compiler generating methods of copy and assignment operators.
+    AudioTap(AudioTap const& copy);
+    AudioTap& operator=(AudioTap const& copy);
+
+public:
+    static AudioTap *getInstance()
+    {
+        static AudioTap instance;
+        return &instance;
+    }
+
+public: // Called by readers
+    // Keep the tap measuring for aLeaseMs.
+    void  Observe(TBool aSpectrum, TUint aLeaseMs);
+    // False if no window has been measured or a consistent snapshot could
+    // not be read.
+    TBool Read(Snapshot& aSnapshot) const;
+public: // Called by the driver
+    TBool Observed() const;
+    void  Process(const TByte* aData, TUint aFrames, TUint aChannels,
+                  TUint aSubsampleBytes, TUint aSampleRate);
+private:
+    void  startWindow(TUint aChannels, TUint aSampleRate);
+    void  publish();
+    void  analyseSpectrum();
+private:
+    static const TUint kWindowsPerSecond = 10;
+    static const TUint kSpectrumFrames   = 1024;
+    static const TUint kSnapshotWords    = sizeof(Snapshot) / 4;
+    static const TUint kMaxReadAttempts  = 16;
+
+    std::atomic<TUint32> iSequence;   // Odd while publishing.
+    std::atomic<TUint32> iWords[kSnapshotWords];
+    std::atomic<TUint>   iLease;      // Windows still to measure.
+    std::atomic<TUint>   iSpectrumLease;
+
+    // Owned by the driver.
+    TBool                iMeasuring;
+    TUint                iSampleRate;
+    TUint                iChannels;
+    TUint                iWindowFrames;
+    TUint                iFrames;     // Measured in this window.
+    float                iPeak[kMaxChannels];
+    double               iSquares[kMaxChannels];
+    Snapshot             iSnapshot;
+    TUint                iSpectrumCount;
+    float                iSpectrum[kSpectrumFrames];
+    RealFft              iFft;
+    float                iSpectrumRe[kSpectrumFrames / 2];
+    float                iSpectrumIm[kSpectrumFrames / 2];
+};
+
+} // namespace Media
+} // namespace OpenHome
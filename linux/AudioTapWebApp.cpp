@@ -0,0 +1,219 @@
+#include <OpenHome/Private/Printer.h>
+#include <OpenHome/Private/Stream.h>
+
+#include <stdio.h>
+
+#include "AudioTap.h"
+#include "AudioTapWebApp.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+using namespace OpenHome::Web;
+
+// The page drawing the meters and spectrum, polling every 200ms.
+static const TChar kPage[] =
+"<!DOCTYPE html>\n"
+"<html><head><meta charset=\"utf-8\"><title>Output levels</title>\n"
+"<style>\n"
+"body{font-family:sans-serif;background:#222;color:#ddd}\n"
+".ch{margin:8px 0}.bar{height:14px;background:#444;position:relative;"
+"width:480px}\n"
+".rms{position:absolute;height:100%;background:#4a4}\n"
+".peak{position:absolute;height:100%;width:2px;background:#ee4}\n"
+".clip{color:#f44}\n"
+"</style></head><body>\n"
+"<h3>Output levels <span id=\"rate\"></span></h3>\n"
+"<div id=\"channels\"></div>\n"
+"<label><input type=\"checkbox\" id=\"spectrum\"> Spectrum</label><br>\n"
+"<canvas id=\"bands\" width=\"480\" height=\"160\"></canvas>\n"
+"<script>\n"
+"var floorDb=-60,clipped=[];\n"
+"function pos(db){return Math.max(0,Math.min(1,1-db/floorDb))*100+'%';}\n"
+"function show(s){\n"
+" document.getElementById('rate').textContent=s.sample_rate+'Hz';\n"
+" var html='';\n"
+" s.channels.forEach(function(c,i){\n"
+"  if(clipped[i]===undefined)clipped[i]=c.clipped;\n"
+"  var n=c.clipped-clipped[i];\n"
+"  html+='<div class=\"ch\">ch'+i+' peak '+c.peak_db.toFixed(1)+"
+"'dB rms '+c.rms_db.toFixed(1)+'dB'+"
+"(n?' <span class=\"clip\">clipped '+n+'</span>':'')+"
+"'<div class=\"bar\"><div class=\"rms\" style=\"width:'+pos(c.rms_db)+"
+"'\"></div><div class=\"peak\" style=\"left:'+pos(c.peak_db)+"
+"'\"></div></div></div>';});\n"
+" document.getElementById('channels').innerHTML=html;\n"
+" var g=document.getElementById('bands').getContext('2d');\n"
+" g.clearRect(0,0,480,160);\n"
+" if(!s.spectrum)return;\n"
+" var w=480/s.spectrum.db.length;\n"
+" g.fillStyle='#4a4';\n"
+" s.spectrum.db.forEach(function(db,b){\n"
+"  var h=Math.max(0,Math.min(1,1-db/-90))*160;\n"
+"  g.fillRect(b*w+1,160-h,w-2,h);});\n"
+"}\n"
+"function poll(){\n"
+" var r=new XMLHttpRequest(),\n"
+"     spectrum=document.getElementById('spectrum').checked;\n"
+" r.open('GET',spectrum?'spectrum.json':'levels.json');\n"
+" r.onload=function(){\n"
+"  try{var s=JSON.parse(r.responseText);if(s.channels)show(s);}catch(e){}\n"
+"  setTimeout(poll,200);};\n"
+" r.onerror=function(){setTimeout(poll,1000);};\n"
+" r.send();\n"
+"}\n"
+"poll();\n"
+"</script></body></html>\n";
+
+// A resource held in memory, released once written.
+class AudioTapResource : public IResourceHandler
+{
+public:
+    AudioTapResource(const Brx& aContent)
+        : iContent(aContent)
+    {
+    }
+public: // from IResourceHandler
+    TBool Allocated() override
+    {
+        return true;
+    }
+    void SetResource(const Brx& /*aUri*/) override
+    {
+    }
+    TUint Bytes() override
+    {
+        return iContent.Bytes();
+    }
+    void Write(IWriter& aWriter) override
+    {
+        aWriter.Write(iContent);
+    }
+    void Destroy() override
+    {
+        delete this;
+    }
+private:
+    Bwh iContent;
+};
+
+// The page polls resources rather than using the tab, which only needs
+// to be accepted.
+class AudioTapTab : public ITab
+{
+public: // from ITab
+    void Receive(const Brx& /*aMessage*/) override
+    {
+    }
+    void Destroy() override
+    {
+        delete this;
+    }
+};
+
+const Brn AudioTapWebApp::kPrefix("Levels");
+
+AudioTapWebApp::AudioTapWebApp()
+{
+}
+
+void AudioTapWebApp::PresentationUrlChanged(const Brx& aUrl)
+{
+    Log::Print("AudioTapWebApp: Levels at %.*s\n", PBUF(aUrl));
+}
+
+IResourceManager& AudioTapWebApp::ResourceManager()
+{
+    return *this;
+}
+
+ITab& AudioTapWebApp::Create(ITabHandler& /*aHandler*/,
+                             const std::vector<char*>& /*aLanguageList*/)
+{
+    return *new AudioTapTab();
+}
+
+const Brx& AudioTapWebApp::ResourcePrefix() const
+{
+    return kPrefix;
+}
+
+IResourceHandler& AudioTapWebApp::CreateResourceHandler(const Brx& aResource)
+{
+    if ((aResource.Bytes() == 0) || (aResource == Brn("index.html")))
+    {
+        return *new AudioTapResource(Brn(kPage));
+    }
+
+    TBool spectrum = (aResource == Brn("spectrum.json"));
+
+    if (! spectrum && (aResource != Brn("levels.json")))
+    {
+        THROW(ResourceInvalid);
+    }
+
+    Bws<kMaxJson> json;
+
+    WriteLevels(json, spectrum);
+
+    return *new AudioTapResource(json);
+}
+
+// The latest snapshot as JSON, an empty object before the first window.
+// Clip counts accumulate while observed, so the page reports the change.
+void AudioTapWebApp::WriteLevels(Bwx& aJson, TBool aSpectrum)
+{
+    AudioTap          *tap = AudioTap::getInstance();
+    AudioTap::Snapshot snapshot;
+    TChar              item[128];
+
+    tap->Observe(aSpectrum, kLeaseMs);
+
+    aJson.Replace("{");
+
+    if (! tap->Read(snapshot))
+    {
+        aJson.Append("}");
+        return;
+    }
+
+    (void)snprintf(item, sizeof(item),
+                   "\"window\":%u,\"sample_rate\":%u,\"channels\":[",
+                   (TUint)snapshot.iWindow, (TUint)snapshot.iSampleRate);
+    aJson.Append(item);
+
+    for (TUint c=0; c<snapshot.iChannels; c++)
+    {
+        (void)snprintf(item, sizeof(item),
+                       "%s{\"peak_db\":%.1f,\"rms_db\":%.1f,\"clipped\":%u}",
+                       (c == 0) ? "" : ",", snapshot.iPeakDb[c],
+                       snapshot.iRmsDb[c], (TUint)snapshot.iClipped[c]);
+        aJson.Append(item);
+    }
+
+    aJson.Append("]");
+
+    if (aSpectrum && snapshot.iSpectrumValid)
+    {
+        aJson.Append(",\"spectrum\":{\"hz\":[");
+
+        for (TUint b=0; b<AudioTap::kSpectrumBands; b++)
+        {
+            (void)snprintf(item, sizeof(item), "%s%.0f",
+                           (b == 0) ? "" : ",", snapshot.iBandHz[b]);
+            aJson.Append(item);
+        }
+
+        aJson.Append("],\"db\":[");
+
+        for (TUint b=0; b<AudioTap::kSpectrumBands; b++)
+        {
+            (void)snprintf(item, sizeof(item), "%s%.1f",
+                           (b == 0) ? "" : ",", snapshot.iBandDb[b]);
+            aJson.Append(item);
+        }
+
+        aJson.Append("]}");
+    }
+
+    aJson.Append("}");
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Web/WebAppFramework.h>
+
+#include <vector>
+
+namespace OpenHome {
+namespace Web {
+
+// Web app showing the level meter and spectrum of AudioTap, alongside the
+// config app.
+//
+// The page polls 'levels.json', or 'spectrum.json' with the spectrum
+// shown, and each request keeps the tap measuring for a short lease, so
+// the tap costs nothing once the page is closed.
+class AudioTapWebApp : public IWebApp, private IResourceManager
+{
+    static const TUint kLeaseMs = 2000;
+    static const TUint kMaxJson = 4096;
+public:
+    AudioTapWebApp();
+    void PresentationUrlChanged(const Brx& aUrl);
+public: // from IWebApp
+    IResourceManager& ResourceManager() override;
+    ITab& Create(ITabHandler& aHandler,
+                 const std::vector<char*>& aLanguageList) override;
+    const Brx& ResourcePrefix() const override;
+private: // from IResourceManager
+    IResourceHandler& CreateResourceHandler(const Brx& aResource) override;
+private:
+    static void WriteLevels(Bwx& aJson, TBool aSpectrum);
+private:
+    static const Brn kPrefix;
+};
+
+} // namespace Web
+} // namespace OpenHome
@@ -0,0 +1,186 @@
+#include <OpenHome/Media/Pipeline/Msg.h>
+#include <OpenHome/Private/Printer.h>
+
+#include <algorithm>
+
+#include "ClockPullerAlsa.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// Controller gains. The error is in ms, the adjustment in ppm.
+static const double kProportionalGain = 10.0;
+static const double kIntegralGain     = 0.1;
+
+// Interval between logging the measured device clock.
+static const TUint64 kLogIntervalUs   = 60000000;
+
+// ClockPullerAlsa
+
+ClockPullerAlsa::ClockPullerAlsa()
+    : iLock("CPAL")
+    , iRunning(false)
+{
+    reset();
+}
+
+void ClockPullerAlsa::reset()
+{
+    iBufferError     = 0;
+    iDelayError      = 0;
+    iDelayReferenced = false;
+    iDelayReference  = 0;
+    iSettleDelay     = 0;
+    iSettleUs        = 0;
+    iIntegral        = 0;
+    iAdjust          = 0;
+    iLastControlUs   = 0;
+    iStatusFrames    = 0;
+    iStatusUs        = 0;
+}
+
+// Called by the receiver as a stream starts.
+void ClockPullerAlsa::Start()
+{
+    AutoMutex am(iLock);
+
+    reset();
+    iRunning = true;
+}
+
+void ClockPullerAlsa::Stop()
+{
+    AutoMutex am(iLock);
+
+    iRunning = false;
+    iAdjust  = 0;
+}
+
+// The change in the receiver buffer, in jiffies, since the previous
+// update. Positive when the buffer has grown.
+void ClockPullerAlsa::Update(TInt aDelta)
+{
+    AutoMutex am(iLock);
+
+    if (iRunning)
+    {
+        iBufferError += aDelta;
+    }
+}
+
+TBool ClockPullerAlsa::Running() const
+{
+    AutoMutex am(iLock);
+
+    return iRunning;
+}
+
+// The ratio adjustment for the driver resampler. Positive when audio is to
+// be consumed faster.
+double ClockPullerAlsa::RatioAdjust() const
+{
+    AutoMutex am(iLock);
+
+    return iAdjust;
+}
+
+// Report the device status following a write.
+//
+// aDelayFrames is the ALSA delay, aFramesConsumed the frames played by the
+// device and aTimestampUs the time the status was sampled.
+void ClockPullerAlsa::DeviceStatus(TUint aSampleRate, TUint aDelayFrames,
+                                   TUint64 aFramesConsumed,
+                                   TUint64 aTimestampUs)
+{
+    AutoMutex am(iLock);
+
+    if (! iRunning || (aSampleRate == 0))
+    {
+        return;
+    }
+
+    // The reference latency is taken once the device buffer has filled,
+    // when the delay has stopped growing. The buffer error is restarted
+    // with it, so both terms measure from the same point.
+    if (! iDelayReferenced)
+    {
+        const TUint tolerance =
+            (TUint)(((TUint64)aSampleRate * kSettleToleranceUs) / 1000000);
+
+        if ((iSettleUs == 0) || (aDelayFrames > iSettleDelay + tolerance))
+        {
+            iSettleDelay = std::max(iSettleDelay, aDelayFrames);
+            iSettleUs    = aTimestampUs;
+
+            return;
+        }
+
+        if (aTimestampUs - iSettleUs < kSettleUs)
+        {
+            return;
+        }
+
+        iDelayReferenced = true;
+        iDelayReference  = aDelayFrames;
+        iBufferError     = 0;
+        iLastControlUs   = aTimestampUs;
+        iStatusFrames    = aFramesConsumed;
+        iStatusUs        = aTimestampUs;
+
+        return;
+    }
+
+    iDelayError = (((TInt64)aDelayFrames - (TInt64)iDelayReference) *
+                   (TInt64)Jiffies::kPerSecond) / aSampleRate;
+
+    if (aTimestampUs - iLastControlUs < kControlIntervalUs)
+    {
+        return;
+    }
+
+    double intervalSecs = (aTimestampUs - iLastControlUs) / 1000000.0;
+    double errorMs      = ((iBufferError + iDelayError) * 1000.0) /
+                          Jiffies::kPerSecond;
+
+    iLastControlUs = aTimestampUs;
+
+    // Limit the integral term to the adjustment range, preventing windup.
+    double integralMax = kMaxAdjustPpm / kIntegralGain;
+
+    iIntegral += errorMs * intervalSecs;
+
+    if (iIntegral > integralMax)
+    {
+        iIntegral = integralMax;
+    }
+    else if (iIntegral < -integralMax)
+    {
+        iIntegral = -integralMax;
+    }
+
+    double ppm = (kProportionalGain * errorMs) + (kIntegralGain * iIntegral);
+
+    if (ppm > kMaxAdjustPpm)
+    {
+        ppm = kMaxAdjustPpm;
+    }
+    else if (ppm < -kMaxAdjustPpm)
+    {
+        ppm = -kMaxAdjustPpm;
+    }
+
+    iAdjust = ppm / 1000000.0;
+
+    if (aTimestampUs - iStatusUs >= kLogIntervalUs)
+    {
+        double rate = (aFramesConsumed - iStatusFrames) /
+                      ((aTimestampUs - iStatusUs) / 1000000.0);
+
+        Log::Print("ClockPullerAlsa: Device clock %+.1fppm, latency error "
+                   "%.2fms, adjust %+.1fppm\n",
+                   ((rate / aSampleRate) - 1.0) * 1000000.0, errorMs, ppm);
+
+        iStatusFrames = aFramesConsumed;
+        iStatusUs     = aTimestampUs;
+    }
+}
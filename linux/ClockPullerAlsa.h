@@ -0,0 +1,55 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Media/ClockPuller.h>
+#include <OpenHome/Private/Thread.h>
+
+namespace OpenHome {
+namespace Media {
+
+// Clock puller for the Songcast receiver, trimming the rate DriverAlsa
+// consumes audio at so the receive latency remains constant.
+//
+// The latency error is the change in the receiver buffer, reported by the
+// pipeline, plus the change in the ALSA delay, reported by the driver from
+// snd_pcm_status(), against their values once the device buffer has
+// filled. A PI controller turns the error into a ratio
+// adjustment for the driver's adaptive resampler. The device clock is
+// measured against the status timestamps and logged.
+class ClockPullerAlsa : public IClockPuller
+{
+    static const TUint  kControlIntervalUs = 1000000;
+    static const TInt   kMaxAdjustPpm      = 500;
+    static const TUint  kSettleUs          = 500000;
+    static const TUint  kSettleToleranceUs = 5000;
+public:
+    ClockPullerAlsa();
+public: // Called by the driver
+    TBool  Running() const;
+    void   DeviceStatus(TUint aSampleRate, TUint aDelayFrames,
+                        TUint64 aFramesConsumed, TUint64 aTimestampUs);
+    double RatioAdjust() const;
+private: // from IClockPuller
+    void Update(TInt aDelta) override;
+    void Start() override;
+    void Stop() override;
+private:
+    void reset();
+private:
+    mutable Mutex iLock;
+    TBool         iRunning;
+    TInt64        iBufferError;     // Jiffies
+    TInt64        iDelayError;      // Jiffies
+    TBool         iDelayReferenced;
+    TUint         iDelayReference;  // Frames
+    TUint         iSettleDelay;     // Frames, the most seen while filling.
+    TUint64       iSettleUs;        // When the delay last grew.
+    double        iIntegral;
+    double        iAdjust;
+    TUint64       iLastControlUs;
+    TUint64       iStatusFrames;
+    TUint64       iStatusUs;
+};
+
+} // namespace Media
+} // namespace OpenHome
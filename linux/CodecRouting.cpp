@@ -0,0 +1,244 @@
+#include <OpenHome/Private/Ascii.h>
+#include <OpenHome/Private/Printer.h>
+#include <OpenHome/Configuration/IStore.h>
+
+#include "CodecRouting.h"
+#include "CodecSelfBenchmark.h"
+#include "ConfigGTKKeyStore.h"
+#include "OptionalFeatures.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Configuration;
+using namespace OpenHome::Media::Codec;
+
+static const TChar *kRouteKeys[CodecRouting::kFormatCount] =
+{
+    "Codec.Route.Flac",
+    "Codec.Route.Wav",
+    "Codec.Route.Aiff",
+    "Codec.Route.Vorbis",
+    "Codec.Route.Mp3",
+    "Codec.Route.Aac"
+};
+
+static const TChar *kAutoKeys[CodecRouting::kFormatCount] =
+{
+    "Codec.Route.Flac.Auto",
+    "Codec.Route.Wav.Auto",
+    "Codec.Route.Aiff.Auto",
+    "Codec.Route.Vorbis.Auto",
+    "Codec.Route.Mp3.Auto",
+    "Codec.Route.Aac.Auto"
+};
+
+// The libavcodec version the 'auto' routes were measured with.
+static const Brn kAutoVersionKey("Codec.Route.AutoVersion");
+
+static const Brn kRouteNative("native");
+static const Brn kRouteLibAv("libav");
+static const Brn kRouteAuto("auto");
+
+static const TChar *decoderName(CodecRouting::Decoder aDecoder)
+{
+    return (aDecoder == CodecRouting::kDecoderNative) ? "native" : "libav";
+}
+
+// CodecRouting
+
+CodecRouting::CodecRouting()
+{
+    ConfigGTKKeyStore *configStore = ConfigGTKKeyStore::getInstance();
+
+    for (TUint i=0; i<kFormatCount; i++)
+    {
+        Brn      key(kRouteKeys[i]);
+        Bws<16>  route;
+
+        iRoutes[i] = defaultRoute((Format)i);
+        iAuto[i]   = false;
+
+        try
+        {
+            configStore->Read(key, route);
+        }
+        catch (StoreKeyNotFound&)
+        {
+            // Create the property, allowing it to be located and edited in
+            // the config file. Formats either decoder can decode are
+            // measured.
+            if (nativeAvailable((Format)i) && autoAvailable())
+            {
+                route.Replace(kRouteAuto);
+            }
+            else
+            {
+                route.Replace(decoderName(iRoutes[i]));
+            }
+
+            configStore->Write(key, route);
+        }
+        catch (StoreReadBufferUndersized&)
+        {
+            route.SetBytes(0);
+        }
+
+        if (route.Equals(kRouteNative))
+        {
+            if (nativeAvailable((Format)i))
+            {
+                iRoutes[i] = kDecoderNative;
+            }
+            else
+            {
+                Log::Print("Error: CodecRouting: '%s' native codec not "
+                           "built\n", kRouteKeys[i]);
+            }
+        }
+        else if (route.Equals(kRouteLibAv))
+        {
+            iRoutes[i] = kDecoderLibAv;
+        }
+        else if (route.Equals(kRouteAuto))
+        {
+            // Routed by default until measured.
+            iAuto[i] = nativeAvailable((Format)i) && autoAvailable();
+        }
+        else
+        {
+            Log::Print("Error: CodecRouting: Invalid '%s' property\n",
+                       kRouteKeys[i]);
+        }
+
+        if (! iAuto[i])
+        {
+            Log::Print("CodecRouting: %s -> %s\n", kRouteKeys[i],
+                       decoderName(iRoutes[i]));
+        }
+    }
+}
+
+CodecRouting::Decoder CodecRouting::Route(Format aFormat) const
+{
+    return iRoutes[aFormat];
+}
+
+// Formats routed 'auto' take the route last measured with this libavcodec.
+// Otherwise both decoders are measured now, the format being routed to
+// libavcodec while it is measured so CodecLibAV accepts it.
+void CodecRouting::MeasureAuto()
+{
+#if defined (USE_LIBAVCODEC) && (defined (ENABLE_AAC) || defined (ENABLE_MP3))
+    ConfigGTKKeyStore *configStore = ConfigGTKKeyStore::getInstance();
+    TUint              version     = CodecSelfBenchmark::Version();
+    TBool              current     = (configStore->ReadUint(kAutoVersionKey,
+                                                            0) == version);
+
+    for (TUint i=0; i<kFormatCount; i++)
+    {
+        if (! iAuto[i])
+        {
+            continue;
+        }
+
+        Brn      key(kAutoKeys[i]);
+        Bws<16>  route;
+        Decoder  decoder = iRoutes[i];
+
+        try
+        {
+            configStore->Read(key, route);
+        }
+        catch (StoreKeyNotFound&)
+        {
+            route.SetBytes(0);
+        }
+        catch (StoreReadBufferUndersized&)
+        {
+            route.SetBytes(0);
+        }
+
+        if (current && route.Equals(kRouteNative))
+        {
+            decoder = kDecoderNative;
+        }
+        else if (current && route.Equals(kRouteLibAv))
+        {
+            decoder = kDecoderLibAv;
+        }
+        else
+        {
+            Decoder defaultDecoder = iRoutes[i];
+
+            iRoutes[i] = kDecoderLibAv;
+
+            if (CodecSelfBenchmark::Measure((Format)i, decoder))
+            {
+                configStore->Write(key, Brn(decoderName(decoder)));
+            }
+            else
+            {
+                decoder = defaultDecoder;
+            }
+        }
+
+        iRoutes[i] = decoder;
+
+        Log::Print("CodecRouting: %s -> auto (%s)\n", kRouteKeys[i],
+                   decoderName(iRoutes[i]));
+    }
+
+    if (! current)
+    {
+        Bws<Ascii::kMaxUintStringBytes> versionBuf;
+
+        Ascii::AppendDec(versionBuf, version);
+        configStore->Write(kAutoVersionKey, versionBuf);
+    }
+#endif // USE_LIBAVCODEC && (ENABLE_AAC || ENABLE_MP3)
+}
+
+// The license restricted MP3 and AAC codecs are linked alongside libavcodec
+// only on request.
+TBool CodecRouting::nativeAvailable(Format aFormat)
+{
+    switch (aFormat)
+    {
+        case kFormatMp3:
+#if defined (ENABLE_MP3) && \
+    (! defined (USE_LIBAVCODEC) || defined (ROUTE_RESTRICTED_CODECS))
+            return true;
+#else
+            return false;
+#endif // ENABLE_MP3
+        case kFormatAac:
+#if defined (ENABLE_AAC) && \
+    (! defined (USE_LIBAVCODEC) || defined (ROUTE_RESTRICTED_CODECS))
+            return true;
+#else
+            return false;
+#endif // ENABLE_AAC
+        default:
+            return true;
+    }
+}
+
+// Both decoders are only available where libavcodec is registered.
+TBool CodecRouting::autoAvailable()
+{
+#if defined (USE_LIBAVCODEC) && (defined (ENABLE_AAC) || defined (ENABLE_MP3))
+    return true;
+#else
+    return false;
+#endif // USE_LIBAVCODEC && (ENABLE_AAC || ENABLE_MP3)
+}
+
+// The decoder used for a format until its property is edited, or until an
+// 'auto' route is measured.
+//
+// The native codecs decode these formats without the cost of a libav
+// probe and take no part in the libav packet/frame copies, so are
+// preferred where they are linked.
+CodecRouting::Decoder CodecRouting::defaultRoute(Format aFormat)
+{
+    return nativeAvailable(aFormat) ? kDecoderNative : kDecoderLibAv;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Buffer.h>
+
+namespace OpenHome {
+namespace Media {
+namespace Codec {
+
+// Selects the decoder for each format that can be decoded by both a native
+// ohMediaPlayer codec and libavcodec.
+//
+// Each format is routed by a 'Codec.Route.<Format>' config property holding
+// 'native', 'libav' or 'auto', created with the default route for the
+// format. A format whose native codec is not linked is always routed to
+// libavcodec.
+//
+// A format routed 'auto' is decoded by whichever decoder MeasureAuto()
+// found fastest on this CPU, see CodecSelfBenchmark. The result is held in
+// 'Codec.Route.<Format>.Auto', and measured again when libavcodec changes.
+class CodecRouting
+{
+public:
+    enum Format
+    {
+        kFormatFlac,     // Including Ogg FLAC.
+        kFormatWav,
+        kFormatAiff,     // Including AIFC.
+        kFormatVorbis,
+        kFormatMp3,
+        kFormatAac,      // ADTS and MPEG4.
+        kFormatCount
+    };
+
+    enum Decoder
+    {
+        kDecoderNative,
+        kDecoderLibAv
+    };
+
+private:
+    CodecRouting();
+
+    // Stop the compiler generating methods of copy and assignment operators.
+    CodecRouting(CodecRouting const& copy);
+    CodecRouting& operator=(CodecRouting const& copy);
+
+public:
+    static CodecRouting *getInstance()
+    {
+        static CodecRouting instance;
+        return &instance;
+    }
+
+public:
+    Decoder Route(Format aFormat) const;
+    // Route the formats set to 'auto', measuring any not yet measured.
+    // Called before the codecs are created.
+    void    MeasureAuto();
+private:
+    static TBool   nativeAvailable(Format aFormat);
+    static TBool   autoAvailable();
+    static Decoder defaultRoute(Format aFormat);
+private:
+    Decoder iRoutes[kFormatCount];
+    TBool   iAuto[kFormatCount];
+};
+
+} // namespace Codec
+} // namespace Media
+} // namespace OpenHome
@@ -0,0 +1,465 @@
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Media/Codec/CodecFactory.h>
+#include <OpenHome/Media/Pipeline/Msg.h>
+#include <OpenHome/Media/Utils/AllocatorInfoLogger.h>
+#include <OpenHome/Private/Printer.h>
+
+#include "OptionalFeatures.h"
+
+#if defined (USE_LIBAVCODEC) && (defined (ENABLE_AAC) || defined (ENABLE_MP3))
+
+#include <algorithm>
+#include <vector>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+extern "C"
+{
+#include "libavutil/channel_layout.h"
+#include "libavutil/opt.h"
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+}
+
+#include "CodecRouting.h"
+#include "CodecSelfBenchmark.h"
+#include "CodecTiming.h"
+#include "Libav.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+using namespace OpenHome::Media::Codec;
+
+// The libavcodec encoder and muxer producing each format, with a further
+// encoder tried if the first is not built.
+static const struct
+{
+    const char *encoder;
+    const char *fallbackEncoder;
+    const char *muxer;
+    const char *uri;
+} kEncoders[CodecRouting::kFormatCount] =
+{
+    { "flac",       NULL,     "flac", "selfbenchmark.flac" },
+    { "pcm_s16le",  NULL,     "wav",  "selfbenchmark.wav"  },
+    { "pcm_s16be",  NULL,     "aiff", "selfbenchmark.aiff" },
+    { "libvorbis",  "vorbis", "ogg",  "selfbenchmark.ogg"  },
+    { "libmp3lame", NULL,     "mp3",  "selfbenchmark.mp3"  },
+    { "aac",        NULL,     "adts", "selfbenchmark.aac"  }
+};
+
+static const TUint kIoBytes = 32 * 1024;
+
+// The muxer output, held in memory. Seekable, so muxers may complete their
+// headers once the audio is written.
+typedef struct
+{
+    std::vector<TByte> *data;
+    size_t              pos;
+} MemoryOutput;
+
+static int writeOutput(void* aOpaque, TUint8* aBuf, int aBytes)
+{
+    MemoryOutput *output = (MemoryOutput *)aOpaque;
+
+    if (output->data->size() < output->pos + aBytes)
+    {
+        output->data->resize(output->pos + aBytes);
+    }
+
+    memcpy(&(*output->data)[output->pos], aBuf, aBytes);
+    output->pos += aBytes;
+
+    return aBytes;
+}
+
+static TInt64 seekOutput(void* aOpaque, TInt64 aOffset, TInt aWhence)
+{
+    MemoryOutput *output = (MemoryOutput *)aOpaque;
+    TInt64        pos;
+
+    switch (aWhence & ~AVSEEK_FORCE)
+    {
+        case AVSEEK_SIZE:
+            return (TInt64)output->data->size();
+        case SEEK_SET:
+            pos = aOffset;
+            break;
+        case SEEK_CUR:
+            pos = (TInt64)output->pos + aOffset;
+            break;
+        case SEEK_END:
+            pos = (TInt64)output->data->size() + aOffset;
+            break;
+        default:
+            return -1;
+    }
+
+    if (pos < 0)
+    {
+        return -1;
+    }
+
+    output->pos = (size_t)pos;
+
+    return pos;
+}
+
+// Write one sample of aFrame, in any of the sample formats the encoders
+// take.
+static void writeSample(AVFrame* aFrame, TUint aChannels, TUint aIndex,
+                        TUint aChannel, double aValue)
+{
+    AVSampleFormat format = (AVSampleFormat)aFrame->format;
+    TBool          planar = (av_sample_fmt_is_planar(format) != 0);
+    TByte         *plane  = aFrame->data[planar ? aChannel : 0];
+    TUint          index  = planar ? aIndex : (aIndex * aChannels) + aChannel;
+
+    switch (av_get_packed_sample_fmt(format))
+    {
+        case AV_SAMPLE_FMT_S16:
+            ((TInt16 *)plane)[index] = (TInt16)lrint(aValue * 32767.0);
+            break;
+        case AV_SAMPLE_FMT_S32:
+            ((TInt32 *)plane)[index] = (TInt32)lrint(aValue * 2147483647.0);
+            break;
+        case AV_SAMPLE_FMT_FLT:
+            ((float *)plane)[index] = (float)aValue;
+            break;
+        case AV_SAMPLE_FMT_DBL:
+            ((double *)plane)[index] = aValue;
+            break;
+        default:
+            break;
+    }
+}
+
+// Tones differing between the channels over noise 60dB down, so the
+// lossless encoders cannot reduce the audio to nothing.
+static double syntheticSample(TUint aIndex, TUint aChannel, TUint aSampleRate,
+                              TUint32& aNoise)
+{
+    double t = (double)aIndex / aSampleRate;
+
+    aNoise = (aNoise * 1664525U) + 1013904223U;
+
+    return (0.3 * sin((2.0 * M_PI * 440.0 * t) + aChannel)) +
+           (0.2 * sin(2.0 * M_PI * 1000.0 * t)) +
+           (0.1 * sin(2.0 * M_PI * (5500.0 + (500.0 * aChannel)) * t)) +
+           (0.001 * ((TInt32)aNoise / 2147483648.0));
+}
+
+// Encode and mux aSeconds of synthetic audio through the opened encoder.
+static TBool writeStream(AVFormatContext* aFormatCtx,
+                         AVCodecContext* aCodecCtx, AVFrame* aFrame,
+                         AVPacket* aPacket, TUint aSeconds)
+{
+    AVStream *stream = avformat_new_stream(aFormatCtx, NULL);
+
+    if ((stream == NULL) ||
+        (avcodec_parameters_from_context(stream->codecpar, aCodecCtx) < 0))
+    {
+        return false;
+    }
+
+    stream->time_base = aCodecCtx->time_base;
+
+    // MP3 is written bare, as the native codec is measured without the
+    // ID3v2 container.
+    if (strcmp(aFormatCtx->oformat->name, "mp3") == 0)
+    {
+        av_opt_set_int(aFormatCtx->priv_data, "id3v2_version", 0, 0);
+        av_opt_set_int(aFormatCtx->priv_data, "write_xing", 0, 0);
+    }
+
+    if (avformat_write_header(aFormatCtx, NULL) < 0)
+    {
+        return false;
+    }
+
+    const TUint sampleRate   = aCodecCtx->sample_rate;
+    const TUint channels     = aCodecCtx->channels;
+    const TUint frameSamples = (aCodecCtx->frame_size > 0)
+                                   ? aCodecCtx->frame_size : 1024;
+    const TUint total        = ((sampleRate * aSeconds) / frameSamples) *
+                               frameSamples;
+    TUint32     noise        = 1;
+
+    aFrame->nb_samples     = frameSamples;
+    aFrame->format         = aCodecCtx->sample_fmt;
+    aFrame->channels       = channels;
+    aFrame->channel_layout = aCodecCtx->channel_layout;
+    aFrame->sample_rate    = sampleRate;
+
+    if (av_frame_get_buffer(aFrame, 0) < 0)
+    {
+        return false;
+    }
+
+    // The encoder is flushed once the audio is written.
+    for (TUint start=0; start<=total; start+=frameSamples)
+    {
+        TBool flush = (start == total);
+
+        if (! flush)
+        {
+            if (av_frame_make_writable(aFrame) < 0)
+            {
+                return false;
+            }
+
+            for (TUint i=0; i<frameSamples; i++)
+            {
+                for (TUint c=0; c<channels; c++)
+                {
+                    writeSample(aFrame, channels, i, c,
+                                syntheticSample(start + i, c, sampleRate,
+                                                noise));
+                }
+            }
+
+            aFrame->pts = start;
+        }
+
+        if (avcodec_send_frame(aCodecCtx, flush ? NULL : aFrame) < 0)
+        {
+            return false;
+        }
+
+        for (;;)
+        {
+            int ret = avcodec_receive_packet(aCodecCtx, aPacket);
+
+            if ((ret == AVERROR(EAGAIN)) || (ret == AVERROR_EOF))
+            {
+                break;
+            }
+
+            if (ret < 0)
+            {
+                return false;
+            }
+
+            av_packet_rescale_ts(aPacket, aCodecCtx->time_base,
+                                 stream->time_base);
+            aPacket->stream_index = stream->index;
+
+            if (av_interleaved_write_frame(aFormatCtx, aPacket) < 0)
+            {
+                return false;
+            }
+        }
+    }
+
+    return (av_write_trailer(aFormatCtx) == 0);
+}
+
+// CodecSelfBenchmark
+
+TUint CodecSelfBenchmark::Version()
+{
+    return avcodec_version();
+}
+
+TBool CodecSelfBenchmark::Measure(CodecRouting::Format aFormat,
+                                  CodecRouting::Decoder& aFastest)
+{
+    std::vector<TByte> data;
+
+    if (! encode(aFormat, data))
+    {
+        return false;
+    }
+
+    AllocatorInfoLogger infoAggregator;
+    NullMimeTypeList    mimeTypes;
+    Brn                 uri(kEncoders[aFormat].uri);
+    double              best[2] = { 0.0, 0.0 };    // CPU ns per sample.
+
+    for (TUint r=0; r<kRuns; r++)
+    {
+        for (TUint d=0; d<2; d++)
+        {
+            std::vector<CodecBase*> codecs;
+            DecodeTiming            timing;
+
+            if (d == CodecRouting::kDecoderNative)
+            {
+                nativeCodecs(aFormat, mimeTypes, codecs);
+            }
+            else
+            {
+                codecs.push_back(NewCodecLibAV(mimeTypes, false));
+            }
+
+            // A decoder failing part way through is not chosen.
+            if ((! TimeDecode(uri, data, codecs, infoAggregator, NULL,
+                              timing)) ||
+                (timing.jiffies <
+                     ((TUint64)kSeconds * Jiffies::kPerSecond * 9) / 10))
+            {
+                Log::Print("CodecSelfBenchmark: '%s' not decoded by the %s "
+                           "decoder\n", kEncoders[aFormat].uri,
+                           (d == CodecRouting::kDecoderNative) ? "native"
+                                                               : "libav");
+                return false;
+            }
+
+            TUint64 samples = (timing.jiffies /
+                               Jiffies::PerSample(timing.sampleRate)) *
+                              timing.channels;
+            double  cpu     = (double)timing.cpuNs / samples;
+
+            if ((r == 0) || (cpu < best[d]))
+            {
+                best[d] = cpu;
+            }
+        }
+    }
+
+    aFastest = (best[CodecRouting::kDecoderLibAv] <
+                best[CodecRouting::kDecoderNative])
+                   ? CodecRouting::kDecoderLibAv
+                   : CodecRouting::kDecoderNative;
+
+    Log::Print("CodecSelfBenchmark: '%s' native %.2fns, libav %.2fns per "
+               "sample\n", kEncoders[aFormat].uri,
+               best[CodecRouting::kDecoderNative],
+               best[CodecRouting::kDecoderLibAv]);
+
+    return true;
+}
+
+// Encode kSeconds of synthetic audio in aFormat.
+TBool CodecSelfBenchmark::encode(CodecRouting::Format aFormat,
+                                 std::vector<TByte>& aData)
+{
+    const AVCodec *codec = avcodec_find_encoder_by_name(
+                               kEncoders[aFormat].encoder);
+
+    if ((codec == NULL) && (kEncoders[aFormat].fallbackEncoder != NULL))
+    {
+        codec = avcodec_find_encoder_by_name(
+                    kEncoders[aFormat].fallbackEncoder);
+    }
+
+    if (codec == NULL)
+    {
+        Log::Print("CodecSelfBenchmark: No '%s' encoder, '%s' not "
+                   "measured\n", kEncoders[aFormat].encoder,
+                   kEncoders[aFormat].uri);
+        return false;
+    }
+
+    AVFormatContext *formatCtx = NULL;
+    MemoryOutput     output    = { &aData, 0 };
+
+    aData.clear();
+
+    avformat_alloc_output_context2(&formatCtx, NULL,
+                                   kEncoders[aFormat].muxer, NULL);
+
+    AVCodecContext  *codecCtx = avcodec_alloc_context3(codec);
+    AVFrame         *frame    = av_frame_alloc();
+    AVPacket        *packet   = av_packet_alloc();
+    TByte           *ioBuf    = (TByte *)av_malloc(kIoBytes);
+    TBool            ok       = (formatCtx != NULL) && (codecCtx != NULL) &&
+                                (frame != NULL) && (packet != NULL) &&
+                                (ioBuf != NULL);
+
+    if (ok)
+    {
+        codecCtx->sample_rate           = kSampleRate;
+        codecCtx->channels              = kChannels;
+        codecCtx->channel_layout        = AV_CH_LAYOUT_STEREO;
+        codecCtx->sample_fmt            = (codec->sample_fmts != NULL)
+                                              ? codec->sample_fmts[0]
+                                              : AV_SAMPLE_FMT_S16;
+        codecCtx->bit_rate              = 192000;
+        codecCtx->time_base             = av_make_q(1, kSampleRate);
+        codecCtx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+
+        if (formatCtx->oformat->flags & AVFMT_GLOBALHEADER)
+        {
+            codecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        }
+
+        ok = (avcodec_open2(codecCtx, codec, NULL) >= 0);
+    }
+
+    if (ok)
+    {
+        formatCtx->pb = avio_alloc_context(ioBuf, kIoBytes, 1, &output, NULL,
+                                           writeOutput, seekOutput);
+        ok            = (formatCtx->pb != NULL);
+
+        // The buffer now belongs to the context.
+        if (ok)
+        {
+            ioBuf = NULL;
+        }
+    }
+
+    ok = ok && writeStream(formatCtx, codecCtx, frame, packet, kSeconds);
+
+    if ((formatCtx != NULL) && (formatCtx->pb != NULL))
+    {
+        av_freep(&formatCtx->pb->buffer);
+        avio_context_free(&formatCtx->pb);
+    }
+
+    av_free(ioBuf);
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    avcodec_free_context(&codecCtx);
+    avformat_free_context(formatCtx);
+
+    if (! ok)
+    {
+        Log::Print("CodecSelfBenchmark: Cannot encode '%s'\n",
+                   kEncoders[aFormat].uri);
+        aData.clear();
+    }
+
+    return ok;
+}
+
+// The native codecs of a format, as registered by the player.
+void CodecSelfBenchmark::nativeCodecs(CodecRouting::Format aFormat,
+                                      IMimeTypeList& aMimeTypes,
+                                      std::vector<CodecBase*>& aCodecs)
+{
+    switch (aFormat)
+    {
+        case CodecRouting::kFormatFlac:
+            aCodecs.push_back(CodecFactory::NewFlac(aMimeTypes));
+            break;
+        case CodecRouting::kFormatWav:
+            aCodecs.push_back(CodecFactory::NewWav(aMimeTypes));
+            break;
+        case CodecRouting::kFormatAiff:
+            aCodecs.push_back(CodecFactory::NewAiff(aMimeTypes));
+            aCodecs.push_back(CodecFactory::NewAifc(aMimeTypes));
+            break;
+        case CodecRouting::kFormatVorbis:
+            aCodecs.push_back(CodecFactory::NewVorbis(aMimeTypes));
+            break;
+        case CodecRouting::kFormatMp3:
+#if defined (ENABLE_MP3) && defined (ROUTE_RESTRICTED_CODECS)
+            aCodecs.push_back(CodecFactory::NewMp3(aMimeTypes));
+#endif // ENABLE_MP3 && ROUTE_RESTRICTED_CODECS
+            break;
+        case CodecRouting::kFormatAac:
+#if defined (ENABLE_AAC) && defined (ROUTE_RESTRICTED_CODECS)
+            aCodecs.push_back(CodecFactory::NewAacFdkAdts(aMimeTypes));
+#endif // ENABLE_AAC && ROUTE_RESTRICTED_CODECS
+            break;
+        default:
+            break;
+    }
+}
+
+#endif // USE_LIBAVCODEC && (ENABLE_AAC || ENABLE_MP3)
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Media/Codec/CodecController.h>
+#include <OpenHome/Media/MimeTypeList.h>
+
+#include <vector>
+
+#include "CodecRouting.h"
+
+namespace OpenHome {
+namespace Media {
+namespace Codec {
+
+// Measures the native codec and libavcodec decoding a format, choosing the
+// route of a format set to 'auto'.
+//
+// Ten seconds of synthetic stereo audio are encoded by libavcodec in the
+// format, then decoded by each decoder in turn through a CodecController,
+// see TimeDecode(). The decoder taking the least CPU per sample, including
+// any decoder worker threads, is chosen. A format is not measured if
+// libavcodec has no encoder for it, eg. MP3 without libmp3lame.
+class CodecSelfBenchmark
+{
+    static const TUint kSampleRate = 44100;
+    static const TUint kChannels   = 2;
+    static const TUint kSeconds    = 10;
+    static const TUint kRuns       = 3;     // Per decoder, the best taken.
+public:
+    // The version of libavcodec, the measurements being repeated when it
+    // changes.
+    static TUint Version();
+    // False if the format could not be encoded or was not decoded in full
+    // by both decoders.
+    static TBool Measure(CodecRouting::Format aFormat,
+                         CodecRouting::Decoder& aFastest);
+private:
+    static TBool encode(CodecRouting::Format aFormat,
+                        std::vector<TByte>& aData);
+    static void  nativeCodecs(CodecRouting::Format aFormat,
+                              IMimeTypeList& aMimeTypes,
+                              std::vector<CodecBase*>& aCodecs);
+};
+
+} // namespace Codec
+} // namespace Media
+} // namespace OpenHome
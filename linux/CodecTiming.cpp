@@ -0,0 +1,277 @@
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Media/Codec/CodecController.h>
+#include <OpenHome/Media/Pipeline/Msg.h>
+#include <OpenHome/Private/Thread.h>
+
+#include <algorithm>
+
+#include <time.h>
+
+#include "CodecTiming.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+using namespace OpenHome::Media::Codec;
+
+static TUint64 monotonicUs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((TUint64)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static TUint64 processCpuNs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return ((TUint64)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+// Out of band reads are not supported, so codecs fall back to the stream.
+class NullUrlBlockWriter : public IUrlBlockWriter
+{
+public: // from IUrlBlockWriter
+    TBool TryGet(IWriter& /*aWriter*/, const Brx& /*aUrl*/,
+                 TUint64 /*aOffset*/, TUint /*aBytes*/) override
+    {
+        return false;
+    }
+};
+
+// The stream is neither seekable nor stopped.
+class NullStreamHandler : public IStreamHandler
+{
+public: // from IStreamHandler
+    EStreamPlay OkToPlay(TUint /*aStreamId*/) override
+    {
+        return ePlayYes;
+    }
+    TUint TrySeek(TUint /*aStreamId*/, TUint64 /*aOffset*/) override
+    {
+        return MsgFlush::kIdInvalid;
+    }
+    TUint TryDiscard(TUint /*aJiffies*/) override
+    {
+        return MsgFlush::kIdInvalid;
+    }
+    TUint TryStop(TUint /*aStreamId*/) override
+    {
+        return MsgFlush::kIdInvalid;
+    }
+    void NotifyStarving(const Brx& /*aMode*/, TUint /*aStreamId*/,
+                        TBool /*aStarving*/) override
+    {
+    }
+};
+
+// Supplies a file held in memory as a single encoded stream, then quits.
+class FileSupplier : public IPipelineElementUpstream, private INonCopyable
+{
+public:
+    FileSupplier(MsgFactory& aMsgFactory, IStreamHandler& aStreamHandler,
+                 const Brx& aUri, const std::vector<TByte>& aData)
+        : iMsgFactory(aMsgFactory)
+        , iStreamHandler(aStreamHandler)
+        , iUri(aUri)
+        , iData(aData)
+        , iOffset(0)
+        , iStarted(false)
+        , iStartUs(0)
+    {
+    }
+
+    TUint64 StartUs() const
+    {
+        return iStartUs;
+    }
+public: // from IPipelineElementUpstream
+    Msg* Pull() override
+    {
+        if (! iStarted)
+        {
+            iStarted = true;
+            iStartUs = monotonicUs();
+
+            return iMsgFactory.CreateMsgEncodedStream(
+                       iUri, Brx::Empty(), iData.size(), 0, kStreamId,
+                       false,                   // seekable
+                       false,                   // live
+                       Multiroom::Forbidden,
+                       &iStreamHandler);
+        }
+
+        if (iOffset < iData.size())
+        {
+            TUint bytes = (TUint)std::min(iData.size() - iOffset,
+                                          (size_t)EncodedAudio::kMaxBytes);
+            Brn   chunk(&iData[iOffset], bytes);
+
+            iOffset += bytes;
+
+            return iMsgFactory.CreateMsgAudioEncoded(chunk);
+        }
+
+        return iMsgFactory.CreateMsgQuit();
+    }
+private:
+    static const TUint kStreamId = 1;
+private:
+    MsgFactory&                iMsgFactory;
+    IStreamHandler&            iStreamHandler;
+    const Brx&                 iUri;
+    const std::vector<TByte>&  iData;
+    size_t                     iOffset;
+    TBool                      iStarted;
+    TUint64                    iStartUs;
+};
+
+// Counts the decoded audio, signalling once the controller quits.
+class DecodedSink : public PipelineElement, public IPipelineElementDownstream,
+                    private INonCopyable
+{
+    static const TUint kSupportedMsgTypes;
+public:
+    DecodedSink()
+        : PipelineElement(kSupportedMsgTypes)
+        , iDone("CBDN", 0)
+        , iSampleRate(0)
+        , iChannels(0)
+        , iJiffies(0)
+        , iFirstAudioUs(0)
+    {
+    }
+
+    void Wait()
+    {
+        iDone.Wait();
+    }
+public: // from IPipelineElementDownstream
+    void Push(Msg* aMsg) override
+    {
+        Msg* msg = aMsg->Process(*this);
+
+        if (msg != NULL)
+        {
+            msg->RemoveRef();
+        }
+    }
+private: // from IMsgProcessor
+    Msg* ProcessMsg(MsgDecodedStream* aMsg) override
+    {
+        const DecodedStreamInfo& info = aMsg->StreamInfo();
+
+        iSampleRate = info.SampleRate();
+        iChannels   = info.NumChannels();
+        iCodecName.Replace(info.CodecName().Split(0,
+                           std::min(info.CodecName().Bytes(),
+                                    iCodecName.MaxBytes())));
+
+        return aMsg;
+    }
+
+    Msg* ProcessMsg(MsgAudioPcm* aMsg) override
+    {
+        if (iFirstAudioUs == 0)
+        {
+            iFirstAudioUs = monotonicUs();
+        }
+
+        iJiffies += aMsg->Jiffies();
+
+        return aMsg;
+    }
+
+    Msg* ProcessMsg(MsgQuit* aMsg) override
+    {
+        iDone.Signal();
+
+        return aMsg;
+    }
+public:
+    Semaphore iDone;
+    TUint     iSampleRate;
+    TUint     iChannels;
+    Bws<32>   iCodecName;
+    TUint64   iJiffies;
+    TUint64   iFirstAudioUs;
+};
+
+const TUint DecodedSink::kSupportedMsgTypes =
+      PipelineElement::MsgType::eMode
+    | PipelineElement::MsgType::eTrack
+    | PipelineElement::MsgType::eDrain
+    | PipelineElement::MsgType::eDelay
+    | PipelineElement::MsgType::eEncodedStream
+    | PipelineElement::MsgType::eMetatext
+    | PipelineElement::MsgType::eStreamInterrupted
+    | PipelineElement::MsgType::eHalt
+    | PipelineElement::MsgType::eFlush
+    | PipelineElement::MsgType::eWait
+    | PipelineElement::MsgType::eDecodedStream
+    | PipelineElement::MsgType::eAudioPcm
+    | PipelineElement::MsgType::eSilence
+    | PipelineElement::MsgType::eQuit;
+
+TBool OpenHome::Media::Codec::TimeDecode(const Brx& aUri,
+                                         const std::vector<TByte>& aData,
+                                         const std::vector<CodecBase*>& aCodecs,
+                                         IInfoAggregator& aInfoAggregator,
+                                         const std::atomic<TUint64>* aAllocs,
+                                         DecodeTiming& aTiming)
+{
+    static const TUint kMaxOutputJiffies = Jiffies::kPerMs * 20;
+
+    MsgFactoryInitParams init;
+
+    init.SetMsgEncodedStreamCount(2);
+    init.SetMsgAudioEncodedCount(64, 96);
+    init.SetMsgDecodedStreamCount(4);
+    init.SetMsgAudioPcmCount(64, 96);
+    init.SetMsgQuitCount(2);
+
+    MsgFactory         msgFactory(aInfoAggregator, init);
+    NullStreamHandler  streamHandler;
+    NullUrlBlockWriter urlBlockWriter;
+    FileSupplier       supplier(msgFactory, streamHandler, aUri, aData);
+    DecodedSink        sink;
+    CodecController   *controller;
+
+    controller = new CodecController(msgFactory, supplier, sink,
+                                     urlBlockWriter, kMaxOutputJiffies,
+                                     kPriorityNormal, false);
+
+    // The controller owns its codecs.
+    for (auto* codec : aCodecs)
+    {
+        controller->AddCodec(codec);
+    }
+
+    TUint64 allocsStart = (aAllocs != NULL) ? aAllocs->load() : 0;
+    TUint64 cpuStart    = processCpuNs();
+
+    controller->Start();
+    sink.Wait();
+
+    TUint64 endUs = monotonicUs();
+
+    aTiming.cpuNs  = processCpuNs() - cpuStart;
+    aTiming.allocs = (aAllocs != NULL) ? aAllocs->load() - allocsStart : 0;
+
+    delete controller;
+
+    aTiming.sampleRate   = sink.iSampleRate;
+    aTiming.channels     = sink.iChannels;
+    aTiming.jiffies      = sink.iJiffies;
+    aTiming.decodeUs     = endUs - supplier.StartUs();
+    aTiming.firstAudioUs = (sink.iFirstAudioUs == 0)
+                               ? 0 : sink.iFirstAudioUs - supplier.StartUs();
+
+    aTiming.codecName.Replace(sink.iCodecName);
+
+    return (sink.iSampleRate != 0) && (sink.iJiffies != 0);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Media/Codec/CodecController.h>
+#include <OpenHome/Media/MimeTypeList.h>
+#include <OpenHome/Private/Standard.h>
+
+#include <atomic>
+#include <vector>
+
+namespace OpenHome {
+class IInfoAggregator;
+namespace Media {
+namespace Codec {
+
+// Mime types registered by codecs that are only timed.
+class NullMimeTypeList : public IMimeTypeList
+{
+public: // from IMimeTypeList
+    void Add(const TChar* /*aMimeType*/) override {}
+};
+
+// The outcome of decoding a stream held in memory.
+//
+// Times are from the stream starting. CPU is that of the process, so
+// includes any decoder worker threads.
+typedef struct
+{
+    TUint            sampleRate;
+    TUint            channels;
+    Bws<32>          codecName;
+    TUint64          jiffies;        // Of decoded audio.
+    TUint64          decodeUs;
+    TUint64          firstAudioUs;
+    TUint64          cpuNs;
+    TUint64          allocs;         // Counted by aAllocs, if given.
+} DecodeTiming;
+
+// Decode aData as a single stream through a CodecController holding
+// aCodecs, which it takes ownership of. Returns false if no audio was
+// decoded.
+TBool TimeDecode(const Brx& aUri, const std::vector<TByte>& aData,
+                 const std::vector<CodecBase*>& aCodecs,
+                 IInfoAggregator& aInfoAggregator,
+                 const std::atomic<TUint64>* aAllocs, DecodeTiming& aTiming);
+
+} // namespace Codec
+} // namespace Media
+} // namespace OpenHome
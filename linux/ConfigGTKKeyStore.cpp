@@ -1,3 +1,4 @@
+#include <OpenHome/Private/Ascii.h>
 #include <OpenHome/Private/Converter.h>
 #include <OpenHome/Private/Printer.h>
 
@@ -235,3 +236,41 @@ void ConfigGTKKeyStore::Delete(const Brx& aKey)
 
 void ConfigGTKKeyStore::ResetToDefaults()
 {}
+
+TUint ConfigGTKKeyStore::ReadUint(const Brx& aKey, TUint aDefault)
+{
+    Bws<Ascii::kMaxUintStringBytes> valueBuf;
+
+    try
+    {
+        Read(aKey, valueBuf);
+
+        // No config file is available.
+        if (valueBuf.Bytes() == 0)
+        {
+            return aDefault;
+        }
+
+        return Ascii::Uint(valueBuf);
+    }
+    catch (StoreKeyNotFound&)
+    {
+        // Create the property with its default value.
+        valueBuf.SetBytes(0);
+        Ascii::AppendDec(valueBuf, aDefault);
+
+        Write(aKey, valueBuf);
+    }
+    catch (StoreReadBufferUndersized&)
+    {
+        Log::Print("Error: ConfigGTKKeyStore: Invalid '%.*s' property\n",
+                   PBUF(aKey));
+    }
+    catch (AsciiError&)
+    {
+        Log::Print("Error: ConfigGTKKeyStore: Invalid '%.*s' property\n",
+                   PBUF(aKey));
+    }
+
+    return aDefault;
+}
@@ -35,6 +35,12 @@ public: // from IStoreReadWrite
     void Write(const Brx& aKey, const Brx& aSource) override;
     void Delete(const Brx& aKey) override;
     void ResetToDefaults() override;
+public:
+    // Read a property holding an ASCII decimal value.
+    //
+    // If the property does not exist it is created with the supplied
+    // default, allowing it to be located and edited in the config file.
+    TUint ReadUint(const Brx& aKey, TUint aDefault);
 private:
     bool mkPath(std::vector<std::string>);
 private:
@@ -0,0 +1,306 @@
+#include <OpenHome/Private/Printer.h>
+
+#include <algorithm>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "DecodedPcmCache.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media::Codec;
+
+using namespace std;
+
+// Region of the spill file occupied by an entry.
+typedef struct
+{
+    TUint64 offset;
+    TUint64 bytes;
+} SpillRegion;
+
+static bool regionBefore(const SpillRegion& aRegion1,
+                         const SpillRegion& aRegion2)
+{
+    return aRegion1.offset < aRegion2.offset;
+}
+
+// DecodedPcmCache
+
+DecodedPcmCache::DecodedPcmCache(TUint64 aMemoryBytes, TUint64 aSpillBytes)
+    : iMemoryBytes(aMemoryBytes)
+    , iMemoryUsed(0)
+    , iSpillBytes(0)
+    , iSpill(NULL)
+    , iUseCount(0)
+{
+    if (aSpillBytes == 0)
+    {
+        return;
+    }
+
+    // The spill file is unlinked once mapped so it is removed on exit.
+    char path[] = "/tmp/OpenHomePlayerPcmXXXXXX";
+    int  fd     = mkstemp(path);
+
+    if (fd < 0)
+    {
+        Log::Print("DecodedPcmCache: Cannot create spill file\n");
+        return;
+    }
+
+    unlink(path);
+
+    if (ftruncate(fd, aSpillBytes) == 0)
+    {
+        void *map = mmap(NULL, aSpillBytes, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+
+        if (map != MAP_FAILED)
+        {
+            iSpill      = (TByte *)map;
+            iSpillBytes = aSpillBytes;
+        }
+    }
+
+    close(fd);
+
+    if (iSpill == NULL)
+    {
+        Log::Print("DecodedPcmCache: Cannot map spill file\n");
+    }
+}
+
+DecodedPcmCache::~DecodedPcmCache()
+{
+    if (iSpill != NULL)
+    {
+        munmap(iSpill, iSpillBytes);
+    }
+}
+
+// The largest stream that can be cached.
+TUint64 DecodedPcmCache::MaxEntryBytes() const
+{
+    return max(iMemoryBytes, iSpillBytes) / 4;
+}
+
+// Is any stream of the given length cached.
+TBool DecodedPcmCache::Contains(TUint64 aStreamLength) const
+{
+    for (TUint i=0; i<iEntries.size(); i++)
+    {
+        if (iEntries[i].key.streamLength == aStreamLength)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+TBool DecodedPcmCache::Find(const PcmCacheKey& aKey, PcmCacheFormat& aFormat,
+                            Brn& aPcm)
+{
+    TInt index = find(aKey);
+
+    if (index < 0)
+    {
+        return false;
+    }
+
+    Entry& entry = iEntries[index];
+
+    entry.lastUsed = ++iUseCount;
+    aFormat        = entry.format;
+
+    if (entry.spilled)
+    {
+        aPcm.Set(iSpill + entry.spillOffset, (TUint)entry.bytes);
+    }
+    else
+    {
+        aPcm.Set(&entry.memory[0], (TUint)entry.bytes);
+    }
+
+    return true;
+}
+
+// Add an entry to the cache, taking ownership of the supplied PCM.
+void DecodedPcmCache::Insert(const PcmCacheKey& aKey,
+                             const PcmCacheFormat& aFormat,
+                             vector<TByte>& aPcm)
+{
+    if (aPcm.empty() || (aPcm.size() > MaxEntryBytes()))
+    {
+        return;
+    }
+
+    TInt existing = find(aKey);
+
+    if (existing >= 0)
+    {
+        remove(existing);
+    }
+
+    iEntries.push_back(Entry());
+
+    Entry& entry = iEntries.back();
+
+    entry.key         = aKey;
+    entry.format      = aFormat;
+    entry.bytes       = aPcm.size();
+    entry.spilled     = false;
+    entry.spillOffset = 0;
+    entry.lastUsed    = ++iUseCount;
+
+    entry.memory.swap(aPcm);
+
+    iMemoryUsed += entry.bytes;
+
+    // Move the least recently used entries out of memory until within the
+    // memory limit, evicting those that cannot be spilled.
+    while (iMemoryUsed > iMemoryBytes)
+    {
+        TInt index = leastRecentlyUsed(false);
+
+        if (index < 0)
+        {
+            break;
+        }
+
+        // Spilling may evict other entries, so the entry is identified by
+        // its key rather than its index.
+        PcmCacheKey key = iEntries[index].key;
+
+        if (! spill(key))
+        {
+            remove(find(key));
+        }
+    }
+}
+
+TInt DecodedPcmCache::find(const PcmCacheKey& aKey) const
+{
+    for (TUint i=0; i<iEntries.size(); i++)
+    {
+        if ((iEntries[i].key.streamLength == aKey.streamLength) &&
+            (iEntries[i].key.streamHash   == aKey.streamHash))
+        {
+            return (TInt)i;
+        }
+    }
+
+    return -1;
+}
+
+void DecodedPcmCache::remove(TUint aIndex)
+{
+    if (! iEntries[aIndex].spilled)
+    {
+        iMemoryUsed -= iEntries[aIndex].bytes;
+    }
+
+    iEntries.erase(iEntries.begin() + aIndex);
+}
+
+// Find the least recently used entry that is, or is not, spilled.
+TInt DecodedPcmCache::leastRecentlyUsed(TBool aSpilled) const
+{
+    TInt index = -1;
+
+    for (TUint i=0; i<iEntries.size(); i++)
+    {
+        if (iEntries[i].spilled != aSpilled)
+        {
+            continue;
+        }
+
+        if ((index < 0) || (iEntries[i].lastUsed < iEntries[index].lastUsed))
+        {
+            index = (TInt)i;
+        }
+    }
+
+    return index;
+}
+
+// Move an entry from memory to the spill file.
+TBool DecodedPcmCache::spill(const PcmCacheKey& aKey)
+{
+    TUint64 offset;
+
+    if (! allocateSpill(iEntries[find(aKey)].bytes, offset))
+    {
+        return false;
+    }
+
+    Entry& entry = iEntries[find(aKey)];
+
+    memcpy(iSpill + offset, &entry.memory[0], entry.bytes);
+
+    vector<TByte>().swap(entry.memory);
+
+    iMemoryUsed      -= entry.bytes;
+    entry.spilled     = true;
+    entry.spillOffset = offset;
+
+    return true;
+}
+
+// Find a free region of the spill file, first fit, evicting the least
+// recently used spilled entries until one is available.
+TBool DecodedPcmCache::allocateSpill(TUint64 aBytes, TUint64& aOffset)
+{
+    if ((iSpill == NULL) || (aBytes > iSpillBytes))
+    {
+        return false;
+    }
+
+    for (;;)
+    {
+        vector<SpillRegion> regions;
+
+        for (TUint i=0; i<iEntries.size(); i++)
+        {
+            if (iEntries[i].spilled)
+            {
+                SpillRegion region = {iEntries[i].spillOffset,
+                                      iEntries[i].bytes};
+
+                regions.push_back(region);
+            }
+        }
+
+        sort(regions.begin(), regions.end(), regionBefore);
+
+        TUint64 start = 0;
+
+        for (TUint i=0; i<regions.size(); i++)
+        {
+            if (regions[i].offset - start >= aBytes)
+            {
+                break;
+            }
+
+            start = regions[i].offset + regions[i].bytes;
+        }
+
+        if (iSpillBytes - start >= aBytes)
+        {
+            aOffset = start;
+            return true;
+        }
+
+        TInt index = leastRecentlyUsed(true);
+
+        if (index < 0)
+        {
+            return false;
+        }
+
+        remove(index);
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Buffer.h>
+
+#include <string>
+#include <vector>
+
+namespace OpenHome {
+namespace Media {
+namespace Codec {
+
+// Identifies an encoded stream in the decoded PCM cache by its length and
+// a hash of its entire content.
+typedef struct
+{
+    TUint64          streamLength;
+    TUint64          streamHash;
+} PcmCacheKey;
+
+// Format of the decoded PCM held for a stream.
+typedef struct
+{
+    TUint            bitRate;
+    TUint            bitDepth;
+    TUint            sampleRate;
+    TUint            channels;
+    TUint64          trackLengthJiffies;
+    std::string      codecName;
+} PcmCacheFormat;
+
+// Bounded cache of decoded PCM for recently played streams.
+//
+// Entries are held in memory up to the memory limit. Beyond this the least
+// recently used entries are moved to a memory mapped spill file, which the
+// kernel may page out, and are evicted when the spill file is full.
+//
+// Not thread safe. PCM returned by Find() remains valid until the next call
+// to Insert().
+class DecodedPcmCache
+{
+public:
+    DecodedPcmCache(TUint64 aMemoryBytes, TUint64 aSpillBytes);
+    ~DecodedPcmCache();
+    TUint64 MaxEntryBytes() const;
+    TBool   Contains(TUint64 aStreamLength) const;
+    TBool   Find(const PcmCacheKey& aKey, PcmCacheFormat& aFormat, Brn& aPcm);
+    void    Insert(const PcmCacheKey& aKey, const PcmCacheFormat& aFormat,
+                   std::vector<TByte>& aPcm);
+private:
+    typedef struct
+    {
+        PcmCacheKey        key;
+        PcmCacheFormat     format;
+        std::vector<TByte> memory;
+        TUint64            bytes;
+        TBool              spilled;
+        TUint64            spillOffset;
+        TUint              lastUsed;
+    } Entry;
+private:
+    TInt  find(const PcmCacheKey& aKey) const;
+    void  remove(TUint aIndex);
+    TBool spill(const PcmCacheKey& aKey);
+    TBool allocateSpill(TUint64 aBytes, TUint64& aOffset);
+    TInt  leastRecentlyUsed(TBool aSpilled) const;
+private:
+    std::vector<Entry> iEntries;
+    TUint64            iMemoryBytes;
+    TUint64            iMemoryUsed;
+    TUint64            iSpillBytes;
+    TByte             *iSpill;
+    TUint              iUseCount;
+};
+
+} // namespace Codec
+} // namespace Media
+} // namespace OpenHome
@@ -0,0 +1,470 @@
+#include <OpenHome/Private/Printer.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "Dither.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// Noise shaping filters, applied to the errors of the previous samples,
+// newest first.
+static const float kShapedCoeffs[]   = { 2.0f, -1.0f };
+static const float kLipshitzCoeffs[] = { 2.033f, -2.165f, 1.959f, -1.590f,
+                                         0.6149f };
+
+// Adding 1.5 * 2^23 to a float of magnitude below 2^22 rounds it to the
+// nearest integer, held in the low bits of the mantissa.
+static const float   kRoundMagic     = 12582912.0f;
+static const TInt32  kRoundMagicBits = 0x4b400000;
+
+// A 16 bit integer in the low bits of the mantissa of 2^23.
+static const float   kUnpackMagic     = 8388608.0f;
+static const TUint32 kUnpackMagicBits = 0x4b000000;
+
+// Audio used by Benchmark().
+static const TUint kBenchmarkRate     = 48000;
+static const TUint kBenchmarkChannels = 2;
+static const TUint kBenchmarkSeconds  = 10;
+static const TUint kBenchmarkFrames   = 4096;
+
+static TUint32 seed(TUint aChannel)
+{
+    return 0x9e3779b9U * (aChannel + 1);
+}
+
+// Read a big endian sample of aSubsampleBytes, in units of the 16 bit LSB.
+static float readSample(const TByte* aPtr, TUint aSubsampleBytes)
+{
+    TUint32 value = ((TUint32)aPtr[0] << 24) | ((TUint32)aPtr[1] << 16) |
+                    ((TUint32)aPtr[2] << 8);
+
+    if (aSubsampleBytes == 4)
+    {
+        value |= aPtr[3];
+    }
+
+    return (TInt32)value * (1.0f / 65536.0f);
+}
+
+static void writeS16(TByte*& aPtr, TInt32 aValue, TBool aDuplicate)
+{
+    TInt16 value = (TInt16)std::min(std::max(aValue, -32768), 32767);
+
+    *aPtr++ = (TByte)value;
+    *aPtr++ = (TByte)(value >> 8);
+
+    if (aDuplicate)
+    {
+        *aPtr++ = (TByte)value;
+        *aPtr++ = (TByte)(value >> 8);
+    }
+}
+
+// Dither
+
+Dither::Dither()
+    : iMode(kOff)
+    , iApplied(kOff)
+    , iChannels(0)
+{
+    reset();
+}
+
+void Dither::SetMode(const Brx& aMode)
+{
+    std::string mode((const char *)aMode.Ptr(), aMode.Bytes());
+
+    if (mode.empty() || (mode == "off"))
+    {
+        SetMode(kOff);
+    }
+    else if (mode == "tpdf")
+    {
+        SetMode(kTpdf);
+    }
+    else if (mode == "shaped")
+    {
+        SetMode(kShaped);
+    }
+    else if (mode == "lipshitz")
+    {
+        SetMode(kLipshitz);
+    }
+    else
+    {
+        Log::Print("Error: Dither: Invalid mode '%s'\n", mode.c_str());
+        SetMode(kOff);
+    }
+}
+
+// May be called from any thread.
+void Dither::SetMode(Mode aMode)
+{
+    iMode.store(aMode, std::memory_order_relaxed);
+}
+
+TBool Dither::Active() const
+{
+    return (iMode.load(std::memory_order_relaxed) != kOff);
+}
+
+void Dither::Process(const TByte* aInput, TByte* aOutput, TUint aFrames,
+                     TUint aChannels, TUint aSubsampleBytes,
+                     TBool aDuplicate)
+{
+    const TUint mode    = iMode.load(std::memory_order_relaxed);
+    const TUint samples = aFrames * aChannels;
+
+    if ((mode != iApplied) || (aChannels != iChannels))
+    {
+        iApplied  = mode;
+        iChannels = aChannels;
+
+        reset();
+    }
+
+    if ((mode == kOff) || (aChannels == 0) || (aChannels > kMaxChannels))
+    {
+        truncate(aInput, aOutput, samples, aSubsampleBytes, aDuplicate);
+        return;
+    }
+
+    // Nothing is lost converting a block without low bits, so it is not
+    // dithered.
+    TBool exact = true;
+
+    for (TUint i=0; exact && (i<samples); i++)
+    {
+        const TByte *ptr = aInput + (i * aSubsampleBytes);
+
+        exact = (ptr[2] == 0) && ((aSubsampleBytes == 3) || (ptr[3] == 0));
+    }
+
+    if (exact)
+    {
+        truncate(aInput, aOutput, samples, aSubsampleBytes, aDuplicate);
+        return;
+    }
+
+    switch (mode)
+    {
+        case kTpdf:
+            shape<0>(aInput, aOutput, aFrames, aChannels, aSubsampleBytes,
+                     aDuplicate, nullptr);
+            break;
+        case kShaped:
+            shape<2>(aInput, aOutput, aFrames, aChannels, aSubsampleBytes,
+                     aDuplicate, kShapedCoeffs);
+            break;
+        case kLipshitz:
+            shape<5>(aInput, aOutput, aFrames, aChannels, aSubsampleBytes,
+                     aDuplicate, kLipshitzCoeffs);
+            break;
+    }
+}
+
+void Dither::reset()
+{
+    memset(iErrors, 0, sizeof(iErrors));
+
+    for (TUint c=0; c<kMaxChannels; c++)
+    {
+        iRandom[c] = seed(c);
+    }
+}
+
+// Dither and quantise, feeding back the error through the kTaps of
+// aCoeffs.
+template <TUint kTaps>
+void Dither::shape(const TByte* aInput, TByte* aOutput, TUint aFrames,
+                   TUint aChannels, TUint aSubsampleBytes, TBool aDuplicate,
+                   const float* aCoeffs)
+{
+    const TUint  lanes       = (aChannels + 3) / 4;
+    const Vec4   roundMagic  = {kRoundMagic, kRoundMagic,
+                                kRoundMagic, kRoundMagic};
+    const IVec4  roundBits   = {kRoundMagicBits, kRoundMagicBits,
+                                kRoundMagicBits, kRoundMagicBits};
+    const Vec4   unpackMagic = {kUnpackMagic, kUnpackMagic,
+                                kUnpackMagic, kUnpackMagic};
+    const UVec4  unpackBits  = {kUnpackMagicBits, kUnpackMagicBits,
+                                kUnpackMagicBits, kUnpackMagicBits};
+    const UVec4  lowMask     = {0xffff, 0xffff, 0xffff, 0xffff};
+    const Vec4   centre      = {65535.0f, 65535.0f, 65535.0f, 65535.0f};
+    const Vec4   scale       = {1.0f / 65536.0f, 1.0f / 65536.0f,
+                                1.0f / 65536.0f, 1.0f / 65536.0f};
+    Vec4         coeffs[kMaxTaps];
+    Vec4         errors[kMaxTaps][kLanes];
+    UVec4        random[kLanes];
+    Vec4         frame[kLanes];
+    IVec4        quantised[kLanes];
+    float        samples[kMaxChannels];
+    TInt32       values[kMaxChannels];
+    const TByte *ptr  = aInput;
+    TByte       *ptr1 = aOutput;
+
+    static_assert(sizeof(errors) == sizeof(iErrors), "Error size mismatch");
+    static_assert(sizeof(random) == sizeof(iRandom), "Random size mismatch");
+
+    for (TUint k=0; k<kTaps; k++)
+    {
+        coeffs[k] = (Vec4){aCoeffs[k], aCoeffs[k], aCoeffs[k], aCoeffs[k]};
+    }
+
+    memcpy(errors, iErrors, sizeof(errors));
+    memcpy(random, iRandom, sizeof(random));
+    memset(samples, 0, sizeof(samples));
+
+    for (TUint f=0; f<aFrames; f++)
+    {
+        for (TUint c=0; c<aChannels; c++)
+        {
+            samples[c] = readSample(ptr, aSubsampleBytes);
+            ptr       += aSubsampleBytes;
+        }
+
+        memcpy(frame, samples, lanes * sizeof(Vec4));
+
+        for (TUint l=0; l<lanes; l++)
+        {
+            // Xorshift, then the sum of its two halves as triangular
+            // dither of +/-1 LSB.
+            UVec4 r = random[l];
+
+            r ^= r << 13;
+            r ^= r >> 17;
+            r ^= r << 5;
+
+            random[l] = r;
+
+            Vec4 low    = (Vec4)((r & lowMask) | unpackBits) - unpackMagic;
+            Vec4 high   = (Vec4)((r >> 16) | unpackBits) - unpackMagic;
+            Vec4 dither = ((low + high) - centre) * scale;
+
+            Vec4 wanted = frame[l];
+
+            for (TUint k=0; k<kTaps; k++)
+            {
+                wanted -= coeffs[k] * errors[k][l];
+            }
+
+            Vec4 rounded = (wanted + dither) + roundMagic;
+
+            for (TUint k=kTaps; k-->1; )
+            {
+                errors[k][l] = errors[k - 1][l];
+            }
+
+            if (kTaps > 0)
+            {
+                errors[0][l] = (rounded - roundMagic) - wanted;
+            }
+
+            quantised[l] = (IVec4)rounded - roundBits;
+        }
+
+        memcpy(values, quantised, lanes * sizeof(IVec4));
+
+        for (TUint c=0; c<aChannels; c++)
+        {
+            writeS16(ptr1, values[c], aDuplicate);
+        }
+    }
+
+    memcpy(iErrors, errors, sizeof(errors));
+    memcpy(iRandom, random, sizeof(random));
+}
+
+// Drop the low bytes, as done without dither.
+void Dither::truncate(const TByte* aInput, TByte* aOutput, TUint aSamples,
+                      TUint aSubsampleBytes, TBool aDuplicate)
+{
+    TByte *ptr1 = aOutput;
+
+    for (TUint i=0; i<aSamples; i++)
+    {
+        *ptr1++ = aInput[1];
+        *ptr1++ = aInput[0];
+
+        if (aDuplicate)
+        {
+            *ptr1++ = aInput[1];
+            *ptr1++ = aInput[0];
+        }
+
+        aInput += aSubsampleBytes;
+    }
+}
+
+// Reference implementation of a mode, one sample at a time, in the same
+// order of operations as shape().
+static void reference(Dither::Mode aMode, const std::vector<TByte>& aInput,
+                      TUint aChannels, std::vector<TInt32>& aOutput)
+{
+    const float *coeffs = (aMode == Dither::kShaped)   ? kShapedCoeffs
+                        : (aMode == Dither::kLipshitz) ? kLipshitzCoeffs
+                                                       : nullptr;
+    const TUint  taps   = (aMode == Dither::kShaped)   ? 2
+                        : (aMode == Dither::kLipshitz) ? 5 : 0;
+    const TUint  count  = aInput.size() / 4;
+    float        errors[8][5];
+    TUint32      random[8];
+
+    memset(errors, 0, sizeof(errors));
+
+    for (TUint c=0; c<aChannels; c++)
+    {
+        random[c] = seed(c);
+    }
+
+    aOutput.resize(count);
+
+    for (TUint i=0; i<count; i++)
+    {
+        const TUint c     = i % aChannels;
+        const float value = readSample(&aInput[i * 4], 4);
+
+        if (aMode == Dither::kOff)
+        {
+            aOutput[i] = (TInt32)floor(value);
+            continue;
+        }
+
+        TUint32 r = random[c];
+
+        r ^= r << 13;
+        r ^= r >> 17;
+        r ^= r << 5;
+
+        random[c] = r;
+
+        float dither = (((float)(r & 0xffff) + (float)(r >> 16)) - 65535.0f) *
+                       (1.0f / 65536.0f);
+        float wanted = value;
+
+        for (TUint k=0; k<taps; k++)
+        {
+            wanted -= coeffs[k] * errors[c][k];
+        }
+
+        float rounded = nearbyintf(wanted + dither);
+
+        for (TUint k=taps; k-->1; )
+        {
+            errors[c][k] = errors[c][k - 1];
+        }
+
+        if (taps > 0)
+        {
+            errors[c][0] = rounded - wanted;
+        }
+
+        aOutput[i] = (TInt32)rounded;
+    }
+}
+
+void Dither::Benchmark()
+{
+    static const Mode        kModes[] = { kOff, kTpdf, kShaped, kLipshitz };
+    static const char *const kNames[] = { "off", "tpdf", "shaped",
+                                          "lipshitz" };
+
+    const TUint        samples = kBenchmarkFrames * kBenchmarkChannels;
+    std::vector<TByte> input(samples * 4);
+    std::vector<TByte> output(samples * 2);
+    std::vector<TInt32> expected;
+
+    // A quiet 997Hz sine, with a different phase per channel, whose low
+    // bits vary from sample to sample.
+    for (TUint f=0; f<kBenchmarkFrames; f++)
+    {
+        for (TUint c=0; c<kBenchmarkChannels; c++)
+        {
+            double  phase = (2.0 * M_PI * 997.0 * f) / kBenchmarkRate + c;
+            TUint32 value = (TUint32)(TInt32)lrint(sin(phase) *
+                                                   1000.37 * 65536.0);
+            TByte  *ptr   = &input[((f * kBenchmarkChannels) + c) * 4];
+
+            ptr[0] = (TByte)(value >> 24);
+            ptr[1] = (TByte)(value >> 16);
+            ptr[2] = (TByte)(value >> 8);
+            ptr[3] = (TByte)value;
+        }
+    }
+
+    for (TUint m=0; m<sizeof(kModes)/sizeof(kModes[0]); m++)
+    {
+        const float *coeffs = (kModes[m] == kShaped)   ? kShapedCoeffs
+                            : (kModes[m] == kLipshitz) ? kLipshitzCoeffs
+                                                       : nullptr;
+        const TUint  taps   = (kModes[m] == kShaped)   ? 2
+                            : (kModes[m] == kLipshitz) ? 5 : 0;
+        Dither       dither;
+
+        dither.SetMode(kModes[m]);
+
+        // Check one block against the reference.
+        dither.Process(&input[0], &output[0], kBenchmarkFrames,
+                       kBenchmarkChannels, 4, false);
+
+        reference(kModes[m], input, kBenchmarkChannels, expected);
+
+        TUint  mismatches = 0;
+        double sum        = 0.0;
+        double squares    = 0.0;
+
+        for (TUint i=0; i<samples; i++)
+        {
+            TInt32 value = (TInt16)(output[i * 2] | (output[(i * 2) + 1] << 8));
+            double error = value - readSample(&input[i * 4], 4);
+
+            mismatches += (value != expected[i]) ? 1 : 0;
+            sum        += error;
+            squares    += error * error;
+        }
+
+        // Truncation error is uniform over one LSB. Triangular dither adds
+        // twice that, and shaping multiplies it by the power gain of the
+        // noise transfer function.
+        double power = (kModes[m] == kOff) ? (1.0 / 12.0) + 0.25 : 0.25;
+
+        for (TUint k=0; k<taps; k++)
+        {
+            power += 0.25 * coeffs[k] * coeffs[k];
+        }
+
+        // Measure the cost.
+        struct timespec cpuStart, cpuEnd;
+
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuStart);
+
+        for (TUint f=0; f<kBenchmarkRate*kBenchmarkSeconds;
+             f+=kBenchmarkFrames)
+        {
+            dither.Process(&input[0], &output[0], kBenchmarkFrames,
+                           kBenchmarkChannels, 4, false);
+        }
+
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuEnd);
+
+        double cpu = (cpuEnd.tv_sec - cpuStart.tv_sec) +
+                     ((cpuEnd.tv_nsec - cpuStart.tv_nsec) / 1e9);
+
+        Log::Print("Dither: %-8s %5.2fns per sample, %.3f%% CPU at %uHz "
+                   "stereo, %u of %u samples differ from the reference, "
+                   "error mean %+.3f LSB, power %.2fdB (expected %.2fdB)\n",
+                   kNames[m],
+                   (1e9 * cpu) / ((double)kBenchmarkRate * kBenchmarkSeconds *
+                                  kBenchmarkChannels),
+                   (100.0 * cpu) / kBenchmarkSeconds, kBenchmarkRate,
+                   mismatches, samples, sum / samples,
+                   10.0 * log10(squares / samples), 10.0 * log10(power));
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Buffer.h>
+
+#include <atomic>
+
+namespace OpenHome {
+namespace Media {
+
+// TPDF dither, with optional noise shaping, for reducing 24 or 32 bit
+// audio to S16_LE.
+//
+// The dither is two uniform values per sample, taken from one xorshift
+// word, so the channels of a frame are dithered together as vectors of
+// four. Noise shaping feeds the quantisation error back through a short
+// filter, moving the noise to where it is least audible.
+//
+// A block whose low 16 bits are all zero, such as 16 bit audio in a
+// larger container or digital silence, is converted exactly.
+class Dither
+{
+public:
+    static const TUint kMaxChannels = 8;
+
+    enum Mode
+    {
+        kOff,       // Truncate.
+        kTpdf,      // Flat TPDF dither.
+        kShaped,    // Second order high pass noise shaping.
+        kLipshitz   // Lipshitz's five tap E-weighted filter, for 44.1kHz
+                    // and 48kHz.
+    };
+public:
+    Dither();
+    // Set the mode from its name, 'off', 'tpdf', 'shaped' or 'lipshitz'.
+    void  SetMode(const Brx& aMode);
+    void  SetMode(Mode aMode);
+    // Log the cost per sample of each mode, checking the output against
+    // a double precision reference.
+    static void Benchmark();
+public: // Called by the audio thread
+    TBool Active() const;
+    // Reduce aFrames of aChannels big endian samples of aSubsampleBytes,
+    // 3 or 4, to S16_LE, writing each sample twice if aDuplicate.
+    void  Process(const TByte* aInput, TByte* aOutput, TUint aFrames,
+                  TUint aChannels, TUint aSubsampleBytes, TBool aDuplicate);
+private:
+    typedef float   Vec4 __attribute__((vector_size(16)));
+    typedef TInt32  IVec4 __attribute__((vector_size(16)));
+    typedef TUint32 UVec4 __attribute__((vector_size(16)));
+
+    static const TUint kLanes   = kMaxChannels / 4;
+    static const TUint kMaxTaps = 5;
+private:
+    void reset();
+    template <TUint kTaps>
+    void shape(const TByte* aInput, TByte* aOutput, TUint aFrames,
+               TUint aChannels, TUint aSubsampleBytes, TBool aDuplicate,
+               const float* aCoeffs);
+    static void truncate(const TByte* aInput, TByte* aOutput, TUint aSamples,
+                         TUint aSubsampleBytes, TBool aDuplicate);
+private:
+    std::atomic<TUint> iMode;
+
+    // Owned by the audio thread.
+    TUint              iApplied;
+    TUint              iChannels;
+    // Stored as scalars as the object may not be aligned for vectors.
+    float              iErrors[kMaxTaps][kMaxChannels];  // Newest first.
+    TUint32            iRandom[kMaxChannels];
+};
+
+} // namespace Media
+} // namespace OpenHome
@@ -1,10 +1,24 @@
 #include <OpenHome/Private/Printer.h>
 #include <OpenHome/Net/Private/Globals.h>
 #include <OpenHome/OsWrapper.h>
+#include <OpenHome/Private/Fifo.h>
 #include <alsa/asoundlib.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <memory>
+#include <string>
 
+#include "AudioTap.h"
+#include "ClockPullerAlsa.h"
+#include "Dither.h"
 #include "DriverAlsa.h"
+#include "FirConvolver.h"
+#include "LoudnessNormaliser.h"
+#include "OhmTimestamperAlsa.h"
+#include "ParametricEq.h"
+#include "PolyphaseResampler.h"
+#include "SongcastSenderAlsa.h"
 
 using namespace OpenHome;
 using namespace OpenHome::Media;
@@ -161,16 +175,56 @@ class PcmProcessorLe : public PcmProcessorBase
 {
 public:
     PcmProcessorLe(IDataSink& aSink, Bwx& aBuffer);
+    void SetDither(Dither* aDither);
 public: // IPcmProcessor
     virtual void ProcessFragment8(const Brx& aData, TUint aNumChannels);
     virtual void ProcessFragment16(const Brx& aData, TUint aNumChannels);
     virtual void ProcessFragment24(const Brx& aData, TUint aNumChannels);
     virtual void ProcessFragment32(const Brx& aData, TUint aNumChannels);
+private:
+    void ProcessDithered(const Brx& aData, TUint aNumChannels,
+                         TUint aSubsampleBytes, TBool aDuplicate);
+private:
+    Dither* iDither;
 };
 
 PcmProcessorLe::PcmProcessorLe(IDataSink& aSink, Bwx& aBuffer)
 : PcmProcessorBase(aSink, aBuffer)
+, iDither(nullptr)
+{
+}
+
+// Dither the 24 and 32 bit audio reduced to 16 bit.
+void PcmProcessorLe::SetDither(Dither* aDither)
+{
+    iDither = aDither;
+}
+
+void PcmProcessorLe::ProcessDithered(const Brx& aData, TUint aNumChannels,
+                                     TUint aSubsampleBytes, TBool aDuplicate)
 {
+    TByte *nData;
+    TUint  frames;
+    TUint  bytes;
+
+    frames = aData.Bytes() / (aSubsampleBytes * aNumChannels);
+    bytes  = frames * aNumChannels * 2;
+
+    if (aDuplicate)
+    {
+        bytes *= 2;
+    }
+
+    nData = new TByte[bytes];
+    ASSERT(nData != NULL);
+
+    iDither->Process(aData.Ptr(), nData, frames, aNumChannels,
+                     aSubsampleBytes, aDuplicate);
+
+    Brn fragment(nData, bytes);
+    Flush();
+    iSink.Write(fragment);
+    delete[] nData;
 }
 
 void PcmProcessorLe::ProcessFragment8(const Brx& aData, TUint aNumChannels)
@@ -269,7 +323,12 @@ void PcmProcessorLe::ProcessFragment24(const Brx& aData, TUint aNumChannels)
 
     // 24 bit audio is not supported on the platform so it is converted
     // to signed 16 bit audio for playback.
-    //
+    if ((iDither != nullptr) && iDither->Active() && (aNumChannels != 0))
+    {
+        ProcessDithered(aData, aNumChannels, 3, iDuplicateChannel);
+        return;
+    }
+
     // Accordingly one third of the input data is discarded.
     bytes = (aData.Bytes() * 2) / 3;
 
@@ -314,11 +373,22 @@ void PcmProcessorLe::ProcessFragment32(const Brx& aData, TUint aNumChannels)
     TByte *nData;
     TUint  bytes;
 
-    // Currently the only 32 bit pcm in the pipeline is auto-generated by
-    // the ramper.
+    // 32 bit pcm is output by codecs decoding at full precision and is
+    // also auto-generated by the ramper.
     //
-    // This may differ from the stream format so we must do the conversion
-    // here.
+    // The ramper output may differ from the stream format so we must do the
+    // conversion here.
+    //
+    // Audio of more than 16 bits is dithered, if enabled, but not the
+    // ramps of 16 bit streams.
+    if ((iDither != nullptr) && iDither->Active() && (aNumChannels != 0) &&
+        ((iBitDepth == 24) || (iBitDepth == 32)))
+    {
+        ProcessDithered(aData, aNumChannels, 4,
+                        iDuplicateChannel && (aNumChannels != 2));
+        return;
+    }
+
     bytes = aData.Bytes();
 
     // If we are manually converting mono to stereo the data will double.
@@ -463,11 +533,11 @@ void PcmProcessorLe32::ProcessFragment32(const Brx& aData, TUint aNumChannels)
     TByte *nData;
     TUint  bytes;
 
-    // Currently the only 32 bit pcm in the pipeline is auto-generated by
-    // the ramper.
+    // 32 bit pcm is output by codecs decoding at full precision and is
+    // also auto-generated by the ramper.
     //
-    // This may differ from the stream format so we must do the conversion
-    // here.
+    // The ramper output may differ from the stream format so we must do the
+    // conversion here.
     bytes = aData.Bytes();
 
     // If we are manually converting mono to stereo the data will double.
@@ -557,6 +627,359 @@ void PcmProcessorLe32::ProcessFragment32(const Brx& aData, TUint aNumChannels)
     delete[] nData;
 }
 
+// PcmProcessorResample
+//
+// Resamples all streams to the fixed output rate, or adaptively to their
+// own rate under the control of a clock puller, as stereo S32_LE or S16_LE.
+// Mono is duplicated and only the front pair of multichannel streams is
+// played.
+
+class PcmProcessorResample : public PcmProcessorBase
+{
+public:
+    static const TUint kOutputChannels = 2;
+public:
+    PcmProcessorResample(IDataSink& aSink, Bwx& aBuffer);
+    TBool Configure(TUint aSampleRate, TUint aOutputRate, TUint aOutputBytes,
+                    TBool aAdaptive);
+    void  SetRatioAdjust(double aAdjust);
+public: // IPcmProcessor
+    void ProcessFragment(const Brx& aData, TUint aNumChannels,
+                         TUint aSubsampleBytes) override;
+protected:
+    void ProcessFragment8(const Brx& aData, TUint aNumChannels) override;
+    void ProcessFragment16(const Brx& aData, TUint aNumChannels) override;
+    void ProcessFragment24(const Brx& aData, TUint aNumChannels) override;
+    void ProcessFragment32(const Brx& aData, TUint aNumChannels) override;
+private:
+    static float ReadSample(const TByte* aPtr, TUint aSubsampleBytes);
+private:
+    PolyphaseResampler iResampler;
+    TUint              iOutputBytes;
+    std::vector<float> iInput;
+    std::vector<float> iOutput;
+};
+
+PcmProcessorResample::PcmProcessorResample(IDataSink& aSink, Bwx& aBuffer)
+: PcmProcessorBase(aSink, aBuffer)
+, iOutputBytes(4)
+{
+}
+
+// Prepare for a stream. The resampler history is retained between streams
+// of the same rate so gapless playback is preserved.
+TBool PcmProcessorResample::Configure(TUint aSampleRate, TUint aOutputRate,
+                                      TUint aOutputBytes, TBool aAdaptive)
+{
+    iOutputBytes = aOutputBytes;
+
+    return iResampler.Configure(aSampleRate, aOutputRate, kOutputChannels,
+                                aAdaptive);
+}
+
+void PcmProcessorResample::SetRatioAdjust(double aAdjust)
+{
+    iResampler.SetRatioAdjust(aAdjust);
+}
+
+// The fragment sample size is taken from the fragment itself, as the ramper
+// may inject 32 bit audio into a stream of another bit depth.
+void PcmProcessorResample::ProcessFragment(const Brx& aData,
+                                           TUint aNumChannels,
+                                           TUint aSubsampleBytes)
+{
+    if ((aNumChannels == 0) || (aSubsampleBytes == 0) ||
+        (aSubsampleBytes > 4))
+    {
+        return;
+    }
+
+    const TUint  frameBytes = aNumChannels * aSubsampleBytes;
+    const TUint  frames     = aData.Bytes() / frameBytes;
+    const TByte *ptr        = aData.Ptr();
+
+    iInput.resize(frames * kOutputChannels);
+
+    for (TUint i=0; i<frames; i++, ptr+=frameBytes)
+    {
+        float left  = ReadSample(ptr, aSubsampleBytes);
+        float right = (aNumChannels > 1)
+                          ? ReadSample(ptr + aSubsampleBytes, aSubsampleBytes)
+                          : left;
+
+        iInput[(i * kOutputChannels) + 0] = left;
+        iInput[(i * kOutputChannels) + 1] = right;
+    }
+
+    iOutput.clear();
+
+    if (frames > 0)
+    {
+        iResampler.Process(&iInput[0], frames, iOutput);
+    }
+
+    for (TUint i=0; i<iOutput.size(); i++)
+    {
+        float sample = iOutput[i];
+
+        if (sample > 1.0f)
+        {
+            sample = 1.0f;
+        }
+        else if (sample < -1.0f)
+        {
+            sample = -1.0f;
+        }
+
+        if (iBuffer.BytesRemaining() < iOutputBytes)
+        {
+            Flush();
+        }
+
+        TByte *out = (TByte *)iBuffer.Ptr() + iBuffer.Bytes();
+
+        // Store the data in little endian format.
+        if (iOutputBytes == 4)
+        {
+            TInt32 value = (sample >= 1.0f) ? 0x7fffffff
+                                            : (TInt32)(sample * 2147483648.0f);
+
+            out[0] = (TByte)(value);
+            out[1] = (TByte)(value >> 8);
+            out[2] = (TByte)(value >> 16);
+            out[3] = (TByte)(value >> 24);
+        }
+        else
+        {
+            TInt16 value = (sample >= 1.0f) ? 0x7fff
+                                            : (TInt16)(sample * 32768.0f);
+
+            out[0] = (TByte)(value);
+            out[1] = (TByte)(value >> 8);
+        }
+
+        iBuffer.SetBytes(iBuffer.Bytes() + iOutputBytes);
+    }
+}
+
+void PcmProcessorResample::ProcessFragment8(const Brx& aData,
+                                            TUint aNumChannels)
+{
+    ProcessFragment(aData, aNumChannels, 1);
+}
+
+void PcmProcessorResample::ProcessFragment16(const Brx& aData,
+                                             TUint aNumChannels)
+{
+    ProcessFragment(aData, aNumChannels, 2);
+}
+
+void PcmProcessorResample::ProcessFragment24(const Brx& aData,
+                                             TUint aNumChannels)
+{
+    ProcessFragment(aData, aNumChannels, 3);
+}
+
+void PcmProcessorResample::ProcessFragment32(const Brx& aData,
+                                             TUint aNumChannels)
+{
+    ProcessFragment(aData, aNumChannels, 4);
+}
+
+// Convert a big endian sample to float. 8 bit audio is unsigned.
+float PcmProcessorResample::ReadSample(const TByte* aPtr,
+                                       TUint aSubsampleBytes)
+{
+    TInt32 value;
+
+    switch (aSubsampleBytes)
+    {
+        case 1:
+            value = (TInt32)((TUint32)(aPtr[0] ^ 0x80) << 24);
+            break;
+        case 2:
+            value = (TInt32)(((TUint32)aPtr[0] << 24) |
+                             ((TUint32)aPtr[1] << 16));
+            break;
+        case 3:
+            value = (TInt32)(((TUint32)aPtr[0] << 24) |
+                             ((TUint32)aPtr[1] << 16) |
+                             ((TUint32)aPtr[2] << 8));
+            break;
+        default:
+            value = (TInt32)(((TUint32)aPtr[0] << 24) |
+                             ((TUint32)aPtr[1] << 16) |
+                             ((TUint32)aPtr[2] << 8)  |
+                             ((TUint32)aPtr[3]));
+            break;
+    }
+
+    return value * (1.0f / 2147483648.0f);
+}
+
+// DsdProcessor
+//
+// Formats DSD for output, either natively as DSD_U32_BE or packed as
+// DSD over PCM (DoP) into S32_LE.
+//
+// The pipeline delivers DSD as interleaved 2 byte chunks for each channel,
+// preceded by the pad bytes requested by the driver.
+
+class DsdProcessor : public IDsdProcessor
+{
+public:
+    static const TUint kNativeBlockWords = 2; // 2 chunks per channel
+    static const TUint kNativePadBytes   = 0;
+    static const TUint kDopBlockWords    = 2; // 1 chunk per channel
+    static const TUint kDopPadBytes      = 2;
+public:
+    DsdProcessor(IDataSink& aSink, Bwx& aBuffer);
+    void SetNative(TBool aNative);
+    void Reset();
+public: // IDsdProcessor
+    void BeginBlock() override;
+    void ProcessFragment(const Brx& aData, TUint aNumChannels,
+                         TUint aSampleBlockWords) override;
+    void ProcessSilence(const Brx& aData, TUint aNumChannels,
+                        TUint aSampleBlockWords) override;
+    void EndBlock() override;
+    void Flush() override;
+private:
+    void ProcessNative(const Brx& aData, TUint aNumChannels);
+    void ProcessDop(const Brx& aData, TUint aNumChannels);
+private:
+    static const TByte kDopMarker1 = 0x05;
+    static const TByte kDopMarker2 = 0xfa;
+
+    IDataSink& iSink;
+    Bwx&       iBuffer;
+    TBool      iNative;
+    TByte      iDopMarker;
+};
+
+DsdProcessor::DsdProcessor(IDataSink& aSink, Bwx& aBuffer)
+: iSink(aSink)
+, iBuffer(aBuffer)
+, iNative(false)
+, iDopMarker(kDopMarker1)
+{
+}
+
+void DsdProcessor::SetNative(TBool aNative)
+{
+    iNative = aNative;
+}
+
+// Restart the DoP marker sequence at the start of a stream.
+void DsdProcessor::Reset()
+{
+    iDopMarker = kDopMarker1;
+}
+
+void DsdProcessor::BeginBlock()
+{
+    ASSERT(iBuffer.Bytes() == 0);
+}
+
+void DsdProcessor::ProcessFragment(const Brx& aData, TUint aNumChannels,
+                                   TUint /*aSampleBlockWords*/)
+{
+    if (iNative)
+    {
+        ProcessNative(aData, aNumChannels);
+    }
+    else
+    {
+        ProcessDop(aData, aNumChannels);
+    }
+}
+
+void DsdProcessor::ProcessSilence(const Brx& aData, TUint aNumChannels,
+                                  TUint aSampleBlockWords)
+{
+    ProcessFragment(aData, aNumChannels, aSampleBlockWords);
+}
+
+void DsdProcessor::EndBlock()
+{
+    Flush();
+}
+
+void DsdProcessor::Flush()
+{
+    if (iBuffer.Bytes() != 0)
+    {
+        iSink.Write(iBuffer);
+        iBuffer.SetBytes(0);
+    }
+}
+
+// Gather the two chunks of each channel in a block into a 32 bit big
+// endian word of consecutive DSD bytes.
+void DsdProcessor::ProcessNative(const Brx& aData, TUint aNumChannels)
+{
+    const TUint  blockBytes = aNumChannels * 4;
+    const TByte *ptr        = aData.Ptr();
+    const TByte *endp       = ptr + aData.Bytes() -
+                                  (aData.Bytes() % blockBytes);
+
+    while (ptr < endp)
+    {
+        if (iBuffer.BytesRemaining() < blockBytes)
+        {
+            Flush();
+        }
+
+        TByte *out = (TByte *)iBuffer.Ptr() + iBuffer.Bytes();
+
+        for (TUint ch=0; ch<aNumChannels; ch++)
+        {
+            *out++ = ptr[(ch * 2) + 0];
+            *out++ = ptr[(ch * 2) + 1];
+            *out++ = ptr[(aNumChannels * 2) + (ch * 2) + 0];
+            *out++ = ptr[(aNumChannels * 2) + (ch * 2) + 1];
+        }
+
+        iBuffer.SetBytes(iBuffer.Bytes() + blockBytes);
+        ptr += blockBytes;
+    }
+}
+
+// Pack each chunk into a little endian S32 DoP word. The DSD bytes occupy
+// the top 24 bits below the marker, which alternates each frame.
+void DsdProcessor::ProcessDop(const Brx& aData, TUint aNumChannels)
+{
+    const TUint  frameBytes = aNumChannels * 4;
+    const TByte *ptr        = aData.Ptr();
+    const TByte *endp       = ptr + aData.Bytes() -
+                                  (aData.Bytes() % frameBytes);
+
+    while (ptr < endp)
+    {
+        if (iBuffer.BytesRemaining() < frameBytes)
+        {
+            Flush();
+        }
+
+        TByte *out = (TByte *)iBuffer.Ptr() + iBuffer.Bytes();
+
+        for (TUint ch=0; ch<aNumChannels; ch++)
+        {
+            // The chunk follows its 2 pad bytes.
+            *out++ = 0x00;
+            *out++ = ptr[3];
+            *out++ = ptr[2];
+            *out++ = iDopMarker;
+
+            ptr += 4;
+        }
+
+        iDopMarker = (iDopMarker == kDopMarker1) ? kDopMarker2 : kDopMarker1;
+
+        iBuffer.SetBytes(iBuffer.Bytes() + frameBytes);
+    }
+}
+
 typedef std::pair<snd_pcm_format_t, TUint> OutputFormat;
 
 class Profile
@@ -618,44 +1041,182 @@ IPcmProcessor& Profile::GetPcmProcessor() const
 class DriverAlsa::Pimpl : public IDataSink
 {
 public:
-    Pimpl(const TChar* aAlsaDevice, TUint aBufferUs);
+    Pimpl(const TChar* aAlsaDevice, TUint aBufferUs, TUint aFixedRate,
+          ClockPullerAlsa* aClockPuller, TBool aPrimary);
     virtual ~Pimpl();
+    TBool Opened() const;
+    TBool DsdNative() const;
+    TBool DsdEnabled() const;
+    void DisableDsd();
+    void SetDsdDop(TBool aDop);
+    void SetTrimUs(TUint aTrimUs);
+    void SetEq(const Brx& aSpec);
+    void SetFir(const std::string& aPath, TUint aPartitionFrames,
+                TUint aThreads);
+    void SetLoudness(LoudnessNormaliser* aLoudness);
+    void SetDither(const Brx& aMode);
+    void ProcessTrack(MsgTrack* aMsg);
     void ProcessDecodedStream(MsgDecodedStream* aMsg);
     void ProcessPlayable(MsgPlayable* aMsg);
+    void ProcessFragment(const Brx& aData, TUint aNumChannels,
+                         TUint aSampleBytes);
+    void ReportWritePosition();
+    void ProcessHalt();
     void ProcessDrain();
     void LogPCMState();
     TUint DriverDelayJiffies(TUint aSampleRate);
+    TUint DspDelayJiffies(TUint aSampleRate) const;
+    TUint DsdPcmRate(TUint aDsdSampleRate) const;
+    TUint OutputRate(TUint aSampleRate) const;
+    void DsdBlockConfiguration(TUint& aSampleBlockWords,
+                               TUint& aPadBytesPerChunk) const;
 public:
     virtual void Write(const Brx& aData);
 private:
     TBool TryProfile(Profile& aProfile, TUint aBitDepth, TUint aNumChannels,
                      TUint aSampleRate, TUint aBufferUs);
+    TBool TryDsd(TUint aNumChannels, TUint aSampleRate);
+    TBool TryResampleRate(TUint aOutputRate);
+    void  PcmOpened(TUint aOutputRate);
+    void  WritePcm(const TByte* aData, TUint aBytes);
+    void  UpdateFir();
+    void  RequestFir(TUint aSampleRate, TUint aChannels);
+    void  FirLoaderThread();
+    void  ResamplerFilterThread();
+    void  WriteSilence(TUint aFrames);
+    void  ReportStatus();
+    void  ReportTrackStart();
+    TBool SupportsNativeDsd();
 private:
     snd_pcm_t* iHandle;
     Bwh iSampleBuffer;  // buffer ProcessSampleX data
     TUint iSampleBytes;
+    TUint iSubsampleBytes;  // Of the PCM output, 0 for DSD.
     TBool iDuplicateChannel;
     std::vector<Profile> iProfiles;
     TInt iProfileIndex;
     TBool iDitch;
     TUint iBytesSent;
     TUint iBufferUs;
+    DsdProcessor iDsdProcessor;
+    TBool iDsdNative;
+    TBool iDsd;
+    PcmProcessorResample iResampleProcessor;
+    TUint iFixedRate;
+    TUint iFixedBytes;
+    TUint iResampleRate;    // Rate the PCM is open at for resampling.
+    ClockPullerAlsa* iClockPuller;
+    TBool iPulled;
+    ThreadFunctor* iResamplerFilters;
+    TUint iOutputRate;      // Rate the PCM is open at.
+    TUint64 iFramesWritten;
+    TBool iMonotonicTimestamps;
+    TBool iPrimary;         // Feeds the Songcast media clock.
+    TBool iDsdEnabled;
+    TUint iTrimUs;
+    TBool iTrimPending;
+    ParametricEq iEq;
+    Dither iDither;
+    FirConvolver* iFir;     // Owned by the audio thread.
+    Mutex iFirLock;
+    FirConvolver* iFirNext; // Guarded by iFirLock.
+    std::atomic<TBool> iFirChanged;
+    std::string iFirPath;   // Guarded by iFirLock, as are the following.
+    TUint iFirPartitionFrames;
+    TUint iFirThreads;
+    TUint iFirGeneration;   // Counts the convolvers set.
+    TUint iFirLoadRate;     // Format to prepare for, or 0.
+    TUint iFirLoadChannels;
+    FirConvolver* iFirRetired;  // For the loader to delete.
+    TBool iFirLoaderQuit;
+    Semaphore iFirLoad;
+    ThreadFunctor* iFirLoader;
+    TUint iFirRequestRate;  // Last requested by the audio thread.
+    TUint iFirRequestChannels;
+    std::atomic<TUint> iFirLatency;  // In frames.
+    Bwh iDspBuffer;
+    std::atomic<LoudnessNormaliser*> iLoudness;
+    TBool iTrackPending;    // A track awaits its first audio.
+    TUint64 iTrackUs;       // When the track arrived.
+    TUint64 iTrackQueuedUs; // Audio still to play when it arrived.
 
     static const TUint kSampleBufSize = 16 * 1024;
 };
 
-DriverAlsa::Pimpl::Pimpl(const TChar* aAlsaDevice, TUint aBufferUs)
+DriverAlsa::Pimpl::Pimpl(const TChar* aAlsaDevice, TUint aBufferUs,
+                         TUint aFixedRate, ClockPullerAlsa* aClockPuller,
+                         TBool aPrimary)
 : iHandle(nullptr)
 , iSampleBuffer(kSampleBufSize)
 , iSampleBytes(0)
+, iSubsampleBytes(0)
 , iDuplicateChannel(false)
 , iProfileIndex(-1)
 , iDitch(false)
 , iBytesSent(0)
 , iBufferUs(aBufferUs)
+, iDsdProcessor(*this, iSampleBuffer)
+, iDsdNative(false)
+, iDsd(false)
+, iResampleProcessor(*this, iSampleBuffer)
+, iFixedRate(aFixedRate)
+, iFixedBytes(4)
+, iResampleRate(0)
+, iClockPuller(aClockPuller)
+, iPulled(false)
+, iResamplerFilters(nullptr)
+, iOutputRate(0)
+, iFramesWritten(0)
+, iMonotonicTimestamps(false)
+, iPrimary(aPrimary)
+, iDsdEnabled(true)
+, iTrimUs(0)
+, iTrimPending(false)
+, iFir(nullptr)
+, iFirLock("DAFL")
+, iFirNext(nullptr)
+, iFirChanged(false)
+, iFirPartitionFrames(0)
+, iFirThreads(0)
+, iFirGeneration(0)
+, iFirLoadRate(0)
+, iFirLoadChannels(0)
+, iFirRetired(nullptr)
+, iFirLoaderQuit(false)
+, iFirLoad("FIRL", 0)
+, iFirLoader(nullptr)
+, iFirRequestRate(0)
+, iFirRequestChannels(0)
+, iFirLatency(0)
+, iDspBuffer(kSampleBufSize)
+, iLoudness(nullptr)
+, iTrackPending(false)
+, iTrackUs(0)
+, iTrackQueuedUs(0)
 {
     auto err = snd_pcm_open(&iHandle, aAlsaDevice, SND_PCM_STREAM_PLAYBACK, 0);
-    ASSERT(err == 0);
+
+    // Only the primary device is required.
+    if (err < 0)
+    {
+        Log::Print("DriverAlsa: Cannot open '%s' : %s\n", aAlsaDevice,
+                   snd_strerror(err));
+        ASSERT(! aPrimary);
+
+        iHandle = nullptr;
+
+        return;
+    }
+
+    // The DSD block configuration is fixed for the lifetime of the driver,
+    // so the DSD output format is selected up front.
+    iDsdNative = SupportsNativeDsd();
+    iDsdProcessor.SetNative(iDsdNative);
+
+    if (iDsdNative)
+    {
+        Log::Print("DriverAlsa: DSD output DSD_U32_BE\n");
+    }
 
     // PcmProcessorLe with S32 support
     iProfiles.emplace_back(new PcmProcessorLe32(*this, iSampleBuffer),
@@ -665,74 +1226,564 @@ DriverAlsa::Pimpl::Pimpl(const TChar* aAlsaDevice, TUint aBufferUs)
             OutputFormat(SND_PCM_FORMAT_S16_LE, 2)); // U8 -> S16
 
     // PcmProcessorLe without S32 support
-    iProfiles.emplace_back(new PcmProcessorLe(*this, iSampleBuffer),
+    PcmProcessorLe *pcmProcessor16 = new PcmProcessorLe(*this, iSampleBuffer);
+
+    pcmProcessor16->SetDither(&iDither);
+
+    iProfiles.emplace_back(pcmProcessor16,
             OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S32 -> S16
             OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S24 -> S16
             OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S16
             OutputFormat(SND_PCM_FORMAT_S16_LE, 2)); // U8 -> S16
+
+    // The resampler filters are shared by all outputs, so are prepared
+    // once, by the primary.
+    if (aPrimary && ((iFixedRate != 0) || (iClockPuller != nullptr)))
+    {
+        iResamplerFilters =
+            new ThreadFunctor("ResamplerFilters",
+                              MakeFunctor(*this, &Pimpl::ResamplerFilterThread),
+                              kPriorityLow);
+        iResamplerFilters->Start();
+    }
 }
 
 DriverAlsa::Pimpl::~Pimpl()
 {
-    auto err = snd_pcm_close(iHandle);
-    ASSERT(err == 0);
-}
+    delete iResamplerFilters;
 
-void DriverAlsa::Pimpl::ProcessPlayable(MsgPlayable* aMsg)
-{
-    if (! iDitch)
-    	aMsg->Read(iProfiles[iProfileIndex].GetPcmProcessor());
-}
+    if (iHandle != nullptr)
+    {
+        auto err = snd_pcm_close(iHandle);
+        ASSERT(err == 0);
+    }
 
-void DriverAlsa::Pimpl::ProcessDrain()
-{
-    // Wait for the native audio buffers to empty.
-    if (iProfileIndex != -1)
+    if (iFirLoader != nullptr)
     {
-        // Drain the PCM buffers.
-        auto err = snd_pcm_drain(iHandle);
-        if (err < 0)
         {
-            Log::Print("DriverAlsa: snd_pcm_drain() error : %s\n",
-                       snd_strerror(err));
-            ASSERTS();
+            AutoMutex am(iFirLock);
+            iFirLoaderQuit = true;
         }
 
-        // Prepare the PCM to accept new data.
-        err = snd_pcm_prepare(iHandle);
-
-        if (err < 0)
-        {
-            Log::Print("DriverAlsa: snd_pcm_prepare() error : %s\n",
-                       snd_strerror(err));
-            ASSERTS();
-        }
+        iFirLoad.Signal();
+        delete iFirLoader;
     }
+
+    delete iFirRetired;
+    delete iFirNext;
+    delete iFir;
 }
 
-void DriverAlsa::Pimpl::Write(const Brx& aData)
+TBool DriverAlsa::Pimpl::Opened() const
 {
-    int err;
+    return iHandle != nullptr;
+}
 
-    err = snd_pcm_writei(iHandle, aData.Ptr(), aData.Bytes() / iSampleBytes);
+TBool DriverAlsa::Pimpl::DsdNative() const
+{
+    return iDsdNative;
+}
 
-    // Handle underrun errors.
-    if(err == -EPIPE) {
-        err = snd_pcm_prepare(iHandle);
+TBool DriverAlsa::Pimpl::DsdEnabled() const
+{
+    return iDsdEnabled;
+}
 
-        if (err < 0)
-        {
-            Log::Print("DriverAlsa: failed to snd_pcm_recover with %s\n",
-                       snd_strerror(err));
-            ASSERTS();
-        }
+// DSD streams are not played, as the device cannot play them in the DSD
+// block configuration of the driver.
+void DriverAlsa::Pimpl::DisableDsd()
+{
+    iDsdEnabled = false;
+}
 
-        err = snd_pcm_writei(iHandle,
-                             aData.Ptr(),
-                             aData.Bytes() / iSampleBytes);
+// A device without native DSD support only plays DSD as DoP where aDop is
+// set. A DAC that does not decode DoP plays it as full scale noise.
+void DriverAlsa::Pimpl::SetDsdDop(TBool aDop)
+{
+    if (iDsdNative)
+    {
+        return;
     }
 
-
+    if (aDop)
+    {
+        Log::Print("DriverAlsa: DSD output DoP\n");
+    }
+    else
+    {
+        Log::Print("DriverAlsa: DSD disabled, the device has no native DSD "
+                   "support and DoP is not enabled\n");
+        iDsdEnabled = false;
+    }
+}
+
+// Delay the output by aTrimUs, so it aligns with the other outputs.
+void DriverAlsa::Pimpl::SetTrimUs(TUint aTrimUs)
+{
+    iTrimUs = aTrimUs;
+}
+
+// May be called from any thread.
+void DriverAlsa::Pimpl::SetEq(const Brx& aSpec)
+{
+    iEq.SetBands(aSpec);
+}
+
+// May be called from any thread. The audio thread picks up the convolver
+// before its next write, and an empty aPath removes it.
+//
+// The impulse response for the format played is loaded by a thread of its
+// own, which hands a prepared convolver to the audio thread the same way.
+void DriverAlsa::Pimpl::SetFir(const std::string& aPath,
+                               TUint aPartitionFrames, TUint aThreads)
+{
+    FirConvolver *fir = nullptr;
+    FirConvolver *old;
+
+    if (! aPath.empty())
+    {
+        fir = new FirConvolver(aPath, aPartitionFrames, aThreads);
+    }
+
+    iFirLatency = (fir != nullptr) ? fir->LatencyFrames() : 0;
+
+    {
+        AutoMutex am(iFirLock);
+
+        // Any convolver not yet picked up is discarded, and any being
+        // prepared is for the previous path.
+        old                 = iFirNext;
+        iFirNext            = fir;
+        iFirChanged         = true;
+        iFirPath            = aPath;
+        iFirPartitionFrames = aPartitionFrames;
+        iFirThreads         = aThreads;
+        iFirLoadRate        = 0;
+
+        iFirGeneration++;
+
+        if ((fir != nullptr) && (iFirLoader == nullptr))
+        {
+            iFirLoader = new ThreadFunctor("FirLoader",
+                                           MakeFunctor(*this,
+                                               &Pimpl::FirLoaderThread),
+                                           kPriorityNormal);
+            iFirLoader->Start();
+        }
+    }
+
+    delete old;
+}
+
+// Replace the convolver, continuing the audio it is delaying. The one
+// replaced is deleted by the loader, as that waits for its workers.
+void DriverAlsa::Pimpl::UpdateFir()
+{
+    FirConvolver *old;
+    TBool         retire;
+
+    {
+        AutoMutex am(iFirLock);
+
+        old         = iFir;
+        iFir        = iFirNext;
+        iFirNext    = nullptr;
+        iFirChanged = false;
+    }
+
+    if ((iFir != nullptr) && (old != nullptr))
+    {
+        iFir->Continue(*old);
+    }
+
+    iFirRequestRate     = 0;
+    iFirRequestChannels = 0;
+
+    {
+        AutoMutex am(iFirLock);
+
+        retire = (old != nullptr) && (iFirLoader != nullptr) &&
+                 (iFirRetired == nullptr);
+
+        if (retire)
+        {
+            iFirRetired = old;
+            old         = nullptr;
+        }
+    }
+
+    if (retire)
+    {
+        iFirLoad.Signal();
+    }
+
+    // Deleted here only if the loader has yet to delete the last one.
+    delete old;
+}
+
+// Have the loader prepare a convolver for the format, once per format.
+void DriverAlsa::Pimpl::RequestFir(TUint aSampleRate, TUint aChannels)
+{
+    if ((aSampleRate == iFirRequestRate) &&
+        (aChannels == iFirRequestChannels))
+    {
+        return;
+    }
+
+    iFirRequestRate     = aSampleRate;
+    iFirRequestChannels = aChannels;
+
+    {
+        AutoMutex am(iFirLock);
+
+        iFirLoadRate     = aSampleRate;
+        iFirLoadChannels = aChannels;
+    }
+
+    iFirLoad.Signal();
+}
+
+// Design the resampler filters for the common stream rates, so the audio
+// thread finds them designed when configuring the resampler for a stream.
+// Those for other rates are designed as the stream is configured.
+void DriverAlsa::Pimpl::ResamplerFilterThread()
+{
+    static const TUint kRates[] = { 44100, 48000, 88200, 96000, 176400,
+                                    192000, 32000, 22050, 16000 };
+
+    // Without a fixed rate, a pulled stream is resampled at its own rate.
+    if (iFixedRate == 0)
+    {
+        PolyphaseResampler::PrepareFilter(kRates[0], kRates[0], true);
+        return;
+    }
+
+    for (TUint i=0; i<sizeof(kRates)/sizeof(kRates[0]); i++)
+    {
+        PolyphaseResampler::PrepareFilter(kRates[i], iFixedRate, false);
+
+        if (iClockPuller != nullptr)
+        {
+            PolyphaseResampler::PrepareFilter(kRates[i], iFixedRate, true);
+        }
+    }
+}
+
+// Read and transform the impulse responses requested by the audio thread,
+// and delete the convolvers it has replaced.
+void DriverAlsa::Pimpl::FirLoaderThread()
+{
+    for (;;)
+    {
+        std::string   path;
+        TUint         partitionFrames;
+        TUint         threads;
+        TUint         generation;
+        TUint         rate;
+        TUint         channels;
+        FirConvolver *retired;
+
+        iFirLoad.Wait();
+
+        {
+            AutoMutex am(iFirLock);
+
+            if (iFirLoaderQuit)
+            {
+                break;
+            }
+
+            path            = iFirPath;
+            partitionFrames = iFirPartitionFrames;
+            threads         = iFirThreads;
+            generation      = iFirGeneration;
+            rate            = iFirLoadRate;
+            channels        = iFirLoadChannels;
+            retired         = iFirRetired;
+            iFirLoadRate    = 0;
+            iFirRetired     = nullptr;
+        }
+
+        delete retired;
+
+        if ((rate == 0) || path.empty())
+        {
+            continue;
+        }
+
+        FirConvolver *fir = new FirConvolver(path, partitionFrames, threads);
+        FirConvolver *old = nullptr;
+
+        fir->Prepare(rate, channels);
+
+        {
+            AutoMutex am(iFirLock);
+
+            // Discarded if the path has since changed.
+            if (generation == iFirGeneration)
+            {
+                old         = iFirNext;
+                iFirNext    = fir;
+                iFirChanged = true;
+                fir         = nullptr;
+            }
+        }
+
+        delete old;
+        delete fir;
+    }
+}
+
+void DriverAlsa::Pimpl::SetLoudness(LoudnessNormaliser* aLoudness)
+{
+    iLoudness.store(aLoudness, std::memory_order_release);
+}
+
+void DriverAlsa::Pimpl::SetDither(const Brx& aMode)
+{
+    iDither.SetMode(aMode);
+}
+
+void DriverAlsa::Pimpl::ProcessPlayable(MsgPlayable* aMsg)
+{
+    if (iDitch)
+        return;
+
+#ifdef DEBUG
+    if (iTrackPending)
+        ReportTrackStart();
+#endif // DEBUG
+
+    if (iDsd)
+        aMsg->Read(iDsdProcessor);
+    else if (iResampleRate != 0)
+        aMsg->Read(iResampleProcessor);
+    else
+    	aMsg->Read(iProfiles[iProfileIndex].GetPcmProcessor());
+}
+
+// Play a fragment of audio copied from a MsgPlayable, as a block of its
+// own. aSampleBytes is the subsample size of PCM, or the sample block
+// words of DSD.
+void DriverAlsa::Pimpl::ProcessFragment(const Brx& aData, TUint aNumChannels,
+                                        TUint aSampleBytes)
+{
+    if (iDitch)
+        return;
+
+    if (iDsd)
+    {
+        iDsdProcessor.BeginBlock();
+        iDsdProcessor.ProcessFragment(aData, aNumChannels, aSampleBytes);
+        iDsdProcessor.EndBlock();
+
+        return;
+    }
+
+    IPcmProcessor& processor = (iResampleRate != 0)
+                                   ? iResampleProcessor
+                                   : iProfiles[iProfileIndex].GetPcmProcessor();
+
+    processor.BeginBlock();
+    processor.ProcessFragment(aData, aNumChannels, aSampleBytes);
+    processor.EndBlock();
+}
+
+// Identify the track whose loudness the streams that follow apply, or
+// measure.
+void DriverAlsa::Pimpl::ProcessTrack(MsgTrack* aMsg)
+{
+    LoudnessNormaliser *loudness = iLoudness.load(std::memory_order_acquire);
+
+    if (iPrimary && (loudness != nullptr))
+    {
+        loudness->TrackStarted(aMsg->Track().Uri());
+    }
+
+    if (! iPrimary)
+    {
+        return;
+    }
+
+#ifdef DEBUG
+    // Note the audio still queued, so the time to the track's first audio
+    // can be compared with it.
+    snd_pcm_sframes_t delay = 0;
+
+    if ((iProfileIndex == -1) || (iOutputRate == 0) ||
+        (snd_pcm_delay(iHandle, &delay) < 0) || (delay < 0))
+    {
+        delay = 0;
+    }
+
+    iTrackPending  = true;
+    iTrackUs       = MediaClockAlsa::MonotonicUs();
+    iTrackQueuedUs = (delay == 0)
+                         ? 0 : ((TUint64)delay * 1000000) / iOutputRate;
+#endif // DEBUG
+}
+
+#ifdef DEBUG
+// Log the time from a track arriving to its first audio, and the silence
+// heard, if any, once the audio queued before it had played.
+void DriverAlsa::Pimpl::ReportTrackStart()
+{
+    TUint64 waitUs = MediaClockAlsa::MonotonicUs() - iTrackUs;
+    TUint64 gapUs  = (waitUs > iTrackQueuedUs) ? waitUs - iTrackQueuedUs : 0;
+
+    iTrackPending = false;
+
+    Log::Print("DriverAlsa: Track first audio after %lluus, %lluus queued, "
+               "%lluus gap\n", (unsigned long long)waitUs,
+               (unsigned long long)iTrackQueuedUs, (unsigned long long)gapUs);
+}
+#endif // DEBUG
+
+// A halt may end the track being measured, and a track halted before its
+// audio is not timed.
+void DriverAlsa::Pimpl::ProcessHalt()
+{
+    LoudnessNormaliser *loudness = iLoudness.load(std::memory_order_acquire);
+
+    iTrackPending = false;
+
+    if (iPrimary && (loudness != nullptr))
+    {
+        loudness->StreamHalted();
+    }
+}
+
+void DriverAlsa::Pimpl::ProcessDrain()
+{
+    // Wait for the native audio buffers to empty.
+    if (iProfileIndex != -1)
+    {
+        // Drain the PCM buffers.
+        auto err = snd_pcm_drain(iHandle);
+        if (err < 0)
+        {
+            Log::Print("DriverAlsa: snd_pcm_drain() error : %s\n",
+                       snd_strerror(err));
+            ASSERTS();
+        }
+
+        // Prepare the PCM to accept new data.
+        err = snd_pcm_prepare(iHandle);
+
+        if (err < 0)
+        {
+            Log::Print("DriverAlsa: snd_pcm_prepare() error : %s\n",
+                       snd_strerror(err));
+            ASSERTS();
+        }
+    }
+}
+
+void DriverAlsa::Pimpl::Write(const Brx& aData)
+{
+    // Lead the first audio written after configuring the PCM with the
+    // trim.
+    if (iTrimPending)
+    {
+        iTrimPending = false;
+
+        if (! iDsd)
+        {
+            WriteSilence((TUint)(((TUint64)iTrimUs * iOutputRate) / 1000000));
+        }
+    }
+
+    if (iFirChanged)
+    {
+        UpdateFir();
+    }
+
+    // Equalise and convolve the PCM output, skipping a flat equaliser.
+    const TUint channels = (iSubsampleBytes != 0)
+                               ? iSampleBytes / iSubsampleBytes : 0;
+    const TBool eq       = (channels != 0) &&
+                           iEq.Active(iOutputRate, channels);
+    const TBool fir      = (channels != 0) && (iFir != nullptr) &&
+                           iFir->Active(iOutputRate, channels);
+
+    if (fir && ! iFir->Prepared(iOutputRate, channels))
+    {
+        RequestFir(iOutputRate, channels);
+    }
+
+    // Measure the loudness of the default device's PCM, as decoded.
+    LoudnessNormaliser *loudness = iLoudness.load(std::memory_order_acquire);
+
+    if (iPrimary && (channels != 0) && (loudness != nullptr) &&
+        loudness->Analysing())
+    {
+        loudness->Process(aData.Ptr(), aData.Bytes() / iSampleBytes, channels,
+                          iSubsampleBytes, iOutputRate);
+    }
+
+    if (eq || fir)
+    {
+        const TUint  chunkBytes = kSampleBufSize -
+                                  (kSampleBufSize % iSampleBytes);
+        const TByte *ptr        = aData.Ptr();
+        TUint        remaining  = aData.Bytes();
+        TByte       *buffer     = (TByte *)iDspBuffer.Ptr();
+
+        while (remaining >= iSampleBytes)
+        {
+            TUint        bytes = std::min(remaining, chunkBytes);
+            const TByte *input = ptr;
+
+            bytes -= bytes % iSampleBytes;
+
+            if (eq)
+            {
+                iEq.Process(input, buffer, bytes / iSampleBytes,
+                            iSubsampleBytes);
+                input = buffer;
+            }
+
+            if (fir)
+            {
+                iFir->Process(input, buffer, bytes / iSampleBytes,
+                              iSubsampleBytes);
+            }
+
+            WritePcm(buffer, bytes);
+
+            ptr       += bytes;
+            remaining -= bytes;
+        }
+
+        return;
+    }
+
+    WritePcm(aData.Ptr(), aData.Bytes());
+}
+
+void DriverAlsa::Pimpl::WritePcm(const TByte* aData, TUint aBytes)
+{
+    int err;
+
+    err = snd_pcm_writei(iHandle, aData, aBytes / iSampleBytes);
+
+    // Handle underrun errors.
+    if(err == -EPIPE) {
+        err = snd_pcm_prepare(iHandle);
+
+        if (err < 0)
+        {
+            Log::Print("DriverAlsa: failed to snd_pcm_recover with %s\n",
+                       snd_strerror(err));
+            ASSERTS();
+        }
+
+        err = snd_pcm_writei(iHandle,
+                             aData,
+                             aBytes / iSampleBytes);
+    }
+
+
     if (err < 0)
     {
         Log::Print("DriverAlsa: snd_pcm_writei() got error %s\n",
@@ -740,29 +1791,149 @@ void DriverAlsa::Pimpl::Write(const Brx& aData)
     }
     else
     {
-        iBytesSent += aData.Bytes();
+        iBytesSent     += aBytes;
+        iFramesWritten += err;
+
+        ReportStatus();
+
+        // Meter the default device's PCM output, while observed.
+        AudioTap *tap = AudioTap::getInstance();
+
+        if (iPrimary && (iSubsampleBytes != 0) && tap->Observed())
+        {
+            tap->Process(aData, err, iSampleBytes / iSubsampleBytes,
+                         iSubsampleBytes, iOutputRate);
+        }
     }
 }
 
-#ifdef DEBUG
-void DriverAlsa::Pimpl::LogPCMState()
+// Write silence, being zero for the signed PCM formats used.
+void DriverAlsa::Pimpl::WriteSilence(TUint aFrames)
 {
-    switch (snd_pcm_state(iHandle))
+    if ((aFrames == 0) || (iSampleBytes == 0))
     {
-        case SND_PCM_STATE_OPEN:
-            Log::Print("PCM STATE: SND_PCM_STATE_OPEN\n");
-            break;
-        case SND_PCM_STATE_SETUP:
-            Log::Print("PCM STATE: SND_PCM_STATE_SETUP\n");
-            break;
-        case SND_PCM_STATE_PREPARED:
-            Log::Print("PCM STATE: SND_PCM_STATE_PREPARED\n");
-            break;
-        case SND_PCM_STATE_RUNNING:
-            Log::Print("PCM STATE: SND_PCM_STATE_RUNNING\n");
-            break;
-        case SND_PCM_STATE_XRUN:
-            Log::Print("PCM STATE: SND_PCM_STATE_XRUN\n");
+        return;
+    }
+
+    std::vector<TByte> silence(kSampleBufSize, 0);
+    const TUint        chunkFrames = kSampleBufSize / iSampleBytes;
+
+    while (aFrames > 0)
+    {
+        auto err = snd_pcm_writei(iHandle, &silence[0],
+                                  std::min(aFrames, chunkFrames));
+
+        if (err == -EPIPE)
+        {
+            err = snd_pcm_prepare(iHandle);
+
+            if (err == 0)
+            {
+                continue;
+            }
+        }
+
+        if (err < 0)
+        {
+            Log::Print("DriverAlsa: snd_pcm_writei() got error %s\n",
+                       snd_strerror(err));
+            return;
+        }
+
+        aFrames        -= err;
+        iFramesWritten += err;
+    }
+}
+
+// Report the frames played to the Songcast media clock and the device
+// latency to the clock puller, applying its adjustment to the resampler.
+void DriverAlsa::Pimpl::ReportStatus()
+{
+    snd_pcm_status_t  *status;
+    snd_htimestamp_t   tstamp;
+
+    snd_pcm_status_alloca(&status);
+
+    if (snd_pcm_status(iHandle, status) < 0)
+    {
+        return;
+    }
+
+    snd_pcm_sframes_t delay = snd_pcm_status_get_delay(status);
+
+    if (delay < 0)
+    {
+        delay = 0;
+    }
+
+    snd_pcm_status_get_htstamp(status, &tstamp);
+
+    // Fall back to the system clock should the device not timestamp
+    // against the monotonic clock.
+    TUint64 timestampUs = ((TUint64)tstamp.tv_sec * 1000000) +
+                          (tstamp.tv_nsec / 1000);
+
+    if (! iMonotonicTimestamps || (timestampUs == 0))
+    {
+        timestampUs = MediaClockAlsa::MonotonicUs();
+    }
+
+    TUint64 consumed = (iFramesWritten > (TUint64)delay)
+                           ? iFramesWritten - delay : 0;
+
+    if (iPrimary)
+    {
+        MediaClockAlsa::getInstance()->DeviceStatus(iOutputRate, consumed,
+                                                    timestampUs);
+    }
+
+    if (iPulled)
+    {
+        iClockPuller->DeviceStatus(iOutputRate, (TUint)delay, consumed,
+                                   timestampUs);
+        iResampleProcessor.SetRatioAdjust(iClockPuller->RatioAdjust());
+    }
+}
+
+// Report the device frame at which the audio processed next will play to
+// the Songcast media clock. It follows any trim still to be written and
+// the convolver's latency.
+void DriverAlsa::Pimpl::ReportWritePosition()
+{
+    if (! iPrimary || iDsd || iDitch)
+    {
+        return;
+    }
+
+    TUint64 frame = iFramesWritten + iFirLatency;
+
+    if (iTrimPending)
+    {
+        frame += ((TUint64)iTrimUs * iOutputRate) / 1000000;
+    }
+
+    MediaClockAlsa::getInstance()->WritePosition(frame);
+}
+
+#ifdef DEBUG
+void DriverAlsa::Pimpl::LogPCMState()
+{
+    switch (snd_pcm_state(iHandle))
+    {
+        case SND_PCM_STATE_OPEN:
+            Log::Print("PCM STATE: SND_PCM_STATE_OPEN\n");
+            break;
+        case SND_PCM_STATE_SETUP:
+            Log::Print("PCM STATE: SND_PCM_STATE_SETUP\n");
+            break;
+        case SND_PCM_STATE_PREPARED:
+            Log::Print("PCM STATE: SND_PCM_STATE_PREPARED\n");
+            break;
+        case SND_PCM_STATE_RUNNING:
+            Log::Print("PCM STATE: SND_PCM_STATE_RUNNING\n");
+            break;
+        case SND_PCM_STATE_XRUN:
+            Log::Print("PCM STATE: SND_PCM_STATE_XRUN\n");
             break;
         case SND_PCM_STATE_DRAINING:
             Log::Print("PCM STATE: SND_PCM_STATE_DRAINING\n");
@@ -781,163 +1952,865 @@ void DriverAlsa::Pimpl::LogPCMState()
             break;
     }
 }
-#endif
+#endif
+
+void DriverAlsa::Pimpl::ProcessDecodedStream(MsgDecodedStream* aMsg)
+{
+    auto decodedStreamInfo = aMsg->StreamInfo();
+
+    // Apply the loudness gain of the stream's track, or measure it.
+    LoudnessNormaliser *loudness = iLoudness.load(std::memory_order_acquire);
+
+    if (iPrimary && (loudness != nullptr))
+    {
+        loudness->StreamStarted(decodedStreamInfo.TrackLength(),
+                                decodedStreamInfo.SampleStart(),
+                                decodedStreamInfo.Live());
+    }
+
+    // PCM streams are resampled in fixed rate mode, and when a clock puller
+    // is trimming the rate audio is consumed at. There is no need to drain
+    // the PCM if it is already configured for the output rate.
+    TBool pcm        = (decodedStreamInfo.Format() != AudioFormat::Dsd);
+    TBool fixedRate  = pcm && (iFixedRate != 0);
+    TBool pulled     = pcm && (iClockPuller != nullptr) &&
+                       iClockPuller->Running();
+    TUint outputRate = fixedRate ? iFixedRate : decodedStreamInfo.SampleRate();
+
+    if ((iProfileIndex != -1) &&
+        ! ((fixedRate || pulled) && (iResampleRate == outputRate)))
+    {
+        // Drain and stop the PCM.
+        auto err = snd_pcm_drain(iHandle);
+        if (err < 0)
+        {
+            Log::Print("DriverAlsa: snd_pcm_drain() error : %s\n",
+                       snd_strerror(err));
+            ASSERTS();
+        }
+    }
+
+    Log::Print("DriverAlsa: Bytes Sent since last MsgDecodedStream = %d\n",
+               iBytesSent);
+
+    iBytesSent = 0;
+
+    Log::Print("DriverAlsa: Finding PcmProcessor for stream: BitDepth = %d, "
+               "SampleRate = %d, Channels = %d\n",
+               decodedStreamInfo.BitDepth(), decodedStreamInfo.SampleRate(),
+               decodedStreamInfo.NumChannels());
+
+    if (decodedStreamInfo.Format() == AudioFormat::Dsd)
+    {
+        iDsd          = true;
+        iResampleRate = 0;
+        iPulled       = false;
+
+        if (TryDsd(decodedStreamInfo.NumChannels(),
+                   decodedStreamInfo.SampleRate()))
+        {
+            iDsdProcessor.Reset();
+
+            iProfileIndex   = 0;
+            iSampleBytes    = decodedStreamInfo.NumChannels() * 4;
+            iSubsampleBytes = 0;
+            iDitch          = false;
+
+            return;
+        }
+
+        Log::Print("DriverAlsa: Could not configure DSD output for stream! "
+                   "SampleRate = %d, Channels = %d\n",
+                   decodedStreamInfo.SampleRate(),
+                   decodedStreamInfo.NumChannels());
+
+        iDitch = true;
+        iProfileIndex = -1;
+
+        return;
+    }
+
+    iDsd    = false;
+    iPulled = pulled;
+
+    if (fixedRate || pulled)
+    {
+        if (iResampleRate != outputRate)
+        {
+            iResampleRate = TryResampleRate(outputRate) ? outputRate : 0;
+        }
+
+        if ((iResampleRate != 0) &&
+            iResampleProcessor.Configure(decodedStreamInfo.SampleRate(),
+                                         outputRate, iFixedBytes, pulled))
+        {
+            iProfileIndex   = 0;
+            iSampleBytes    = PcmProcessorResample::kOutputChannels *
+                              iFixedBytes;
+            iSubsampleBytes = iFixedBytes;
+            iDitch          = false;
+
+            return;
+        }
+
+        Log::Print("DriverAlsa: Cannot resample stream to %d! "
+                   "SampleRate = %d\n", outputRate,
+                   decodedStreamInfo.SampleRate());
+
+        iDitch = true;
+        iPulled = false;
+        iProfileIndex = -1;
+
+        return;
+    }
+
+    iResampleRate = 0;
+
+    // Mono plays badly on the Raspberry Pi and causes issues when
+    // switching to a stereo track.
+    //
+    // So we configure the playback for stereo and duplicate the
+    // channel data.
+    if (decodedStreamInfo.NumChannels() == 1)
+    {
+        iDuplicateChannel = true;
+    }
+    else
+    {
+        iDuplicateChannel = false;
+    }
+
+    for (TUint i = 0; i < iProfiles.size(); ++i)
+    {
+        if (TryProfile(iProfiles[i], decodedStreamInfo.BitDepth(),
+                       decodedStreamInfo.NumChannels(),
+                       decodedStreamInfo.SampleRate(), iBufferUs))
+        {
+            iProfileIndex = i;
+
+            PcmProcessorBase& pcmP =
+                (PcmProcessorBase&)iProfiles[i].GetPcmProcessor();
+            pcmP.SetDuplicateChannel(iDuplicateChannel);
+            pcmP.SetBitDepth(decodedStreamInfo.BitDepth());
+
+            iSubsampleBytes =
+                iProfiles[i].GetFormat(decodedStreamInfo.BitDepth()).second;
+            iSampleBytes = decodedStreamInfo.NumChannels() * iSubsampleBytes;
+
+            // If we manually converting mono to stereo the sample size doubles.
+            if (iDuplicateChannel)
+            {
+                iSampleBytes *= 2;
+            }
+
+            iDitch = false;
+
+            Log::Print("Found PcmProcessor %d\n", iProfileIndex);
+
+            return;
+        }
+    }
+
+    Log::Print("DriverAlsa: Could not find a PcmProcessor for stream! "
+               "BitDepth = %d, SampleRate = %d, Channels = %d\n",
+               decodedStreamInfo.BitDepth(), decodedStreamInfo.SampleRate(),
+               decodedStreamInfo.NumChannels());
+
+    iDitch = true;
+    iProfileIndex = -1;
+}
+
+TBool DriverAlsa::Pimpl::TryProfile(Profile& aProfile, TUint aBitDepth,
+                                    TUint aNumChannels, TUint aSampleRate,
+                                    TUint aBufferUs)
+{
+    auto outputFormat = aProfile.GetFormat(aBitDepth);
+
+    if (iDuplicateChannel)
+    {
+        // We are manually converting a mono input to stereo.
+        // Configure the stream for stereo.
+        aNumChannels *= 2;
+    }
+
+    auto err = snd_pcm_set_params(iHandle,
+                                  outputFormat.first,
+                                  SND_PCM_ACCESS_RW_INTERLEAVED,
+                                  aNumChannels,
+                                  aSampleRate,
+                                  0,             // no soft-resample
+                                  aBufferUs);
+    if (err == 0)
+    {
+        PcmOpened(aSampleRate);
+    }
+
+    return err == 0;
+}
+
+// Configure the PCM for a DSD stream.
+TBool DriverAlsa::Pimpl::TryDsd(TUint aNumChannels, TUint aSampleRate)
+{
+    snd_pcm_format_t format = SND_PCM_FORMAT_S32_LE;
+
+    if (! iDsdEnabled)
+    {
+        return false;
+    }
+
+#if SND_LIB_VERSION >= 0x01001d
+    if (iDsdNative)
+    {
+        format = SND_PCM_FORMAT_DSD_U32_BE;
+    }
+#endif // SND_LIB_VERSION
+
+    auto err = snd_pcm_set_params(iHandle,
+                                  format,
+                                  SND_PCM_ACCESS_RW_INTERLEAVED,
+                                  aNumChannels,
+                                  DsdPcmRate(aSampleRate),
+                                  0,             // no soft-resample
+                                  iBufferUs);
+    if (err == 0)
+    {
+        PcmOpened(DsdPcmRate(aSampleRate));
+    }
+
+    return err == 0;
+}
+
+// Configure the PCM for resampled output, at the highest precision the
+// device supports.
+TBool DriverAlsa::Pimpl::TryResampleRate(TUint aOutputRate)
+{
+    static const OutputFormat kFormats[] = {
+        OutputFormat(SND_PCM_FORMAT_S32_LE, 4),
+        OutputFormat(SND_PCM_FORMAT_S16_LE, 2)
+    };
+
+    for (TUint i=0; i<sizeof(kFormats)/sizeof(kFormats[0]); i++)
+    {
+        auto err = snd_pcm_set_params(iHandle,
+                                      kFormats[i].first,
+                                      SND_PCM_ACCESS_RW_INTERLEAVED,
+                                      PcmProcessorResample::kOutputChannels,
+                                      aOutputRate,
+                                      0,             // no soft-resample
+                                      iBufferUs);
+        if (err == 0)
+        {
+            iFixedBytes = kFormats[i].second;
+
+            PcmOpened(aOutputRate);
+
+            Log::Print("DriverAlsa: Resampled output at %d, %d bit\n",
+                       aOutputRate, iFixedBytes * 8);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// The PCM has been configured, restarting its frame count.
+//
+// Have the device timestamp its status against the monotonic clock, for
+// the Songcast media clock and the clock puller.
+void DriverAlsa::Pimpl::PcmOpened(TUint aOutputRate)
+{
+    snd_pcm_sw_params_t *swParams;
+
+    iOutputRate          = aOutputRate;
+    iFramesWritten       = 0;
+    iMonotonicTimestamps = false;
+    iTrimPending         = (iTrimUs != 0);
+
+    // Clear the convolver of the previous stream.
+    if (iFir != nullptr)
+    {
+        iFir->Reset();
+    }
+
+    if (iPrimary)
+    {
+        MediaClockAlsa::getInstance()->Discontinuity();
+    }
+
+    snd_pcm_sw_params_alloca(&swParams);
+
+    if ((snd_pcm_sw_params_current(iHandle, swParams) < 0) ||
+        (snd_pcm_sw_params_set_tstamp_mode(iHandle, swParams,
+                                           SND_PCM_TSTAMP_ENABLE) < 0))
+    {
+        Log::Print("DriverAlsa: Device timestamps unavailable\n");
+        return;
+    }
+
+#if SND_LIB_VERSION >= 0x01001d
+    iMonotonicTimestamps =
+        (snd_pcm_sw_params_set_tstamp_type(iHandle, swParams,
+                                      SND_PCM_TSTAMP_TYPE_MONOTONIC) == 0);
+#endif // SND_LIB_VERSION
+
+    if (snd_pcm_sw_params(iHandle, swParams) < 0)
+    {
+        Log::Print("DriverAlsa: Device timestamps unavailable\n");
+        iMonotonicTimestamps = false;
+    }
+}
+
+// The rate the PCM runs at for a stream of the given rate.
+TUint DriverAlsa::Pimpl::OutputRate(TUint aSampleRate) const
+{
+    return (iFixedRate != 0) ? iFixedRate : aSampleRate;
+}
+
+// Can the device play DSD natively.
+//
+// DSD_U32_BE is available from alsa-lib 1.0.29.
+TBool DriverAlsa::Pimpl::SupportsNativeDsd()
+{
+#if SND_LIB_VERSION >= 0x01001d
+    snd_pcm_hw_params_t *hwParams;
+
+    snd_pcm_hw_params_alloca(&hwParams);
+
+    if (snd_pcm_hw_params_any(iHandle, hwParams) < 0)
+    {
+        return false;
+    }
+
+    return snd_pcm_hw_params_test_format(iHandle, hwParams,
+                                         SND_PCM_FORMAT_DSD_U32_BE) == 0;
+#else // SND_LIB_VERSION
+    return false;
+#endif // SND_LIB_VERSION
+}
+
+// The PCM frame rate carrying a DSD stream. Native output carries 32 bits
+// of each channel per frame, DoP 16 bits.
+TUint DriverAlsa::Pimpl::DsdPcmRate(TUint aDsdSampleRate) const
+{
+    return iDsdNative ? (aDsdSampleRate / 32) : (aDsdSampleRate / 16);
+}
+
+void DriverAlsa::Pimpl::DsdBlockConfiguration(TUint& aSampleBlockWords,
+                                              TUint& aPadBytesPerChunk) const
+{
+    if (iDsdNative)
+    {
+        aSampleBlockWords = DsdProcessor::kNativeBlockWords;
+        aPadBytesPerChunk = DsdProcessor::kNativePadBytes;
+    }
+    else
+    {
+        aSampleBlockWords = DsdProcessor::kDopBlockWords;
+        aPadBytesPerChunk = DsdProcessor::kDopPadBytes;
+    }
+}
+
+TUint DriverAlsa::Pimpl::DriverDelayJiffies(TUint aSampleRate)
+{
+    snd_pcm_sframes_t dp;
+    int ret;
+
+    if (!aSampleRate) {
+        return 0;
+    }
+
+    // Verify the supplied sample rate is supported.
+    snd_pcm_hw_params_t *hwParams;
+    TUint                err;
+
+    snd_pcm_hw_params_alloca(&hwParams);
+    err = snd_pcm_hw_params_any(iHandle, hwParams);
+    if (err < 0)
+    {
+        Log::Print("DriverAlsa: Cannot get hardware parameters: %s\n",
+                   snd_strerror(err));
+
+        THROW(SampleRateUnsupported);
+    }
+
+    if (snd_pcm_hw_params_test_rate(iHandle, hwParams, aSampleRate, 0) < 0)
+    {
+        THROW(SampleRateUnsupported);
+    }
+
+    ret = snd_pcm_delay(iHandle, &dp);
+    if (ret < 0) {
+        Log::Print("DriverAlsa: snd_pcm_delay() error : %s\n",
+                   snd_strerror(ret));
+        return 0;
+    }
+
+    Log::Print("DriverAlsa: snd_pcm_delay() : %u\n", dp);
+    return dp * Jiffies::PerSample(aSampleRate);
+}
+
+// The delay added by the convolver, for PCM.
+TUint DriverAlsa::Pimpl::DspDelayJiffies(TUint aSampleRate) const
+{
+    if (aSampleRate == 0)
+    {
+        return 0;
+    }
+
+    return iFirLatency * Jiffies::PerSample(aSampleRate);
+}
+
+
+/*  Output
+
+    An additional ALSA device playing the audio of the primary device,
+    with its own converters, buffer and writer thread.
+
+    The audio is copied into a ring owned by the output as it is queued,
+    so a device unable to keep up loses audio rather than stalling the
+    others or holding on to the pipeline's audio. Slots are reserved for
+    stream and drain messages.
+
+    The device clock is locked to the primary's, as the primary paces the
+    pipeline. Its PCM is resampled adaptively, a clock puller holding the
+    audio queued for it, plus its ALSA delay, constant.
+*/
+
+class DriverAlsa::Output : public PipelineElement, private IPcmProcessor,
+                           private IDsdProcessor, private INonCopyable
+{
+    static const TUint kQueueSlots   = 256;
+    static const TUint kControlSlots = 16;
+    static const TUint kRingBytes    = 2 * 1024 * 1024;
+public:
+    Output(const TChar* aAlsaDevice, TUint aBufferUs, TUint aFixedRate,
+           TUint aTrimUs, TBool aDsdNative);
+    ~Output();
+    TBool Opened() const;
+    void  SetEq(const Brx& aSpec);
+    void  SetFir(const std::string& aPath, TUint aPartitionFrames,
+                 TUint aThreads);
+    void  SetDither(const Brx& aMode);
+    void  Enqueue(MsgDecodedStream* aMsg);
+    void  Enqueue(MsgDrain* aMsg);
+    void  Enqueue(MsgPlayable* aMsg);
+private:
+    // A queued message, or a fragment of audio in the ring if iMsg is null.
+    struct Entry
+    {
+        Msg*    iMsg;
+        TUint   iOffset;
+        TUint   iBytes;
+        TUint   iRingBytes;     // Including any skipped at the ring's end.
+        TUint   iChannels;
+        TUint   iSampleBytes;
+        TUint64 iJiffies;
+    };
+private:
+    void  EnqueueMsg(Msg* aMsg);
+    TBool Overrun(TBool aOverrun);
+    void  Release(const Entry& aEntry);
+    void  StartDrift();
+    void  WriterThread();
+private: // from IPcmProcessor and IDsdProcessor
+    void BeginBlock() override;
+    void ProcessFragment(const Brx& aData, TUint aNumChannels,
+                         TUint aSampleBytes) override;
+    void ProcessSilence(const Brx& aData, TUint aNumChannels,
+                        TUint aSampleBytes) override;
+    void EndBlock() override;
+    void Flush() override;
+private: // from IMsgProcessor
+    Msg* ProcessMsg(MsgMode* aMsg) override;
+    Msg* ProcessMsg(MsgDrain* aMsg) override;
+    Msg* ProcessMsg(MsgHalt* aMsg) override;
+    Msg* ProcessMsg(MsgDecodedStream* aMsg) override;
+    Msg* ProcessMsg(MsgPlayable* aMsg) override;
+    Msg* ProcessMsg(MsgQuit* aMsg) override;
+private:
+    std::string          iName;
+    ClockPullerAlsa      iDrift;
+    Pimpl               *iPimpl;
+    Fifo<Entry>          iQueue;
+    std::vector<TByte>   iRing;
+    std::atomic<TUint>   iRingUsed;
+    std::atomic<TUint64> iQueuedJiffies;
+    std::atomic<TBool>   iQuit;
+
+    // Owned by the pipeline animator.
+    TUint                iRingWrite;
+    TUint                iQueueRate;
+    TBool                iQueueDsd;
+    TUint                iDropped;
+
+    // Owned by the writer thread.
+    TUint                iStreamRate;    // 0 following a drain, or DSD.
+    TUint64              iDriftQueued;
+    ThreadFunctor       *iThread;
+};
+
+DriverAlsa::Output::Output(const TChar* aAlsaDevice, TUint aBufferUs,
+                           TUint aFixedRate, TUint aTrimUs,
+                           TBool aDsdNative)
+    : PipelineElement(kSupportedMsgTypes)
+    , iName(aAlsaDevice)
+    , iPimpl(new Pimpl(aAlsaDevice, aBufferUs, aFixedRate, &iDrift, false))
+    , iQueue(kQueueSlots)
+    , iRing(kRingBytes)
+    , iRingUsed(0)
+    , iQueuedJiffies(0)
+    , iQuit(false)
+    , iRingWrite(0)
+    , iQueueRate(0)
+    , iQueueDsd(false)
+    , iDropped(0)
+    , iStreamRate(0)
+    , iDriftQueued(0)
+    , iThread(nullptr)
+{
+    if (! iPimpl->Opened())
+    {
+        return;
+    }
+
+    iPimpl->SetTrimUs(aTrimUs);
+
+    // The DSD block configuration follows the primary device.
+    if (iPimpl->DsdNative() != aDsdNative)
+    {
+        iPimpl->DisableDsd();
+    }
+
+    iThread = new ThreadFunctor("AlsaOutput",
+                                MakeFunctor(*this, &Output::WriterThread),
+                                kPrioritySystemHighest);
+    iThread->Start();
+}
+
+// The pipeline animator has stopped, so nothing more is queued. The writer
+// thread is woken by an entry only if one can be queued without blocking,
+// as otherwise it has entries to read, and those it leaves are released.
+DriverAlsa::Output::~Output()
+{
+    if (iThread != nullptr)
+    {
+        iQuit = true;
+
+        if (iQueue.SlotsFree() > 0)
+        {
+            Entry wake = {};
+
+            iQueue.Write(wake);
+        }
+
+        delete iThread;
+    }
+
+    while (iQueue.SlotsUsed() > 0)
+    {
+        Release(iQueue.Read());
+    }
+
+    delete iPimpl;
+}
+
+TBool DriverAlsa::Output::Opened() const
+{
+    return iPimpl->Opened();
+}
+
+void DriverAlsa::Output::SetEq(const Brx& aSpec)
+{
+    iPimpl->SetEq(aSpec);
+}
+
+void DriverAlsa::Output::SetFir(const std::string& aPath,
+                                TUint aPartitionFrames, TUint aThreads)
+{
+    iPimpl->SetFir(aPath, aPartitionFrames, aThreads);
+}
+
+void DriverAlsa::Output::SetDither(const Brx& aMode)
+{
+    iPimpl->SetDither(aMode);
+}
+
+// Called by the pipeline animator.
+void DriverAlsa::Output::Enqueue(MsgDecodedStream* aMsg)
+{
+    const DecodedStreamInfo& info = aMsg->StreamInfo();
+
+    iQueueRate = info.SampleRate();
+    iQueueDsd  = (info.Format() == AudioFormat::Dsd);
+
+    EnqueueMsg(aMsg);
+}
+
+void DriverAlsa::Output::Enqueue(MsgDrain* aMsg)
+{
+    EnqueueMsg(aMsg);
+}
+
+// The audio is copied fragment by fragment, see ProcessFragment().
+void DriverAlsa::Output::Enqueue(MsgPlayable* aMsg)
+{
+    if (iQueueDsd)
+    {
+        aMsg->Read(static_cast<IDsdProcessor&>(*this));
+    }
+    else
+    {
+        aMsg->Read(static_cast<IPcmProcessor&>(*this));
+    }
+}
+
+void DriverAlsa::Output::EnqueueMsg(Msg* aMsg)
+{
+    if (Overrun(iQueue.SlotsFree() == 0))
+    {
+        return;
+    }
+
+    Entry entry = {};
+
+    aMsg->AddRef();
+    entry.iMsg = aMsg;
+
+    iQueue.Write(entry);
+}
+
+// Count the messages or fragments lost while the output cannot keep up,
+// logging the start and end of each overrun.
+TBool DriverAlsa::Output::Overrun(TBool aOverrun)
+{
+    if (aOverrun)
+    {
+        if (iDropped++ == 0)
+        {
+            Log::Print("DriverAlsa: Output '%s' overrun\n", iName.c_str());
+        }
+
+        return true;
+    }
+
+    if (iDropped != 0)
+    {
+        Log::Print("DriverAlsa: Output '%s' dropped %u fragments\n",
+                   iName.c_str(), iDropped);
+
+        iDropped = 0;
+    }
+
+    return false;
+}
 
-void DriverAlsa::Pimpl::ProcessDecodedStream(MsgDecodedStream* aMsg)
+// Called by the writer thread, or once it has stopped.
+void DriverAlsa::Output::Release(const Entry& aEntry)
 {
-    if (iProfileIndex != -1)
+    if (aEntry.iMsg != nullptr)
     {
-        // Drain and stop the PCM.
-        auto err = snd_pcm_drain(iHandle);
-        if (err < 0)
-        {
-            Log::Print("DriverAlsa: snd_pcm_drain() error : %s\n",
-                       snd_strerror(err));
-            ASSERTS();
-        }
+        aEntry.iMsg->RemoveRef();
     }
 
-    auto decodedStreamInfo = aMsg->StreamInfo();
+    iRingUsed      -= aEntry.iRingBytes;
+    iQueuedJiffies -= aEntry.iJiffies;
+}
 
-    Log::Print("DriverAlsa: Bytes Sent since last MsgDecodedStream = %d\n",
-               iBytesSent);
+void DriverAlsa::Output::BeginBlock()
+{
+}
 
-    iBytesSent = 0;
+// Copy a fragment into the ring, skipping the end of the ring should the
+// fragment not fit before it.
+void DriverAlsa::Output::ProcessFragment(const Brx& aData,
+                                         TUint aNumChannels,
+                                         TUint aSampleBytes)
+{
+    const TUint bytes = aData.Bytes();
+    TUint       skip  = 0;
 
-    Log::Print("DriverAlsa: Finding PcmProcessor for stream: BitDepth = %d, "
-               "SampleRate = %d, Channels = %d\n",
-               decodedStreamInfo.BitDepth(), decodedStreamInfo.SampleRate(),
-               decodedStreamInfo.NumChannels());
+    if ((bytes == 0) || (aNumChannels == 0) || (aSampleBytes == 0))
+    {
+        return;
+    }
 
-    // Mono plays badly on the Raspberry Pi and causes issues when
-    // switching to a stereo track.
-    //
-    // So we configure the playback for stereo and duplicate the
-    // channel data.
-    if (decodedStreamInfo.NumChannels() == 1)
+    if (iRingWrite + bytes > kRingBytes)
     {
-        iDuplicateChannel = true;
+        skip = kRingBytes - iRingWrite;
     }
-    else
+
+    if (Overrun((iQueue.SlotsFree() <= kControlSlots) ||
+                (iRingUsed + skip + bytes > kRingBytes)))
     {
-        iDuplicateChannel = false;
+        return;
     }
 
-    for (TUint i = 0; i < iProfiles.size(); ++i)
+    if (skip != 0)
     {
-        if (TryProfile(iProfiles[i], decodedStreamInfo.BitDepth(),
-                       decodedStreamInfo.NumChannels(),
-                       decodedStreamInfo.SampleRate(), iBufferUs))
-        {
-            iProfileIndex = i;
+        iRingWrite = 0;
+    }
 
-            PcmProcessorBase& pcmP =
-                (PcmProcessorBase&)iProfiles[i].GetPcmProcessor();
-            pcmP.SetDuplicateChannel(iDuplicateChannel);
-            pcmP.SetBitDepth(decodedStreamInfo.BitDepth());
+    Entry entry = {};
 
-            iSampleBytes =
-                decodedStreamInfo.NumChannels() *
-                iProfiles[i].GetFormat(decodedStreamInfo.BitDepth()).second;
+    entry.iOffset      = iRingWrite;
+    entry.iBytes       = bytes;
+    entry.iRingBytes   = skip + bytes;
+    entry.iChannels    = aNumChannels;
+    entry.iSampleBytes = aSampleBytes;
 
-            // If we manually converting mono to stereo the sample size doubles.
-            if (iDuplicateChannel)
-            {
-                iSampleBytes *= 2;
-            }
+    // DSD is played as it is, so its latency is not measured.
+    if (! iQueueDsd && (iQueueRate != 0))
+    {
+        entry.iJiffies = (TUint64)(bytes / (aNumChannels * aSampleBytes)) *
+                         Jiffies::PerSample(iQueueRate);
+    }
 
-            iDitch = false;
+    memcpy(&iRing[iRingWrite], aData.Ptr(), bytes);
 
-            Log::Print("Found PcmProcessor %d\n", iProfileIndex);
+    iRingWrite      = (iRingWrite + bytes) % kRingBytes;
+    iRingUsed      += entry.iRingBytes;
+    iQueuedJiffies += entry.iJiffies;
 
-            return;
-        }
-    }
+    iQueue.Write(entry);
+}
 
-    Log::Print("DriverAlsa: Could not find a PcmProcessor for stream! "
-               "BitDepth = %d, SampleRate = %d, Channels = %d\n",
-               decodedStreamInfo.BitDepth(), decodedStreamInfo.SampleRate(),
-               decodedStreamInfo.NumChannels());
+void DriverAlsa::Output::ProcessSilence(const Brx& aData,
+                                        TUint aNumChannels,
+                                        TUint aSampleBytes)
+{
+    ProcessFragment(aData, aNumChannels, aSampleBytes);
+}
 
-    iDitch = true;
-    iProfileIndex = -1;
+void DriverAlsa::Output::EndBlock()
+{
 }
 
-TBool DriverAlsa::Pimpl::TryProfile(Profile& aProfile, TUint aBitDepth,
-                                    TUint aNumChannels, TUint aSampleRate,
-                                    TUint aBufferUs)
+void DriverAlsa::Output::Flush()
 {
-    auto outputFormat = aProfile.GetFormat(aBitDepth);
+}
 
-    if (iDuplicateChannel)
+// Lock the device clock to the primary afresh, as the device has been
+// reconfigured or drained.
+void DriverAlsa::Output::StartDrift()
+{
+    IClockPuller& drift = iDrift;
+
+    drift.Start();
+    iDriftQueued = iQueuedJiffies;
+}
+
+void DriverAlsa::Output::WriterThread()
+{
+    try
     {
-        // We are manually converting a mono input to stereo.
-        // Configure the stream for stereo.
-        aNumChannels *= 2;
+        for (;;)
+        {
+            Entry entry = iQueue.Read();
+
+            if (iQuit)
+            {
+                Release(entry);
+                break;
+            }
+
+            if (entry.iMsg != nullptr)
+            {
+                (void)entry.iMsg->Process(*this);
+            }
+            else
+            {
+                iPimpl->ProcessFragment(Brn(&iRing[entry.iOffset],
+                                            entry.iBytes),
+                                        entry.iChannels,
+                                        entry.iSampleBytes);
+            }
+
+            Release(entry);
+
+            // Report the change in the audio queued for the device.
+            if (iDrift.Running())
+            {
+                IClockPuller& drift  = iDrift;
+                TUint64       queued = iQueuedJiffies;
+
+                drift.Update((TInt)((TInt64)queued - (TInt64)iDriftQueued));
+                iDriftQueued = queued;
+            }
+        }
     }
+    catch (ThreadKill&) {}
+}
 
-    auto err = snd_pcm_set_params(iHandle,
-                                  outputFormat.first,
-                                  SND_PCM_ACCESS_RW_INTERLEAVED,
-                                  aNumChannels,
-                                  aSampleRate,
-                                  0,             // no soft-resample
-                                  aBufferUs);
-    return err == 0;
+Msg* DriverAlsa::Output::ProcessMsg(MsgMode* aMsg)
+{
+    return aMsg;
 }
 
-TUint DriverAlsa::Pimpl::DriverDelayJiffies(TUint aSampleRate)
+// The primary device reports the drain.
+Msg* DriverAlsa::Output::ProcessMsg(MsgDrain* aMsg)
 {
-    snd_pcm_sframes_t dp;
-    int ret;
+    iPimpl->ProcessDrain();
+    iStreamRate = 0;
 
-    if (!aSampleRate) {
-        return 0;
-    }
+    return aMsg;
+}
 
-    // Verify the supplied sample rate is supported.
-    snd_pcm_hw_params_t *hwParams;
-    TUint                err;
+Msg* DriverAlsa::Output::ProcessMsg(MsgHalt* aMsg)
+{
+    return aMsg;
+}
 
-    snd_pcm_hw_params_alloca(&hwParams);
-    err = snd_pcm_hw_params_any(iHandle, hwParams);
-    if (err < 0)
-    {
-        Log::Print("DriverAlsa: Cannot get hardware parameters: %s\n",
-                   snd_strerror(err));
+// The clock is locked afresh when the device is reconfigured.
+Msg* DriverAlsa::Output::ProcessMsg(MsgDecodedStream* aMsg)
+{
+    const DecodedStreamInfo& info = aMsg->StreamInfo();
+    IClockPuller&            drift = iDrift;
 
-        THROW(SampleRateUnsupported);
+    if (info.Format() == AudioFormat::Dsd)
+    {
+        drift.Stop();
+        iStreamRate = 0;
     }
-
-    if (snd_pcm_hw_params_test_rate(iHandle, hwParams, aSampleRate, 0) < 0)
+    else if (info.SampleRate() != iStreamRate)
     {
-        THROW(SampleRateUnsupported);
+        StartDrift();
+        iStreamRate = info.SampleRate();
     }
 
-    ret = snd_pcm_delay(iHandle, &dp);
-    if (ret < 0) {
-        Log::Print("DriverAlsa: snd_pcm_delay() error : %s\n",
-                   snd_strerror(ret));
-        return 0;
-    }
+    iPimpl->ProcessDecodedStream(aMsg);
+    return aMsg;
+}
 
-    Log::Print("DriverAlsa: snd_pcm_delay() : %u\n", dp);
-    return dp * Jiffies::PerSample(aSampleRate);
+Msg* DriverAlsa::Output::ProcessMsg(MsgPlayable* aMsg)
+{
+    return aMsg;
 }
 
+Msg* DriverAlsa::Output::ProcessMsg(MsgQuit* aMsg)
+{
+    return aMsg;
+}
 
 // DriverAlsa
 
 const TUint DriverAlsa::kSupportedMsgTypes = PipelineElement::MsgType::eMode
 | PipelineElement::MsgType::eDrain
 | PipelineElement::MsgType::eHalt
+| PipelineElement::MsgType::eTrack
 | PipelineElement::MsgType::eDecodedStream
 | PipelineElement::MsgType::ePlayable
 | PipelineElement::MsgType::eQuit;
 
-DriverAlsa::DriverAlsa(IPipeline& aPipeline, TUint aBufferUs)
+DriverAlsa::DriverAlsa(IPipeline& aPipeline, TUint aBufferUs,
+                       TUint aFixedRate, ClockPullerAlsa* aClockPuller)
     : PipelineElement(kSupportedMsgTypes)
-    , iPimpl(new Pimpl("default", aBufferUs))
+    , iPimpl(new Pimpl("default", aBufferUs, aFixedRate, aClockPuller, true))
+    , iBufferUs(aBufferUs)
+    , iFixedRate(aFixedRate)
+    , iSender(NULL)
+    , iFirPartitionFrames(0)
+    , iFirThreads(0)
     , iPipeline(aPipeline)
     , iMutex("alsa")
     , iQuit(false)
@@ -953,9 +2826,148 @@ DriverAlsa::DriverAlsa(IPipeline& aPipeline, TUint aBufferUs)
 DriverAlsa::~DriverAlsa()
 {
     delete iThread;
+
+    for (auto* output : iOutputs)
+    {
+        delete output;
+    }
+
     delete iPimpl;
 }
 
+// Delay the primary device by aTrimUs, aligning it with the outputs.
+void DriverAlsa::SetTrimUs(TUint aTrimUs)
+{
+    iPimpl->SetTrimUs(aTrimUs);
+}
+
+// Send DSD as DoP where the default device has no native DSD support.
+void DriverAlsa::SetDsdDop(TBool aDop)
+{
+    iPimpl->SetDsdDop(aDop);
+}
+
+// The block configuration for the DSD codecs, false if DSD is not played.
+TBool DriverAlsa::DsdBlockConfiguration(TUint& aSampleBlockWords,
+                                        TUint& aPadBytesPerChunk) const
+{
+    iPimpl->DsdBlockConfiguration(aSampleBlockWords, aPadBytesPerChunk);
+
+    return iPimpl->DsdEnabled();
+}
+
+// Play the audio on a further device, delayed by aTrimUs.
+//
+// The device is configured by the next stream.
+void DriverAlsa::AddOutput(const TChar* aAlsaDevice, TUint aTrimUs)
+{
+    Output *output = new Output(aAlsaDevice, iBufferUs, iFixedRate, aTrimUs,
+                                iPimpl->DsdNative());
+
+    if (! output->Opened())
+    {
+        delete output;
+        return;
+    }
+
+    Log::Print("DriverAlsa: Added output '%s', trim %uus\n", aAlsaDevice,
+               aTrimUs);
+
+    AutoMutex am(iMutex);
+    output->SetEq(iEqSpec);
+    output->SetFir(iFirPath, iFirPartitionFrames, iFirThreads);
+    output->SetDither(iDitherMode);
+    iOutputs.push_back(output);
+}
+
+// Equalise all outputs. May be called while playing.
+void DriverAlsa::SetEq(const Brx& aSpec)
+{
+    if (aSpec.Bytes() > iEqSpec.MaxBytes())
+    {
+        Log::Print("DriverAlsa: Equaliser specification too long\n");
+        return;
+    }
+
+    iPimpl->SetEq(aSpec);
+
+    AutoMutex am(iMutex);
+    iEqSpec.Replace(aSpec);
+
+    for (auto* output : iOutputs)
+    {
+        output->SetEq(aSpec);
+    }
+}
+
+// Convolve all outputs with the impulse responses at aPath, see
+// FirConvolver.
+void DriverAlsa::SetFir(const TChar* aPath, TUint aPartitionFrames,
+                        TUint aThreads)
+{
+    TUint partitionFrames = FirConvolver::PartitionFrames(aPartitionFrames);
+
+    iPimpl->SetFir(aPath, partitionFrames, aThreads);
+
+    AutoMutex am(iMutex);
+    iFirPath            = aPath;
+    iFirPartitionFrames = partitionFrames;
+    iFirThreads         = aThreads;
+
+    for (auto* output : iOutputs)
+    {
+        output->SetFir(iFirPath, iFirPartitionFrames, iFirThreads);
+    }
+}
+
+// Dither audio reduced to 16 bits on all outputs, see Dither::SetMode().
+void DriverAlsa::SetDither(const Brx& aMode)
+{
+    if (aMode.Bytes() > iDitherMode.MaxBytes())
+    {
+        Log::Print("DriverAlsa: Invalid dither mode\n");
+        return;
+    }
+
+    iPimpl->SetDither(aMode);
+
+    AutoMutex am(iMutex);
+    iDitherMode.Replace(aMode);
+
+    for (auto* output : iOutputs)
+    {
+        output->SetDither(aMode);
+    }
+}
+
+void DriverAlsa::SetLoudness(LoudnessNormaliser* aLoudness)
+{
+    iPimpl->SetLoudness(aLoudness);
+}
+
+// The sender is passed the same messages as the further outputs.
+void DriverAlsa::SetSender(SongcastSenderAlsa* aSender)
+{
+    AutoMutex am(iMutex);
+    iSender = aSender;
+}
+
+template <class T>
+void DriverAlsa::FanOut(T* aMsg)
+{
+    AutoMutex am(iMutex);
+
+    for (auto* output : iOutputs)
+    {
+        output->Enqueue(aMsg);
+    }
+
+    if (iSender != NULL)
+    {
+        iSender->Enqueue(aMsg);
+    }
+}
+
 void DriverAlsa::AudioThread()
 {
     try
@@ -987,10 +2999,14 @@ TUint DriverAlsa::PipelineAnimatorDelayJiffies(AudioFormat aFormat,
                                                TUint /*aBitDepth*/,
                                                TUint /*aNumChannels*/) const
 {
-	if (aFormat == AudioFormat::Dsd) {
-		THROW(FormatUnsupported);
-	}
-    return iPimpl->DriverDelayJiffies(aSampleRate);
+    if (aFormat == AudioFormat::Dsd)
+    {
+        return iPimpl->DriverDelayJiffies(iPimpl->DsdPcmRate(aSampleRate));
+    }
+
+    TUint rate = iPimpl->OutputRate(aSampleRate);
+
+    return iPimpl->DriverDelayJiffies(rate) + iPimpl->DspDelayJiffies(rate);
 }
 
 TUint DriverAlsa::PipelineAnimatorMaxBitDepth() const
@@ -1001,39 +3017,49 @@ TUint DriverAlsa::PipelineAnimatorMaxBitDepth() const
 void DriverAlsa::PipelineAnimatorDsdBlockConfiguration(TUint& aSampleBlockWords, 
                                                        TUint& aPadBytesPerChunk) const
 {
-    aSampleBlockWords=0;
-    aPadBytesPerChunk=0;
-}
-
-
-
-void DriverAlsa::PipelineAnimatorGetMaxSampleRates(TUint& aPcm, TUint& aDsd) const
-{
-    aPcm=0;
-    aDsd=0;
+    iPimpl->DsdBlockConfiguration(aSampleBlockWords, aPadBytesPerChunk);
 }
 
 void DriverAlsa::PipelineAnimatorGetMaxSampleRates(TUint& aPcm, TUint& aDsd) const
 {
     aPcm = 192000;
-    aDsd = 5644800;
+    aDsd = iPimpl->DsdEnabled() ? 5644800 : 0;
 }
 
 Msg* DriverAlsa::ProcessMsg(MsgHalt* aMsg)
 {
+    {
+        AutoMutex am(iMutex);
+        if (iSender != NULL)
+        {
+            iSender->Halt();
+        }
+    }
+
+    iPimpl->ProcessHalt();
     aMsg->ReportHalted();
 
     return aMsg;
 }
 
+Msg* DriverAlsa::ProcessMsg(MsgTrack* aMsg)
+{
+    iPimpl->ProcessTrack(aMsg);
+    return aMsg;
+}
+
 Msg* DriverAlsa::ProcessMsg(MsgDecodedStream* aMsg)
 {
+    FanOut(aMsg);
     iPimpl->ProcessDecodedStream(aMsg);
     return aMsg;
 }
 
+// The sender stamps the audio with the time the primary device plays it.
 Msg* DriverAlsa::ProcessMsg(MsgPlayable* aMsg)
 {
+    iPimpl->ReportWritePosition();
+    FanOut(aMsg);
     iPimpl->ProcessPlayable(aMsg);
     return aMsg;
 }
@@ -1041,6 +3067,10 @@ Msg* DriverAlsa::ProcessMsg(MsgPlayable* aMsg)
 Msg* DriverAlsa::ProcessMsg(MsgQuit* aMsg)
 {
     AutoMutex am(iMutex);
+    if (iSender != NULL)
+    {
+        iSender->Halt();
+    }
     iQuit = true;
     return aMsg;
 }
@@ -1054,6 +3084,7 @@ Msg* DriverAlsa::ProcessMsg(MsgMode* aMsg)
 Msg* DriverAlsa::ProcessMsg(MsgDrain* aMsg)
 {
     // Ensure the ALSA audio buffer is emptied.
+    FanOut(aMsg);
     iPimpl->ProcessDrain();
 
     aMsg->ReportDrained();
@@ -6,9 +6,16 @@
 #include <OpenHome/Media/Utils/ProcessorAudioUtils.h>
 #include <OpenHome/Private/Thread.h>
 
+#include <string>
+#include <vector>
+
 namespace OpenHome {
 namespace Media {
 
+class ClockPullerAlsa;
+class LoudnessNormaliser;
+class SongcastSenderAlsa;
+
 class PriorityArbitratorDriver : public IPriorityArbitrator, private INonCopyable
 {
 public:
@@ -27,14 +34,39 @@ class DriverAlsa : public PipelineElement, public IPipelineAnimator, private INo
 {
     static const TUint kSupportedMsgTypes;
 public:
-    DriverAlsa(IPipeline& aPipeline, TUint aBufferUs);
+    // A non zero aFixedRate runs the device continuously at that rate,
+    // resampling all PCM streams. aClockPuller, if given, trims the rate
+    // audio is consumed at while it is running.
+    DriverAlsa(IPipeline& aPipeline, TUint aBufferUs, TUint aFixedRate,
+               ClockPullerAlsa* aClockPuller);
     ~DriverAlsa();
+public:
+    // Additional devices play the same audio, each trimmed by a delay so
+    // the outputs align.
+    void SetTrimUs(TUint aTrimUs);
+    void AddOutput(const TChar* aAlsaDevice, TUint aTrimUs);
+    // DSD is played natively where the default device supports it,
+    // otherwise as DoP only if aDop is set.
+    void SetDsdDop(TBool aDop);
+    TBool DsdBlockConfiguration(TUint& aSampleBlockWords,
+                                TUint& aPadBytesPerChunk) const;
+    // Parametric equaliser bands, see ParametricEq::SetBands().
+    void SetEq(const Brx& aSpec);
+    // FIR room correction, see FirConvolver. An empty aPath disables it.
+    void SetFir(const TChar* aPath, TUint aPartitionFrames, TUint aThreads);
+    // Dither audio reduced to 16 bits, see Dither::SetMode().
+    void SetDither(const Brx& aMode);
+    // Measure the loudness of the default device's tracks. May be null.
+    void SetLoudness(LoudnessNormaliser* aLoudness);
+    // Send the audio played to Songcast receivers. May be null.
+    void SetSender(SongcastSenderAlsa* aSender);
 public:
     void AudioThread();
 private: // from IMsgProcessor
     Msg* ProcessMsg(MsgMode* aMsg) override;
     Msg* ProcessMsg(MsgDrain* aMsg) override;
     Msg* ProcessMsg(MsgHalt* aMsg) override;
+    Msg* ProcessMsg(MsgTrack* aMsg) override;
     Msg* ProcessMsg(MsgDecodedStream* aMsg) override;
     Msg* ProcessMsg(MsgPlayable* aMsg) override;
     Msg* ProcessMsg(MsgQuit* aMsg) override;
@@ -48,9 +80,21 @@ private: // from IPipelineAnimator
                                                TUint& aPadBytesPerChunk) const override;
     void PipelineAnimatorGetMaxSampleRates(TUint& aPcm, TUint& aDsd) const override;
 
+private:
+    template <class T> void FanOut(T* aMsg);
 private:
     class Pimpl;
+    class Output;
     Pimpl* iPimpl;
+    const TUint iBufferUs;
+    const TUint iFixedRate;
+    std::vector<Output*> iOutputs;
+    SongcastSenderAlsa *iSender;
+    Bws<512> iEqSpec;
+    Bws<16> iDitherMode;
+    std::string iFirPath;
+    TUint iFirPartitionFrames;
+    TUint iFirThreads;
     IPipeline& iPipeline;
     Mutex iMutex;
     TBool iQuit;
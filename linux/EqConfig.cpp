@@ -0,0 +1,33 @@
+#include "DriverAlsa.h"
+#include "EqConfig.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Configuration;
+using namespace OpenHome::Media;
+
+// EqConfig
+
+const Brn EqConfig::kKeyEq("Dsp.Eq");
+
+EqConfig::EqConfig(IConfigInitialiser& aConfigInit, DriverAlsa& aDriver)
+    : iDriver(aDriver)
+{
+    iConfigEq     = new ConfigText(aConfigInit, kKeyEq, 0, kMaxSpecBytes,
+                                   Brx::Empty());
+    // Called back at once with the stored value.
+    iSubscriberId = iConfigEq->Subscribe(
+                        MakeFunctorConfigText(*this, &EqConfig::EqChanged));
+}
+
+EqConfig::~EqConfig()
+{
+    iConfigEq->Unsubscribe(iSubscriberId);
+    delete iConfigEq;
+}
+
+// The equaliser hands the bands to the audio thread without locking, as
+// this is called on whichever thread changed the property.
+void EqConfig::EqChanged(KeyValuePair<const Brx&>& aKvp)
+{
+    iDriver.SetEq(aKvp.Value());
+}
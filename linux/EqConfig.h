@@ -0,0 +1,35 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Configuration/ConfigManager.h>
+
+namespace OpenHome {
+namespace Media {
+
+class DriverAlsa;
+
+// Applies the 'Dsp.Eq' property to DriverAlsa, at startup and whenever it
+// is changed through the config manager, eg. by a control point, while
+// playing.
+//
+// Must be created before the config manager is opened, and deleted before
+// the driver.
+class EqConfig : private INonCopyable
+{
+    static const TUint kMaxSpecBytes = 512;
+public:
+    EqConfig(Configuration::IConfigInitialiser& aConfigInit,
+             DriverAlsa& aDriver);
+    ~EqConfig();
+private:
+    void EqChanged(Configuration::KeyValuePair<const Brx&>& aKvp);
+private:
+    static const Brn           kKeyEq;
+    DriverAlsa&                iDriver;
+    Configuration::ConfigText *iConfigEq;
+    TUint                      iSubscriberId;
+};
+
+} // namespace Media
+} // namespace OpenHome
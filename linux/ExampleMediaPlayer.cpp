@@ -20,11 +20,16 @@
 #include <OpenHome/Private/ShellCommandDebug.h>
 #include <OpenHome/OAuth.h>
 
+#include "AudioTapWebApp.h"
+#include "ClockPullerAlsa.h"
+#include "CodecRouting.h"
 #include "ConfigGTKKeyStore.h"
 #include "ControlPointProxy.h"
 #include "CustomMessages.h"
 #include "ExampleMediaPlayer.h"
+#include "FramePoolStats.h"
 #include "IconOpenHome.h"
+#include "Libav.h"
 #include "OpenHomePlayer.h"
 #include "MediaPlayerIF.h"
 #include "OptionalFeatures.h"
@@ -53,16 +58,26 @@ ExampleMediaPlayer::ExampleMediaPlayer(Net::DvStack& aDvStack,
                                        const Brx& aUserAgent)
     : iSemShutdown("TMPS", 0)
     , iDisabled("test", 0)
+    , iClockPuller(NULL)
     , iCpProxy(NULL)
     , iTxTimestamper(NULL)
     , iRxTimestamper(NULL)
     , iTxTsMapper(NULL)
     , iRxTsMapper(NULL)
+    , iDsdEnabled(false)
+    , iDsdSampleBlockWords(0)
+    , iDsdPadBytesPerChunk(0)
     , iUserAgent(aUserAgent)
 {
     iShell = new Shell(aDvStack.Env(), kShellPort);
     iShellDebug = new ShellCommandDebug(*iShell);
     iInfoLogger = new Media::AllocatorInfoLogger();
+    iClockPuller = new Media::ClockPullerAlsa();
+
+#ifdef USE_LIBAVCODEC
+    // Report the libavcodec frame pools with the pipeline allocators.
+    Codec::FramePoolStats::getInstance()->Register(*iInfoLogger);
+#endif // USE_LIBAVCODEC
 
     // Do NOT set UPnP friendly name attributes at this stage.
     // (Wait until MediaPlayer is created so that friendly name can be
@@ -119,6 +134,14 @@ ExampleMediaPlayer::ExampleMediaPlayer(Net::DvStack& aDvStack,
     iInitParams->SetStarvationRamperMinSize(100 * Jiffies::kPerMs);
     iInitParams->SetGorgerDuration(iInitParams->DecodedReservoirJiffies());
 
+    // Allow the codec to run ahead of playback, so the next track is fetched,
+    // probed and its first audio decoded while the current track plays out
+    // of the decoded reservoir. The gorger keeps its default duration to
+    // avoid delaying the start of playback.
+    iInitParams->SetEncodedReservoirSize(kEncodedReservoirBytes);
+    iInitParams->SetDecodedReservoirSize(kDecodeAheadMs * Jiffies::kPerMs);
+    iInitParams->SetMaxStreamsPerReservoir(kMaxStreamsPerReservoir);
+
     // create MediaPlayer
     iAudioTime = new AudioTimeCpu(aDvStack.Env());
 	auto mpInit = MediaPlayerInitParams::New(Brn(aRoom), Brn(aProductName), kPrefix);
@@ -168,6 +191,7 @@ ExampleMediaPlayer::~ExampleMediaPlayer()
 #endif // DEBUG
     delete iMediaPlayer;
     delete iInfoLogger;
+    delete iClockPuller;
     delete iShellDebug;
     delete iShell;
     delete iDevice;
@@ -196,6 +220,16 @@ void ExampleMediaPlayer::SetSongcastTimestampMappers(
     iRxTsMapper = &aRxTsMapper;
 }
 
+// The DSD codecs are registered with the block configuration of the
+// driver, where it plays DSD.
+void ExampleMediaPlayer::SetDsdBlockConfiguration(TUint aSampleBlockWords,
+                                                  TUint aPadBytesPerChunk)
+{
+    iDsdEnabled          = true;
+    iDsdSampleBlockWords = aSampleBlockWords;
+    iDsdPadBytesPerChunk = aPadBytesPerChunk;
+}
+
 void ExampleMediaPlayer::StopPipeline()
 {
     TUint waitCount = 0;
@@ -244,6 +278,7 @@ void ExampleMediaPlayer::RunWithSemaphore(Net::CpStack& aCpStack)
 {
     RegisterPlugins(iMediaPlayer->Env());
     AddConfigApp();
+    AddLevelsApp();
     iMediaPlayer->Start(iRebootHandler);
     iAppFramework->Start();
     iDevice->SetEnabled();
@@ -262,6 +297,25 @@ PipelineManager& ExampleMediaPlayer::Pipeline()
     return iMediaPlayer->Pipeline();
 }
 
+// Trims the rate DriverAlsa consumes Songcast audio at.
+ClockPullerAlsa& ExampleMediaPlayer::ClockPuller()
+{
+    return *iClockPuller;
+}
+
+// Applies loudness normalisation, in addition to the user's volume.
+VolumeControl& ExampleMediaPlayer::Volume()
+{
+    return iVolume;
+}
+
+// Properties are added before RunWithSemaphore() starts the media player,
+// which opens the config manager.
+IConfigInitialiser& ExampleMediaPlayer::ConfigInitialiser()
+{
+    return iMediaPlayer->ConfigInitialiser();
+}
+
 DvDeviceStandard* ExampleMediaPlayer::Device()
 {
     return iDevice;
@@ -272,41 +326,110 @@ DvDevice* ExampleMediaPlayer::UpnpAvDevice()
     return iDeviceUpnpAv;
 }
 
+// Should the native codec be used for a format.
+//
+// Where libavcodec is available this is selected by the codec routing
+// table, otherwise the native codecs are always used.
+static TBool UseNativeCodec(Codec::CodecRouting::Format aFormat)
+{
+#if defined (USE_LIBAVCODEC) && (defined (ENABLE_AAC) || defined (ENABLE_MP3))
+    return (Codec::CodecRouting::getInstance()->Route(aFormat) ==
+            Codec::CodecRouting::kDecoderNative);
+#else
+    return true;
+#endif
+}
+
 void ExampleMediaPlayer::RegisterPlugins(Environment& aEnv)
 {
+#if defined (USE_LIBAVCODEC) && (defined (ENABLE_AAC) || defined (ENABLE_MP3))
+    // Route the formats set to 'auto' before the routes are used below,
+    // measuring them on first run.
+    Codec::CodecRouting::getInstance()->MeasureAuto();
+#endif
+
     // Register containers.
-#ifndef USE_LIBAVCODEC
-    iMediaPlayer->Add(Codec::ContainerFactory::NewId3v2());
-    // Registering this container breaks the Libavcodec AAC ptobe.
-    iMediaPlayer->Add(Codec::ContainerFactory::NewMpeg4(iMediaPlayer->MimeTypes()));
-#endif // USE_LIBAVCODEC
+    //
+    // Where libavcodec decodes MP3 and AAC it parses their tags and MPEG4
+    // container itself. Registering the MPEG4 container breaks the
+    // libavcodec AAC probe.
+    if (UseNativeCodec(Codec::CodecRouting::kFormatMp3))
+    {
+        iMediaPlayer->Add(Codec::ContainerFactory::NewId3v2());
+    }
+
+    if (UseNativeCodec(Codec::CodecRouting::kFormatAac))
+    {
+        iMediaPlayer->Add(Codec::ContainerFactory::NewMpeg4(iMediaPlayer->MimeTypes()));
+    }
+
     iMediaPlayer->Add(Codec::ContainerFactory::NewMpegTs(iMediaPlayer->MimeTypes()));
 
     // Add codecs
-    iMediaPlayer->Add(Codec::CodecFactory::NewFlac(iMediaPlayer->MimeTypes()));
-    iMediaPlayer->Add(Codec::CodecFactory::NewWav(iMediaPlayer->MimeTypes()));
-    iMediaPlayer->Add(Codec::CodecFactory::NewAiff(iMediaPlayer->MimeTypes()));
-    iMediaPlayer->Add(Codec::CodecFactory::NewAifc(iMediaPlayer->MimeTypes()));
-#ifdef USE_LIBAVCODEC
-#if defined (ENABLE_AAC) || defined (ENABLE_MP3)
-    // Use distributable MP3/AAC Codec, using libavcodec
-    iMediaPlayer->Add(Codec::CodecFactory::NewMp3(iMediaPlayer->MimeTypes()));
-#endif // ENABLE_AAC || ENABLE_MP3
-#else // USE_LIBAVCODEC
+    //
+    // Native codecs are registered ahead of libavcodec, so take precedence
+    // for the formats routed to them.
+    if (UseNativeCodec(Codec::CodecRouting::kFormatFlac))
+    {
+        iMediaPlayer->Add(Codec::CodecFactory::NewFlac(iMediaPlayer->MimeTypes()));
+    }
+
+    if (UseNativeCodec(Codec::CodecRouting::kFormatWav))
+    {
+        iMediaPlayer->Add(Codec::CodecFactory::NewWav(iMediaPlayer->MimeTypes()));
+    }
+
+    if (UseNativeCodec(Codec::CodecRouting::kFormatAiff))
+    {
+        iMediaPlayer->Add(Codec::CodecFactory::NewAiff(iMediaPlayer->MimeTypes()));
+        iMediaPlayer->Add(Codec::CodecFactory::NewAifc(iMediaPlayer->MimeTypes()));
+    }
+
+    // DSD is passed to the driver undecoded, ahead of libavcodec which
+    // would otherwise convert it to PCM.
+    if (iDsdEnabled)
+    {
+        iMediaPlayer->Add(Codec::CodecFactory::NewDsdDsf(
+                                                iMediaPlayer->MimeTypes(),
+                                                iDsdSampleBlockWords,
+                                                iDsdPadBytesPerChunk));
+        iMediaPlayer->Add(Codec::CodecFactory::NewDsdDff(
+                                                iMediaPlayer->MimeTypes(),
+                                                iDsdSampleBlockWords,
+                                                iDsdPadBytesPerChunk));
+    }
+
+#if ! defined (USE_LIBAVCODEC) || defined (ROUTE_RESTRICTED_CODECS)
 #ifdef ENABLE_AAC
     // Disabled by default - requires patent license
-    iMediaPlayer->Add(Codec::CodecFactory::NewAacFdkMp4(iMediaPlayer->MimeTypes()));
-    iMediaPlayer->Add(Codec::CodecFactory::NewAacFdkAdts(iMediaPlayer->MimeTypes()));
+    if (UseNativeCodec(Codec::CodecRouting::kFormatAac))
+    {
+        iMediaPlayer->Add(Codec::CodecFactory::NewAacFdkMp4(iMediaPlayer->MimeTypes()));
+        iMediaPlayer->Add(Codec::CodecFactory::NewAacFdkAdts(iMediaPlayer->MimeTypes()));
+    }
 #endif // ENABLE_AAC
 
 #ifdef ENABLE_MP3
     // Disabled by default - requires patent and copyright licenses
-    iMediaPlayer->Add(Codec::CodecFactory::NewMp3(iMediaPlayer->MimeTypes()));
+    if (UseNativeCodec(Codec::CodecRouting::kFormatMp3))
+    {
+        iMediaPlayer->Add(Codec::CodecFactory::NewMp3(iMediaPlayer->MimeTypes()));
+    }
 #endif // ENABLE_MP3
-#endif // USE_LIBAVCODEC
+#endif // ! USE_LIBAVCODEC || ROUTE_RESTRICTED_CODECS
+
+#if defined (USE_LIBAVCODEC) && (defined (ENABLE_AAC) || defined (ENABLE_MP3))
+    // Use distributable MP3/AAC Codec, using libavcodec, for the formats
+    // routed to it.
+    iMediaPlayer->Add(Codec::NewCodecLibAV(iMediaPlayer->MimeTypes()));
+#endif // USE_LIBAVCODEC && (ENABLE_AAC || ENABLE_MP3)
     iMediaPlayer->Add(Codec::CodecFactory::NewAlacApple(iMediaPlayer->MimeTypes()));
     iMediaPlayer->Add(Codec::CodecFactory::NewPcm());
-    iMediaPlayer->Add(Codec::CodecFactory::NewVorbis(iMediaPlayer->MimeTypes()));
+
+    if (UseNativeCodec(Codec::CodecRouting::kFormatVorbis))
+    {
+        iMediaPlayer->Add(Codec::CodecFactory::NewVorbis(iMediaPlayer->MimeTypes()));
+    }
 
     // Add protocol modules
     SslContext& ssl = iMediaPlayer->Ssl();
@@ -325,7 +448,7 @@ void ExampleMediaPlayer::RegisterPlugins(Environment& aEnv)
 
     iMediaPlayer->Add(SourceFactory::NewReceiver(
                                   *iMediaPlayer,
-                                   Optional<IClockPuller>(nullptr),
+                                   Optional<IClockPuller>(iClockPuller),
                                    Optional<IOhmTimestamper>(iTxTimestamper),
                                    Optional<IOhmTimestamper>(iRxTimestamper),
                                    Optional<IOhmMsgProcessor>(nullptr)));
@@ -411,6 +534,15 @@ void ExampleMediaPlayer::AddConfigApp()
     }
 }
 
+// Serve the output level meter beside the config app.
+void ExampleMediaPlayer::AddLevelsApp()
+{
+    AudioTapWebApp *levelsApp = new AudioTapWebApp();
+
+    iAppFramework->Add(levelsApp,               // iAppFramework takes ownership
+                       MakeFunctorGeneric(*levelsApp, &AudioTapWebApp::PresentationUrlChanged));
+}
+
 void ExampleMediaPlayer::PresentationUrlChanged(const Brx& aUrl)
 {
     iPresentationUrl.Replace(aUrl);
@@ -26,10 +26,12 @@ namespace Media {
     class PipelineManager;
     class DriverSongcastSender;
     class AllocatorInfoLogger;
+    class ClockPullerAlsa;
 }
 namespace Configuration {
     class ConfigGTKKeyStore;
     class ConfigManager;
+    class IConfigInitialiser;
 }
 namespace Web {
     class ConfigAppMediaPlayer;
@@ -48,6 +50,16 @@ class ExampleMediaPlayer : private Net::IResourceManager
     static const TUint kUiMsgBufBytes   = 16;
     static const TUint kMaxPinsDevice   = 6;
     static const TUint kShellPort       = 2323;
+    // Decoding runs up to kDecodeAheadMs ahead of playback. The pipeline
+    // sizes its audio message allocators from the reservoirs, but holds at
+    // most kMaxStreamsPerReservoir streams in each, so decode ahead covers
+    // tracks of kMinDecodeAheadTrackMs or more. Shorter tracks still play,
+    // the codec waiting for them to play out instead.
+    static const TUint kDecodeAheadMs   = 5000;
+    static const TUint kEncodedReservoirBytes = 4 * 1024 * 1024;
+    static const TUint kMinDecodeAheadTrackMs = 250;
+    static const TUint kMaxStreamsPerReservoir =
+                           (kDecodeAheadMs / kMinDecodeAheadTrackMs) + 1;
     static const Brn   kResourceDir;
     static const Brn   kPlayerName;
 
@@ -70,7 +82,11 @@ public:
     virtual void            RunWithSemaphore(Net::CpStack& aCpStack);
     void                    SetSongcastTimestampers(IOhmTimestamper& aTxTimestamper, IOhmTimestamper& aRxTimestamper);
     void                    SetSongcastTimestampMappers(IOhmTimestamper& aTxTsMapper, IOhmTimestamper& aRxTsMapper);
+    void                    SetDsdBlockConfiguration(TUint aSampleBlockWords, TUint aPadBytesPerChunk);
     Media::PipelineManager &Pipeline();
+    Media::ClockPullerAlsa &ClockPuller();
+    Av::VolumeControl      &Volume();
+    Configuration::IConfigInitialiser &ConfigInitialiser();
     Net::DvDeviceStandard  *Device();
     Net::DvDevice          *UpnpAvDevice();
 private: // from Net::IResourceManager
@@ -81,6 +97,7 @@ private: // from Net::IResourceManager
 private:
     void  RegisterPlugins(Environment& aEnv);
     void  AddConfigApp();
+    void  AddLevelsApp();
     void  PresentationUrlChanged(const Brx& aUrl);
     TBool TryDisable(Net::DvDevice& aDevice);
     void  Disabled();
@@ -106,11 +123,15 @@ private:
     Semaphore                  iDisabled;
     Av::VolumeControl          iVolume;
     Media::AudioTimeCpu       *iAudioTime;
+    Media::ClockPullerAlsa    *iClockPuller;
     ControlPointProxy         *iCpProxy;
     IOhmTimestamper           *iTxTimestamper;
     IOhmTimestamper           *iRxTimestamper;
     IOhmTimestamper           *iTxTsMapper;
     IOhmTimestamper           *iRxTsMapper;
+    TBool                      iDsdEnabled;
+    TUint                      iDsdSampleBlockWords;
+    TUint                      iDsdPadBytesPerChunk;
     const Brx                 &iUserAgent;
     Web::FileResourceHandlerFactory iFileResourceHandlerFactory;
     Web::ConfigAppMediaPlayer *iConfigApp;
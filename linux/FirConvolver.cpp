@@ -0,0 +1,686 @@
+#include <OpenHome/Private/Printer.h>
+
+#include <algorithm>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FirConvolver.h"
+#include "RealFft.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+typedef float Vec4 __attribute__((vector_size(16)));
+
+// A thread is only worth its synchronisation with this many partitions.
+static const TUint kMinPartsPerThread = 8;
+
+// Length of the benchmark audio.
+static const TUint kBenchmarkSeconds = 10;
+
+static TUint16 readLe16(const TByte* aPtr)
+{
+    return (TUint16)(aPtr[0] | (aPtr[1] << 8));
+}
+
+static TUint32 readLe32(const TByte* aPtr)
+{
+    return (TUint32)aPtr[0]         | ((TUint32)aPtr[1] << 8) |
+           ((TUint32)aPtr[2] << 16) | ((TUint32)aPtr[3] << 24);
+}
+
+// Read an interleaved impulse response from a PCM or IEEE float WAV file.
+static TBool readWav(const std::string& aPath, TUint& aSampleRate,
+                     TUint& aChannels, std::vector<float>& aSamples)
+{
+    FILE  *file = fopen(aPath.c_str(), "rb");
+    TByte  header[12];
+    TByte  chunk[8];
+    TByte  format[40];
+    TUint  formatTag = 0;
+    TUint  bitDepth  = 0;
+    TBool  haveFormat = false;
+
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    if ((fread(header, 1, sizeof(header), file) != sizeof(header)) ||
+        (memcmp(header, "RIFF", 4) != 0) ||
+        (memcmp(header + 8, "WAVE", 4) != 0))
+    {
+        fclose(file);
+        return false;
+    }
+
+    while (fread(chunk, 1, sizeof(chunk), file) == sizeof(chunk))
+    {
+        TUint32 bytes = readLe32(chunk + 4);
+
+        if (memcmp(chunk, "fmt ", 4) == 0)
+        {
+            if ((bytes < 16) || (bytes > sizeof(format)) ||
+                (fread(format, 1, bytes, file) != bytes))
+            {
+                break;
+            }
+
+            formatTag   = readLe16(format);
+            aChannels   = readLe16(format + 2);
+            aSampleRate = readLe32(format + 4);
+            bitDepth    = readLe16(format + 14);
+
+            // WAVE_FORMAT_EXTENSIBLE carries the format in its sub-format.
+            if ((formatTag == 0xFFFE) && (bytes >= 26))
+            {
+                formatTag = readLe16(format + 24);
+            }
+
+            haveFormat = true;
+        }
+        else if ((memcmp(chunk, "data", 4) == 0) && haveFormat)
+        {
+            TUint subsampleBytes = bitDepth / 8;
+
+            if ((aChannels == 0) ||
+                ! (((formatTag == 1) && (subsampleBytes >= 2) &&
+                    (subsampleBytes <= 4)) ||
+                   ((formatTag == 3) && (subsampleBytes == 4))))
+            {
+                break;
+            }
+
+            TUint frames = bytes / (subsampleBytes * aChannels);
+
+            frames = std::min(frames, FirConvolver::kMaxTaps);
+
+            std::vector<TByte> data(frames * aChannels * subsampleBytes);
+
+            if (fread(&data[0], 1, data.size(), file) != data.size())
+            {
+                break;
+            }
+
+            aSamples.resize(frames * aChannels);
+
+            for (TUint i=0; i<aSamples.size(); i++)
+            {
+                const TByte *ptr = &data[i * subsampleBytes];
+
+                if (formatTag == 3)
+                {
+                    TUint32 bits = readLe32(ptr);
+
+                    memcpy(&aSamples[i], &bits, sizeof(float));
+                }
+                else
+                {
+                    // Left align the sample, to scale every depth alike.
+                    TInt32 sample = 0;
+
+                    for (TUint b=0; b<subsampleBytes; b++)
+                    {
+                        sample |= (TInt32)ptr[b] <<
+                                  (8 * (4 - subsampleBytes + b));
+                    }
+
+                    aSamples[i] = sample / 2147483648.0f;
+                }
+            }
+
+            fclose(file);
+
+            return true;
+        }
+        else
+        {
+            // Chunks are padded to an even length.
+            if (fseek(file, bytes + (bytes & 1), SEEK_CUR) != 0)
+            {
+                break;
+            }
+        }
+    }
+
+    fclose(file);
+
+    return false;
+}
+
+
+/*  Worker
+
+    Sums the filtered spectra of a range of partitions while the audio
+    thread sums the first range.
+*/
+
+class FirConvolver::Worker : private INonCopyable
+{
+public:
+    Worker(FirConvolver& aOwner, TUint aIndex);
+    ~Worker();
+    void Start();
+private:
+    void Run();
+private:
+    FirConvolver&  iOwner;
+    const TUint    iIndex;
+    Semaphore      iStart;
+    ThreadFunctor *iThread;
+};
+
+FirConvolver::Worker::Worker(FirConvolver& aOwner, TUint aIndex)
+    : iOwner(aOwner)
+    , iIndex(aIndex)
+    , iStart("FIRS", 0)
+{
+    iThread = new ThreadFunctor("FirConvolver",
+                                MakeFunctor(*this, &Worker::Run),
+                                kPrioritySystemHighest);
+    iThread->Start();
+}
+
+// The owner sets iQuit first.
+FirConvolver::Worker::~Worker()
+{
+    iStart.Signal();
+    delete iThread;
+}
+
+void FirConvolver::Worker::Start()
+{
+    iStart.Signal();
+}
+
+void FirConvolver::Worker::Run()
+{
+    for (;;)
+    {
+        iStart.Wait();
+
+        if (iOwner.iQuit)
+        {
+            break;
+        }
+
+        iOwner.accumulate(iIndex);
+        iOwner.iDone.Signal();
+    }
+}
+
+
+// FirConvolver
+
+FirConvolver::FirConvolver(const std::string& aPath, TUint aPartitionFrames,
+                           TUint aThreads)
+    : iPath(aPath)
+    , iBlock(aPartitionFrames)
+    , iDone("FIRD", 0)
+    , iQuit(false)
+    , iSampleRate(0)
+    , iChannels(0)
+    , iLoaded(false)
+    , iParts(0)
+    , iThreads(1)
+    , iImpulseChannels(0)
+    , iNewest(0)
+    , iScratch(2 * aPartitionFrames)
+    , iAccumulators(std::min(std::max(aThreads, 1u), kMaxThreads))
+    , iPosition(0)
+{
+    ASSERT((iBlock >= kMinPartitionFrames) &&
+           (iBlock <= kMaxPartitionFrames) &&
+           ((iBlock & (iBlock - 1)) == 0));
+
+    iFft = new RealFft(iBlock);
+
+    for (TUint t=1; t<iAccumulators.size(); t++)
+    {
+        iWorkers.push_back(new Worker(*this, t));
+    }
+
+    iSplit[0] = 0;
+    iSplit[1] = 0;
+}
+
+FirConvolver::~FirConvolver()
+{
+    iQuit = true;
+
+    for (auto* worker : iWorkers)
+    {
+        delete worker;
+    }
+
+    delete iFft;
+}
+
+TUint FirConvolver::LatencyFrames() const
+{
+    return iBlock;
+}
+
+TUint FirConvolver::PartitionFrames(TUint aFrames)
+{
+    TUint frames = kMinPartitionFrames;
+
+    while ((frames < kMaxPartitionFrames) && (frames * 2 <= aFrames))
+    {
+        frames *= 2;
+    }
+
+    return frames;
+}
+
+void FirConvolver::Prepare(TUint aSampleRate, TUint aChannels)
+{
+    if ((aChannels == 0) || (aChannels > kMaxChannels))
+    {
+        return;
+    }
+
+    iSampleRate = aSampleRate;
+    iChannels   = aChannels;
+    iLoaded     = true;
+
+    load();
+}
+
+// Reconfigure for a change of format. Unless prepared for it, the audio is
+// only delayed, keeping the latency constant, as the impulse response for
+// the sample rate is loaded off the audio thread.
+TBool FirConvolver::Active(TUint aSampleRate, TUint aChannels)
+{
+    if ((aChannels == 0) || (aChannels > kMaxChannels))
+    {
+        return false;
+    }
+
+    if ((aSampleRate != iSampleRate) || (aChannels != iChannels))
+    {
+        iSampleRate = aSampleRate;
+        iChannels   = aChannels;
+        iLoaded     = false;
+
+        configure(std::vector<float>(), 0);
+    }
+
+    return true;
+}
+
+TBool FirConvolver::Prepared(TUint aSampleRate, TUint aChannels) const
+{
+    return iLoaded && (aSampleRate == iSampleRate) && (aChannels == iChannels);
+}
+
+// Take over the block of audio being delayed, so replacing a convolver
+// does not drop it. The filter history starts empty, as after Reset().
+void FirConvolver::Continue(const FirConvolver& aPrevious)
+{
+    if ((aPrevious.iBlock != iBlock) ||
+        (aPrevious.iSampleRate != iSampleRate) ||
+        (aPrevious.iChannels != iChannels))
+    {
+        return;
+    }
+
+    Reset();
+
+    // The last block of input, the block being filled and the output of
+    // the last. The sizes match, so nothing is allocated.
+    iInput    = aPrevious.iInput;
+    iOutput   = aPrevious.iOutput;
+    iPosition = aPrevious.iPosition;
+}
+
+void FirConvolver::load()
+{
+    std::string        path(iPath);
+    size_t             rate = path.find("%u");
+    std::vector<float> impulse;
+    TUint              impulseRate     = 0;
+    TUint              impulseChannels = 0;
+
+    if (rate != std::string::npos)
+    {
+        path.replace(rate, 2, std::to_string(iSampleRate));
+    }
+
+    if (! readWav(path, impulseRate, impulseChannels, impulse))
+    {
+        Log::Print("FirConvolver: Cannot read '%s'\n", path.c_str());
+        impulse.clear();
+    }
+    else if (impulseRate != iSampleRate)
+    {
+        Log::Print("FirConvolver: '%s' is %uHz, not %uHz\n", path.c_str(),
+                   impulseRate, iSampleRate);
+        impulse.clear();
+    }
+    else if ((impulseChannels != 1) && (impulseChannels != iChannels))
+    {
+        Log::Print("FirConvolver: '%s' has %u channels, not %u\n",
+                   path.c_str(), impulseChannels, iChannels);
+        impulse.clear();
+    }
+    else
+    {
+        Log::Print("FirConvolver: '%s', %u taps, %u frame partitions\n",
+                   path.c_str(), (TUint)(impulse.size() / impulseChannels),
+                   iBlock);
+    }
+
+    configure(impulse, impulseChannels);
+}
+
+// Transform the impulse response into partition spectra, scaled for the
+// unscaled inverse transform.
+void FirConvolver::configure(const std::vector<float>& aImpulse,
+                             TUint aImpulseChannels)
+{
+    const TUint taps  = aImpulse.empty() ? 0
+                                         : aImpulse.size() / aImpulseChannels;
+    const float scale = 1.0f / iBlock;
+
+    iImpulseChannels = aImpulse.empty() ? 0 : aImpulseChannels;
+    iParts           = (taps + iBlock - 1) / iBlock;
+
+    iFilterRe.assign(iImpulseChannels * iParts * iBlock, 0.0f);
+    iFilterIm.assign(iImpulseChannels * iParts * iBlock, 0.0f);
+
+    for (TUint c=0; c<iImpulseChannels; c++)
+    {
+        for (TUint p=0; p<iParts; p++)
+        {
+            const TUint offset = ((c * iParts) + p) * iBlock;
+
+            std::fill(iScratch.begin(), iScratch.end(), 0.0f);
+
+            for (TUint i=0; (i < iBlock) && ((p * iBlock) + i < taps); i++)
+            {
+                iScratch[i] = aImpulse[(((p * iBlock) + i) *
+                                        iImpulseChannels) + c] * scale;
+            }
+
+            iFft->Forward(&iScratch[0], &iFilterRe[offset],
+                          &iFilterIm[offset]);
+        }
+    }
+
+    iSpectraRe.assign(iChannels * iParts * iBlock, 0.0f);
+    iSpectraIm.assign(iChannels * iParts * iBlock, 0.0f);
+    iInput.assign(iChannels * 2 * iBlock, 0.0f);
+    iOutput.assign(iChannels * iBlock, 0.0f);
+
+    // Share the partitions between as many threads as they keep busy.
+    iThreads = std::max(std::min((TUint)iAccumulators.size(),
+                                 iParts / kMinPartsPerThread), 1u);
+
+    for (TUint t=0; t<=iThreads; t++)
+    {
+        iSplit[t] = (iParts * t) / iThreads;
+    }
+
+    for (auto& accumulator : iAccumulators)
+    {
+        accumulator.iRe.assign(iChannels * iBlock, 0.0f);
+        accumulator.iIm.assign(iChannels * iBlock, 0.0f);
+    }
+
+    iNewest   = 0;
+    iPosition = 0;
+}
+
+// Clear the audio of a previous stream.
+void FirConvolver::Reset()
+{
+    std::fill(iSpectraRe.begin(), iSpectraRe.end(), 0.0f);
+    std::fill(iSpectraIm.begin(), iSpectraIm.end(), 0.0f);
+    std::fill(iInput.begin(), iInput.end(), 0.0f);
+    std::fill(iOutput.begin(), iOutput.end(), 0.0f);
+
+    iNewest   = 0;
+    iPosition = 0;
+}
+
+void FirConvolver::Process(const TByte* aInput, TByte* aOutput,
+                           TUint aFrames, TUint aSubsampleBytes)
+{
+    for (TUint f=0; f<aFrames; f++)
+    {
+        for (TUint c=0; c<iChannels; c++)
+        {
+            float *input  = &iInput[(c * 2 * iBlock) + iBlock + iPosition];
+            float  output = iOutput[(c * iBlock) + iPosition];
+
+            // Read the input before writing, as the buffers may be shared.
+            if (aSubsampleBytes == 2)
+            {
+                const TInt16 *in  = (const TInt16 *)aInput;
+                TInt16       *out = (TInt16 *)aOutput;
+
+                *input = in[(f * iChannels) + c] / 32768.0f;
+
+                output = std::min(std::max(output * 32768.0f, -32768.0f),
+                                  32767.0f);
+                out[(f * iChannels) + c] = (TInt16)lrintf(output);
+            }
+            else
+            {
+                const TInt32 *in  = (const TInt32 *)aInput;
+                TInt32       *out = (TInt32 *)aOutput;
+
+                *input = in[(f * iChannels) + c] / 2147483648.0f;
+
+                // The largest float below 2^31.
+                output = std::min(std::max(output * 2147483648.0f,
+                                           -2147483648.0f),
+                                  2147483520.0f);
+                out[(f * iChannels) + c] = (TInt32)lrintf(output);
+            }
+        }
+
+        if (++iPosition == iBlock)
+        {
+            processBlock();
+
+            iPosition = 0;
+        }
+    }
+}
+
+// Overlap-save: transform the last two blocks of input, sum the products of
+// the partition spectra with those of the delayed input, and keep the
+// second half of the result.
+void FirConvolver::processBlock()
+{
+    if (iParts == 0)
+    {
+        for (TUint c=0; c<iChannels; c++)
+        {
+            float *input = &iInput[c * 2 * iBlock];
+
+            std::copy(input + iBlock, input + (2 * iBlock),
+                      &iOutput[c * iBlock]);
+            std::copy(input + iBlock, input + (2 * iBlock), input);
+        }
+
+        return;
+    }
+
+    iNewest = (iNewest + 1) % iParts;
+
+    for (TUint c=0; c<iChannels; c++)
+    {
+        float       *input  = &iInput[c * 2 * iBlock];
+        const TUint  offset = ((c * iParts) + iNewest) * iBlock;
+
+        iFft->Forward(input, &iSpectraRe[offset], &iSpectraIm[offset]);
+
+        std::copy(input + iBlock, input + (2 * iBlock), input);
+    }
+
+    for (TUint t=1; t<iThreads; t++)
+    {
+        iWorkers[t - 1]->Start();
+    }
+
+    accumulate(0);
+
+    for (TUint t=1; t<iThreads; t++)
+    {
+        iDone.Wait();
+    }
+
+    Accumulator& sum = iAccumulators[0];
+
+    for (TUint t=1; t<iThreads; t++)
+    {
+        const Accumulator& other = iAccumulators[t];
+
+        for (TUint i=0; i<iChannels*iBlock; i++)
+        {
+            sum.iRe[i] += other.iRe[i];
+            sum.iIm[i] += other.iIm[i];
+        }
+
+        for (TUint c=0; c<iChannels; c++)
+        {
+            sum.iDc[c]      += other.iDc[c];
+            sum.iNyquist[c] += other.iNyquist[c];
+        }
+    }
+
+    for (TUint c=0; c<iChannels; c++)
+    {
+        float *re = &sum.iRe[c * iBlock];
+        float *im = &sum.iIm[c * iBlock];
+
+        re[0] = sum.iDc[c];
+        im[0] = sum.iNyquist[c];
+
+        iFft->Inverse(re, im, &iScratch[0]);
+
+        std::copy(&iScratch[iBlock], &iScratch[2 * iBlock],
+                  &iOutput[c * iBlock]);
+    }
+}
+
+// Sum the products for this thread's partitions, four bins at a time. The
+// packed DC and Nyquist bins are real, so are summed apart.
+void FirConvolver::accumulate(TUint aThread)
+{
+    Accumulator& acc = iAccumulators[aThread];
+
+    for (TUint c=0; c<iChannels; c++)
+    {
+        const TUint  filter  = (iImpulseChannels == 1) ? 0 : c;
+        float       *accRe   = &acc.iRe[c * iBlock];
+        float       *accIm   = &acc.iIm[c * iBlock];
+        float        dc      = 0.0f;
+        float        nyquist = 0.0f;
+
+        std::fill(accRe, accRe + iBlock, 0.0f);
+        std::fill(accIm, accIm + iBlock, 0.0f);
+
+        for (TUint p=iSplit[aThread]; p<iSplit[aThread + 1]; p++)
+        {
+            // Partition p applies to the input of p blocks ago.
+            const TUint  slot = (iNewest + iParts - p) % iParts;
+            const float *xRe  = &iSpectraRe[((c * iParts) + slot) * iBlock];
+            const float *xIm  = &iSpectraIm[((c * iParts) + slot) * iBlock];
+            const float *hRe  = &iFilterRe[((filter * iParts) + p) * iBlock];
+            const float *hIm  = &iFilterIm[((filter * iParts) + p) * iBlock];
+
+            dc      += xRe[0] * hRe[0];
+            nyquist += xIm[0] * hIm[0];
+
+            for (TUint k=0; k<iBlock; k+=4)
+            {
+                Vec4 xr, xi, hr, hi, ar, ai;
+
+                // The vectors are not aligned, so load through memcpy.
+                memcpy(&xr, xRe + k, sizeof(xr));
+                memcpy(&xi, xIm + k, sizeof(xi));
+                memcpy(&hr, hRe + k, sizeof(hr));
+                memcpy(&hi, hIm + k, sizeof(hi));
+                memcpy(&ar, accRe + k, sizeof(ar));
+                memcpy(&ai, accIm + k, sizeof(ai));
+
+                ar += (xr * hr) - (xi * hi);
+                ai += (xr * hi) + (xi * hr);
+
+                memcpy(accRe + k, &ar, sizeof(ar));
+                memcpy(accIm + k, &ai, sizeof(ai));
+            }
+        }
+
+        acc.iDc[c]      = dc;
+        acc.iNyquist[c] = nyquist;
+    }
+}
+
+void FirConvolver::Benchmark(TUint aTaps, TUint aPartitionFrames,
+                             TUint aThreads)
+{
+    static const TUint kRates[]     = { 44100, 96000, 192000 };
+    static const TUint kChannels    = 2;
+    static const TUint kChunkFrames = 4096;
+
+    aTaps = std::min(std::max(aTaps, 1u), kMaxTaps);
+    aPartitionFrames = PartitionFrames(aPartitionFrames);
+
+    std::vector<float>  impulse(aTaps);
+    std::vector<TInt32> audio(kChunkFrames * kChannels);
+
+    srand(1);
+
+    for (TUint i=0; i<aTaps; i++)
+    {
+        impulse[i] = ((rand() / (float)RAND_MAX) - 0.5f) / aTaps;
+    }
+
+    for (TUint i=0; i<audio.size(); i++)
+    {
+        audio[i] = (TInt32)(rand() - (RAND_MAX / 2));
+    }
+
+    for (TUint r=0; r<sizeof(kRates)/sizeof(kRates[0]); r++)
+    {
+        FirConvolver    convolver(std::string(), aPartitionFrames, aThreads);
+        struct timespec cpuStart, cpuEnd, wallStart, wallEnd;
+
+        convolver.iSampleRate = kRates[r];
+        convolver.iChannels   = kChannels;
+        convolver.configure(impulse, 1);
+
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuStart);
+        clock_gettime(CLOCK_MONOTONIC, &wallStart);
+
+        for (TUint f=0; f<kRates[r]*kBenchmarkSeconds; f+=kChunkFrames)
+        {
+            convolver.Process((const TByte *)&audio[0], (TByte *)&audio[0],
+                              kChunkFrames, sizeof(TInt32));
+        }
+
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuEnd);
+        clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+
+        double cpu  = (cpuEnd.tv_sec - cpuStart.tv_sec) +
+                      ((cpuEnd.tv_nsec - cpuStart.tv_nsec) / 1e9);
+        double wall = (wallEnd.tv_sec - wallStart.tv_sec) +
+                      ((wallEnd.tv_nsec - wallStart.tv_nsec) / 1e9);
+
+        Log::Print("FirConvolver: %u taps, %u frame partitions, %u threads, "
+                   "%uHz: %.2f%% CPU per channel, %.3f real time%s\n",
+                   aTaps, aPartitionFrames, convolver.iThreads, kRates[r],
+                   (100.0 * cpu) / (kBenchmarkSeconds * kChannels),
+                   wall / kBenchmarkSeconds,
+                   (wall < kBenchmarkSeconds) ? "" : " (too slow)");
+    }
+}
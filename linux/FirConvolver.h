@@ -0,0 +1,105 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Private/Standard.h>
+#include <OpenHome/Private/Thread.h>
+
+#include <string>
+#include <vector>
+
+namespace OpenHome {
+namespace Media {
+
+class RealFft;
+
+// Uniformly partitioned FFT convolution, applying a room correction
+// filter measured as an impulse response to interleaved S16_LE or S32_LE
+// audio.
+//
+// The impulse response is read from a WAV file, with any '%u' in the path
+// replaced by the sample rate. A mono response is applied to all channels,
+// otherwise each channel has its own.
+//
+// The audio is delayed by one partition. Larger partitions cost less CPU
+// for more latency. The partitions of a long filter are shared between
+// worker threads.
+//
+// Reading and transforming the impulse response is too slow for the audio
+// thread, so is done by Prepare() before the convolver is handed over. On
+// a change of format the audio thread only delays the audio, keeping the
+// latency, until a convolver prepared for the format replaces this one.
+class FirConvolver : private INonCopyable
+{
+public:
+    static const TUint kMaxChannels        = 8;
+    static const TUint kMinPartitionFrames = 64;
+    static const TUint kMaxPartitionFrames = 16384;
+    static const TUint kMaxTaps            = 262144;
+    static const TUint kMaxThreads         = 4;
+public:
+    FirConvolver(const std::string& aPath, TUint aPartitionFrames,
+                 TUint aThreads);
+    ~FirConvolver();
+    TUint LatencyFrames() const;
+    // The nearest supported partition size at or below aFrames.
+    static TUint PartitionFrames(TUint aFrames);
+    // Log the CPU used per channel with a random filter of aTaps.
+    static void Benchmark(TUint aTaps, TUint aPartitionFrames,
+                          TUint aThreads);
+    // Load the impulse response for a format. Not for the audio thread.
+    void  Prepare(TUint aSampleRate, TUint aChannels);
+public: // Called by the audio thread
+    TBool Active(TUint aSampleRate, TUint aChannels);
+    // Whether the impulse response for the format is loaded.
+    TBool Prepared(TUint aSampleRate, TUint aChannels) const;
+    // Continue the audio delayed by aPrevious, of the same format.
+    void  Continue(const FirConvolver& aPrevious);
+    void  Reset();
+    void  Process(const TByte* aInput, TByte* aOutput, TUint aFrames,
+                  TUint aSubsampleBytes);
+private:
+    class Worker;
+
+    // Each thread sums the filtered spectra of a range of partitions.
+    struct Accumulator
+    {
+        std::vector<float> iRe;   // iBlock bins per channel.
+        std::vector<float> iIm;
+        float              iDc[kMaxChannels];
+        float              iNyquist[kMaxChannels];
+    };
+private:
+    void  load();
+    void  configure(const std::vector<float>& aImpulse,
+                    TUint aImpulseChannels);
+    void  processBlock();
+    void  accumulate(TUint aThread);
+private:
+    const std::string          iPath;
+    const TUint                iBlock;       // Frames per partition.
+    RealFft                   *iFft;
+    std::vector<Worker*>       iWorkers;
+    Semaphore                  iDone;
+    TBool                      iQuit;
+
+    TUint                      iSampleRate;
+    TUint                      iChannels;
+    TBool                      iLoaded;      // For iSampleRate, iChannels.
+    TUint                      iParts;       // 0 when only delaying.
+    TUint                      iThreads;     // Sharing this filter.
+    TUint                      iSplit[kMaxThreads + 1];
+    TUint                      iImpulseChannels;
+    std::vector<float>         iFilterRe;    // Per impulse channel,
+    std::vector<float>         iFilterIm;    // iParts spectra of iBlock.
+    std::vector<float>         iSpectraRe;   // Per channel, the spectra of
+    std::vector<float>         iSpectraIm;   // the last iParts blocks.
+    TUint                      iNewest;      // Index of the newest spectrum.
+    std::vector<float>         iInput;       // Per channel, 2 blocks.
+    std::vector<float>         iOutput;      // Per channel, 1 block.
+    std::vector<float>         iScratch;
+    std::vector<Accumulator>   iAccumulators;
+    TUint                      iPosition;    // Frames into the block.
+};
+
+} // namespace Media
+} // namespace OpenHome
@@ -0,0 +1,101 @@
+#ifdef USE_LIBAVCODEC
+
+#include <OpenHome/Media/Pipeline/Msg.h>
+#include <OpenHome/Private/Stream.h>
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "FramePoolStats.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+using namespace OpenHome::Media::Codec;
+
+// FramePoolStats
+
+FramePoolStats::FramePoolStats()
+    : iPools(0)
+    , iPoolBufferBytes(0)
+    , iBuffersAllocated(0)
+    , iFramesPooled(0)
+    , iFramesUnpooled(0)
+{
+}
+
+void FramePoolStats::Register(IInfoAggregator& aInfoAggregator)
+{
+    std::vector<Brn> queries;
+
+    queries.push_back(AllocatorBase::kQueryMemory);
+    aInfoAggregator.Register(*this, queries);
+}
+
+void FramePoolStats::PoolCreated(TUint aBufferBytes)
+{
+    iPools++;
+    iPoolBufferBytes += aBufferBytes;
+}
+
+void FramePoolStats::PoolDestroyed(TUint aBufferBytes)
+{
+    iPools--;
+    iPoolBufferBytes -= aBufferBytes;
+}
+
+void FramePoolStats::BufferAllocated()
+{
+    iBuffersAllocated++;
+}
+
+void FramePoolStats::FramePooled()
+{
+    iFramesPooled++;
+}
+
+// A frame too large for its pool, allocated by libavcodec.
+void FramePoolStats::FrameUnpooled()
+{
+    iFramesUnpooled++;
+}
+
+TUint64 FramePoolStats::Allocations() const
+{
+    return iBuffersAllocated + iFramesUnpooled;
+}
+
+void FramePoolStats::QueryInfo(const Brx& aQuery, IWriter& aWriter)
+{
+    if (aQuery != AllocatorBase::kQueryMemory)
+    {
+        return;
+    }
+
+    // The values are read independently so may be slightly inconsistent.
+    TChar info[256];
+    TInt  bytes;
+
+    bytes = snprintf(info, sizeof(info),
+                     "Allocator: LibAV Frame Pool, pools:%u, "
+                     "buffer bytes:%u, buffers allocated:%u, "
+                     "frames pooled:%llu, frames unpooled:%llu\n",
+                     iPools.load(), iPoolBufferBytes.load(),
+                     iBuffersAllocated.load(),
+                     (unsigned long long)iFramesPooled.load(),
+                     (unsigned long long)iFramesUnpooled.load());
+
+    if (bytes <= 0)
+    {
+        return;
+    }
+
+    if (bytes >= (TInt)sizeof(info))
+    {
+        bytes = sizeof(info) - 1;
+    }
+
+    aWriter.Write(Brn((const TByte *)info, bytes));
+}
+
+#endif // USE_LIBAVCODEC
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Media/InfoProvider.h>
+
+#include <atomic>
+
+namespace OpenHome {
+class IWriter;
+namespace Media {
+namespace Codec {
+
+// Usage of the pools backing the libavcodec decoded frame buffers.
+//
+// Reported with the pipeline allocators by AllocatorInfoLogger. The pools
+// are owned by the codec thread, while the statistics may be queried from
+// any thread.
+class FramePoolStats : public IInfoProvider
+{
+private:
+    FramePoolStats();
+
+    // Stop the compiler generating methods of copy and assignment operators.
+    FramePoolStats(FramePoolStats const& copy);
+    FramePoolStats& operator=(FramePoolStats const& copy);
+
+public:
+    static FramePoolStats *getInstance()
+    {
+        static FramePoolStats instance;
+        return &instance;
+    }
+
+public:
+    void Register(IInfoAggregator& aInfoAggregator);
+
+    void PoolCreated(TUint aBufferBytes);
+    void PoolDestroyed(TUint aBufferBytes);
+    void BufferAllocated();
+    void FramePooled();
+    void FrameUnpooled();
+    // Frame buffers allocated rather than reused, by the pools or by
+    // libavcodec for frames the pools cannot hold.
+    TUint64 Allocations() const;
+private: // from IInfoProvider
+    void QueryInfo(const Brx& aQuery, IWriter& aWriter) override;
+private:
+    std::atomic<TUint>   iPools;
+    std::atomic<TUint>   iPoolBufferBytes;
+    std::atomic<TUint>   iBuffersAllocated;
+    std::atomic<TUint64> iFramesPooled;
+    std::atomic<TUint64> iFramesUnpooled;
+};
+
+} // namespace Codec
+} // namespace Media
+} // namespace OpenHome
@@ -12,8 +12,14 @@
 #include <OpenHome/Private/Standard.h>
 #include <OpenHome/Media/MimeTypeList.h>
 
+#include <algorithm>
+#include <exception>
+#include <vector>
+
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 // Uncomment to enable out of bounds checking in OpenHome buffers.
 //#define BUFFER_GUARD_CHECK
@@ -36,8 +42,20 @@
 #define DBUG_F(...) Log::Print(__VA_ARGS__)
 #endif
 
+// Uncomment to log decoder throughput for each stream, or build with
+// DECODE_STATS=1.
+//
+// A JSON record is logged as each stream completes, prefixed with
+// '[CodecLibAV] Stats'.
+//#define DECODE_STATS_LOGGING
+
+#ifdef DECODE_STATS_LOGGING
+#include <sys/resource.h>
+#endif // DECODE_STATS_LOGGING
+
 extern "C"     
 {
+#include "libavutil/buffer.h"
 #include "libavutil/mathematics.h"
 #include "libavutil/opt.h"
 #include "libavutil/samplefmt.h"
@@ -45,25 +63,95 @@ extern "C"
 #include <libswresample/swresample.h>
 }
 
+#include "CodecRouting.h"
+#include "ConfigGTKKeyStore.h"
+#include "DecodedPcmCache.h"
+#include "FramePoolStats.h"
+#include "Libav.h"
 #include "OptionalFeatures.h"
+#include "SeekIndexCache.h"
 
 namespace OpenHome {
 namespace Media {
 namespace Codec {
 
+// Outcome of reading the encoded stream.
+//
+// Once a read has failed the status is latched, and further reads return
+// without calling the controller, until a seek succeeds.
+enum ReadStatus
+{
+    kReadOk,
+    kReadStreamStart,
+    kReadStreamEnded,
+    kReadStreamStopped,
+    kReadOutOfData,      // Recognition data exhausted.
+    kReadFailed          // Unexpected exception, to be rethrown.
+};
+
 // Data passed to the libavcodec callbacks.
 typedef struct
 {
    ICodecController *controller;
+   ReadStatus       *readStatus;
+   std::exception_ptr *readException;
+   TUint64          *boundaryUs;
    TBool            *streamStart;
    TBool            *streamEnded;
+   TBool            *streamStopped;
    TUint             streamId;
    TBool            *seekExpected;
    TBool            *seekExecuted;
    TBool            *seekSuccess;
    TUint64          *byteTotal;
+   const Brx        *prefix;
+   TUint            *prefixOffset;
+   TUint64          *keyHash;
+   TUint            *keyBytes;
+   TBool            *keying;
+   TUint64          *contentHash;
 } OpaqueType;
 
+// Parameters identifying an opened decoder that can be reused for a stream.
+typedef struct
+{
+    AVCodecID        codecId;
+    TInt             sampleRate;
+    TInt             channels;
+    TUint64          channelLayout;
+    TInt             format;
+    TInt             extradataSize;
+    TUint32          extradataHash;
+} DecoderKey;
+
+// An opened decoder, and any sample format converter, retained between
+// streams.
+typedef struct
+{
+    DecoderKey       key;
+    AVCodecContext  *codecContext;
+    SwrContext      *swrContext;
+    TUint            lastUsed;
+} PooledDecoder;
+
+// Buffers backing the decoded frames of a decoder, sized for the frames of
+// the stream it was opened for.
+//
+// Held as the opaque data of the decoder context.
+typedef struct
+{
+    AVBufferPool    *pool;
+    TInt             format;
+    TInt             channels;
+    TInt             bufferBytes;
+} FramePool;
+
+#if LIBAVUTIL_VERSION_MAJOR >= 57
+typedef size_t FramePoolBytes;
+#else // LIBAVUTIL_VERSION_MAJOR
+typedef int    FramePoolBytes;
+#endif // LIBAVUTIL_VERSION_MAJOR
+
 #ifdef BUFFER_GUARD_CHECK
 static TInt kGuardSize = 4;
 
@@ -99,7 +187,7 @@ void CheckGuardBytes(Bwx& buffer)
 class CodecLibAV : public CodecBase
 {
 public:
-    CodecLibAV(IMimeTypeList& aMimeTypeList);
+    CodecLibAV(IMimeTypeList& aMimeTypeList, TBool aCaches);
 private: // from CodecBase
     ~CodecLibAV();
     TBool InitAVIOContext();
@@ -108,19 +196,101 @@ private: // from CodecBase
     void  Process();
     TBool TrySeek(TUint aStreamId, TUint64 aSample);
     void  StreamCompleted();
+private:
+    // Stream classification obtained from the leading bytes of a stream,
+    // used to avoid a full libav probe where the outcome is already known.
+    enum StreamFamily
+    {
+        kFamilyUnknown,
+        kFamilyId3,
+        kFamilyMpegAudio,
+        kFamilyAdts,
+        kFamilyMp4,
+        kFamilyOgg,
+
+        // Formats also decoded by the native ohMediaPlayer codecs.
+        kFamilyFlac,
+        kFamilyWav,
+        kFamilyAiff,
+        kFamilyVorbis
+    };
 private:
     static const TUint   kInBufBytes      = 4096;
+    static const TUint   kSignatureBytes  = 64;
+    static const TUint   kProbeBytesMpeg  = 16 * 1024;
+    static const TUint   kProbeBytesAdts  = 8 * 1024;
+    static const TUint   kProbeBytesMp4   = 4 * 1024;
+    static const TUint   kProbeBytesOgg   = 4 * 1024;
+    static const TUint   kProbeBytesRouted = 4 * 1024;
+    static const TUint   kProbeBytesMax   = 1024 * 1024;
     static const TInt32  kInt24Max        = 8388607L;
     static const TInt32  kInt24Min        = -8388608L;
     static const TInt    kDurationRoundUp = 50000;
-
+    static const TUint   kDecoderPoolSize = 2;
+    static const TUint   kMaxChannels     = 8;
+    static const TUint   kDecodeThreadsDefault = 1;
+    static const TUint   kDecodeThreadsMax     = 4;
+    static const Brn     kConfigDecodeThreads;
+    static const TUint   kSeekIndexIntervalSecs = 1;
+    static const TUint   kSeekDiscardMaxSecs    = 10;
+    static const TUint   kSeekIndexCacheKbDefault = 8192;
+    static const Brn     kConfigSeekIndexCacheKb;
+    static const TUint   kPcmCacheKbDefault       = 0;
+    static const TUint   kPcmCacheSpillKbDefault  = 65536;
+    static const Brn     kConfigPcmCacheKb;
+    static const Brn     kConfigPcmCacheSpillKb;
+    static const TUint   kLiveProbeBytes          = 32 * 1024;
+    static const TUint   kLiveAnalyzeUs           = 500000;
+    static const TInt    kFramePoolSamplesDefault = 4096;
+    static const TInt    kFramePoolAlign          = 32;
+    static const TInt    kFramePoolPadding        = 64;
 
     static int     avCodecRead(void* ptr, TUint8* buf, TInt buf_size);
+    static ReadStatus readStream(OpaqueType* aClassData, Bwx& aBuffer,
+                                 TUint aBytes);
     static TInt64  avCodecSeek(void* ptr, TInt64 offset, TInt whence);
     static TBool   isPlatformBigEndian(void);
     static TBool   isFormatPlanar(AVSampleFormat fmt);
-
-    void processPCM(TUint8 **pcmData, AVSampleFormat fmt, TInt plane_size);
+    static StreamFamily classifyStream(const Brx& aHeader, TUint& aProbeBytes);
+    static TBool   routedNative(StreamFamily aFamily);
+
+    static void    makeDecoderKey(const AVCodecParameters* aPar, DecoderKey& aKey);
+    static TBool   decoderKeysMatch(const DecoderKey& aKey1, const DecoderKey& aKey2);
+    static void    freeDecoder(AVCodecContext*& aCodecContext, SwrContext*& aSwrContext);
+    static void    createFramePool(AVCodecContext* aCodecContext);
+    static AVBufferRef *framePoolAlloc(FramePoolBytes aBytes);
+    static int     framePoolGetBuffer(AVCodecContext* aCodecContext,
+                                      AVFrame* aFrame, int aFlags);
+    static TUint   decodeThreadCount();
+    static TInt64  streamChannelLayout(const AVCodecContext* aCodecContext);
+    static TUint64 monotonicUs();
+    static void    hashContent(TUint64& aHash, const Brx& aData);
+    static bool    seekPointBefore(TUint64 aSample, const SeekPoint& aPoint);
+
+    TBool readSignature();
+    void  rethrowReadException();
+    TBool acquirePooledDecoder(const DecoderKey& aKey);
+    void  releaseDecoder();
+
+    TUint64 streamSample(TInt64 aPts) const;
+    void    updateSeekIndex();
+    TBool   seekByIndex(TUint64 aSample);
+    TBool   seekByTime(TUint64 aSample);
+    TBool   trimSeekFrame(TInt& aStartSample);
+    void    trackSeekTimeline();
+    TBool   cacheKeyValid() const;
+    TBool   loadCachedStream();
+    void    storeSeekIndex();
+    void    evictCachedStream();
+    TBool   loadCachedPcm();
+    void    outputCachedPcm();
+    void    storeCachedPcm();
+    void    outputPcm();
+    void    outputPcm(TInt aChannels, TInt aSampleRate);
+    void    refineLiveStream();
+
+    void processPCM(TUint8 **pcmData, AVSampleFormat fmt, TInt plane_size,
+                    TInt startSample);
 
     TUint64                      iTotalSamples;
     TUint64                      iTrackLengthJiffies;
@@ -139,14 +309,70 @@ private:
     const TChar     *iStreamFormat;
     TUint            iOutputBitDepth;
     AVSampleFormat   iConvertedFormat;
+    TUint8          *iConvertedData[kMaxChannels];
+    TInt             iConvertedSamples;
+    TInt             iConvertedChannels;
     TBool            iStreamStart;
     TBool            iStreamEnded;
+    TBool            iStreamStopped;
+    ReadStatus       iReadStatus;
+    std::exception_ptr iReadException;
+    TUint64          iBoundaryUs;
     TBool            iSeekExpected;
     TBool            iSeekExecuted;
     TBool            iSeekSuccess;
     TUint64          iByteTotal;
     OpaqueType       iClassData;
     SpeakerProfile*  iSpeakerProfile;
+    Bws<kSignatureBytes> iSignature;
+    TUint            iSignatureOffset;
+    DecoderKey       iDecoderKey;
+    TBool            iDecoderPoolable;
+    PooledDecoder    iDecoderPool[kDecoderPoolSize];
+    TUint            iDecoderUseCount;
+    TUint            iDecodeThreads;
+    std::vector<SeekPoint> iSeekIndex;
+    TBool            iSeekIndexable;
+    TBool            iSeekIndexing;
+    TBool            iSeekTrimPending;
+    TBool            iSeekIndexed;
+    TBool            iSeekTimelineLost;
+    TUint64          iSeekTargetSample;
+    TUint64          iSeekFrameSample;
+    TUint64          iSeekStartUs;
+    SeekIndexCache  *iSeekIndexCache;
+    TUint64          iCacheKeyHash;
+    TUint            iCacheKeyBytes;
+    TBool            iCacheKeying;
+    TBool            iCacheChecking;
+    TUint64          iCacheStreamLength;
+    TUint64          iContentHash;
+    size_t           iSeekIndexStored;
+    DecodedPcmCache *iPcmCache;
+    TBool            iPcmCacheHit;
+    PcmCacheFormat   iCachedFormat;
+    Brn              iCachedPcm;
+    TUint            iCachedPcmOffset;
+    std::vector<TByte> iHeldEncoded;
+    Brn              iHeldPrefix;
+    std::vector<TByte> iPcmCapture;
+    TBool            iPcmCapturing;
+    TBool            iPcmCaptureComplete;
+    TBool            iLiveStream;
+    TInt             iLiveSampleRate;
+    TInt             iLiveChannels;
+#ifdef DECODE_STATS_LOGGING
+    static TUint64 threadCpuNs();
+
+    TUint64          iDecodeUs;
+    TUint64          iDecodeCpuNs;
+    TUint64          iDecodedSamples;
+    TUint64          iDecodeAllocs;
+    TUint64          iFrameAllocsStart;
+    TUint64          iStreamStartUs;
+    TUint64          iProbeUs;
+    TUint64          iFirstAudioUs;
+#endif // DECODE_STATS_LOGGING
 };
 
 } // namespace Codec
@@ -157,14 +383,28 @@ using namespace OpenHome;
 using namespace OpenHome::Media;
 using namespace OpenHome::Media::Codec;
 
-CodecBase* CodecFactory::NewMp3(IMimeTypeList& aMimeTypeList)
-{ // static
-    return new CodecLibAV(aMimeTypeList);
+using namespace OpenHome::Configuration;
+
+const Brn CodecLibAV::kConfigDecodeThreads("Codec.LibAV.DecodeThreads");
+const Brn CodecLibAV::kConfigSeekIndexCacheKb("Codec.LibAV.SeekIndexCacheKb");
+const Brn CodecLibAV::kConfigPcmCacheKb("Codec.LibAV.PcmCacheKb");
+const Brn CodecLibAV::kConfigPcmCacheSpillKb("Codec.LibAV.PcmCacheSpillKb");
+
+CodecBase* Codec::NewCodecLibAV(IMimeTypeList& aMimeTypeList,
+                                TBool aCaches)
+{
+    return new CodecLibAV(aMimeTypeList, aCaches);
+}
+
+static TBool routedLibAv(CodecRouting::Format aFormat)
+{
+    return (CodecRouting::getInstance()->Route(aFormat) ==
+            CodecRouting::kDecoderLibAv);
 }
 
 // CodecLibAV
 
-CodecLibAV::CodecLibAV(IMimeTypeList& aMimeTypeList)
+CodecLibAV::CodecLibAV(IMimeTypeList& aMimeTypeList, TBool aCaches)
     : CodecBase("LIBAV")
     , iTotalSamples(0)
     , iTrackLengthJiffies(0)
@@ -182,23 +422,129 @@ CodecLibAV::CodecLibAV(IMimeTypeList& aMimeTypeList)
     , iConvertedFormat(AV_SAMPLE_FMT_NONE)
     , iStreamStart(false)
     , iStreamEnded(false)
+    , iStreamStopped(false)
+    , iReadStatus(kReadOk)
+    , iBoundaryUs(0)
     , iSeekExpected(false)
     , iSeekExecuted(false)
     , iSeekSuccess(false)
     , iByteTotal(0)
+    , iSignatureOffset(0)
+    , iDecoderPoolable(false)
+    , iDecoderUseCount(0)
+    , iSeekIndexable(false)
+    , iSeekIndexing(false)
+    , iSeekTrimPending(false)
+    , iSeekIndexed(false)
+    , iSeekTimelineLost(false)
+    , iSeekTargetSample(0)
+    , iSeekFrameSample(0)
+    , iSeekStartUs(0)
+    , iSeekIndexCache(NULL)
+    , iCacheKeyHash(0)
+    , iCacheKeyBytes(0)
+    , iCacheKeying(false)
+    , iCacheChecking(false)
+    , iCacheStreamLength(0)
+    , iContentHash(0)
+    , iSeekIndexStored(0)
+    , iPcmCache(NULL)
+    , iPcmCacheHit(false)
+    , iCachedPcmOffset(0)
+    , iPcmCapturing(false)
+    , iPcmCaptureComplete(false)
+    , iLiveStream(false)
+    , iLiveSampleRate(0)
+    , iLiveChannels(0)
+    , iConvertedSamples(0)
+    , iConvertedChannels(0)
+#ifdef DECODE_STATS_LOGGING
+    , iDecodeUs(0)
+    , iDecodeCpuNs(0)
+    , iDecodedSamples(0)
+    , iDecodeAllocs(0)
+    , iFrameAllocsStart(0)
+    , iStreamStartUs(0)
+    , iProbeUs(0)
+    , iFirstAudioUs(0)
+#endif // DECODE_STATS_LOGGING
 {
     iSpeakerProfile = new SpeakerProfile();
 
+    memset(&iDecoderKey, 0, sizeof(iDecoderKey));
+    memset(iDecoderPool, 0, sizeof(iDecoderPool));
+    memset(iConvertedData, 0, sizeof(iConvertedData));
+
+    iDecodeThreads = decodeThreadCount();
+
+    // Seek indexes built for previously played streams are retained on
+    // disk, bounded by the configured size. A size of 0 disables the cache.
+    ConfigGTKKeyStore *configStore = ConfigGTKKeyStore::getInstance();
+    TUint cacheKb = configStore->ReadUint(kConfigSeekIndexCacheKb,
+                                          kSeekIndexCacheKbDefault);
+
+    if (aCaches && (cacheKb > 0))
+    {
+        iSeekIndexCache = new SeekIndexCache((TUint64)cacheKb * 1024);
+    }
+
+    // Optionally retain the decoded PCM of recently played streams, so
+    // streams played repeatedly are not decoded again.
+    TUint pcmCacheKb = configStore->ReadUint(kConfigPcmCacheKb,
+                                             kPcmCacheKbDefault);
+    TUint spillKb    = configStore->ReadUint(kConfigPcmCacheSpillKb,
+                                             kPcmCacheSpillKbDefault);
+
+    if (aCaches && (pcmCacheKb > 0))
+    {
+        iPcmCache = new DecodedPcmCache((TUint64)pcmCacheKb * 1024,
+                                        (TUint64)spillKb * 1024);
+    }
+
+    // Advertise the formats routed here, the native codecs advertising
+    // their own.
 #ifdef ENABLE_MP3
-    aMimeTypeList.Add("audio/mpeg");
-    aMimeTypeList.Add("audio/x-mpeg");
-    aMimeTypeList.Add("audio/mp1");
+    if (routedLibAv(CodecRouting::kFormatMp3))
+    {
+        aMimeTypeList.Add("audio/mpeg");
+        aMimeTypeList.Add("audio/x-mpeg");
+        aMimeTypeList.Add("audio/mp1");
+    }
 #endif // ENABLE_MP3
 
 #ifdef ENABLE_AAC
-    aMimeTypeList.Add("audio/aac");
-    aMimeTypeList.Add("audio/aacp");
+    if (routedLibAv(CodecRouting::kFormatAac))
+    {
+        aMimeTypeList.Add("audio/aac");
+        aMimeTypeList.Add("audio/aacp");
+    }
 #endif // ENABLE_AAC
+
+    if (routedLibAv(CodecRouting::kFormatFlac))
+    {
+        aMimeTypeList.Add("audio/flac");
+        aMimeTypeList.Add("audio/x-flac");
+    }
+
+    if (routedLibAv(CodecRouting::kFormatWav))
+    {
+        aMimeTypeList.Add("audio/wav");
+        aMimeTypeList.Add("audio/wave");
+        aMimeTypeList.Add("audio/x-wav");
+    }
+
+    if (routedLibAv(CodecRouting::kFormatAiff))
+    {
+        aMimeTypeList.Add("audio/aiff");
+        aMimeTypeList.Add("audio/x-aiff");
+    }
+
+    if (routedLibAv(CodecRouting::kFormatVorbis))
+    {
+        aMimeTypeList.Add("audio/ogg");
+        aMimeTypeList.Add("audio/x-ogg");
+        aMimeTypeList.Add("application/ogg");
+    }
     
     // av_register_all() got deprecated in lavf 58.9.100
     // It is now useless
@@ -218,9 +564,369 @@ CodecLibAV::CodecLibAV(IMimeTypeList& aMimeTypeList)
 
 CodecLibAV::~CodecLibAV()
 {
+    for (TUint i=0; i<kDecoderPoolSize; i++)
+    {
+        freeDecoder(iDecoderPool[i].codecContext, iDecoderPool[i].swrContext);
+    }
+
+    if (iAvFrame != NULL)
+    {
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(55, 45, 101)
+        av_frame_free(&iAvFrame);
+#else // LIBAVCODEC_VERSION_INT
+        avcodec_free_frame(&iAvFrame);
+#endif // LIBAVCODEC_VERSION_INT
+    }
+
+    av_packet_free(&iAvPacket);
+
+    // The planes of the conversion buffer are a single allocation.
+    av_freep(&iConvertedData[0]);
+
+    delete iPcmCache;
+    delete iSeekIndexCache;
     delete iSpeakerProfile;
 }
 
+// The number of threads to use for decoding.
+//
+// Read from the config store and bounded by the available cores. Decoder
+// worker threads inherit the priority of the codec thread, so one core is
+// left for the higher priority pipeline animator.
+//
+// Of the audio decoders only FLAC, ALAC, TTA and WavPack support frame
+// threading, and DSD slice threading. Threads only help where cores are
+// spare, see 'openhome-codec-benchmark --threads N'.
+TUint CodecLibAV::decodeThreadCount()
+{
+    ConfigGTKKeyStore *configStore = ConfigGTKKeyStore::getInstance();
+
+    TUint threads  = configStore->ReadUint(kConfigDecodeThreads,
+                                           kDecodeThreadsDefault);
+    long  cores    = sysconf(_SC_NPROCESSORS_ONLN);
+    TUint maxThreads = (cores > 1) ? (TUint)(cores - 1) : 1;
+
+    if (maxThreads > kDecodeThreadsMax)
+    {
+        maxThreads = kDecodeThreadsMax;
+    }
+
+    if (threads > maxThreads)
+    {
+        threads = maxThreads;
+    }
+
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+
+    return threads;
+}
+
+TUint64 CodecLibAV::monotonicUs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((TUint64)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+// Extend a hash of the stream content.
+//
+// FNV-1a, 64 bit.
+void CodecLibAV::hashContent(TUint64& aHash, const Brx& aData)
+{
+    for (TUint i=0; i<aData.Bytes(); i++)
+    {
+        aHash ^= aData[i];
+        aHash *= 1099511628211ULL;
+    }
+}
+
+#ifdef DECODE_STATS_LOGGING
+// CPU time consumed by the calling thread.
+TUint64 CodecLibAV::threadCpuNs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return ((TUint64)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+#endif // DECODE_STATS_LOGGING
+
+bool CodecLibAV::seekPointBefore(TUint64 aSample, const SeekPoint& aPoint)
+{
+    return aSample < aPoint.sample;
+}
+
+// The channel layout of the decoded stream.
+//
+// Decoders do not always report a layout, or report one inconsistent with
+// the channel count. In that case the default layout for the channel count
+// is used.
+TInt64 CodecLibAV::streamChannelLayout(const AVCodecContext* aCodecContext)
+{
+    TInt64 layout = aCodecContext->channel_layout;
+
+    if ((layout == 0) ||
+        (av_get_channel_layout_nb_channels(layout) != aCodecContext->channels))
+    {
+        layout = av_get_default_channel_layout(aCodecContext->channels);
+    }
+
+    return layout;
+}
+
+// Build the key identifying the decoder required by a stream.
+void CodecLibAV::makeDecoderKey(const AVCodecParameters* aPar,
+                                DecoderKey& aKey)
+{
+    memset(&aKey, 0, sizeof(aKey));
+
+    aKey.codecId       = aPar->codec_id;
+    aKey.sampleRate    = aPar->sample_rate;
+    aKey.channels      = aPar->channels;
+    aKey.channelLayout = aPar->channel_layout;
+    aKey.format        = aPar->format;
+    aKey.extradataSize = aPar->extradata_size;
+
+    // FNV-1a hash of the codec specific configuration data.
+    TUint32 hash = 2166136261U;
+
+    for (TInt i=0; i<aPar->extradata_size; i++)
+    {
+        hash ^= aPar->extradata[i];
+        hash *= 16777619U;
+    }
+
+    aKey.extradataHash = hash;
+}
+
+TBool CodecLibAV::decoderKeysMatch(const DecoderKey& aKey1,
+                                   const DecoderKey& aKey2)
+{
+    return ((aKey1.codecId       == aKey2.codecId)       &&
+            (aKey1.sampleRate    == aKey2.sampleRate)    &&
+            (aKey1.channels      == aKey2.channels)      &&
+            (aKey1.channelLayout == aKey2.channelLayout) &&
+            (aKey1.format        == aKey2.format)        &&
+            (aKey1.extradataSize == aKey2.extradataSize) &&
+            (aKey1.extradataHash == aKey2.extradataHash));
+}
+
+void CodecLibAV::freeDecoder(AVCodecContext*& aCodecContext,
+                             SwrContext*& aSwrContext)
+{
+    if (aSwrContext != NULL)
+    {
+        swr_free(&aSwrContext);
+        aSwrContext = NULL;
+    }
+
+    if (aCodecContext != NULL)
+    {
+        FramePool *framePool = (FramePool *)aCodecContext->opaque;
+
+        avcodec_free_context(&aCodecContext);
+        aCodecContext = NULL;
+
+        // Buffers held by frames outstanding are freed as they are
+        // released.
+        if (framePool != NULL)
+        {
+            av_buffer_pool_uninit(&framePool->pool);
+
+            FramePoolStats::getInstance()->PoolDestroyed(
+                                               framePool->bufferBytes);
+
+            delete framePool;
+        }
+    }
+}
+
+// Install a pool for the decoded frame buffers of an opened decoder.
+//
+// The pool buffers are sized for the frames of the stream, so steady state
+// decoding reuses them rather than allocating each frame. Frames that do
+// not fit are allocated by libavcodec.
+void CodecLibAV::createFramePool(AVCodecContext* aCodecContext)
+{
+    TInt samples = (aCodecContext->frame_size > 0) ? aCodecContext->frame_size
+                                                   : kFramePoolSamplesDefault;
+    TInt linesize;
+
+    if ((aCodecContext->sample_fmt == AV_SAMPLE_FMT_NONE) ||
+        (av_samples_get_buffer_size(&linesize, aCodecContext->channels,
+                                    samples, aCodecContext->sample_fmt,
+                                    kFramePoolAlign) < 0))
+    {
+        return;
+    }
+
+    FramePool *framePool = new FramePool;
+
+    framePool->format      = aCodecContext->sample_fmt;
+    framePool->channels    = aCodecContext->channels;
+    framePool->bufferBytes = linesize + kFramePoolPadding;
+    framePool->pool        = av_buffer_pool_init(framePool->bufferBytes,
+                                                 framePoolAlloc);
+
+    if (framePool->pool == NULL)
+    {
+        delete framePool;
+        return;
+    }
+
+    FramePoolStats::getInstance()->PoolCreated(framePool->bufferBytes);
+
+    // Frame threads take the callback from the decoder context as each
+    // packet is submitted.
+    aCodecContext->opaque      = framePool;
+    aCodecContext->get_buffer2 = framePoolGetBuffer;
+}
+
+AVBufferRef *CodecLibAV::framePoolAlloc(FramePoolBytes aBytes)
+{
+    FramePoolStats::getInstance()->BufferAllocated();
+
+    return av_buffer_alloc(aBytes);
+}
+
+// AVCodec callback to provide the buffers of a decoded frame.
+//
+// May be called from decoder worker threads.
+int CodecLibAV::framePoolGetBuffer(AVCodecContext* aCodecContext,
+                                   AVFrame* aFrame, int aFlags)
+{
+    FramePool      *framePool = (FramePool *)aCodecContext->opaque;
+    FramePoolStats *stats     = FramePoolStats::getInstance();
+    TInt            linesize;
+    TInt            planes;
+
+    planes = av_sample_fmt_is_planar((AVSampleFormat)aFrame->format)
+                 ? aFrame->channels : 1;
+
+    if ((framePool == NULL) ||
+        (aFrame->format   != framePool->format) ||
+        (aFrame->channels != framePool->channels) ||
+        (planes > AV_NUM_DATA_POINTERS) ||
+        (av_samples_get_buffer_size(&linesize, aFrame->channels,
+                                    aFrame->nb_samples,
+                                    (AVSampleFormat)aFrame->format,
+                                    kFramePoolAlign) < 0) ||
+        (linesize > framePool->bufferBytes))
+    {
+        stats->FrameUnpooled();
+
+        return avcodec_default_get_buffer2(aCodecContext, aFrame, aFlags);
+    }
+
+    for (TInt i=0; i<planes; i++)
+    {
+        aFrame->buf[i] = av_buffer_pool_get(framePool->pool);
+
+        if (aFrame->buf[i] == NULL)
+        {
+            av_frame_unref(aFrame);
+            return AVERROR(ENOMEM);
+        }
+
+        aFrame->data[i] = aFrame->buf[i]->data;
+    }
+
+    aFrame->extended_data = aFrame->data;
+    aFrame->linesize[0]   = linesize;
+
+    stats->FramePooled();
+
+    return 0;
+}
+
+// Take an opened decoder matching the supplied key from the pool.
+//
+// On success iAvCodecContext, and iSwrResampleCtx if the stream required
+// sample format conversion, are populated with flushed contexts.
+TBool CodecLibAV::acquirePooledDecoder(const DecoderKey& aKey)
+{
+    for (TUint i=0; i<kDecoderPoolSize; i++)
+    {
+        PooledDecoder& entry = iDecoderPool[i];
+
+        if ((entry.codecContext == NULL) ||
+            (! decoderKeysMatch(entry.key, aKey)))
+        {
+            continue;
+        }
+
+        iAvCodecContext = entry.codecContext;
+        iSwrResampleCtx = entry.swrContext;
+
+        entry.codecContext = NULL;
+        entry.swrContext   = NULL;
+
+        // Discard any state remaining from the previous stream.
+        avcodec_flush_buffers(iAvCodecContext);
+
+        if ((iSwrResampleCtx != NULL) && (swr_init(iSwrResampleCtx) < 0))
+        {
+            swr_free(&iSwrResampleCtx);
+            iSwrResampleCtx = NULL;
+        }
+
+#ifdef DEBUG
+        DBUG_F("[CodecLibAV] Reusing pooled decoder [%s]\n",
+               iAvCodecContext->codec->name);
+#endif // DEBUG
+
+        return true;
+    }
+
+    return false;
+}
+
+// Return the decoder used by the current stream to the pool, evicting the
+// least recently used entry if required.
+//
+// Decoders that were not fully initialised are freed.
+void CodecLibAV::releaseDecoder()
+{
+    if ((iAvCodecContext == NULL) || (! iDecoderPoolable))
+    {
+        freeDecoder(iAvCodecContext, iSwrResampleCtx);
+        return;
+    }
+
+    PooledDecoder *slot = &iDecoderPool[0];
+
+    for (TUint i=0; i<kDecoderPoolSize; i++)
+    {
+        if (iDecoderPool[i].codecContext == NULL)
+        {
+            slot = &iDecoderPool[i];
+            break;
+        }
+
+        if (iDecoderPool[i].lastUsed < slot->lastUsed)
+        {
+            slot = &iDecoderPool[i];
+        }
+    }
+
+    freeDecoder(slot->codecContext, slot->swrContext);
+
+    slot->key          = iDecoderKey;
+    slot->codecContext = iAvCodecContext;
+    slot->swrContext   = iSwrResampleCtx;
+    slot->lastUsed     = ++iDecoderUseCount;
+
+    iAvCodecContext  = NULL;
+    iSwrResampleCtx  = NULL;
+    iDecoderPoolable = false;
+}
+
 #ifdef DEBUG
 void printBuf(TChar *buf, TInt bufLen)
 {
@@ -273,10 +979,15 @@ TBool CodecLibAV::isFormatPlanar(AVSampleFormat fmt)
 TInt CodecLibAV::avCodecRead(void* ptr, TUint8* buf, TInt buf_size)
 {
     OpaqueType       *classData       = (OpaqueType *)ptr;
-    ICodecController *controller      = classData->controller;;
     TBool            *streamStart     = classData->streamStart;
     TBool            *streamEnded     = classData->streamEnded;
+    TBool            *streamStopped   = classData->streamStopped;
     TUint64          *byteTotal       = classData->byteTotal;
+    const Brx        *prefix          = classData->prefix;
+    TUint            *prefixOffset    = classData->prefixOffset;
+    TUint64          *keyHash         = classData->keyHash;
+    TUint            *keyBytes        = classData->keyBytes;
+    ReadStatus       *readStatus      = classData->readStatus;
 
     TUint             bytesLeft       = (TUint)buf_size;
     const TUint       bufferLimit     = 32 * 1024; // Use 32K chunks
@@ -285,68 +996,153 @@ TInt CodecLibAV::avCodecRead(void* ptr, TUint8* buf, TInt buf_size)
 
     inputBuffer.SetBytes(0);
 
+    // Hand over any bytes consumed by the signature check in Recognise()
+    // before reading further data from the pipeline.
+    if (*prefixOffset < prefix->Bytes())
+    {
+        TUint prefixBytes = prefix->Bytes() - *prefixOffset;
+
+        if (prefixBytes > bytesLeft)
+        {
+            prefixBytes = bytesLeft;
+        }
+
+        inputBuffer.Append(prefix->Ptr() + *prefixOffset, prefixBytes);
+
+        *prefixOffset += prefixBytes;
+        bytesLeft     -= prefixBytes;
+    }
+
     // Read the required amount of data in chunks.
-    while (bytesLeft > 0)
+    //
+    // Stream boundaries are reported as a latched status so that no
+    // exception passes through the libav frames, and the controller is not
+    // called again to rediscover the same boundary.
+    while ((bytesLeft > 0) && (*readStatus == kReadOk))
     {
         TUint leftToRead = (bytesLeft < bufferLimit) ? bytesLeft : bufferLimit;
 
         // Reset the chunk buffer.
         tmpBuffer.SetBytes(0);
 
-        try
-        {
-            // Read a chunk of data.
-            controller->Read(tmpBuffer, leftToRead);
-
-            // Append the chunk to the output buffer.
-            if (! inputBuffer.TryAppend(tmpBuffer))
-            {
-                DBUG_F("Info: [CodecLibAV]: avCodecRead - TryAppend Failed\n ");
-                break;
-            }
+        // Read a chunk of data.
+        *readStatus = readStream(classData, tmpBuffer, leftToRead);
 
-            bytesLeft -= tmpBuffer.Bytes();
-        }
-        catch(CodecStreamStart&)
+        if (*readStatus != kReadOk)
         {
-#ifdef DEBUG
-            DBUG_F("Info: [CodecLibAV]: avCodecRead - CodecStreamStart "
-                   "Exception Caught\n");
-#endif // DEBUG
-            *streamStart = true;
             break;
         }
-        catch(CodecStreamEnded&)
+
+        // Append the chunk to the output buffer.
+        if (! inputBuffer.TryAppend(tmpBuffer))
         {
-#ifdef DEBUG
-            DBUG_F("Info: [CodecLibAV] avCodecRead - CodecStreamEnded "
-                   "Exception Caught\n");
-#endif // DEBUG
-            *streamEnded = true;
+            DBUG_F("Info: [CodecLibAV]: avCodecRead - TryAppend Failed\n ");
             break;
         }
-        catch(CodecStreamStopped&)
-        {
-#ifdef DEBUG
-            DBUG_F("Info: [CodecLibAV] avCodecRead - CodecStreamStopped "
-                   "Exception Caught\n");
-#endif // DEBUG
+
+        // The prefix was hashed as it was read from the controller.
+        hashContent(*classData->contentHash, tmpBuffer);
+
+        bytesLeft -= tmpBuffer.Bytes();
+    }
+
+    switch (*readStatus)
+    {
+        case kReadStreamStart:
+            *streamStart = true;
+            break;
+        case kReadStreamStopped:
+            *streamStopped = true;
+            // Fallthrough
+        case kReadStreamEnded:
             *streamEnded = true;
             break;
-        }
-        catch(CodecRecognitionOutOfData&)
-        {
-#ifdef DEBUG
-            DBUG_F("Info: [CodecLibAV] avCodecRead - CodecRecognitionOutOfData "
-                   "Exception Caught\n");
-#endif // DEBUG
+        default:
             break;
-        }
     }
 
-    *byteTotal += inputBuffer.Bytes();
+    // Hash the data libav reads while opening the stream, identifying the
+    // stream in the seek index cache by all of the headers its parameters
+    // are probed from.
+    if (*classData->keying)
+    {
+        hashContent(*keyHash, inputBuffer);
 
-    return inputBuffer.Bytes();
+        *keyBytes += inputBuffer.Bytes();
+    }
+
+    *byteTotal += inputBuffer.Bytes();
+
+    if ((inputBuffer.Bytes() == 0) && (*readStatus != kReadOk))
+    {
+        return (*readStatus == kReadFailed) ? AVERROR(EIO) : AVERROR_EOF;
+    }
+
+    return inputBuffer.Bytes();
+}
+
+// Read from the controller, converting the exceptions signalling stream
+// boundaries to a status.
+//
+// Any other exception is retained, to be rethrown by rethrowReadException()
+// once control has returned from libav.
+ReadStatus CodecLibAV::readStream(OpaqueType* aClassData, Bwx& aBuffer,
+                                  TUint aBytes)
+{
+    ReadStatus status = kReadOk;
+
+#ifdef DECODE_STATS_LOGGING
+    TUint64 readStart = monotonicUs();
+#endif // DECODE_STATS_LOGGING
+
+    try
+    {
+        aClassData->controller->Read(aBuffer, aBytes);
+        return kReadOk;
+    }
+    catch(CodecStreamStart&)
+    {
+        status = kReadStreamStart;
+    }
+    catch(CodecStreamEnded&)
+    {
+        status = kReadStreamEnded;
+    }
+    catch(CodecStreamStopped&)
+    {
+        status = kReadStreamStopped;
+    }
+    catch(CodecRecognitionOutOfData&)
+    {
+        status = kReadOutOfData;
+    }
+    catch(...)
+    {
+        *aClassData->readException = std::current_exception();
+        status = kReadFailed;
+    }
+
+#ifdef DEBUG
+    DBUG_F("Info: [CodecLibAV] readStream - Status [%d]\n", status);
+#endif // DEBUG
+
+#ifdef DECODE_STATS_LOGGING
+    *aClassData->boundaryUs += monotonicUs() - readStart;
+#endif // DECODE_STATS_LOGGING
+
+    return status;
+}
+
+// Rethrow any unexpected exception caught in the libav callbacks.
+void CodecLibAV::rethrowReadException()
+{
+    if (iReadException)
+    {
+        std::exception_ptr exception = iReadException;
+
+        iReadException = nullptr;
+        std::rethrow_exception(exception);
+    }
 }
 
 // AVCodec callback to seek to a position in the input stream.
@@ -389,7 +1185,19 @@ TInt64 CodecLibAV::avCodecSeek(void* ptr, TInt64 offset, TInt whence)
             *seekExecuted = true;
             *seekSuccess  = false;
 
-            if (controller->TrySeekTo(streamId, offset))
+            TBool seeked;
+
+            try
+            {
+                seeked = controller->TrySeekTo(streamId, offset);
+            }
+            catch(...)
+            {
+                *classData->readException = std::current_exception();
+                return -1;
+            }
+
+            if (seeked)
             {
 #ifdef DEBUG
                 DBUG_F("Info: [CodecLibAV] avCodecSeek Seek [SET] Succeeded\n");
@@ -397,6 +1205,18 @@ TInt64 CodecLibAV::avCodecSeek(void* ptr, TInt64 offset, TInt whence)
 
                 *byteTotal   = offset;
                 *seekSuccess = true;
+
+                // Any data held ahead of the stream is now stale.
+                *classData->prefixOffset = classData->prefix->Bytes();
+
+                // Reading resumes from the new position.
+                if ((*classData->readStatus == kReadStreamEnded) ||
+                    (*classData->readStatus == kReadOutOfData))
+                {
+                    *classData->readStatus  = kReadOk;
+                    *classData->streamEnded = false;
+                }
+
                 return offset;
             }
             else
@@ -442,6 +1262,9 @@ TBool CodecLibAV::InitAVIOContext()
     // Initialise Stream State
     iStreamStart  = false;
     iStreamEnded  = false;
+    iStreamStopped = false;
+    iReadStatus    = kReadOk;
+    iReadException = nullptr;
 
     iSeekExpected  = false;
     iSeekExecuted  = false;
@@ -449,6 +1272,10 @@ TBool CodecLibAV::InitAVIOContext()
 
     iByteTotal     = 0;
 
+    iCacheKeyHash  = 14695981039346656037ULL;
+    iCacheKeyBytes = 0;
+    iCacheKeying   = true;
+
     // Initialise the codec data buffer.
     //
     // NB. This may be free'd/realloced out with our control.
@@ -462,13 +1289,23 @@ TBool CodecLibAV::InitAVIOContext()
 
     // Data to be passed to the AVCodec callbacks.
     iClassData.controller     = iController;
+    iClassData.readStatus     = &iReadStatus;
+    iClassData.readException  = &iReadException;
+    iClassData.boundaryUs     = &iBoundaryUs;
     iClassData.streamStart    = &iStreamStart;
     iClassData.streamEnded    = &iStreamEnded;
+    iClassData.streamStopped  = &iStreamStopped;
     iClassData.streamId       = 0;
     iClassData.seekExpected   = &iSeekExpected;
     iClassData.seekExecuted   = &iSeekExecuted;
     iClassData.seekSuccess    = &iSeekSuccess;
     iClassData.byteTotal      = &iByteTotal;
+    iClassData.prefix         = &iSignature;
+    iClassData.prefixOffset   = &iSignatureOffset;
+    iClassData.keyHash        = &iCacheKeyHash;
+    iClassData.keyBytes       = &iCacheKeyBytes;
+    iClassData.keying         = &iCacheKeying;
+    iClassData.contentHash    = &iContentHash;
 
     // Manually create AVIO context, supplying our own read/seek functions.
     iAvioCtx = avio_alloc_context(avcodecBuf,
@@ -490,18 +1327,223 @@ TBool CodecLibAV::InitAVIOContext()
     return true;
 }
 
+// Read the leading bytes of the stream for signature checking.
+//
+// The bytes are retained and handed to libav ahead of any further stream
+// data by avCodecRead().
+TBool CodecLibAV::readSignature()
+{
+    iSignature.SetBytes(0);
+    iSignatureOffset = 0;
+    iContentHash     = 14695981039346656037ULL;
+
+    try
+    {
+        iController->Read(iSignature, kSignatureBytes);
+    }
+    catch(CodecStreamStart&)
+    {
+        return false;
+    }
+    catch(CodecStreamEnded&)
+    {
+        return false;
+    }
+    catch(CodecStreamStopped&)
+    {
+        return false;
+    }
+    catch(CodecRecognitionOutOfData&)
+    {
+        // Classify what we have. A full probe would not fare any better.
+    }
+
+    hashContent(iContentHash, iSignature);
+
+    return (iSignature.Bytes() > 0);
+}
+
+// Classify a stream from its leading bytes.
+//
+// For the formats we expect to decode a bounded probe size is supplied,
+// otherwise aProbeBytes is set to 0 and the libav default probe size
+// applies.
+CodecLibAV::StreamFamily CodecLibAV::classifyStream(const Brx& aHeader,
+                                                    TUint& aProbeBytes)
+{
+    const TUint8 *hdr   = aHeader.Ptr();
+    const TUint   bytes = aHeader.Bytes();
+
+    aProbeBytes = 0;
+
+    if (bytes < 4)
+    {
+        return kFamilyUnknown;
+    }
+
+    aProbeBytes = kProbeBytesRouted;
+
+    if (memcmp(hdr, "fLaC", 4) == 0)
+    {
+        return kFamilyFlac;
+    }
+
+    if (memcmp(hdr, "RIFF", 4) == 0)
+    {
+        return kFamilyWav;
+    }
+
+    if (memcmp(hdr, "FORM", 4) == 0)
+    {
+        return kFamilyAiff;
+    }
+
+    if (memcmp(hdr, "OggS", 4) == 0)
+    {
+        // The first packet of the first page starts after the page header
+        // and a single byte segment table.
+        static const TUint kOggPacketOffset = 28;
+
+        if (bytes >= kOggPacketOffset + 7)
+        {
+            const TUint8 *packet = hdr + kOggPacketOffset;
+
+            if (memcmp(packet, "\x01vorbis", 7) == 0)
+            {
+                return kFamilyVorbis;
+            }
+
+            if (memcmp(packet, "\x7f" "FLAC", 5) == 0)
+            {
+                return kFamilyFlac;
+            }
+        }
+
+        aProbeBytes = kProbeBytesOgg;
+        return kFamilyOgg;
+    }
+
+    aProbeBytes = 0;
+
+    if (memcmp(hdr, "ID3", 3) == 0)
+    {
+        // The tag size is held as a 28 bit 'syncsafe' integer and excludes
+        // the 10 byte tag header.
+        if (bytes >= 10)
+        {
+            TUint tagBytes = ((hdr[6] & 0x7f) << 21) |
+                             ((hdr[7] & 0x7f) << 14) |
+                             ((hdr[8] & 0x7f) <<  7) |
+                              (hdr[9] & 0x7f);
+
+            tagBytes += 10 + kProbeBytesMpeg;
+
+            aProbeBytes = (tagBytes < kProbeBytesMax) ? tagBytes
+                                                      : kProbeBytesMax;
+        }
+
+        return kFamilyId3;
+    }
+
+    if ((bytes >= 8) && (memcmp(hdr + 4, "ftyp", 4) == 0))
+    {
+        aProbeBytes = kProbeBytesMp4;
+        return kFamilyMp4;
+    }
+
+    // MPEG audio frame or ADTS header sync word.
+    if ((hdr[0] == 0xff) && ((hdr[1] & 0xe0) == 0xe0))
+    {
+        TUint layer = (hdr[1] >> 1) & 0x03;
+
+        if (layer == 0)
+        {
+            // ADTS headers have a layer of '00' and a 12 bit sync word.
+            if ((hdr[1] & 0xf0) == 0xf0)
+            {
+                aProbeBytes = kProbeBytesAdts;
+                return kFamilyAdts;
+            }
+        }
+        else
+        {
+            TUint bitrateIndex    = (hdr[2] >> 4) & 0x0f;
+            TUint sampleRateIndex = (hdr[2] >> 2) & 0x03;
+
+            if ((bitrateIndex != 0x0f) && (sampleRateIndex != 0x03))
+            {
+                aProbeBytes = kProbeBytesMpeg;
+                return kFamilyMpegAudio;
+            }
+        }
+    }
+
+    return kFamilyUnknown;
+}
+
+// Is the stream family routed to one of the native codecs.
+TBool CodecLibAV::routedNative(StreamFamily aFamily)
+{
+    CodecRouting::Format format;
+
+    switch (aFamily)
+    {
+        case kFamilyFlac:
+            format = CodecRouting::kFormatFlac;
+            break;
+        case kFamilyWav:
+            format = CodecRouting::kFormatWav;
+            break;
+        case kFamilyAiff:
+            format = CodecRouting::kFormatAiff;
+            break;
+        case kFamilyVorbis:
+            format = CodecRouting::kFormatVorbis;
+            break;
+        case kFamilyId3:
+        case kFamilyMpegAudio:
+            format = CodecRouting::kFormatMp3;
+            break;
+        case kFamilyAdts:
+        case kFamilyMp4:
+            format = CodecRouting::kFormatAac;
+            break;
+        default:
+            return false;
+    }
+
+    return (CodecRouting::getInstance()->Route(format) ==
+            CodecRouting::kDecoderNative);
+}
+
 TBool CodecLibAV::Recognise(const EncodedStreamInfo& aStreamInfo)
 {
 #ifdef DEBUG
     DBUG_F("[CodecLibAV] Recognise\n");
 #endif
 
-/*
-    if (aStreamInfo.Format() == EncodedStreamInfo::Format::Pcm)
+    // PCM and DSD streams are handled by their own codecs.
+    if (aStreamInfo.StreamFormat() != EncodedStreamInfo::Format::Encoded)
+    {
+        return false;
+    }
+
+    if (! readSignature())
     {
         return false;
     }
-*/
+
+    TUint        probeBytes = 0;
+    StreamFamily family     = classifyStream(iSignature, probeBytes);
+
+    if (routedNative(family))
+    {
+#ifdef DEBUG
+        DBUG_F("[CodecLibAV] Recognise - Native Format Rejected\n");
+#endif // DEBUG
+
+        return false;
+    }
 
     if (!InitAVIOContext())
     {
@@ -509,15 +1551,15 @@ TBool CodecLibAV::Recognise(const EncodedStreamInfo& aStreamInfo)
     }
 
     // Read as much data as required from the pipeline to ascertain the
-    // format of the stream.
+    // format of the stream, bounded by the classified stream family.
     av_probe_input_buffer(iAvioCtx,   // AVIOContext
                           &iFormat,   // AVInputFormat
                           "",         // Filename
                           NULL,       // Logctx
                           0,          // Offset
-                          0);         // Default max probe data
+                          probeBytes);// Max probe data (0 - default)
 
-    if (iFormat == NULL)
+    if ((iFormat == NULL) || iReadException)
     {
         DBUG_F("[CodecLibAV] Recognise Probe Failed.\n");
 
@@ -533,6 +1575,8 @@ TBool CodecLibAV::Recognise(const EncodedStreamInfo& aStreamInfo)
             iAvioCtx = NULL;
         }
 
+        rethrowReadException();
+
         return false;
     }
 
@@ -550,6 +1594,20 @@ void CodecLibAV::StreamInitialise()
 
     iAvPacketCached  = false;
     iConvertedFormat = AV_SAMPLE_FMT_NONE;
+    iDecoderPoolable = false;
+    iSeekIndexable   = false;
+
+#ifdef DECODE_STATS_LOGGING
+    iDecodeUs         = 0;
+    iDecodeCpuNs      = 0;
+    iDecodedSamples   = 0;
+    iDecodeAllocs     = 0;
+    iFrameAllocsStart = FramePoolStats::getInstance()->Allocations();
+    iBoundaryUs       = 0;
+    iStreamStartUs    = monotonicUs();
+    iProbeUs          = 0;
+    iFirstAudioUs     = 0;
+#endif // DECODE_STATS_LOGGING
 
     // The stream position is 'rewound' after Recognise() succeeds.
     // Libav does not expect/handle this, thus we must read and discard data
@@ -593,9 +1651,22 @@ void CodecLibAV::StreamInitialise()
         }
     }
 
+    // Recognition may have latched the end of its data, which would stop
+    // avCodecRead() reading the stream itself.
+    iReadStatus   = kReadOk;
+    iStreamEnded  = false;
+
     // Initialise the output buffer to hold decoded PCM.
     iOutput.SetBytes(0);
 
+    iCacheStreamLength = iController->StreamLength();
+
+    // Play previously decoded PCM where available.
+    if (loadCachedPcm())
+    {
+        return;
+    }
+
     // Allocate an AC Format context.
     iAvFormatCtx = avformat_alloc_context();
 
@@ -611,20 +1682,78 @@ void CodecLibAV::StreamInitialise()
     iAvFormatCtx->iformat = iFormat;
     iAvFormatCtx->flags   = AVFMT_FLAG_CUSTOM_IO;
 
+    // A stream of unknown length is live, eg. a radio stream. Probe the
+    // minimum required to start decoding, rather than the default of
+    // several seconds of audio, refining the stream parameters from the
+    // decoded frames.
+    iLiveStream = (iCacheStreamLength == 0);
+
+    if (iLiveStream)
+    {
+        iAvFormatCtx->probesize            = kLiveProbeBytes;
+        iAvFormatCtx->max_analyze_duration = kLiveAnalyzeUs;
+        iAvFormatCtx->fps_probe_size       = 0;
+    }
+
     if (avformat_open_input(&iAvFormatCtx, "", 0, 0) != 0)
     {
+        rethrowReadException();
+
         DBUG_F("[CodecLibAV] StreamInitialise - Could not open AV input "
                "stream\n");
         goto failure;
     }
 
-    if (avformat_find_stream_info(iAvFormatCtx, NULL) < 0)
+    // Streams previously played are initialised from the seek index cache,
+    // avoiding the stream info probe.
+    TBool cached;
+
+    iCacheKeying = false;
+    cached       = loadCachedStream();
+
+    if ((! cached) && (avformat_find_stream_info(iAvFormatCtx, NULL) < 0))
     {
+        rethrowReadException();
+
         DBUG_F("[CodecLibAV] StreamInitialise - Could not find AV stream "
                "info\n");
         goto failure;
     }
 
+    // Fall back to the default probe where the minimal probe of a live
+    // stream did not establish the audio parameters.
+    if (iLiveStream)
+    {
+        TInt audioId = av_find_best_stream(iAvFormatCtx, AVMEDIA_TYPE_AUDIO,
+                                           -1, -1, NULL, 0);
+
+        if ((audioId < 0) ||
+            (iAvFormatCtx->streams[audioId]->codecpar->sample_rate <= 0) ||
+            (iAvFormatCtx->streams[audioId]->codecpar->channels <= 0))
+        {
+            DBUG_F("[CodecLibAV] StreamInitialise - Live Probe "
+                   "Incomplete\n");
+
+            iAvFormatCtx->probesize            = 5000000;
+            iAvFormatCtx->max_analyze_duration = 0;
+
+            if (avformat_find_stream_info(iAvFormatCtx, NULL) < 0)
+            {
+                rethrowReadException();
+
+                DBUG_F("[CodecLibAV] StreamInitialise - Could not find AV "
+                       "stream info\n");
+                goto failure;
+            }
+
+            rethrowReadException();
+        }
+    }
+
+#ifdef DECODE_STATS_LOGGING
+    iProbeUs = monotonicUs() - iStreamStartUs;
+#endif // DECODE_STATS_LOGGING
+
 #ifdef DEBUG
     av_dump_format(iAvFormatCtx, 0, "", false);
 #endif // DEBUG
@@ -656,20 +1785,61 @@ void CodecLibAV::StreamInitialise()
         goto failure;
     }
 
-    iAvCodecContext = avcodec_alloc_context3(codec);
-    if (!iAvCodecContext) {
-        DBUG_F("[CodecLibAV] StreamInitialise - Can't allocate decoder context\n");
-        goto failure;
-    }
+    makeDecoderKey(origin_par, iDecoderKey);
 
-    if (avcodec_parameters_to_context(iAvCodecContext, origin_par) < 0) {
-        DBUG_F("[CodecLibAV] StreamInitialise - Can't copy decoder context\n");
-        goto failure;
+    // Reuse an already opened decoder for the stream parameters where
+    // available. This avoids the decoder setup cost at track boundaries.
+    if (! acquirePooledDecoder(iDecoderKey))
+    {
+        iAvCodecContext = avcodec_alloc_context3(codec);
+        if (!iAvCodecContext) {
+            DBUG_F("[CodecLibAV] StreamInitialise - Can't allocate decoder context\n");
+            goto failure;
+        }
+
+        if (avcodec_parameters_to_context(iAvCodecContext, origin_par) < 0) {
+            DBUG_F("[CodecLibAV] StreamInitialise - Can't copy decoder context\n");
+            goto failure;
+        }
+
+        // Use frame and/or slice threading where the decoder supports it.
+        if ((iDecodeThreads > 1) &&
+            (codec->capabilities & (AV_CODEC_CAP_FRAME_THREADS |
+                                    AV_CODEC_CAP_SLICE_THREADS)))
+        {
+            iAvCodecContext->thread_count = iDecodeThreads;
+            iAvCodecContext->thread_type  = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+#if LIBAVCODEC_VERSION_MAJOR < 59
+            // The frame buffer callback may be called from the decoder
+            // worker threads.
+            iAvCodecContext->thread_safe_callbacks = 1;
+#endif // LIBAVCODEC_VERSION_MAJOR
+        }
+        else
+        {
+            iAvCodecContext->thread_count = 1;
+        }
+
+        if (avcodec_open2(iAvCodecContext,codec,NULL) < 0)
+        {
+            DBUG_F("[CodecLibAV] StreamInitialise - Codec cannot be opened\n");
+            goto failure;
+        }
+
+        createFramePool(iAvCodecContext);
     }
 
-   if (avcodec_open2(iAvCodecContext,codec,NULL) < 0)
-   {
-        DBUG_F("[CodecLibAV] StreamInitialise - Codec cannot be opened\n");
+    iAvCodecContext->pkt_timebase =
+        iAvFormatCtx->streams[iStreamId]->time_base;
+
+    iStreamFormat = codec->name;
+
+    if ((iAvCodecContext->channels < 1) ||
+        (iAvCodecContext->channels > (TInt)kMaxChannels))
+    {
+        DBUG_F("[CodecLibAV] StreamInitialise - Unsupported Channel Count "
+               "[%d]\n", iAvCodecContext->channels);
         goto failure;
     }
 
@@ -685,23 +1855,34 @@ void CodecLibAV::StreamInitialise()
             break;
         case AV_SAMPLE_FMT_S32:
         case AV_SAMPLE_FMT_S32P:
-            iOutputBitDepth = 24;
+            // Output at full precision. The driver reduces the bit depth
+            // where the audio hardware requires it.
+            iOutputBitDepth = 32;
             break;
         case AV_SAMPLE_FMT_FLTP:
         case AV_SAMPLE_FMT_FLT:
-            // For best playback quality use 'libavresample' to convert this
+        case AV_SAMPLE_FMT_DBLP:
+        case AV_SAMPLE_FMT_DBL:
+            // For best playback quality use 'libswresample' to convert this
             // format to a PCM format we can handle.
+            //
+            // Convert to S32P and output at full precision.
+            iOutputBitDepth  = 32;
+            iConvertedFormat = AV_SAMPLE_FMT_S32P;
+
+            // A pooled decoder retains its configured converter.
+            if (iSwrResampleCtx != NULL)
+            {
+                break;
+            }
 
             iSwrResampleCtx = swr_alloc();
 
             if (iSwrResampleCtx != NULL)
             {
-                TInt64 channelLayout = AV_CH_LAYOUT_STEREO;
-
-                if (iAvCodecContext->channels == 1)
-                {
-                    channelLayout = AV_CH_LAYOUT_MONO;
-                }
+                // The conversion is format only. Identical input and output
+                // layouts ensure no remixing is performed.
+                TInt64 channelLayout = streamChannelLayout(iAvCodecContext);
 
                 av_opt_set_int(iSwrResampleCtx, "in_channel_layout",
                                channelLayout, 0);
@@ -713,12 +1894,6 @@ void CodecLibAV::StreamInitialise()
                                iAvCodecContext->sample_rate, 0);
                 av_opt_set_int(iSwrResampleCtx, "in_sample_fmt",
                                iAvCodecContext->sample_fmt, 0);
-
-                // Convert to S32P (this will be sampled down manually to 24
-                // bit for output)
-                iOutputBitDepth  = 24;
-                iConvertedFormat = AV_SAMPLE_FMT_S32P;
-
                 av_opt_set_int(iSwrResampleCtx, "out_sample_fmt",
                                iConvertedFormat, 0);
 
@@ -739,14 +1914,6 @@ void CodecLibAV::StreamInitialise()
             }
 
             break;
-        case AV_SAMPLE_FMT_DBL:
-            DBUG_F("[CodecLibAV] StreamInitialise - Format "
-                   "'AV_SAMPLE_FMT_DBL' unsupported\n");
-            goto failure;
-        case AV_SAMPLE_FMT_DBLP:
-            DBUG_F("[CodecLibAV] StreamInitialise - Format "
-                   "'AV_SAMPLE_FMT_DBLP' unsupported\n");
-            goto failure;
         default:
             DBUG_F("[CodecLibAV] StreamInitialise - Unknown Sample Format\n");
             goto failure;
@@ -774,6 +1941,52 @@ void CodecLibAV::StreamInitialise()
         iTrackLengthJiffies = 0;
     }
 
+    // Raw MPEG audio and ADTS streams carry no seek tables. Build an index
+    // of packet positions as the stream is decoded to allow accurate
+    // seeking within the decoded region.
+    //
+    // The index of a cached stream is extended from the cached region.
+    if (! cached)
+    {
+        iSeekIndex.clear();
+    }
+
+    iSeekIndexStored = iSeekIndex.size();
+    iSeekTrimPending  = false;
+    iSeekTimelineLost = false;
+    iSeekIndexable    = (iTotalSamples > 0) &&
+                        ((strcmp(iAvFormatCtx->iformat->name, "mp3") == 0) ||
+                         (strcmp(iAvFormatCtx->iformat->name, "aac") == 0));
+    iSeekIndexing     = iSeekIndexable;
+
+    if (iSeekIndexable)
+    {
+        iSeekIndex.reserve((iTotalSamples /
+                            (iAvCodecContext->sample_rate *
+                             kSeekIndexIntervalSecs)) + 1);
+    }
+
+    // Capture the decoded PCM of streams small enough to be cached.
+    iPcmCapturing       = false;
+    iPcmCaptureComplete = false;
+
+    if ((iPcmCache != NULL) && (iCacheStreamLength > 0) &&
+        (iTotalSamples > 0))
+    {
+        TUint64 pcmBytes = iTotalSamples * iAvCodecContext->channels *
+                           (iOutputBitDepth / 8);
+
+        if (pcmBytes <= iPcmCache->MaxEntryBytes())
+        {
+            iPcmCapture.reserve(pcmBytes);
+            iPcmCapturing = true;
+        }
+    }
+
+    iLiveSampleRate = iAvCodecContext->sample_rate;
+    iLiveChannels   = iAvCodecContext->channels;
+    iCacheChecking  = cached;
+
     iController->OutputDecodedStream(iAvCodecContext->bit_rate,
                                      iOutputBitDepth,
                                      iAvCodecContext->sample_rate,
@@ -785,88 +1998,545 @@ void CodecLibAV::StreamInitialise()
                                      *iSpeakerProfile);
 
 
-    // Create a frame to hold the decoded packets.
-#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(55, 45, 101)
-    iAvFrame = av_frame_alloc();
-#else // LIBAVCODEC_VERSION_INT
-    iAvFrame = avcodec_alloc_frame();
-#endif // LIBAVCODEC_VERSION_INT
+    // Create a frame to hold the decoded packets.
+    //
+    // The frame is retained across streams.
+    if (iAvFrame == NULL)
+    {
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(55, 45, 101)
+        iAvFrame = av_frame_alloc();
+#else // LIBAVCODEC_VERSION_INT
+        iAvFrame = avcodec_alloc_frame();
+#endif // LIBAVCODEC_VERSION_INT
+    }
+
+    if (iAvFrame == NULL)
+    {
+        DBUG_F("[CodecLibAV] StreamInitialise - Cannot create iAvFrame\n");
+        goto failure;
+    }
+
+    iDecoderPoolable = true;
+
+    return;
+
+failure:
+    // Resources are tidied up in StreamCompleted
+    THROW(CodecStreamCorrupt);
+}
+
+void CodecLibAV::StreamCompleted()
+{
+#ifdef DEBUG
+    DBUG_F("[CodecLibAV] StreamCompleted\n");
+#endif
+
+    iFormat = NULL;
+
+    storeSeekIndex();
+    storeCachedPcm();
+
+    iPcmCacheHit = false;
+
+#ifdef DECODE_STATS_LOGGING
+    if ((iAvCodecContext != NULL) && (iDecodeUs > 0))
+    {
+        TUint64 audioUs   = (iDecodedSamples * 1000000) /
+                                iAvCodecContext->sample_rate;
+        TUint64 elapsedUs = monotonicUs() - iStreamStartUs;
+        struct rusage usage;
+
+        getrusage(RUSAGE_SELF, &usage);
+
+        // Allocations are those of the packets read, the frame buffers
+        // not reused from the pools (shared by any stream decoding ahead)
+        // and the sample conversion buffer.
+        iDecodeAllocs += FramePoolStats::getInstance()->Allocations() -
+                         iFrameAllocsStart;
+
+        // Samples are counted per channel. CPU time is that of the codec
+        // thread only, so excludes any decoder worker threads.
+        DBUG_F("[CodecLibAV] Stats {\"codec\":\"%s\",\"sample_rate\":%d,"
+               "\"channels\":%d,\"threads\":%d,\"samples\":%llu,"
+               "\"decode_us\":%llu,\"x_realtime\":%.1f,"
+               "\"cpu_ns_per_sample\":%.1f,\"allocs_per_sec\":%.1f,"
+               "\"peak_rss_kb\":%ld,\"boundary_us\":%llu,"
+               "\"live\":%s,\"first_audio_us\":%llu}\n",
+               iAvCodecContext->codec->name, iAvCodecContext->sample_rate,
+               iAvCodecContext->channels, iAvCodecContext->thread_count,
+               iDecodedSamples, iDecodeUs,
+               (double)audioUs / (double)iDecodeUs,
+               iDecodedSamples ? (double)iDecodeCpuNs / iDecodedSamples : 0.0,
+               elapsedUs ? (iDecodeAllocs * 1000000.0) / elapsedUs : 0.0,
+               usage.ru_maxrss, iBoundaryUs,
+               iLiveStream ? "true" : "false", iFirstAudioUs);
+    }
+#endif // DECODE_STATS_LOGGING
+
+    if (iAvPacketCached)
+    {
+        iAvPacketCached = false;
+        av_packet_unref(iAvPacket);
+    }
+
+    if (iAvFrame != NULL)
+    {
+        av_frame_unref(iAvFrame);
+    }
+
+    // Retain the decoder for use by a subsequent stream.
+    releaseDecoder();
+
+    if (iAvFormatCtx != NULL)
+    {
+        avformat_close_input(&iAvFormatCtx);
+        iAvFormatCtx = NULL;
+    }
+
+    if (iAvioCtx != NULL)
+    {
+        if (iAvioCtx->buffer != NULL)
+        {
+            av_free(iAvioCtx->buffer);
+        }
+
+        av_free(iAvioCtx);
+        iAvioCtx = NULL;
+    }
+}
+
+// The cache key is valid once the stream has been opened.
+TBool CodecLibAV::cacheKeyValid() const
+{
+    return (iCacheStreamLength > 0) && (! iCacheKeying) &&
+           (iCacheKeyBytes > 0);
+}
+
+// Initialise the stream parameters and seek index of the opened stream from
+// the seek index cache.
+//
+// The codec has no access to the stream URI, so streams are identified by
+// their length and a hash of all the data read to open them, covering the
+// headers the stream parameters are otherwise probed from. The entry is
+// checked against the first decoded frame, see checkCachedStream().
+TBool CodecLibAV::loadCachedStream()
+{
+    if ((iSeekIndexCache == NULL) || (! cacheKeyValid()) ||
+        (iAvFormatCtx->nb_streams != 1))
+    {
+        return false;
+    }
+
+    AVStream          *stream = iAvFormatCtx->streams[0];
+    AVCodecParameters *par    = stream->codecpar;
+    SeekIndexEntry     entry;
+
+    if ((! iSeekIndexCache->TryLoad(iCacheStreamLength, iCacheKeyHash,
+                                    iCacheKeyBytes, entry)) ||
+        (entry.codecId != (TUint32)par->codec_id))
+    {
+        return false;
+    }
+
+    par->sample_rate    = entry.sampleRate;
+    par->channels       = entry.channels;
+    par->channel_layout = entry.channelLayout;
+    par->format         = entry.format;
+    par->frame_size     = entry.frameSize;
+    par->bit_rate       = entry.bitRate;
+
+    iAvFormatCtx->duration   = entry.duration;
+    iAvFormatCtx->start_time = entry.startTime;
+
+    if (entry.startTime != (TInt64)AV_NOPTS_VALUE)
+    {
+        stream->start_time = av_rescale_q(entry.startTime, AV_TIME_BASE_Q,
+                                          stream->time_base);
+    }
+
+    iSeekIndex.swap(entry.index);
+
+#ifdef DEBUG
+    DBUG_F("[CodecLibAV] StreamInitialise - Cached Stream Info [%lu] Seek "
+           "Points\n", (unsigned long)iSeekIndex.size());
+#endif // DEBUG
+
+    return true;
+}
+
+// Save the stream parameters and seek index to the seek index cache if the
+// index has been extended while playing the stream.
+void CodecLibAV::storeSeekIndex()
+{
+    if ((iSeekIndexCache == NULL) || (! iSeekIndexable) ||
+        (iAvFormatCtx == NULL) || (iAvFormatCtx->nb_streams != 1) ||
+        (! cacheKeyValid()) ||
+        (iSeekIndex.size() <= iSeekIndexStored))
+    {
+        return;
+    }
+
+    AVCodecParameters *par = iAvFormatCtx->streams[iStreamId]->codecpar;
+    SeekIndexEntry     entry;
+
+    entry.codecId       = par->codec_id;
+    entry.sampleRate    = par->sample_rate;
+    entry.channels      = par->channels;
+    entry.channelLayout = par->channel_layout;
+    entry.format        = par->format;
+    entry.frameSize     = par->frame_size;
+    entry.bitRate       = par->bit_rate;
+    entry.duration      = iAvFormatCtx->duration;
+    entry.startTime     = iAvFormatCtx->start_time;
+
+    // The index is not required beyond this point.
+    entry.index.swap(iSeekIndex);
+
+    iSeekIndexCache->Store(iCacheStreamLength, iCacheKeyHash, iCacheKeyBytes,
+                           entry);
+
+    iSeekIndexStored = 0;
+}
+
+// Discard the seek index cache entry of a stream whose decoded parameters
+// differ from those cached, along with the index it supplied.
+void CodecLibAV::evictCachedStream()
+{
+    iSeekIndexCache->Remove(iCacheStreamLength, iCacheKeyHash);
+
+    iSeekIndex.clear();
+
+    iSeekIndexStored = 0;
+    iSeekIndexable   = false;
+    iSeekIndexing    = false;
+}
+
+// Start playback of the stream from the decoded PCM cache.
+//
+// The codec has no access to the stream URI, so a stream is only matched
+// to a cache entry by its length and a hash of its entire content. Where a
+// stream of the same length is cached the remainder of the stream is read
+// and held to complete the hash. On a miss the held data is handed to
+// libav ahead of any further stream data by avCodecRead(), as the
+// signature is.
+TBool CodecLibAV::loadCachedPcm()
+{
+    if ((iPcmCache == NULL) || (iCacheStreamLength == 0) ||
+        (iCacheStreamLength > iPcmCache->MaxEntryBytes()) ||
+        (iSignatureOffset < iSignature.Bytes()) ||
+        (iReadStatus != kReadOk) ||
+        (! iPcmCache->Contains(iCacheStreamLength)))
+    {
+        return false;
+    }
+
+    TUint64 bytesLeft = iCacheStreamLength - iByteTotal;
+    ReadStatus status = kReadOk;
+
+    iHeldEncoded.clear();
+    iHeldEncoded.reserve(bytesLeft);
+
+    while ((bytesLeft > 0) && (status == kReadOk))
+    {
+        TUint bytes = (bytesLeft < iOutput.MaxBytes()) ? (TUint)bytesLeft
+                                                       : iOutput.MaxBytes();
+
+        iOutput.SetBytes(0);
+
+        status = readStream(&iClassData, iOutput, bytes);
+
+        if (status != kReadOk)
+        {
+            break;
+        }
+
+        hashContent(iContentHash, iOutput);
+
+        iHeldEncoded.insert(iHeldEncoded.end(), iOutput.Ptr(),
+                            iOutput.Ptr() + iOutput.Bytes());
+
+        bytesLeft -= iOutput.Bytes();
+    }
+
+    iOutput.SetBytes(0);
+
+    PcmCacheKey key = {iCacheStreamLength, iContentHash};
+
+    if ((bytesLeft > 0) || (! iPcmCache->Find(key, iCachedFormat, iCachedPcm)))
+    {
+        // Any boundary met while reading is latched, to be reported by
+        // avCodecRead() once the held data has been consumed.
+        iReadStatus    = status;
+        iStreamStart   = (status == kReadStreamStart);
+        iStreamStopped = (status == kReadStreamStopped);
+        iStreamEnded   = (status == kReadStreamEnded) || iStreamStopped;
+
+        iHeldPrefix.Set(iHeldEncoded.empty() ? NULL : &iHeldEncoded[0],
+                        (TUint)iHeldEncoded.size());
+
+        iClassData.prefix = &iHeldPrefix;
+        iSignatureOffset  = 0;
+
+        rethrowReadException();
+
+        return false;
+    }
+
+    std::vector<TByte>().swap(iHeldEncoded);
+
+    DBUG_F("[CodecLibAV] StreamInitialise - Playing cached PCM [%u] bytes\n",
+           iCachedPcm.Bytes());
+
+    iPcmCacheHit          = true;
+    iCachedPcmOffset      = 0;
+    iPcmCapturing         = false;
+
+    iController->OutputDecodedStream(iCachedFormat.bitRate,
+                                     iCachedFormat.bitDepth,
+                                     iCachedFormat.sampleRate,
+                                     iCachedFormat.channels,
+                                     Brn(iCachedFormat.codecName.c_str()),
+                                     iCachedFormat.trackLengthJiffies,
+                                     0,
+                                     false,
+                                     *iSpeakerProfile);
+
+    return true;
+}
+
+// Output the next block of cached PCM.
+//
+// The encoded stream has been read in full by loadCachedPcm(). A stop is
+// still honoured, as the audio output after it is discarded downstream
+// until the controller reaches the flush.
+void CodecLibAV::outputCachedPcm()
+{
+    if (iCachedPcmOffset >= iCachedPcm.Bytes())
+    {
+        THROW(CodecStreamEnded);
+    }
+
+    TUint frameBytes = iCachedFormat.channels * (iCachedFormat.bitDepth / 8);
+    TUint bytes      = iCachedPcm.Bytes() - iCachedPcmOffset;
+    TUint maxBytes   = DecodedAudio::kMaxBytes -
+                       (DecodedAudio::kMaxBytes % frameBytes);
+
+    if (bytes > maxBytes)
+    {
+        bytes = maxBytes;
+    }
+
+    Brn pcm(iCachedPcm.Ptr() + iCachedPcmOffset, bytes);
+
+    iTrackOffset += iController->OutputAudioPcm(pcm,
+                                                iCachedFormat.channels,
+                                                iCachedFormat.sampleRate,
+                                                iCachedFormat.bitDepth,
+                                                AudioDataEndian::Big,
+                                                iTrackOffset);
+
+    iCachedPcmOffset += bytes;
+}
+
+// Add the PCM captured from a completely decoded stream to the cache.
+//
+// The content hash is only complete where the whole stream was read
+// without a seek.
+void CodecLibAV::storeCachedPcm()
+{
+    if (iPcmCapturing && iPcmCaptureComplete && (iAvCodecContext != NULL) &&
+        (iByteTotal == iCacheStreamLength))
+    {
+        PcmCacheKey    key = {iCacheStreamLength, iContentHash};
+        PcmCacheFormat format;
+
+        format.bitRate            = (TUint)iAvCodecContext->bit_rate;
+        format.bitDepth           = iOutputBitDepth;
+        format.sampleRate         = iAvCodecContext->sample_rate;
+        format.channels           = iAvCodecContext->channels;
+        format.trackLengthJiffies = iTrackLengthJiffies;
+        format.codecName          = iStreamFormat;
+
+        iPcmCache->Insert(key, format, iPcmCapture);
+    }
+
+    iPcmCapturing       = false;
+    iPcmCaptureComplete = false;
+
+    std::vector<TByte>().swap(iPcmCapture);
+    std::vector<TByte>().swap(iHeldEncoded);
+}
+
+// Output the decoded PCM buffer, retaining a copy while the stream is
+// captured for the decoded PCM cache.
+void CodecLibAV::outputPcm()
+{
+    outputPcm(iAvCodecContext->channels, iAvCodecContext->sample_rate);
+}
+
+// Output the PCM decoded at aChannels and aSampleRate, which differ from
+// the decoder's where a live stream has just been refined.
+void CodecLibAV::outputPcm(TInt aChannels, TInt aSampleRate)
+{
+#ifdef DECODE_STATS_LOGGING
+    // The start latency is logged as audio starts, as a live stream may
+    // not end for hours.
+    if (iFirstAudioUs == 0)
+    {
+        iFirstAudioUs = monotonicUs() - iStreamStartUs;
+
+        DBUG_F("[CodecLibAV] Start {\"live\":%s,\"probe_us\":%llu,"
+               "\"first_audio_us\":%llu}\n",
+               iLiveStream ? "true" : "false", iProbeUs, iFirstAudioUs);
+    }
+#endif // DECODE_STATS_LOGGING
+
+    if (iPcmCapturing)
+    {
+        if (iPcmCapture.size() + iOutput.Bytes() <= iPcmCache->MaxEntryBytes())
+        {
+            iPcmCapture.insert(iPcmCapture.end(), iOutput.Ptr(),
+                               iOutput.Ptr() + iOutput.Bytes());
+        }
+        else
+        {
+            iPcmCapturing = false;
+            std::vector<TByte>().swap(iPcmCapture);
+        }
+    }
+
+    iTrackOffset +=
+        iController->OutputAudioPcm(
+                        iOutput,
+                        aChannels,
+                        aSampleRate,
+                        iOutputBitDepth,
+                        AudioDataEndian::Big,
+                        iTrackOffset);
+
+    iOutput.SetBytes(0);
+}
+
+// Convert a presentation timestamp to a sample offset in the stream.
+TUint64 CodecLibAV::streamSample(TInt64 aPts) const
+{
+    AVStream   *stream     = iAvFormatCtx->streams[iStreamId];
+    AVRational  sampleBase = {1, iAvCodecContext->sample_rate};
+
+    if (stream->start_time != (TInt64)AV_NOPTS_VALUE)
+    {
+        aPts -= stream->start_time;
+    }
+
+    if (aPts < 0)
+    {
+        return 0;
+    }
+
+    return (TUint64)av_rescale_q(aPts, stream->time_base, sampleBase);
+}
+
+// Record the position of the current packet in the seek index if it is
+// at least kSeekIndexIntervalSecs beyond the last indexed position.
+void CodecLibAV::updateSeekIndex()
+{
+    if ((iAvPacket->pos < 0) || (iAvPacket->pts == (TInt64)AV_NOPTS_VALUE))
+    {
+        return;
+    }
+
+    TUint64 sample = streamSample(iAvPacket->pts);
 
-    if (iAvFrame == NULL)
+    if (! iSeekIndex.empty())
     {
-        DBUG_F("[CodecLibAV] StreamInitialise - Cannot create iAvFrame\n");
-        goto failure;
+        TUint64 interval = iAvCodecContext->sample_rate *
+                           kSeekIndexIntervalSecs;
+
+        if (sample < iSeekIndex.back().sample + interval)
+        {
+            return;
+        }
     }
 
-    return;
+    SeekPoint point = {sample, (TUint64)iAvPacket->pos};
 
-failure:
-    // Resources are tidied up in StreamCompleted
-    THROW(CodecStreamCorrupt);
+    iSeekIndex.push_back(point);
 }
 
-void CodecLibAV::StreamCompleted()
+// Seek to the indexed position preceding the target sample.
+//
+// Only possible where the target lies within the region of the stream that
+// has been decoded.
+TBool CodecLibAV::seekByIndex(TUint64 aSample)
 {
-#ifdef DEBUG
-    DBUG_F("[CodecLibAV] StreamCompleted\n");
-#endif
+    if (iSeekIndex.empty())
+    {
+        return false;
+    }
 
-    iFormat = NULL;
+    TUint64 interval = iAvCodecContext->sample_rate * kSeekIndexIntervalSecs;
 
-    if (iSwrResampleCtx != NULL)
+    if (aSample >= iSeekIndex.back().sample + interval)
     {
-        swr_free(&iSwrResampleCtx);
-        iSwrResampleCtx = NULL;
+        return false;
     }
 
-    if (iAvPacketCached)
+    std::vector<SeekPoint>::iterator it =
+        std::upper_bound(iSeekIndex.begin(), iSeekIndex.end(), aSample,
+                         seekPointBefore);
+
+    if (it == iSeekIndex.begin())
     {
-        iAvPacketCached = false;
-        av_packet_free(&iAvPacket);
+        return false;
     }
 
-    if (iAvFrame != NULL)
-    {
-#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(55, 45, 101)
-        av_frame_free(&iAvFrame);
-#else // LIBAVCODEC_VERSION_INT
-        avcodec_free_frame(&iAvFrame);
-#endif // LIBAVCODEC_VERSION_INT
+    --it;
 
-        iAvFrame = NULL;
-    }
+#ifdef DEBUG
+    DBUG_F("[CodecLibAV] TrySeek - Index Point Sample [%llu] Offset [%llu]\n",
+           it->sample, it->bytePos);
+#endif // DEBUG
+
+    iSeekExpected = true;
+    iSeekExecuted = false;
+    iSeekSuccess  = false;
+
+    TInt ret = av_seek_frame(iAvFormatCtx, iStreamId, (TInt64)it->bytePos,
+                             AVSEEK_FLAG_BYTE);
+
+    iSeekExpected = false;
+
+    rethrowReadException();
 
-    if (iAvCodecContext != NULL)
+    // A seek within the AVIO buffer is satisfied without a callback.
+    if ((ret < 0) || (iSeekExecuted && ! iSeekSuccess))
     {
-        avcodec_close(iAvCodecContext);
-        iAvCodecContext = NULL;
+        return false;
     }
 
-    if (iAvFormatCtx != NULL)
+    if (iAvPacketCached)
     {
-        avformat_close_input(&iAvFormatCtx);
-        iAvFormatCtx = NULL;
+        iAvPacketCached = false;
+        av_packet_unref(iAvPacket);
     }
 
-    if (iAvioCtx != NULL)
-    {
-        if (iAvioCtx->buffer != NULL)
-        {
-            av_free(iAvioCtx->buffer);
-        }
+    avcodec_flush_buffers(iAvCodecContext);
 
-        av_free(iAvioCtx);
-        iAvioCtx = NULL;
-    }
+    // The demuxer does not restore its timestamps following a byte seek,
+    // so the positions of the decoded frames are derived from the index
+    // point, and indexing is suspended until the timestamps agree with
+    // them.
+    iSeekFrameSample  = it->sample;
+    iSeekTimelineLost = true;
+    iSeekIndexing     = false;
+    iSeekSuccess      = true;
+
+    return true;
 }
 
-TBool CodecLibAV::TrySeek(TUint aStreamId, TUint64 aSample)
+// Seek to the target sample as a fraction of the stream duration.
+TBool CodecLibAV::seekByTime(TUint64 aSample)
 {
-#ifdef DEBUG
-    DBUG_F("[CodecLibAV] TrySeek - StreamId [%d] Sample[%jd]\n",
-           aStreamId, aSample);
-#endif // DEBUG
-
     double frac        = (double)aSample / (double)iTotalSamples;
     TInt64 seekTarget  = TInt64(frac *
                                 (iAvFormatCtx->duration + kDurationRoundUp));
@@ -878,8 +2548,6 @@ TBool CodecLibAV::TrySeek(TUint aStreamId, TUint64 aSample)
     DBUG_F("[CodecLibAV] TrySeek - SeekTarget [%jd]\n", seekTarget);
 #endif // DEBUG
 
-    iClassData.streamId = aStreamId;
-
     iSeekExpected = true;
     iSeekExecuted = false;
     iSeekSuccess  = false;
@@ -887,6 +2555,8 @@ TBool CodecLibAV::TrySeek(TUint aStreamId, TUint64 aSample)
     TUint64 currentPos = iByteTotal;
     TInt ret = av_seek_frame(iAvFormatCtx, -1, seekTarget, AVSEEK_FLAG_ANY);
 
+    rethrowReadException();
+
     if ((ret < 0) && iSeekExecuted)
     {
          // It looks like the seek operation involved a number of stream
@@ -923,6 +2593,8 @@ TBool CodecLibAV::TrySeek(TUint aStreamId, TUint64 aSample)
         {
             DBUG_F("[CodecLibAV] av_read_frame problem\n");
         }
+
+        rethrowReadException();
         
 
         if (iSeekSuccess)
@@ -944,11 +2616,79 @@ TBool CodecLibAV::TrySeek(TUint aStreamId, TUint64 aSample)
         }
     }
 
-    if (iSeekSuccess == false)
+    // A time based seek restores the demuxer's timestamps.
+    if (iSeekSuccess)
+    {
+        iSeekTimelineLost = false;
+    }
+
+    if (iSeekSuccess && ! iSeekIndex.empty())
+    {
+        // Only continue indexing if decoding resumes within the indexed
+        // region of the stream.
+        TUint64 interval = iAvCodecContext->sample_rate *
+                           kSeekIndexIntervalSecs;
+
+        iSeekIndexing = iSeekIndexable &&
+                        (aSample < iSeekIndex.back().sample + interval);
+    }
+
+    return iSeekSuccess;
+}
+
+TBool CodecLibAV::TrySeek(TUint aStreamId, TUint64 aSample)
+{
+#ifdef DEBUG
+    DBUG_F("[CodecLibAV] TrySeek - StreamId [%d] Sample[%jd]\n",
+           aStreamId, aSample);
+#endif // DEBUG
+
+    iSeekStartUs = monotonicUs();
+
+    iClassData.streamId = aStreamId;
+
+    if (iPcmCacheHit)
+    {
+        TUint frameBytes = iCachedFormat.channels *
+                           (iCachedFormat.bitDepth / 8);
+        TUint64 offset   = aSample * frameBytes;
+
+        iCachedPcmOffset = (offset < iCachedPcm.Bytes()) ? (TUint)offset
+                                                         : iCachedPcm.Bytes();
+        iTrackOffset     =
+            (aSample * Jiffies::kPerSecond) / iCachedFormat.sampleRate;
+
+        iController->OutputDecodedStream(iCachedFormat.bitRate,
+                                         iCachedFormat.bitDepth,
+                                         iCachedFormat.sampleRate,
+                                         iCachedFormat.channels,
+                                         Brn(iCachedFormat.codecName.c_str()),
+                                         iCachedFormat.trackLengthJiffies,
+                                         aSample,
+                                         false,
+                                         *iSpeakerProfile);
+
+        return true;
+    }
+
+    // A partially decoded stream is not cached.
+    iPcmCapturing = false;
+    std::vector<TByte>().swap(iPcmCapture);
+
+    iSeekIndexed = seekByIndex(aSample);
+
+    if (! iSeekIndexed && ! seekByTime(aSample))
     {
         return false;
     }
 
+    // Decoded frames preceding the target are trimmed in Process().
+    //
+    // The position of a time based seek is only known from the timestamps
+    // of the decoded frames.
+    iSeekTargetSample = aSample;
+    iSeekTrimPending  = true;
+
     iTrackOffset =
         (aSample * Jiffies::kPerSecond) / iAvCodecContext->sample_rate;
 
@@ -968,10 +2708,154 @@ TBool CodecLibAV::TrySeek(TUint aStreamId, TUint64 aSample)
     return true;
 }
 
+// Update the stream parameters of a live stream from its decoded frames.
+//
+// The minimal probe of a live stream may not establish the parameters
+// reported by the decoder, eg. the output rate of HE-AAC. Streams
+// initialised from a mismatched seek index cache entry are corrected in the
+// same way.
+void CodecLibAV::refineLiveStream()
+{
+    DBUG_F("[CodecLibAV] Live Stream Refined - Rate [%d -> %d] "
+           "Channels [%d -> %d]\n", iLiveSampleRate, iAvFrame->sample_rate,
+           iLiveChannels, iAvFrame->channels);
+
+    if ((iAvFrame->sample_rate <= 0) || (iAvFrame->channels < 1) ||
+        (iAvFrame->channels > (TInt)kMaxChannels))
+    {
+        av_packet_unref(iAvPacket);
+        THROW(CodecStreamCorrupt);
+    }
+
+    // Output the PCM decoded at the previous parameters as the stream they
+    // were reported in. The decoder already holds the new parameters.
+    if (iOutput.Bytes() > 0)
+    {
+        outputPcm(iLiveChannels, iLiveSampleRate);
+    }
+
+    TUint64 sample = (iTrackOffset * iLiveSampleRate) / Jiffies::kPerSecond;
+
+    iLiveSampleRate = iAvFrame->sample_rate;
+    iLiveChannels   = iAvFrame->channels;
+
+    // The converter, and a decoder configured by the probe, are not reused.
+    iDecoderPoolable = false;
+
+    if (iSwrResampleCtx != NULL)
+    {
+        TInt64 channelLayout = streamChannelLayout(iAvCodecContext);
+
+        swr_close(iSwrResampleCtx);
+
+        av_opt_set_int(iSwrResampleCtx, "in_channel_layout",
+                       channelLayout, 0);
+        av_opt_set_int(iSwrResampleCtx, "out_channel_layout",
+                       channelLayout, 0);
+        av_opt_set_int(iSwrResampleCtx, "in_sample_rate",
+                       iLiveSampleRate, 0);
+        av_opt_set_int(iSwrResampleCtx, "out_sample_rate",
+                       iLiveSampleRate, 0);
+
+        if (swr_init(iSwrResampleCtx) < 0)
+        {
+            DBUG_F("[CodecLibAV] Live Stream Refined - Cannot Open "
+                   "Resampler\n");
+
+            av_packet_unref(iAvPacket);
+            THROW(CodecStreamCorrupt);
+        }
+    }
+
+    iTrackOffset = (sample * Jiffies::kPerSecond) / iLiveSampleRate;
+
+    iController->OutputDecodedStream(iAvCodecContext->bit_rate,
+                                     iOutputBitDepth,
+                                     iLiveSampleRate,
+                                     iLiveChannels,
+                                     Brn(iStreamFormat),
+                                     iTrackLengthJiffies,
+                                     sample,
+                                     false,
+                                     *iSpeakerProfile);
+}
+
+// Determine how much of the first frames decoded following a seek precede
+// the seek target.
+//
+// Returns false if the whole frame is to be discarded, otherwise
+// aStartSample is set to the first sample of the frame to be output and the
+// seek latency and position error are reported.
+TBool CodecLibAV::trimSeekFrame(TInt& aStartSample)
+{
+    TUint64 frameSample;
+
+    aStartSample = 0;
+
+    if (iSeekTimelineLost)
+    {
+        frameSample = iSeekFrameSample;
+    }
+    else if (iAvFrame->pts != (TInt64)AV_NOPTS_VALUE)
+    {
+        frameSample = streamSample(iAvFrame->pts);
+    }
+    else
+    {
+        // The position reached by a time based seek is unknown.
+        frameSample = iSeekTargetSample;
+    }
+
+    TUint64 frameEnd   = frameSample + iAvFrame->nb_samples;
+    TUint64 discardMax = iAvCodecContext->sample_rate * kSeekDiscardMaxSecs;
+
+    iSeekFrameSample = frameEnd;
+
+    if ((frameEnd <= iSeekTargetSample) &&
+        (iSeekTargetSample - frameSample <= discardMax))
+    {
+        return false;
+    }
+
+    if ((frameSample < iSeekTargetSample) &&
+        (iSeekTargetSample < frameEnd))
+    {
+        aStartSample = (TInt)(iSeekTargetSample - frameSample);
+    }
+
+    iSeekTrimPending = false;
+
+    TInt64 errorSamples = (TInt64)(frameSample + aStartSample) -
+                          (TInt64)iSeekTargetSample;
+
+    DBUG_F("[CodecLibAV] Seek - %s seek to sample [%llu] latency [%llu] us "
+           "position error [%lld] samples\n",
+           iSeekIndexed ? "Indexed" : "Timed", iSeekTargetSample,
+           monotonicUs() - iSeekStartUs, errorSamples);
+
+    return true;
+}
+
+// Follow the derived position of the frames decoded following a byte
+// seek, resuming indexing once a frame's timestamp agrees with it.
+void CodecLibAV::trackSeekTimeline()
+{
+    if ((iAvFrame->pts != (TInt64)AV_NOPTS_VALUE) &&
+        (streamSample(iAvFrame->pts) == iSeekFrameSample))
+    {
+        iSeekTimelineLost = false;
+        iSeekIndexing     = iSeekIndexable;
+
+        return;
+    }
+
+    iSeekFrameSample += iAvFrame->nb_samples;
+}
+
 // Convert native endian interleaved/planar PCM to interleaved big endian PCM
 // and output.
 void CodecLibAV::processPCM(TUint8 **pcmData, AVSampleFormat fmt,
-                            TInt plane_size)
+                            TInt plane_size, TInt startSample)
 {
     TInt    outIndex       = 0;
     TUint8 *out            = (TUint8 *)(iOutput.Ptr() + iOutput.Bytes());
@@ -990,6 +2874,8 @@ void CodecLibAV::processPCM(TUint8 **pcmData, AVSampleFormat fmt,
     {
         // For Interleaved PCM the frames are delivered in a single plane.
         planes = 1;
+
+        startSample *= iAvCodecContext->channels;
     }
 
     TUint frameSize   = outSampleBytes * iAvCodecContext->channels;
@@ -1000,23 +2886,15 @@ void CodecLibAV::processPCM(TUint8 **pcmData, AVSampleFormat fmt,
         (frameSize > (TUint)kGuardSize) ? frameSize : (TUint)kGuardSize;
 #endif // BUFFER_GUARD_CHECK
 
-    for (TInt ps=0; ps<planeSamples; ps++)
+    for (TInt ps=startSample; ps<planeSamples; ps++)
     {
         for (TInt plane=0; plane<planes; plane++)
         {
             // Flush the output buffer when full.
             if (iOutput.Bytes() == bufferLimit)
             {
-                iTrackOffset +=
-                    iController->OutputAudioPcm(
-                                    iOutput,
-                                    iAvCodecContext->channels,
-                                    iAvCodecContext->sample_rate,
-                                    iOutputBitDepth,
-                                    AudioDataEndian::Big,
-                                    iTrackOffset);
-
-                iOutput.SetBytes(0);
+                outputPcm();
+
                 out        = (TUint8 *)iOutput.Ptr();
                 outIndex   = 0;
             }
@@ -1078,6 +2956,31 @@ void CodecLibAV::processPCM(TUint8 **pcmData, AVSampleFormat fmt,
                     break;
                 }
 
+                case 32:
+                {
+                    TUint32  sample    = ((TUint32 *)pcmData[plane])[ps];
+                    TUint8  *samplePtr = (TUint8 *)&sample;
+
+                    if (isPlatformBigEndian())
+                    {
+                        // No conversion required.
+                        out[outIndex++] = *(samplePtr+0);
+                        out[outIndex++] = *(samplePtr+1);
+                        out[outIndex++] = *(samplePtr+2);
+                        out[outIndex++] = *(samplePtr+3);
+                    }
+                    else
+                    {
+                        // Convert to big endian
+                        out[outIndex++] = *(samplePtr+3);
+                        out[outIndex++] = *(samplePtr+2);
+                        out[outIndex++] = *(samplePtr+1);
+                        out[outIndex++] = *(samplePtr+0);
+                    }
+
+                    break;
+                }
+
                 default:
                 {
                     DBUG_F("[CodecLibAV] processPCM - Unsupported bit "
@@ -1100,45 +3003,134 @@ void CodecLibAV::Process()
     TInt plane_size;
     TInt ret ;
 
+    if (iPcmCacheHit)
+    {
+        outputCachedPcm();
+        return;
+    }
+
     if (! iAvPacketCached)
     {
-        if (av_read_frame(iAvFormatCtx,iAvPacket) < 0)
+        ret = av_read_frame(iAvFormatCtx,iAvPacket);
+
+        rethrowReadException();
+
+#ifdef DECODE_STATS_LOGGING
+        // libavformat allocates the data of each packet read.
+        if ((ret >= 0) && (iAvPacket->buf != NULL))
+        {
+            iDecodeAllocs++;
+        }
+#endif // DECODE_STATS_LOGGING
+
+        if (ret < 0)
         {
 #ifdef DEBUG
             DBUG_F("Info: [CodecLibAV] Process - Frame read error or EOF\n");
 #endif // DEBUG
 
+            if (iOutput.Bytes() > 0)
+            {
+                outputPcm();
+            }
+
+            iPcmCaptureComplete = (ret == AVERROR_EOF) &&
+                                  ! (iStreamStart || iStreamStopped);
+
             THROW(CodecStreamEnded);
         }
     }
     if (iAvPacket->stream_index != iStreamId)
     {
         DBUG_F("[CodecLibAV] Process - ERROR: Skip Packet with Stream %d\n",iAvPacket->stream_index);
+        iAvPacketCached = false;
+        av_packet_unref(iAvPacket);
 	    return;
     }
 
     iAvPacketCached = false;
 
+    if (iSeekIndexing)
+    {
+        updateSeekIndex();
+    }
+
+#ifdef DECODE_STATS_LOGGING
+    TUint64 decodeStart = monotonicUs();
+    TUint64 cpuStart    = threadCpuNs();
+#endif // DECODE_STATS_LOGGING
+
     ret = avcodec_send_packet(iAvCodecContext, iAvPacket);
+
+#ifdef DECODE_STATS_LOGGING
+    iDecodeUs    += monotonicUs() - decodeStart;
+    iDecodeCpuNs += threadCpuNs() - cpuStart;
+#endif // DECODE_STATS_LOGGING
     if(ret < 0)
     {
 #ifdef DEBUG
         DBUG_F("Info: [CodecLibAV] Process - Error Decoding Frame\n");
 #endif // DEBUG
 
-        av_packet_free(&iAvPacket);
+        av_packet_unref(iAvPacket);
 
         return;
     }
     while (ret >= 0)
     {
+#ifdef DECODE_STATS_LOGGING
+        decodeStart = monotonicUs();
+        cpuStart    = threadCpuNs();
+#endif // DECODE_STATS_LOGGING
+
         ret = avcodec_receive_frame(iAvCodecContext, iAvFrame);
+
+#ifdef DECODE_STATS_LOGGING
+        iDecodeUs    += monotonicUs() - decodeStart;
+        iDecodeCpuNs += threadCpuNs() - cpuStart;
+#endif // DECODE_STATS_LOGGING
+
         if (ret < 0 || ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) 
         {
-            av_packet_free(&iAvPacket);
+            av_packet_unref(iAvPacket);
             return;
         }
 
+#ifdef DECODE_STATS_LOGGING
+        iDecodedSamples += iAvFrame->nb_samples;
+#endif // DECODE_STATS_LOGGING
+
+        // The parameters of a cached stream are checked against its first
+        // frame, correcting them as for a live stream.
+        if ((iLiveStream || iCacheChecking) &&
+            ((iAvFrame->sample_rate != iLiveSampleRate) ||
+             (iAvFrame->channels    != iLiveChannels)))
+        {
+            if (iCacheChecking)
+            {
+                evictCachedStream();
+            }
+
+            refineLiveStream();
+        }
+
+        iCacheChecking = false;
+
+        // Following a seek discard any audio preceding the seek target.
+        TInt startSample = 0;
+
+        if (iSeekTrimPending)
+        {
+            if (! trimSeekFrame(startSample))
+            {
+                continue;
+            }
+        }
+        else if (iSeekTimelineLost)
+        {
+            trackSeekTimeline();
+        }
+
         TInt data_size =
             av_samples_get_buffer_size(&plane_size,
                                         iAvCodecContext->channels,
@@ -1150,7 +3142,7 @@ void CodecLibAV::Process()
         {
             DBUG_F("ERROR:  Cannot obtain frame plane size\n");
 
-            av_packet_free(&iAvPacket);
+            av_packet_unref(iAvPacket);
             THROW(CodecStreamCorrupt);
         }
 
@@ -1158,14 +3150,15 @@ void CodecLibAV::Process()
         {
             case AV_SAMPLE_FMT_FLTP:
             case AV_SAMPLE_FMT_FLT:
+            case AV_SAMPLE_FMT_DBLP:
+            case AV_SAMPLE_FMT_DBL:
             {
-                // Use 'libavresample' to convert FLT[P] to a more
+                // Use 'libswresample' to convert FLT[P]/DBL[P] to a more
                 // usable format.
                 //
                 // The transform is setup in StreamInitialise()
                 TInt    outSamples;
                 TInt    outLinesize;
-                TUint8 *convertedData;
                 TInt    ret;
 
                 // The number of samples expected in the converted buffer.
@@ -1179,30 +3172,52 @@ void CodecLibAV::Process()
                                 iAvCodecContext->sample_rate,
                                 AV_ROUND_UP);
 
-                // Allocate a buffer for the conversion output.
-                ret = av_samples_alloc((TUint8 **)&convertedData,
-                                    &outLinesize,
-                                    iAvCodecContext->channels,
-                                    outSamples,
-                                    iConvertedFormat,
-                                    0);
-
-                if (ret < 0)
+                // The conversion output buffer is retained, growing when a
+                // larger frame is decoded.
+                if ((outSamples > iConvertedSamples) ||
+                    (iAvCodecContext->channels != iConvertedChannels))
                 {
-                    DBUG_F("[CodecLibAV] Process - ERROR: Cannot "
-                        "Allocate Sample Conversion Buffer\n");
-                    THROW(CodecStreamEnded);
+                    av_freep(&iConvertedData[0]);
+
+                    ret = av_samples_alloc(iConvertedData,
+                                        &outLinesize,
+                                        iAvCodecContext->channels,
+                                        outSamples,
+                                        iConvertedFormat,
+                                        0);
+
+                    if (ret < 0)
+                    {
+                        DBUG_F("[CodecLibAV] Process - ERROR: Cannot "
+                            "Allocate Sample Conversion Buffer\n");
+
+                        iConvertedData[0]  = NULL;
+                        iConvertedSamples  = 0;
+                        iConvertedChannels = 0;
+
+                        THROW(CodecStreamEnded);
+                    }
+
+                    iConvertedSamples  = outSamples;
+                    iConvertedChannels = iAvCodecContext->channels;
+
+#ifdef DECODE_STATS_LOGGING
+                    iDecodeAllocs++;
+#endif // DECODE_STATS_LOGGING
                 }
-                swr_convert(iSwrResampleCtx,
-                                (TUint8 **)&convertedData,
+
+                ret = swr_convert(iSwrResampleCtx,
+                                iConvertedData,
                                 outSamples,
                                 (const uint8_t**)iAvFrame->extended_data,
                                 iAvFrame->nb_samples);
 
-                processPCM((TUint8 **)&convertedData, iConvertedFormat,
-                        outLinesize);
-
-                av_freep(&convertedData);
+                if (ret > 0)
+                {
+                    processPCM(iConvertedData, iConvertedFormat,
+                            ret * av_get_bytes_per_sample(iConvertedFormat),
+                            startSample);
+                }
 
                 break;
             }
@@ -1213,7 +3228,7 @@ void CodecLibAV::Process()
             case AV_SAMPLE_FMT_U8P:
             {
                 processPCM(iAvFrame->extended_data, iAvCodecContext->sample_fmt,
-                        plane_size);
+                        plane_size, startSample);
                 break;
             }
 
@@ -1224,7 +3239,7 @@ void CodecLibAV::Process()
             case AV_SAMPLE_FMT_U8:
             {
                 processPCM(iAvFrame->extended_data, iAvCodecContext->sample_fmt,
-                        iAvFrame->linesize[0]);
+                        iAvFrame->linesize[0], startSample);
                 break;
             }
             default:
@@ -1236,25 +3251,19 @@ void CodecLibAV::Process()
         }
     }
 
-    av_packet_free(&iAvPacket);
+    av_packet_unref(iAvPacket);
 
     if (iStreamStart || iStreamEnded)
     {
         if (iOutput.Bytes() > 0)
         {
             // Flush PCM buffer.
-            iTrackOffset +=
-                iController->OutputAudioPcm(
-                                iOutput,
-                                iAvCodecContext->channels,
-                                iAvCodecContext->sample_rate,
-                                iOutputBitDepth,
-                                AudioDataEndian::Big,
-                                iTrackOffset);
-
-            iOutput.SetBytes(0);
+            outputPcm();
         }
 
+        // The stream has been decoded in full if it ran to its end.
+        iPcmCaptureComplete = ! (iStreamStart || iStreamStopped);
+
         if (iStreamStart)
         {
             DBUG_F("[CodecLibAV] Process - Throw CodecStreamStart\n");
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <OpenHome/Media/Codec/CodecController.h>
+#include <OpenHome/Media/MimeTypeList.h>
+
+namespace OpenHome {
+namespace Media {
+namespace Codec {
+
+// Decodes the formats routed to libavcodec, see CodecRouting.
+//
+// A codec without aCaches neither uses nor fills the seek index and decoded
+// PCM caches, eg. when measuring the decoder.
+CodecBase* NewCodecLibAV(IMimeTypeList& aMimeTypeList, TBool aCaches = true);
+
+} // namespace Codec
+} // namespace Media
+} // namespace OpenHome
@@ -0,0 +1,752 @@
+#include <OpenHome/Media/Pipeline/Msg.h>
+#include <OpenHome/Private/Printer.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "LoudnessNormaliser.h"
+#include "OpenHomePlayer.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+using namespace std;
+
+// Gating blocks quieter than this are ignored, as are those quieter than
+// the relative gate below the loudness of the blocks passing this one.
+static const double kAbsoluteGateLufs = -70.0;
+static const double kRelativeGateLu   = -10.0;
+
+// Added to the filter input, keeping the filter state clear of denormals
+// as it decays in silence.
+static const float kAntiDenormal = 1.0e-18f;
+
+static double loudness(double aMeanSquare)
+{
+    return -0.691 + (10.0 * log10(aMeanSquare));
+}
+
+// Serialisation helpers.
+//
+// The cache is local to the host so is stored in native byte order.
+static void append(vector<TByte>& aData, const void* aValue, size_t aBytes)
+{
+    const TByte *ptr = (const TByte *)aValue;
+
+    aData.insert(aData.end(), ptr, ptr + aBytes);
+}
+
+static TBool extract(const vector<TByte>& aData, size_t& aOffset,
+                     void* aValue, size_t aBytes)
+{
+    if (aOffset + aBytes > aData.size())
+    {
+        return false;
+    }
+
+    memcpy(aValue, &aData[aOffset], aBytes);
+    aOffset += aBytes;
+
+    return true;
+}
+
+// FNV-1a hash of the leading aBytes of aData.
+static TUint32 checksum(const vector<TByte>& aData, size_t aBytes)
+{
+    TUint32 hash = 2166136261U;
+
+    for (size_t i=0; i<aBytes; i++)
+    {
+        hash ^= aData[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+// LoudnessMeter
+
+LoudnessMeter::LoudnessMeter()
+{
+    Reset(0, 0);
+}
+
+// Design the K-weighting filter for aSampleRate, as a high shelf followed
+// by a high pass, and clear the measurement.
+void LoudnessMeter::Reset(TUint aSampleRate, TUint aChannels)
+{
+    iSampleRate = aSampleRate;
+    iChannels   = std::min(aChannels, (TUint)kMaxChannels);
+    iFrames     = 0;
+    iStepFrames = std::max(aSampleRate / kStepsPerSecond, 1u);
+    iStepCount  = 0;
+    iStepsSeen  = 0;
+
+    memset(iZ1, 0, sizeof(iZ1));
+    memset(iZ2, 0, sizeof(iZ2));
+    memset(iSquares, 0, sizeof(iSquares));
+    memset(iSteps, 0, sizeof(iSteps));
+    memset(iCounts, 0, sizeof(iCounts));
+    memset(iEnergies, 0, sizeof(iEnergies));
+
+    // The surround channels of 5.1 are weighted +1.5dB, and the LFE is
+    // excluded. Unused lanes have no weight.
+    for (TUint c=0; c<kMaxChannels; c++)
+    {
+        iWeights[c] = (c < iChannels) ? 1.0f : 0.0f;
+    }
+
+    if (iChannels == 6)
+    {
+        iWeights[3] = 0.0f;
+        iWeights[4] = 1.41f;
+        iWeights[5] = 1.41f;
+    }
+
+    if (aSampleRate == 0)
+    {
+        for (TUint s=0; s<kStages; s++)
+        {
+            iB0[s] = 1.0f;
+            iB1[s] = iB2[s] = iA1[s] = iA2[s] = 0.0f;
+        }
+
+        return;
+    }
+
+    // The filter of BS.1770 is specified at 48kHz, so is redesigned from
+    // its analogue prototype for other rates.
+    double k  = tan(M_PI * 1681.974450955533 / aSampleRate);
+    double q  = 0.7071752369554196;
+    double vh = pow(10.0, 3.999843853973347 / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + (k / q) + (k * k);
+
+    iB0[kShelf] = (float)((vh + (vb * k / q) + (k * k)) / a0);
+    iB1[kShelf] = (float)((2.0 * ((k * k) - vh)) / a0);
+    iB2[kShelf] = (float)((vh - (vb * k / q) + (k * k)) / a0);
+    iA1[kShelf] = (float)((2.0 * ((k * k) - 1.0)) / a0);
+    iA2[kShelf] = (float)((1.0 - (k / q) + (k * k)) / a0);
+
+    k  = tan(M_PI * 38.13547087602444 / aSampleRate);
+    q  = 0.5003270373238773;
+    a0 = 1.0 + (k / q) + (k * k);
+
+    iB0[kHighPass] = 1.0f;
+    iB1[kHighPass] = -2.0f;
+    iB2[kHighPass] = 1.0f;
+    iA1[kHighPass] = (float)((2.0 * ((k * k) - 1.0)) / a0);
+    iA2[kHighPass] = (float)((1.0 - (k / q) + (k * k)) / a0);
+}
+
+TUint LoudnessMeter::SampleRate() const
+{
+    return iSampleRate;
+}
+
+TUint LoudnessMeter::Channels() const
+{
+    return iChannels;
+}
+
+TUint64 LoudnessMeter::Frames() const
+{
+    return iFrames;
+}
+
+void LoudnessMeter::Process(const TByte* aData, TUint aFrames,
+                            TUint aSubsampleBytes)
+{
+    if ((iChannels == 0) || (iSampleRate == 0))
+    {
+        return;
+    }
+
+    const TUint lanes = (iChannels + 3) / 4;
+    const float scale = (aSubsampleBytes == 2) ? 1.0f / 32768.0f
+                                               : 1.0f / 2147483648.0f;
+    Vec4        b0[kStages], b1[kStages], b2[kStages];
+    Vec4        a1[kStages], a2[kStages];
+    Vec4        z1[kStages][kLanes];
+    Vec4        z2[kStages][kLanes];
+    Vec4        squares[kLanes];
+    Vec4        weights[kLanes];
+    Vec4        frame[kLanes];
+    float       samples[kMaxChannels];
+
+    // Work on vectors in locals, the members being floats.
+    for (TUint s=0; s<kStages; s++)
+    {
+        b0[s] = (Vec4){iB0[s], iB0[s], iB0[s], iB0[s]};
+        b1[s] = (Vec4){iB1[s], iB1[s], iB1[s], iB1[s]};
+        b2[s] = (Vec4){iB2[s], iB2[s], iB2[s], iB2[s]};
+        a1[s] = (Vec4){iA1[s], iA1[s], iA1[s], iA1[s]};
+        a2[s] = (Vec4){iA2[s], iA2[s], iA2[s], iA2[s]};
+    }
+
+    static_assert(sizeof(z1) == sizeof(iZ1), "Filter state size mismatch");
+
+    memcpy(z1, iZ1, sizeof(z1));
+    memcpy(z2, iZ2, sizeof(z2));
+    memcpy(squares, iSquares, sizeof(squares));
+    memcpy(weights, iWeights, sizeof(weights));
+    memset(samples, 0, sizeof(samples));
+
+    for (TUint f=0; f<aFrames; f++)
+    {
+        for (TUint c=0; c<iChannels; c++)
+        {
+            TUint index = (f * iChannels) + c;
+
+            samples[c] = ((aSubsampleBytes == 2)
+                              ? ((const TInt16 *)aData)[index] * scale
+                              : ((const TInt32 *)aData)[index] * scale) +
+                         kAntiDenormal;
+        }
+
+        memcpy(frame, samples, lanes * sizeof(Vec4));
+
+        // Transposed direct form II, four channels at a time.
+        for (TUint l=0; l<lanes; l++)
+        {
+            Vec4 x = frame[l];
+
+            for (TUint s=0; s<kStages; s++)
+            {
+                Vec4 y = (b0[s] * x) + z1[s][l];
+
+                z1[s][l] = (b1[s] * x) - (a1[s] * y) + z2[s][l];
+                z2[s][l] = (b2[s] * x) - (a2[s] * y);
+                x        = y;
+            }
+
+            squares[l] += weights[l] * x * x;
+        }
+
+        if (++iStepCount == iStepFrames)
+        {
+            float  sums[kMaxChannels];
+            double energy = 0.0;
+
+            memcpy(sums, squares, lanes * sizeof(Vec4));
+
+            for (TUint c=0; c<iChannels; c++)
+            {
+                energy += sums[c];
+            }
+
+            for (TUint l=0; l<lanes; l++)
+            {
+                squares[l] = (Vec4){0.0f, 0.0f, 0.0f, 0.0f};
+            }
+
+            iStepCount = 0;
+
+            step(energy / iStepFrames);
+        }
+    }
+
+    memcpy(iZ1, z1, sizeof(z1));
+    memcpy(iZ2, z2, sizeof(z2));
+    memcpy(iSquares, squares, sizeof(squares));
+
+    iFrames += aFrames;
+}
+
+// Complete a step of 100ms, adding the gating block ending with it to the
+// histogram.
+void LoudnessMeter::step(double aEnergy)
+{
+    iSteps[iStepsSeen % kStepsPerBlock] = aEnergy;
+    iStepsSeen++;
+
+    if (iStepsSeen < kStepsPerBlock)
+    {
+        return;
+    }
+
+    double block = 0.0;
+
+    for (TUint i=0; i<kStepsPerBlock; i++)
+    {
+        block += iSteps[i];
+    }
+
+    block /= kStepsPerBlock;
+
+    if (block <= 0.0)
+    {
+        return;
+    }
+
+    double lufs = loudness(block);
+
+    if (lufs < kAbsoluteGateLufs)
+    {
+        return;
+    }
+
+    TUint bin = std::min((TUint)((lufs - kAbsoluteGateLufs) * 10.0),
+                         kHistogramBins - 1);
+
+    iCounts[bin]++;
+    iEnergies[bin] += block;
+}
+
+TBool LoudnessMeter::Integrated(double& aLufs) const
+{
+    double energy = 0.0;
+    TUint  count  = 0;
+
+    for (TUint b=0; b<kHistogramBins; b++)
+    {
+        energy += iEnergies[b];
+        count  += iCounts[b];
+    }
+
+    if (count == 0)
+    {
+        return false;
+    }
+
+    // Gate relative to the loudness of the blocks passing the absolute
+    // gate, to the resolution of a bin.
+    const double gate = loudness(energy / count) + kRelativeGateLu;
+
+    energy = 0.0;
+    count  = 0;
+
+    for (TUint b=0; b<kHistogramBins; b++)
+    {
+        if (kAbsoluteGateLufs + ((b + 0.5) / 10.0) > gate)
+        {
+            energy += iEnergies[b];
+            count  += iCounts[b];
+        }
+    }
+
+    if (count == 0)
+    {
+        return false;
+    }
+
+    aLufs = loudness(energy / count);
+
+    return true;
+}
+
+// LoudnessNormaliser
+
+LoudnessNormaliser::LoudnessNormaliser(ILoudnessGain& aGain, TUint aTargetLu)
+    : iGain(aGain)
+    , iTargetMilliLufs(-(TInt)aTargetLu * 1000)
+    , iLock("LNRM")
+    , iUseCount(0)
+    , iDirty(false)
+    , iAnalysing(false)
+    , iTrackKey(0)
+    , iKey(0)
+    , iTrackLengthJiffies(0)
+    , iGainMilliDb(0)
+{
+    iGain.SetLoudnessHeadroom(kMaxBoostMilliDb);
+
+    const char *homePath = getenv("HOME");
+
+    if (homePath == NULL)
+    {
+        return;
+    }
+
+    // The cache lives alongside the application configuration file.
+    string configDir(homePath);
+    configDir += "/.config";
+
+    string appDir(configDir);
+    appDir += "/";
+    appDir += g_appName;
+
+    const string *dirs[] = {&configDir, &appDir};
+
+    for (TUint i=0; i<sizeof(dirs)/sizeof(dirs[0]); i++)
+    {
+        struct stat buf;
+
+        if ((stat(dirs[i]->c_str(), &buf) != 0) &&
+            (mkdir(dirs[i]->c_str(), S_IRWXU | S_IRGRP | S_IXGRP |
+                                     S_IROTH | S_IXOTH) != 0))
+        {
+            Log::Print("LoudnessNormaliser: Cannot create '%s'\n",
+                       dirs[i]->c_str());
+            return;
+        }
+    }
+
+    iPath = appDir + "/LoudnessCache.bin";
+
+    load();
+
+    Log::Print("LoudnessNormaliser: Target %d LUFS, %u tracks cached\n",
+               iTargetMilliLufs / 1000, (TUint)iEntries.size());
+}
+
+LoudnessNormaliser::~LoudnessNormaliser()
+{
+    save();
+}
+
+// The streams that follow belong to the track at aUri.
+void LoudnessNormaliser::TrackStarted(const Brx& aUri)
+{
+    iTrackKey = hash(aUri);
+}
+
+// A stream has started. Complete the measurement of the previous track,
+// and apply the cached gain of this one, or measure it if unknown.
+void LoudnessNormaliser::StreamStarted(TUint64 aTrackLengthJiffies,
+                                       TUint64 aSampleStart, TBool aLive)
+{
+    finish(true);
+
+    const TUint64 key   = iTrackKey;
+    TBool         found = false;
+    Entry         entry;
+
+    {
+        AutoMutex am(iLock);
+
+        auto it = iEntries.find(key);
+
+        if ((key != 0) && (it != iEntries.end()))
+        {
+            it->second.lastUsed = ++iUseCount;
+
+            entry = it->second;
+            found = true;
+        }
+    }
+
+    iKey                = key;
+    iTrackLengthJiffies = aTrackLengthJiffies;
+
+    if (found)
+    {
+        TInt gain = iTargetMilliLufs - (TInt)lrint(entry.lufs * 1000.0);
+
+        setGain(std::min(std::max(gain, -(TInt)kMaxCutMilliDb),
+                         (TInt)kMaxBoostMilliDb));
+        return;
+    }
+
+    setGain(0);
+
+    // Only a whole track can be measured.
+    iAnalysing = (key != 0) && ! aLive && (aSampleStart == 0) &&
+                 (aTrackLengthJiffies != 0);
+
+    iMeter.Reset(0, 0);
+}
+
+// Complete the measurement if the halt ends the track, otherwise continue
+// it when playback resumes.
+void LoudnessNormaliser::StreamHalted()
+{
+    finish(false);
+}
+
+TBool LoudnessNormaliser::Analysing() const
+{
+    return iAnalysing;
+}
+
+void LoudnessNormaliser::Process(const TByte* aData, TUint aFrames,
+                                 TUint aChannels, TUint aSubsampleBytes,
+                                 TUint aSampleRate)
+{
+    if (! iAnalysing)
+    {
+        return;
+    }
+
+    if ((aChannels > LoudnessMeter::kMaxChannels) || (aSampleRate == 0))
+    {
+        iAnalysing = false;
+        return;
+    }
+
+    if ((iMeter.SampleRate() != aSampleRate) ||
+        (iMeter.Channels() != aChannels))
+    {
+        // The format is fixed for a stream, so only changes as it starts.
+        if (iMeter.Frames() != 0)
+        {
+            iAnalysing = false;
+            return;
+        }
+
+        iMeter.Reset(aSampleRate, aChannels);
+    }
+
+    iMeter.Process(aData, aFrames, aSubsampleBytes);
+}
+
+// Cache the loudness of the track if enough has been measured. An
+// incomplete measurement is abandoned if aFinal.
+void LoudnessNormaliser::finish(TBool aFinal)
+{
+    if (! iAnalysing)
+    {
+        return;
+    }
+
+    const TUint   rate     = iMeter.SampleRate();
+    const TUint64 measured = (rate == 0)
+                                 ? 0
+                                 : (iMeter.Frames() * Jiffies::kPerSecond) /
+                                       rate;
+    double        lufs;
+
+    if ((measured < (TUint64)kMinSeconds * Jiffies::kPerSecond) ||
+        (measured * 100 < iTrackLengthJiffies * kMinCoverPercent) ||
+        ! iMeter.Integrated(lufs))
+    {
+        iAnalysing = ! aFinal;
+        return;
+    }
+
+    iAnalysing = false;
+
+    Log::Print("LoudnessNormaliser: Track %016llx measured %.1f LUFS\n",
+               (unsigned long long)iKey, lufs);
+
+    AutoMutex am(iLock);
+
+    // Evict the least recently used entry to make room.
+    if ((iEntries.size() >= kMaxEntries) &&
+        (iEntries.find(iKey) == iEntries.end()))
+    {
+        auto oldest = iEntries.begin();
+
+        for (auto it=iEntries.begin(); it!=iEntries.end(); ++it)
+        {
+            if (it->second.lastUsed < oldest->second.lastUsed)
+            {
+                oldest = it;
+            }
+        }
+
+        iEntries.erase(oldest);
+    }
+
+    Entry& entry = iEntries[iKey];
+
+    entry.lufs     = (float)lufs;
+    entry.lastUsed = ++iUseCount;
+    iDirty         = true;
+}
+
+void LoudnessNormaliser::setGain(TInt aMilliDb)
+{
+    if (aMilliDb != iGainMilliDb)
+    {
+        iGainMilliDb = aMilliDb;
+        iGain.SetLoudnessGain(aMilliDb);
+    }
+}
+
+void LoudnessNormaliser::load()
+{
+    FILE *file = fopen(iPath.c_str(), "rb");
+
+    if (file == NULL)
+    {
+        return;
+    }
+
+    struct stat   buf;
+    vector<TByte> data;
+    TBool         valid = false;
+
+    if ((fstat(fileno(file), &buf) == 0) && (buf.st_size > 0) &&
+        ((size_t)buf.st_size <= 64 + (kMaxEntries * 16)))
+    {
+        data.resize(buf.st_size);
+        valid = (fread(&data[0], 1, data.size(), file) == data.size());
+    }
+
+    fclose(file);
+
+    TUint32 magic   = 0;
+    TUint32 version = 0;
+    TUint32 count   = 0;
+    TUint32 stored  = 0;
+    size_t  offset  = 0;
+
+    valid = valid &&
+            extract(data, offset, &magic, sizeof(magic)) &&
+            extract(data, offset, &version, sizeof(version)) &&
+            extract(data, offset, &count, sizeof(count));
+
+    valid = valid &&
+            (magic == kMagic) && (version == kVersion) &&
+            (count <= kMaxEntries) &&
+            (data.size() == offset + (count * 16) + sizeof(stored));
+
+    if (valid)
+    {
+        memcpy(&stored, &data[data.size() - sizeof(stored)], sizeof(stored));
+        valid = (stored == checksum(data, data.size() - sizeof(stored)));
+    }
+
+    if (! valid)
+    {
+        Log::Print("LoudnessNormaliser: Discarding invalid cache '%s'\n",
+                   iPath.c_str());
+
+        unlink(iPath.c_str());
+        return;
+    }
+
+    for (TUint32 i=0; i<count; i++)
+    {
+        TUint64 key = 0;
+        Entry   entry;
+
+        extract(data, offset, &key, sizeof(key));
+        extract(data, offset, &entry.lufs, sizeof(entry.lufs));
+        extract(data, offset, &entry.lastUsed, sizeof(entry.lastUsed));
+
+        iEntries[key] = entry;
+        iUseCount     = std::max(iUseCount, entry.lastUsed);
+    }
+}
+
+// Write the cache, if changed, to a temporary file then rename it into
+// place, so a failed write leaves the previous cache.
+void LoudnessNormaliser::save()
+{
+    vector<TByte> data;
+
+    {
+        AutoMutex am(iLock);
+
+        if (iPath.empty() || ! iDirty)
+        {
+            return;
+        }
+
+        TUint32 magic   = kMagic;
+        TUint32 version = kVersion;
+        TUint32 count   = (TUint32)iEntries.size();
+
+        data.reserve(16 + (count * 16));
+
+        append(data, &magic, sizeof(magic));
+        append(data, &version, sizeof(version));
+        append(data, &count, sizeof(count));
+
+        for (auto it=iEntries.begin(); it!=iEntries.end(); ++it)
+        {
+            append(data, &it->first, sizeof(it->first));
+            append(data, &it->second.lufs, sizeof(it->second.lufs));
+            append(data, &it->second.lastUsed, sizeof(it->second.lastUsed));
+        }
+
+        iDirty = false;
+    }
+
+    TUint32 sum = checksum(data, data.size());
+    append(data, &sum, sizeof(sum));
+
+    string tmpPath = iPath + ".tmp";
+
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+    {
+        Log::Print("LoudnessNormaliser: Cannot create '%s'\n",
+                   tmpPath.c_str());
+        return;
+    }
+
+    size_t written = 0;
+    TBool  success = true;
+
+    while (written < data.size())
+    {
+        ssize_t ret = write(fd, &data[written], data.size() - written);
+
+        if (ret <= 0)
+        {
+            success = false;
+            break;
+        }
+
+        written += ret;
+    }
+
+    success = success && (fsync(fd) == 0);
+    success = (close(fd) == 0) && success;
+
+    if (! success || (rename(tmpPath.c_str(), iPath.c_str()) != 0))
+    {
+        Log::Print("LoudnessNormaliser: Cannot write '%s'\n", iPath.c_str());
+
+        unlink(tmpPath.c_str());
+    }
+}
+
+// FNV-1a 64 bit hash of aUri, never 0.
+TUint64 LoudnessNormaliser::hash(const Brx& aUri)
+{
+    TUint64 hash = 14695981039346656037ULL;
+
+    for (TUint i=0; i<aUri.Bytes(); i++)
+    {
+        hash ^= aUri[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return (hash == 0) ? 1 : hash;
+}
+
+// Pipeline observer. Tracks and streams are reported in the order they
+// pass through the pipeline.
+
+void LoudnessNormaliser::NotifyPipelineState(EPipelineState /*aState*/)
+{
+    save();
+}
+
+void LoudnessNormaliser::NotifyMode(const Brx& /*aMode*/,
+                                    const ModeInfo& /*aInfo*/,
+                                    const ModeTransportControls& /*aControls*/)
+{
+}
+
+void LoudnessNormaliser::NotifyTrack(Track& /*aTrack*/,
+                                     TBool /*aStartOfStream*/)
+{
+    save();
+}
+
+void LoudnessNormaliser::NotifyMetaText(const Brx& /*aText*/)
+{
+}
+
+void LoudnessNormaliser::NotifyTime(TUint /*aSeconds*/)
+{
+}
+
+void LoudnessNormaliser::NotifyStreamInfo(
+                                    const DecodedStreamInfo& /*aStreamInfo*/)
+{
+}
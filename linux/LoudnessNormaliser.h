@@ -0,0 +1,158 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Media/PipelineObserver.h>
+#include <OpenHome/Private/Standard.h>
+#include <OpenHome/Private/Thread.h>
+
+#include <map>
+#include <string>
+
+namespace OpenHome {
+namespace Media {
+
+// Applies a loudness correction, in addition to the user's volume.
+class ILoudnessGain
+{
+public:
+    // Reserve headroom for boosts of up to aMilliDb, lowering the volume
+    // range by that much.
+    virtual void SetLoudnessHeadroom(TUint aMilliDb) = 0;
+    virtual void SetLoudnessGain(TInt aMilliDb) = 0;
+    virtual ~ILoudnessGain() {}
+};
+
+// EBU R128 (ITU-R BS.1770) integrated loudness, measured incrementally.
+//
+// The audio is K-weighted with the channels of a frame filtered together
+// as vectors of four. Gating blocks of 400ms, overlapping by 75%, are
+// gathered into a histogram of 0.1 LU bins, so memory is constant however
+// long the measurement.
+class LoudnessMeter
+{
+public:
+    static const TUint kMaxChannels = 8;
+public:
+    LoudnessMeter();
+    void    Reset(TUint aSampleRate, TUint aChannels);
+    TUint   SampleRate() const;
+    TUint   Channels() const;
+    TUint64 Frames() const;
+    // Interleaved S16_LE or S32_LE audio.
+    void    Process(const TByte* aData, TUint aFrames,
+                    TUint aSubsampleBytes);
+    // False until a block has passed the gates.
+    TBool   Integrated(double& aLufs) const;
+private:
+    typedef float Vec4 __attribute__((vector_size(16)));
+
+    static const TUint kLanes          = kMaxChannels / 4;
+    static const TUint kStepsPerSecond = 10;
+    static const TUint kStepsPerBlock  = 4;
+    static const TUint kHistogramBins  = 750;  // -70 to +5 LUFS.
+
+    // Stages of the K-weighting filter.
+    enum
+    {
+        kShelf,
+        kHighPass,
+        kStages
+    };
+private:
+    void step(double aEnergy);
+private:
+    TUint   iSampleRate;
+    TUint   iChannels;
+    TUint64 iFrames;
+    float   iB0[kStages];
+    float   iB1[kStages];
+    float   iB2[kStages];
+    float   iA1[kStages];
+    float   iA2[kStages];
+    float   iWeights[kMaxChannels];
+    // The filter state and the sum of the current step, stored as floats
+    // as the object may not be aligned for vectors.
+    float   iZ1[kStages][kMaxChannels];
+    float   iZ2[kStages][kMaxChannels];
+    float   iSquares[kMaxChannels];
+    TUint   iStepFrames;
+    TUint   iStepCount;
+    double  iSteps[kStepsPerBlock];  // Mean square of the recent steps.
+    TUint   iStepsSeen;
+    TUint32 iCounts[kHistogramBins];
+    double  iEnergies[kHistogramBins];
+};
+
+// Normalises the loudness of tracks, by the integrated loudness of each
+// track measured the first time it plays through from the start.
+//
+// Loudness is cached persistently per track URI. On a cache hit the gain
+// is applied through the volume, and the track is not measured again.
+//
+// DriverAlsa reports each track and stream and passes the audio to be
+// measured on the animator thread. The cache is written on the pipeline
+// observer thread, so the animator thread never waits on the disk.
+class LoudnessNormaliser : public IPipelineObserver, private INonCopyable
+{
+    static const TUint32 kMagic           = 0x4f484c43; // 'OHLC'
+    static const TUint32 kVersion         = 1;
+    static const TUint   kMaxEntries      = 8192;
+    static const TUint   kMinSeconds      = 10;
+    static const TUint   kMinCoverPercent = 90;
+    static const TInt    kMaxBoostMilliDb = 6000;
+    static const TInt    kMaxCutMilliDb   = 20000;
+public:
+    // Tracks are normalised to -aTargetLu LUFS.
+    LoudnessNormaliser(ILoudnessGain& aGain, TUint aTargetLu);
+    ~LoudnessNormaliser();
+public: // Called by the driver
+    void  TrackStarted(const Brx& aUri);
+    void  StreamStarted(TUint64 aTrackLengthJiffies, TUint64 aSampleStart,
+                        TBool aLive);
+    void  StreamHalted();
+    TBool Analysing() const;
+    void  Process(const TByte* aData, TUint aFrames, TUint aChannels,
+                  TUint aSubsampleBytes, TUint aSampleRate);
+private: // from IPipelineObserver
+    void NotifyPipelineState(EPipelineState aState) override;
+    void NotifyMode(const Brx& aMode, const ModeInfo& aInfo,
+                    const ModeTransportControls& aTransportControls) override;
+    void NotifyTrack(Track& aTrack, TBool aStartOfStream) override;
+    void NotifyMetaText(const Brx& aText) override;
+    void NotifyTime(TUint aSeconds) override;
+    void NotifyStreamInfo(const DecodedStreamInfo& aStreamInfo) override;
+private:
+    typedef struct
+    {
+        float   lufs;
+        TUint32 lastUsed;
+    } Entry;
+private:
+    void   finish(TBool aFinal);
+    void   setGain(TInt aMilliDb);
+    void   load();
+    void   save();
+    static TUint64 hash(const Brx& aUri);
+private:
+    ILoudnessGain&           iGain;
+    const TInt               iTargetMilliLufs;
+    std::string              iPath;
+    Mutex                    iLock;
+
+    // Guarded by iLock.
+    std::map<TUint64, Entry> iEntries;
+    TUint32                  iUseCount;
+    TBool                    iDirty;
+
+    // Owned by the driver.
+    LoudnessMeter            iMeter;
+    TBool                    iAnalysing;
+    TUint64                  iTrackKey;    // Of the last track, 0 if none.
+    TUint64                  iKey;         // Of the stream.
+    TUint64                  iTrackLengthJiffies;
+    TInt                     iGainMilliDb;
+};
+
+} // namespace Media
+} // namespace OpenHome
@@ -7,18 +7,30 @@
 #else // USE_GTK
 #include <glib.h>
 #endif // USE_GDK
+#include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
+#include <string>
+
 #include <OpenHome/Net/Private/DviStack.h>
 #include <OpenHome/Private/Printer.h>
 #include <OpenHome/Av/Debug.h>
 #include <OpenHome/Media/Debug.h>
 
+#include "AudioTap.h"
 #include "ConfigGTKKeyStore.h"
+#include "Dither.h"
 #include "DriverAlsa.h"
+#include "EqConfig.h"
+#include "FirConvolver.h"
 #include "ExampleMediaPlayer.h"
+#include "LoudnessNormaliser.h"
 #include "OpenHomePlayer.h"
 #include "MediaPlayerIF.h"
+#include "OhmTimestamperAlsa.h"
+#include "PolyphaseResampler.h"
+#include "SongcastSenderAlsa.h"
 #include "UpdateCheck.h"
 #include "version.h"
 
@@ -39,10 +51,17 @@ static const TInt  FourHours     = 4 * 60 * 60;
 static ExampleMediaPlayer* g_emp = NULL; // Example media player instance.
 static Library*            g_lib = NULL; // Library instance.
 static gint                g_tID = 0;
+static gint                g_levelsID = 0;
+static TBool               g_levelsSpectrum = false;
+static Media::LoudnessNormaliser* g_loudness = NULL;
 
 static Media::PriorityArbitratorDriver* g_arbDriver;
 static Media::PriorityArbitratorPipeline* g_arbPipeline;
 
+static Av::OhmTimestamperAlsa* g_txTimestamper = NULL;
+static Av::OhmTimestamperAlsa* g_rxTimestamper = NULL;
+static Av::OhmTimestamperAlsa* g_alsaTimestamper = NULL;
+
 // Timed callback to initiate application update check.
 static gint tCallback(gpointer data)
 {
@@ -91,6 +110,131 @@ static gint tCallback(gpointer data)
     return true;
 }
 
+// Read a string property, creating it empty if absent.
+static TBool ReadConfigString(ConfigGTKKeyStore& aStore, const TChar* aKey,
+                              Bwx& aValue)
+{
+    Brn key(aKey);
+
+    aValue.SetBytes(0);
+
+    try
+    {
+        aStore.Read(key, aValue);
+    }
+    catch (StoreKeyNotFound&)
+    {
+        // Create the property, allowing it to be located and edited in
+        // the config file.
+        aStore.Write(key, Brx::Empty());
+        return false;
+    }
+    catch (StoreReadBufferUndersized&)
+    {
+        Log::Print("Error: MediaPlayerIF: '%s' too long\n", aKey);
+        return false;
+    }
+
+    return true;
+}
+
+// Add the further ALSA devices listed in 'Driver.Alsa.Outputs'.
+//
+// Devices are separated by ';', each optionally followed by '@' and the
+// delay in us aligning it with the other outputs, eg.
+// 'hdmi:CARD=vc4hdmi@0;plughw:CARD=DAC@15000'.
+static void AddAlsaOutputs(DriverAlsa& aDriver, ConfigGTKKeyStore& aStore)
+{
+    Bws<1024> outputs;
+
+    if (! ReadConfigString(aStore, "Driver.Alsa.Outputs", outputs))
+    {
+        return;
+    }
+
+    std::string list((const char *)outputs.Ptr(), outputs.Bytes());
+    size_t      start = 0;
+
+    while (start < list.size())
+    {
+        size_t      end    = list.find(';', start);
+        std::string entry  = list.substr(start, (end == std::string::npos)
+                                                    ? std::string::npos
+                                                    : end - start);
+        size_t      at     = entry.rfind('@');
+        TUint       trimUs = 0;
+
+        if (at != std::string::npos)
+        {
+            trimUs = (TUint)strtoul(entry.c_str() + at + 1, NULL, 10);
+            entry.erase(at);
+        }
+
+        if (! entry.empty())
+        {
+            aDriver.AddOutput(entry.c_str(), trimUs);
+        }
+
+        if (end == std::string::npos)
+        {
+            break;
+        }
+
+        start = end + 1;
+    }
+}
+
+// Timed callback logging the output levels, to diagnose clipping and
+// silent channels remotely. The tap is kept observed for two periods.
+static gint levelsCallback(gpointer data)
+{
+    static TUint32     lastClipped[AudioTap::kMaxChannels] = {};
+    gint               period = GPOINTER_TO_INT(data);
+    AudioTap          *tap    = AudioTap::getInstance();
+    AudioTap::Snapshot snapshot;
+    TChar              line[512];
+    TInt               length;
+
+    tap->Observe(g_levelsSpectrum, 2 * period * 1000);
+
+    if (! tap->Read(snapshot))
+    {
+        return true;
+    }
+
+    length = snprintf(line, sizeof(line), "%uHz",
+                      (TUint)snapshot.iSampleRate);
+
+    for (TUint c=0; c<snapshot.iChannels; c++)
+    {
+        length += snprintf(line + length, sizeof(line) - length,
+                           ", ch%u peak %.1fdB rms %.1fdB clipped %u",
+                           c, snapshot.iPeakDb[c], snapshot.iRmsDb[c],
+                           (TUint)(snapshot.iClipped[c] - lastClipped[c]));
+
+        lastClipped[c] = snapshot.iClipped[c];
+    }
+
+    Log::Print("AudioTap: %s\n", line);
+
+    if (snapshot.iSpectrumValid)
+    {
+        length = 0;
+
+        for (TUint b=0; b<AudioTap::kSpectrumBands; b++)
+        {
+            length += snprintf(line + length, sizeof(line) - length,
+                               " %.0f", snapshot.iBandDb[b]);
+        }
+
+        Log::Print("AudioTap: Spectrum %.0fHz to %.0fHz, dB:%s\n",
+                   snapshot.iBandHz[0],
+                   snapshot.iBandHz[AudioTap::kSpectrumBands - 1], line);
+    }
+
+    return true;
+}
+
 // Media Player thread entry point.
 void InitAndRunMediaPlayer(gpointer args)
 {
@@ -111,6 +255,9 @@ void InitAndRunMediaPlayer(gpointer args)
     Net::CpStack   *cpStack = NULL;
     Net::DvStack   *dvStack = NULL;
     DriverAlsa     *driver  = NULL;
+    SongcastSenderAlsa *sender = NULL;
+    EqConfig       *eqConfig = NULL;
+    TIpAddress      senderInterface;
     Bws<512>        roomStore;
     Bws<512>        nameStore;
     const TChar    *productRoom = room;
@@ -148,6 +295,8 @@ void InitAndRunMediaPlayer(gpointer args)
     // The control point will be used for playback control.
     g_lib->StartCombined(adapter->Subnet(), cpStack, dvStack);
 
+    senderInterface = adapter->Address();
+
     adapter->RemoveRef(cookie);
 
     // Set the default room name from any existing key in the
@@ -190,18 +339,137 @@ void InitAndRunMediaPlayer(gpointer args)
     g_emp = new ExampleMediaPlayer(*dvStack, *cpStack, Brn(udn), productRoom, productName,
                                    Brx::Empty()/*aUserAgent*/);
 
+    // Timestamp Songcast audio against the media clock derived from the
+    // ALSA output, for multi-room synchronisation.
+    g_txTimestamper = new Av::OhmTimestamperAlsa("tx");
+    g_rxTimestamper = new Av::OhmTimestamperAlsa("rx");
+
+    g_emp->SetSongcastTimestampers(*g_txTimestamper, *g_rxTimestamper);
+
     // Add the audio driver to the pipeline.
     //
     // The 22052ms value a is a bit of a magic number which get's
     // things going for the Hifiberry Digi+ card.
     //
     // FIXME This should be calculated.
-    driver = new DriverAlsa(g_emp->Pipeline(), 22052);
+    //
+    // A non zero 'Driver.Alsa.FixedRate' resamples all PCM streams to that
+    // rate.
+    //
+    // The clock puller trims the playback rate of Songcast streams to
+    // hold the receive latency.
+    driver = new DriverAlsa(g_emp->Pipeline(), 22052,
+                            configStore->ReadUint(
+                                    Brn("Driver.Alsa.FixedRate"), 0),
+                            &g_emp->ClockPuller());
     if (driver == NULL)
     {
         goto cleanup;
     }
 
+    // Declarations are scoped so the cleanup path does not cross them.
+    {
+        // Further devices play the same audio. 'Driver.Alsa.TrimUs'
+        // delays the default device to align it with them.
+        driver->SetTrimUs(configStore->ReadUint(Brn("Driver.Alsa.TrimUs"),
+                                                0));
+        AddAlsaOutputs(*driver, *configStore);
+
+        // DSD is played natively where the device supports it. Otherwise
+        // it is sent as DoP only with 'Driver.Alsa.DsdDop' set, as a DAC
+        // that does not decode DoP plays it as full scale noise.
+        TUint dsdSampleBlockWords;
+        TUint dsdPadBytesPerChunk;
+
+        driver->SetDsdDop(configStore->ReadUint(Brn("Driver.Alsa.DsdDop"),
+                                                0) != 0);
+
+        if (driver->DsdBlockConfiguration(dsdSampleBlockWords,
+                                          dsdPadBytesPerChunk))
+        {
+            g_emp->SetDsdBlockConfiguration(dsdSampleBlockWords,
+                                            dsdPadBytesPerChunk);
+        }
+
+        // 'Dsp.Eq' is applied whenever it changes.
+        eqConfig = new EqConfig(g_emp->ConfigInitialiser(), *driver);
+
+        Bws<16> dither;
+
+        if (ReadConfigString(*configStore, "Dsp.Dither", dither))
+        {
+            driver->SetDither(dither);
+        }
+
+        // Log the output levels every 'Diag.Levels.LogSeconds'.
+        TUint levelsSeconds =
+            configStore->ReadUint(Brn("Diag.Levels.LogSeconds"), 0);
+
+        if (levelsSeconds != 0)
+        {
+            g_levelsSpectrum =
+                configStore->ReadUint(Brn("Diag.Levels.Spectrum"), 0) != 0;
+            g_levelsID = g_timeout_add_seconds(levelsSeconds,
+                                               levelsCallback,
+                                               GINT_TO_POINTER(levelsSeconds));
+        }
+
+        Bws<256> firPath;
+
+        if (ReadConfigString(*configStore, "Dsp.Fir.Path", firPath) &&
+            (firPath.Bytes() != 0))
+        {
+            std::string path((const char *)firPath.Ptr(), firPath.Bytes());
+
+            driver->SetFir(path.c_str(),
+                           configStore->ReadUint(
+                                   Brn("Dsp.Fir.PartitionFrames"), 1024),
+                           configStore->ReadUint(Brn("Dsp.Fir.Threads"), 2));
+        }
+
+        // Normalise track loudness to -'Loudness.TargetLu' LUFS, through
+        // the mixer.
+        if (configStore->ReadUint(Brn("Loudness.Enabled"), 0) != 0)
+        {
+            if (g_emp->Volume().IsVolumeSupported())
+            {
+                g_loudness = new Media::LoudnessNormaliser(
+                        g_emp->Volume(),
+                        configStore->ReadUint(Brn("Loudness.TargetLu"), 18));
+
+                g_emp->Pipeline().AddObserver(*g_loudness);
+                driver->SetLoudness(g_loudness);
+            }
+            else
+            {
+                Log::Print("Loudness normalisation requires a mixer\n");
+            }
+        }
+    }
+
+    // With 'Songcast.Sender.Enabled' set the audio played is also sent as
+    // a Songcast stream, so any number of receivers play audio decoded
+    // once. 'Songcast.Sender.Multicast' selects multicast or unicast and
+    // 'Songcast.Sender.PacketUs' the audio per packet. Its timestamper is
+    // its own, as it stamps the audio with the time it plays. It is
+    // published by a Sender device of its own, '<udn>-Sender', as the
+    // player device hosts the Songcast source's sender.
+    if (configStore->ReadUint(Brn("Songcast.Sender.Enabled"), 0) != 0)
+    {
+        g_alsaTimestamper = new Av::OhmTimestamperAlsa("alsa");
+
+        sender = new SongcastSenderAlsa(
+                    g_emp->Env(), *dvStack, Brn(udn),
+                    Brn(productRoom), senderInterface,
+                    configStore->ReadUint(Brn("Songcast.Sender.Multicast"),
+                                          1) != 0,
+                    configStore->ReadUint(Brn("Songcast.Sender.PacketUs"),
+                                          5000),
+                    g_alsaTimestamper);
+
+        driver->SetSender(sender);
+    }
+
     // Create the timeout for update checking.
     if (restarted)
     {
@@ -238,16 +506,42 @@ cleanup:
         g_tID = 0;
     }
 
+    if (g_levelsID != 0)
+    {
+        // Remove the level logging timer.
+        g_source_remove(g_levelsID);
+        g_levelsID = 0;
+    }
+
+    delete eqConfig;
+
+    // The driver passes audio to the sender until it is deleted.
     if (driver != NULL)
     {
         delete driver;
     }
 
+    if (sender != NULL)
+    {
+        delete sender;
+    }
+
     if (g_emp != NULL)
     {
         delete g_emp;
     }
 
+    delete g_loudness;
+    g_loudness = NULL;
+
+    delete g_txTimestamper;
+    delete g_rxTimestamper;
+    delete g_alsaTimestamper;
+
+    g_txTimestamper   = NULL;
+    g_rxTimestamper   = NULL;
+    g_alsaTimestamper = NULL;
+
     if (g_lib != NULL)
     {
         delete g_lib;
@@ -268,6 +562,43 @@ void ExitMediaPlayer()
     }
 }
 
+// Log the CPU used by the FIR convolver, without running the player.
+void BenchmarkFir(TUint aTaps, TUint aPartitionFrames, TUint aThreads)
+{
+    Library *lib = new Library(InitialisationParams::Create());
+
+    FirConvolver::Benchmark(aTaps, aPartitionFrames, aThreads);
+
+    delete lib;
+}
+
+void BenchmarkDither()
+{
+    Library *lib = new Library(InitialisationParams::Create());
+
+    Dither::Benchmark();
+
+    delete lib;
+}
+
+void BenchmarkResampler()
+{
+    Library *lib = new Library(InitialisationParams::Create());
+
+    PolyphaseResampler::Benchmark();
+
+    delete lib;
+}
+
+void BenchmarkSongcastSkew()
+{
+    Library *lib = new Library(InitialisationParams::Create());
+
+    MediaClockAlsa::Benchmark();
+
+    delete lib;
+}
+
 void PipeLinePlay()
 {
     if (g_emp != NULL)
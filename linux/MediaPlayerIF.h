@@ -39,6 +39,20 @@ void PipeLinePlay();                     // Pipeline - Play
 void PipeLinePause();                    // Pipeline - Pause
 void PipeLineStop();                     // Pipeline - Stop
 
+// Log the CPU used by FIR room correction, see FirConvolver::Benchmark().
+void BenchmarkFir(OpenHome::TUint aTaps, OpenHome::TUint aPartitionFrames,
+                  OpenHome::TUint aThreads);
+
+// Log the CPU used by dither, see Dither::Benchmark().
+void BenchmarkDither();
+
+// Log the response and CPU used by the resampler, see
+// PolyphaseResampler::Benchmark().
+void BenchmarkResampler();
+
+// Log the Songcast skew between rooms, see MediaClockAlsa::Benchmark().
+void BenchmarkSongcastSkew();
+
 // Get a list of available subnets
 std::vector<SubnetRecord*> * GetSubnets();
 
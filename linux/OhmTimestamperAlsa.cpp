@@ -0,0 +1,419 @@
+#include <OpenHome/Private/Printer.h>
+
+#include <algorithm>
+#include <random>
+
+#include <math.h>
+#include <time.h>
+
+#include "OhmTimestamperAlsa.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Av;
+using namespace OpenHome::Media;
+
+// Weight given to each measurement of the device clock.
+static const double kRateSmoothing = 0.25;
+
+// MediaClockAlsa
+
+MediaClockAlsa::MediaClockAlsa()
+    : iLock("MCAL")
+    , iAnchored(false)
+    , iDeviceValid(false)
+    , iSampleRate(0)
+    , iTickRate(0)
+    , iTicksPerUs(0)
+    , iAnchorUs(0)
+    , iAnchorTicks(0)
+    , iAnchorFrames(0)
+    , iWriteFrame(0)
+    , iRateUs(0)
+    , iRateTicks(0)
+{
+}
+
+TUint64 MediaClockAlsa::MonotonicUs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((TUint64)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+// Songcast timestamps tick at 256 times the base rate of the sample rate
+// family.
+TUint MediaClockAlsa::TickRate(TUint aSampleRate)
+{
+    if ((aSampleRate != 0) && ((aSampleRate % 11025) == 0))
+    {
+        return 44100 * 256;
+    }
+
+    return 48000 * 256;
+}
+
+double MediaClockAlsa::ticksAt(TUint64 aTimestampUs) const
+{
+    return iAnchorTicks + ((TInt64)(aTimestampUs - iAnchorUs) * iTicksPerUs);
+}
+
+void MediaClockAlsa::anchor(TUint64 aTimestampUs, double aTicks)
+{
+    iAnchored    = true;
+    iAnchorUs    = aTimestampUs;
+    iAnchorTicks = aTicks;
+}
+
+// Report the frames played by the device at the monotonic time
+// aTimestampUs.
+void MediaClockAlsa::DeviceStatus(TUint aSampleRate, TUint64 aFramesConsumed,
+                                  TUint64 aTimestampUs)
+{
+    AutoMutex am(iLock);
+
+    if (aSampleRate == 0)
+    {
+        return;
+    }
+
+    if (! iAnchored)
+    {
+        iTickRate   = TickRate(aSampleRate);
+        iTicksPerUs = iTickRate / 1000000.0;
+
+        anchor(aTimestampUs, 0);
+    }
+
+    // Re-anchor the device to the extrapolated clock after the device has
+    // been reconfigured or has stalled.
+    if (! iDeviceValid || (aSampleRate != iSampleRate) ||
+        (aFramesConsumed < iAnchorFrames) || (aTimestampUs <= iAnchorUs) ||
+        (aTimestampUs - iAnchorUs > kMaxStatusGapUs))
+    {
+        double ticks = ticksAt(aTimestampUs);
+
+        if (aSampleRate != iSampleRate)
+        {
+            iTickRate   = TickRate(aSampleRate);
+            iTicksPerUs = iTickRate / 1000000.0;
+        }
+
+        iSampleRate   = aSampleRate;
+        iDeviceValid  = true;
+        iAnchorFrames = aFramesConsumed;
+        iRateUs       = aTimestampUs;
+        iRateTicks    = ticks;
+
+        anchor(aTimestampUs, ticks);
+
+        return;
+    }
+
+    double ticks = iAnchorTicks + (((aFramesConsumed - iAnchorFrames) *
+                                    (double)iTickRate) / iSampleRate);
+
+    iAnchorFrames = aFramesConsumed;
+
+    anchor(aTimestampUs, ticks);
+
+    // Measure the device clock over a longer interval than that between
+    // writes, as the frame count is only accurate to a frame.
+    if (aTimestampUs - iRateUs < kRateIntervalUs)
+    {
+        return;
+    }
+
+    double measured = (ticks - iRateTicks) / (aTimestampUs - iRateUs);
+    double nominal  = iTickRate / 1000000.0;
+    double maxDrift = nominal * kMaxDriftPpm / 1000000.0;
+
+    if (measured > nominal + maxDrift)
+    {
+        measured = nominal + maxDrift;
+    }
+    else if (measured < nominal - maxDrift)
+    {
+        measured = nominal - maxDrift;
+    }
+
+    iTicksPerUs += kRateSmoothing * (measured - iTicksPerUs);
+    iRateUs      = aTimestampUs;
+    iRateTicks   = ticks;
+}
+
+// The device has been reconfigured, so its frame count has restarted.
+void MediaClockAlsa::Discontinuity()
+{
+    AutoMutex am(iLock);
+
+    iDeviceValid = false;
+}
+
+// The audio the driver writes next will play at device frame aFrame,
+// counted as the frames consumed are.
+void MediaClockAlsa::WritePosition(TUint64 aFrame)
+{
+    AutoMutex am(iLock);
+
+    iWriteFrame = aFrame;
+}
+
+// The time in ticks at which the device will play the audio aFrames, at
+// aSampleRate, after that written next.
+//
+// The anchor is the frame played at the htstamp of the last status, so a
+// frame plays its distance from the anchor later. Until the device has
+// reported its status the audio is taken to play now.
+TUint MediaClockAlsa::WriteTicks(TUint aFrames, TUint aSampleRate)
+{
+    return writeTicks(aFrames, aSampleRate, MonotonicUs());
+}
+
+// The current time in Songcast media clock ticks.
+TUint MediaClockAlsa::Ticks()
+{
+    return ticks(MonotonicUs());
+}
+
+TUint MediaClockAlsa::writeTicks(TUint aFrames, TUint aSampleRate,
+                                 TUint64 aNowUs)
+{
+    AutoMutex am(iLock);
+
+    if (! iAnchored)
+    {
+        iTickRate   = TickRate(0);
+        iTicksPerUs = iTickRate / 1000000.0;
+
+        anchor(aNowUs, 0);
+    }
+
+    double ticks;
+
+    if (iDeviceValid)
+    {
+        ticks = iAnchorTicks + (((TInt64)(iWriteFrame - iAnchorFrames) *
+                                 (double)iTickRate) / iSampleRate);
+    }
+    else
+    {
+        ticks = ticksAt(aNowUs);
+    }
+
+    if (aSampleRate != 0)
+    {
+        ticks += ((double)aFrames * iTickRate) / aSampleRate;
+    }
+
+    return (TUint)(TInt64)ticks;
+}
+
+TUint MediaClockAlsa::ticks(TUint64 aNowUs)
+{
+    AutoMutex am(iLock);
+
+    if (! iAnchored)
+    {
+        iTickRate   = TickRate(0);
+        iTicksPerUs = iTickRate / 1000000.0;
+
+        anchor(aNowUs, 0);
+    }
+
+    // The tick count wraps, as the Songcast timestamp does.
+    return (TUint)(TInt64)ticksAt(aNowUs);
+}
+
+// Simulate a sender playing 48kHz audio through a device running 50ppm
+// fast. The driver writes 10ms blocks to a 100ms buffer, each sent as two
+// Songcast frames by a thread woken up to 4ms late, and the device status
+// htstamps are jittered by 20us.
+//
+// The sender's room hears each frame as the device plays it. A receiver
+// playing each frame at its timestamp, plus the latency both rooms share,
+// is skewed from the sender's room by the timestamp less the ticks at
+// which the frame is heard. Timestamps taken as frames are sent, as
+// before the driver reported the write position, are compared with the
+// presentation timestamps the driver now sets.
+void MediaClockAlsa::Benchmark()
+{
+    static const TUint  kSampleRate        = 48000;
+    static const double kDevicePpm         = 50;
+    static const TUint  kBufferFrames      = 4800;
+    static const TUint  kBlockFrames       = 480;
+    static const TUint  kFrameSamples      = 240;   // Per Songcast frame.
+    static const TUint  kBlocks            = 60000;
+    static const TUint  kSettleBlocks      = 2000;  // The rate is measured.
+    static const double kMaxSendLateUs     = 4000;
+    static const double kMaxStatusJitterUs = 20;
+    static const double kStartUs           = 1010000;
+
+    // The mean and spread of a receiver's skew from the sender's room.
+    struct Skew
+    {
+        TUint  iCount;
+        double iSumUs;
+        double iFirstUs;
+        double iSpreadUs;
+
+        void Add(double aUs)
+        {
+            if (iCount++ == 0)
+            {
+                iFirstUs = aUs;
+            }
+
+            iSumUs    += aUs;
+            iSpreadUs  = std::max(iSpreadUs, fabs(aUs - iFirstUs));
+        }
+    };
+
+    MediaClockAlsa                         clock;
+    Av::OhmTimestamperAlsa                 timestamper("Benchmark");
+    Av::IOhmTimestamper&                   stamper = timestamper;
+    std::mt19937                           rng(1);
+    std::uniform_real_distribution<double> sendLate(0, kMaxSendLateUs);
+    std::uniform_real_distribution<double> statusJitter(-kMaxStatusJitterUs,
+                                                        kMaxStatusJitterUs);
+
+    const double rate       = kSampleRate * (1 + (kDevicePpm / 1000000));
+    const double ticksPerUs = TickRate(kSampleRate) / 1000000.0;
+    double       nowUs      = 1000000;
+    TUint64      written    = 0;
+    TUint        frame      = 0;
+    Skew         sendTime   = { 0, 0, 0, 0 };
+    Skew         presented  = { 0, 0, 0, 0 };
+
+    for (TUint i=0; i<kBlocks; i++)
+    {
+        // The driver waits until the device has room for a block.
+        double playedFrames = (nowUs < kStartUs)
+                                  ? 0 : ((nowUs - kStartUs) * rate) / 1000000;
+
+        if ((written > kBufferFrames) &&
+            (written - playedFrames > kBufferFrames - kBlockFrames))
+        {
+            nowUs = kStartUs + (((written - (kBufferFrames - kBlockFrames)) *
+                                 1000000) / rate);
+        }
+
+        clock.WritePosition(written);
+
+        TUint stamps[kBlockFrames / kFrameSamples];
+
+        for (TUint f=0; f<kBlockFrames/kFrameSamples; f++)
+        {
+            stamps[f] = clock.writeTicks(f * kFrameSamples, kSampleRate,
+                                         (TUint64)nowUs);
+        }
+
+        TUint64 blockFrame = written;
+        double  statusUs   = nowUs + statusJitter(rng);
+
+        written      += kBlockFrames;
+        playedFrames  = (statusUs < kStartUs)
+                            ? 0 : ((statusUs - kStartUs) * rate) / 1000000;
+
+        clock.DeviceStatus(kSampleRate, (TUint64)playedFrames,
+                           (TUint64)statusUs);
+
+        for (TUint f=0; f<kBlockFrames/kFrameSamples; f++)
+        {
+            double heardUs = kStartUs +
+                             (((blockFrame + (f * kFrameSamples)) * 1000000) /
+                              rate);
+            TUint  sent    = clock.ticks((TUint64)(nowUs + sendLate(rng)));
+
+            timestamper.SetNextTimestamp(stamps[f]);
+
+            TUint  present = stamper.Timestamp(frame++);
+            TUint  heard   = clock.ticks((TUint64)heardUs);
+
+            if (i >= kSettleBlocks)
+            {
+                sendTime.Add((TInt)(sent - heard) / ticksPerUs);
+                presented.Add((TInt)(present - heard) / ticksPerUs);
+            }
+        }
+    }
+
+    Log::Print("MediaClockAlsa: Receiver skew from the sender's room, "
+               "device %+.0fppm, frames sent up to %.0fms late\n",
+               kDevicePpm, kMaxSendLateUs / 1000);
+    Log::Print("  send time stamps:    %7.0fus mean, %5.0fus spread\n",
+               sendTime.iSumUs / sendTime.iCount, sendTime.iSpreadUs);
+    Log::Print("  presentation stamps: %7.0fus mean, %5.0fus spread\n",
+               presented.iSumUs / presented.iCount, presented.iSpreadUs);
+}
+
+// OhmTimestamperAlsa
+
+OhmTimestamperAlsa::OhmTimestamperAlsa(const TChar* aName)
+    : iName(aName)
+    , iLock("OHMT")
+    , iNextValid(false)
+    , iNextTicks(0)
+{
+    for (TUint i=0; i<kFrames; i++)
+    {
+        iStamps[i].iValid = false;
+    }
+}
+
+void OhmTimestamperAlsa::SetNextTimestamp(TUint aTicks)
+{
+    AutoMutex am(iLock);
+
+    iNextValid = true;
+    iNextTicks = aTicks;
+}
+
+void OhmTimestamperAlsa::Start(const Endpoint& /*aDst*/)
+{
+    Log::Print("OhmTimestamperAlsa(%s): Start\n", iName);
+}
+
+void OhmTimestamperAlsa::Stop()
+{
+    Log::Print("OhmTimestamperAlsa(%s): Stop\n", iName);
+
+    AutoMutex am(iLock);
+
+    iNextValid = false;
+
+    for (TUint i=0; i<kFrames; i++)
+    {
+        iStamps[i].iValid = false;
+    }
+}
+
+// A frame given a time by SetNextTimestamp() keeps it, should it be
+// stamped again. Any other frame is stamped with the current time.
+TUint OhmTimestamperAlsa::Timestamp(TUint aFrame)
+{
+    AutoMutex am(iLock);
+
+    Stamp& stamp = iStamps[aFrame % kFrames];
+
+    if (iNextValid)
+    {
+        iNextValid   = false;
+        stamp.iValid = true;
+        stamp.iFrame = aFrame;
+        stamp.iTicks = iNextTicks;
+    }
+
+    if (stamp.iValid && (stamp.iFrame == aFrame))
+    {
+        return stamp.iTicks;
+    }
+
+    return MediaClockAlsa::getInstance()->Ticks();
+}
+
+TBool OhmTimestamperAlsa::SupportsTimestamps()
+{
+    return true;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Av/Songcast/OhmTimestamp.h>
+#include <OpenHome/Private/Thread.h>
+
+namespace OpenHome {
+class Endpoint;
+namespace Media {
+
+// Songcast media clock, derived from the ALSA output.
+//
+// DriverAlsa reports the frames the device has played against the
+// monotonic clock each time it writes. The clock ticks at 256 times the
+// base rate of the device's sample rate family, advancing with the device
+// while it plays and free running from the monotonic clock while it is
+// idle, so it does not step as the device starts and stops.
+//
+// The driver also reports the device frame at which the audio it writes
+// next will play, so audio may be stamped with the time it is heard: the
+// status htstamp plus the delay to that frame.
+class MediaClockAlsa
+{
+private:
+    MediaClockAlsa();
+
+    // Stop the compiler generating methods of copy and assignment operators.
+    MediaClockAlsa(MediaClockAlsa const& copy);
+    MediaClockAlsa& operator=(MediaClockAlsa const& copy);
+
+public:
+    static MediaClockAlsa *getInstance()
+    {
+        static MediaClockAlsa instance;
+        return &instance;
+    }
+
+public: // Called by the driver
+    void    DeviceStatus(TUint aSampleRate, TUint64 aFramesConsumed,
+                         TUint64 aTimestampUs);
+    void    Discontinuity();
+    void    WritePosition(TUint64 aFrame);
+public:
+    TUint   Ticks();
+    TUint   WriteTicks(TUint aFrames, TUint aSampleRate);
+    static TUint64 MonotonicUs();
+    // Log the skew between the sender's room and a receiver of the send
+    // time and presentation timestamps, simulated against a device clock.
+    static void Benchmark();
+private:
+    static TUint TickRate(TUint aSampleRate);
+    TUint   ticks(TUint64 aNowUs);
+    TUint   writeTicks(TUint aFrames, TUint aSampleRate, TUint64 aNowUs);
+    double  ticksAt(TUint64 aTimestampUs) const;
+    void    anchor(TUint64 aTimestampUs, double aTicks);
+private:
+    static const TUint64 kMaxStatusGapUs = 100000;
+    static const TUint64 kRateIntervalUs = 1000000;
+    static const TUint   kMaxDriftPpm    = 1000;
+
+    mutable Mutex iLock;
+    TBool         iAnchored;
+    TBool         iDeviceValid;
+    TUint         iSampleRate;
+    TUint         iTickRate;
+    double        iTicksPerUs;      // Measured against the device.
+    TUint64       iAnchorUs;
+    double        iAnchorTicks;
+    TUint64       iAnchorFrames;
+    TUint64       iWriteFrame;      // Device frame of the next audio written.
+    TUint64       iRateUs;          // Start of the rate measurement.
+    double        iRateTicks;
+};
+
+} // namespace Media
+
+namespace Av {
+
+// Songcast timestamper reading the ALSA media clock.
+//
+// A sender of the audio played through ALSA sets the time each frame is
+// heard before sending it. Other frames are stamped as they are sent or
+// received, in software rather than by the network hardware.
+class OhmTimestamperAlsa : public IOhmTimestamper
+{
+    static const TUint kFrames = 16;
+public:
+    OhmTimestamperAlsa(const TChar* aName);
+    // Stamp the frame sent next with aTicks, the time its audio plays.
+    void  SetNextTimestamp(TUint aTicks);
+private: // from IOhmTimestamper
+    void  Start(const Endpoint& aDst) override;
+    void  Stop() override;
+    TUint Timestamp(TUint aFrame) override;
+    TBool SupportsTimestamps() override;
+private:
+    struct Stamp
+    {
+        TBool iValid;
+        TUint iFrame;
+        TUint iTicks;
+    };
+private:
+    const TChar *iName;
+    Mutex        iLock;
+    TBool        iNextValid;
+    TUint        iNextTicks;
+    Stamp        iStamps[kFrames];  // Recently sent frames, by frame.
+};
+
+} // namespace Av
+} // namespace OpenHome
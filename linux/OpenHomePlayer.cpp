@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #ifdef USE_GTK
 #include <gtk/gtk.h>
 #include <libnotify/notify.h>
@@ -453,7 +454,48 @@ gboolean updatesAvailable(gpointer data)
 
 int main(int argc, char **argv)
 {
-    const gchar* usage = "openhome-player [subnet address]";
+    const gchar* usage = "openhome-player [subnet address]\n"
+                         "openhome-player --benchmark-fir [taps "
+                         "[partition frames [threads]]]\n"
+                         "openhome-player --benchmark-dither\n"
+                         "openhome-player --benchmark-resampler\n"
+                         "openhome-player --benchmark-songcast-skew";
+
+    // Measure the FIR room correction, rather than play.
+    if ((argc >= 2) && (strcmp(argv[1], "--benchmark-fir") == 0))
+    {
+        if (argc > 5)
+        {
+            fprintf(stderr, "%s\n", usage);
+            exit(1);
+        }
+
+        BenchmarkFir((argc > 2) ? strtoul(argv[2], NULL, 10) : 65536,
+                     (argc > 3) ? strtoul(argv[3], NULL, 10) : 1024,
+                     (argc > 4) ? strtoul(argv[4], NULL, 10) : 2);
+        exit(0);
+    }
+
+    // Measure the dither, rather than play.
+    if ((argc == 2) && (strcmp(argv[1], "--benchmark-dither") == 0))
+    {
+        BenchmarkDither();
+        exit(0);
+    }
+
+    // Measure the resampler, rather than play.
+    if ((argc == 2) && (strcmp(argv[1], "--benchmark-resampler") == 0))
+    {
+        BenchmarkResampler();
+        exit(0);
+    }
+
+    // Measure the Songcast skew between rooms, rather than play.
+    if ((argc == 2) && (strcmp(argv[1], "--benchmark-songcast-skew") == 0))
+    {
+        BenchmarkSongcastSkew();
+        exit(0);
+    }
 
     // Verify command line options.
     if (argc > 2)
@@ -0,0 +1,477 @@
+#include <OpenHome/Private/Printer.h>
+
+#include <algorithm>
+#include <string>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ParametricEq.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// Added to the filter input, keeping the filter state clear of denormals
+// as it decays in silence.
+static const float kAntiDenormal = 1.0e-18f;
+
+// ParametricEq
+
+ParametricEq::ParametricEq()
+    : iWriterLock("PEQW")
+    , iMiddle(1)
+    , iBack(2)
+    , iFront(0)
+    , iSampleRate(0)
+    , iChannels(0)
+    , iBands(0)
+    , iTargetBands(0)
+    , iFlat(true)
+    , iRampStep(kRampSteps)
+    , iRampFrames(0)
+{
+    for (TUint i=0; i<3; i++)
+    {
+        iSlots[i].iCount = 0;
+    }
+
+    for (TUint b=0; b<kMaxBands; b++)
+    {
+        iFrom[b]    = unity();
+        iTarget[b]  = unity();
+        iApplied[b] = unity();
+        iCurrent[b] = broadcast(iApplied[b]);
+    }
+
+    resetState();
+}
+
+// Parse the bands, separated by ';', each as 'type:frequency:gain:q' with
+// the type 'peak', 'lowshelf' or 'highshelf' and the gain in dB. An empty
+// specification is flat.
+void ParametricEq::SetBands(const Brx& aSpec)
+{
+    std::string spec((const char *)aSpec.Ptr(), aSpec.Bytes());
+    Band        bands[kMaxBands];
+    TUint       count = 0;
+    size_t      start = 0;
+
+    while (start < spec.size())
+    {
+        size_t      end   = spec.find(';', start);
+        std::string entry = spec.substr(start, (end == std::string::npos)
+                                                   ? std::string::npos
+                                                   : end - start);
+        size_t      colon = entry.find(':');
+
+        start = (end == std::string::npos) ? spec.size() : end + 1;
+
+        if (entry.empty())
+        {
+            continue;
+        }
+
+        if ((colon == std::string::npos) || (count == kMaxBands))
+        {
+            Log::Print("Error: ParametricEq: Invalid band '%s'\n",
+                       entry.c_str());
+            continue;
+        }
+
+        std::string type  = entry.substr(0, colon);
+        const char *ptr   = entry.c_str() + colon + 1;
+        char       *endp;
+        Band&       band  = bands[count];
+
+        if (type == "peak")
+        {
+            band.iType = kPeaking;
+        }
+        else if (type == "lowshelf")
+        {
+            band.iType = kLowShelf;
+        }
+        else if (type == "highshelf")
+        {
+            band.iType = kHighShelf;
+        }
+        else
+        {
+            Log::Print("Error: ParametricEq: Invalid band '%s'\n",
+                       entry.c_str());
+            continue;
+        }
+
+        band.iFrequency = strtof(ptr, &endp);
+        ptr             = (*endp == ':') ? endp + 1 : endp;
+        band.iGainDb    = strtof(ptr, &endp);
+        ptr             = (*endp == ':') ? endp + 1 : endp;
+        band.iQ         = strtof(ptr, &endp);
+
+        if ((band.iFrequency <= 0.0f) || (band.iQ <= 0.0f) ||
+            (fabsf(band.iGainDb) > 24.0f))
+        {
+            Log::Print("Error: ParametricEq: Invalid band '%s'\n",
+                       entry.c_str());
+            continue;
+        }
+
+        count++;
+    }
+
+    float maxGainDb = 0.0f;
+
+    for (TUint b=0; b<count; b++)
+    {
+        maxGainDb = std::max(maxGainDb, bands[b].iGainDb);
+    }
+
+    Log::Print("ParametricEq: %u bands, preamp -%.1fdB\n", count, maxGainDb);
+
+    SetBands(bands, count);
+}
+
+// Publish the bands to the audio thread.
+void ParametricEq::SetBands(const Band* aBands, TUint aCount)
+{
+    AutoMutex am(iWriterLock);
+
+    Params& params = iSlots[iBack];
+
+    params.iCount = std::min(aCount, kMaxBands);
+
+    for (TUint b=0; b<params.iCount; b++)
+    {
+        params.iBands[b] = aBands[b];
+    }
+
+    iBack = iMiddle.exchange(iBack | kDirty, std::memory_order_acq_rel) &
+            kIndexMask;
+}
+
+// Prepare to process a block, returning false if the equaliser is to be
+// bypassed.
+TBool ParametricEq::Active(TUint aSampleRate, TUint aChannels)
+{
+    if ((aSampleRate == 0) || (aChannels == 0) ||
+        (aChannels > kMaxChannels))
+    {
+        return false;
+    }
+
+    TBool updated = false;
+
+    if (iMiddle.load(std::memory_order_acquire) & kDirty)
+    {
+        iFront  = iMiddle.exchange(iFront, std::memory_order_acq_rel) &
+                  kIndexMask;
+        updated = true;
+    }
+
+    if ((aSampleRate != iSampleRate) || (aChannels != iChannels))
+    {
+        // A new stream format starts from the target response.
+        iSampleRate = aSampleRate;
+        iChannels   = aChannels;
+
+        design();
+
+        for (TUint b=0; b<kMaxBands; b++)
+        {
+            iApplied[b] = iTarget[b];
+            iCurrent[b] = broadcast(iApplied[b]);
+        }
+
+        iBands    = iTargetBands;
+        iRampStep = kRampSteps;
+
+        resetState();
+    }
+    else if (updated)
+    {
+        // Ramp from the response applied to the new one.
+        for (TUint b=0; b<kMaxBands; b++)
+        {
+            iFrom[b] = iApplied[b];
+        }
+
+        design();
+
+        iBands      = std::max(iBands, iTargetBands);
+        iRampStep   = 0;
+        iRampFrames = 0;
+    }
+
+    if (iFlat && (iRampStep == kRampSteps))
+    {
+        resetState();
+        return false;
+    }
+
+    return true;
+}
+
+// Filter aFrames interleaved frames of aSubsampleBytes little endian
+// samples. aInput and aOutput may be the same.
+void ParametricEq::Process(const TByte* aInput, TByte* aOutput,
+                           TUint aFrames, TUint aSubsampleBytes)
+{
+    const TUint lanes = (iChannels + 3) / 4;
+    Vec4        frame[kLanes];
+    float       samples[kMaxChannels];
+
+    memset(samples, 0, sizeof(samples));
+
+    for (TUint i=0; i<aFrames; i++)
+    {
+        if (iRampStep < kRampSteps)
+        {
+            if (iRampFrames == 0)
+            {
+                interpolate(++iRampStep);
+
+                iRampFrames = kRampStepFrames;
+
+                if (iRampStep == kRampSteps)
+                {
+                    iBands = iTargetBands;
+                }
+            }
+
+            iRampFrames--;
+        }
+
+        for (TUint ch=0; ch<iChannels; ch++)
+        {
+            if (aSubsampleBytes == 2)
+            {
+                TInt16 value = (TInt16)(aInput[0] | (aInput[1] << 8));
+
+                samples[ch] = value * (1.0f / 32768.0f);
+            }
+            else
+            {
+                TInt32 value = (TInt32)((TUint32)aInput[0] |
+                                        ((TUint32)aInput[1] << 8) |
+                                        ((TUint32)aInput[2] << 16) |
+                                        ((TUint32)aInput[3] << 24));
+
+                samples[ch] = value * (1.0f / 2147483648.0f);
+            }
+
+            aInput += aSubsampleBytes;
+        }
+
+        memcpy(frame, samples, lanes * sizeof(Vec4));
+
+        filter(frame, lanes);
+
+        memcpy(samples, frame, lanes * sizeof(Vec4));
+
+        for (TUint ch=0; ch<iChannels; ch++)
+        {
+            float sample = samples[ch];
+
+            if (sample > 1.0f)
+            {
+                sample = 1.0f;
+            }
+            else if (sample < -1.0f)
+            {
+                sample = -1.0f;
+            }
+
+            // Store the data in little endian format.
+            if (aSubsampleBytes == 2)
+            {
+                TInt16 value = (sample >= 1.0f) ? 0x7fff
+                                                : (TInt16)(sample * 32768.0f);
+
+                aOutput[0] = (TByte)(value);
+                aOutput[1] = (TByte)(value >> 8);
+            }
+            else
+            {
+                TInt32 value = (sample >= 1.0f)
+                                   ? 0x7fffffff
+                                   : (TInt32)(sample * 2147483648.0f);
+
+                aOutput[0] = (TByte)(value);
+                aOutput[1] = (TByte)(value >> 8);
+                aOutput[2] = (TByte)(value >> 16);
+                aOutput[3] = (TByte)(value >> 24);
+            }
+
+            aOutput += aSubsampleBytes;
+        }
+    }
+}
+
+// Run a frame through the cascade, in transposed direct form II.
+void ParametricEq::filter(Vec4* aFrame, TUint aLanes)
+{
+    for (TUint l=0; l<aLanes; l++)
+    {
+        aFrame[l] += kAntiDenormal;
+    }
+
+    for (TUint b=0; b<iBands; b++)
+    {
+        const VCoeffs& c = iCurrent[b];
+        State&         s = iState[b];
+
+        for (TUint l=0; l<aLanes; l++)
+        {
+            Vec4 x = aFrame[l];
+            Vec4 y = (c.iB0 * x) + s.iZ1[l];
+
+            s.iZ1[l] = (c.iB1 * x) - (c.iA1 * y) + s.iZ2[l];
+            s.iZ2[l] = (c.iB2 * x) - (c.iA2 * y);
+
+            aFrame[l] = y;
+        }
+    }
+}
+
+// Design the target response for the current bands and sample rate.
+void ParametricEq::design()
+{
+    const Params& params = iSlots[iFront];
+
+    float         maxGainDb = 0.0f;
+
+    iFlat        = true;
+    iTargetBands = params.iCount;
+
+    for (TUint b=0; b<kMaxBands; b++)
+    {
+        if (b < params.iCount)
+        {
+            iTarget[b] = designBand(params.iBands[b], iSampleRate);
+            maxGainDb  = std::max(maxGainDb, params.iBands[b].iGainDb);
+
+            if (params.iBands[b].iGainDb != 0.0f)
+            {
+                iFlat = false;
+            }
+        }
+        else
+        {
+            iTarget[b] = unity();
+        }
+    }
+
+    // Preamp by the negative of the largest boost, so a full scale signal
+    // at a boosted frequency does not clip. It scales the numerator of the
+    // first band, so is ramped along with the coefficients.
+    if (maxGainDb > 0.0f)
+    {
+        const float preamp = powf(10.0f, -maxGainDb / 20.0f);
+
+        iTarget[0].iB0 *= preamp;
+        iTarget[0].iB1 *= preamp;
+        iTarget[0].iB2 *= preamp;
+    }
+}
+
+void ParametricEq::resetState()
+{
+    memset(iState, 0, sizeof(iState));
+}
+
+void ParametricEq::interpolate(TUint aStep)
+{
+    const float t = (float)aStep / kRampSteps;
+
+    for (TUint b=0; b<iBands; b++)
+    {
+        const Coeffs& from   = iFrom[b];
+        const Coeffs& target = iTarget[b];
+        Coeffs&       coeffs = iApplied[b];
+
+        coeffs.iB0 = from.iB0 + (t * (target.iB0 - from.iB0));
+        coeffs.iB1 = from.iB1 + (t * (target.iB1 - from.iB1));
+        coeffs.iB2 = from.iB2 + (t * (target.iB2 - from.iB2));
+        coeffs.iA1 = from.iA1 + (t * (target.iA1 - from.iA1));
+        coeffs.iA2 = from.iA2 + (t * (target.iA2 - from.iA2));
+
+        iCurrent[b] = broadcast(coeffs);
+    }
+}
+
+// Band coefficients from the RBJ audio EQ cookbook, normalised by a0.
+ParametricEq::Coeffs ParametricEq::designBand(const Band& aBand,
+                                              TUint aSampleRate)
+{
+    // A band at or above Nyquist has no effect.
+    if (aBand.iFrequency >= aSampleRate / 2.0)
+    {
+        return unity();
+    }
+
+    const double a     = pow(10.0, aBand.iGainDb / 40.0);
+    const double w0    = 2.0 * M_PI * aBand.iFrequency / aSampleRate;
+    const double cosw0 = cos(w0);
+    const double alpha = sin(w0) / (2.0 * aBand.iQ);
+    const double sqrtA = sqrt(a);
+    double       b0, b1, b2, a0, a1, a2;
+
+    switch (aBand.iType)
+    {
+        case kLowShelf:
+            b0 =  a * ((a + 1) - ((a - 1) * cosw0) + (2 * sqrtA * alpha));
+            b1 =  2 * a * ((a - 1) - ((a + 1) * cosw0));
+            b2 =  a * ((a + 1) - ((a - 1) * cosw0) - (2 * sqrtA * alpha));
+            a0 =  (a + 1) + ((a - 1) * cosw0) + (2 * sqrtA * alpha);
+            a1 = -2 * ((a - 1) + ((a + 1) * cosw0));
+            a2 =  (a + 1) + ((a - 1) * cosw0) - (2 * sqrtA * alpha);
+            break;
+        case kHighShelf:
+            b0 =  a * ((a + 1) + ((a - 1) * cosw0) + (2 * sqrtA * alpha));
+            b1 = -2 * a * ((a - 1) + ((a + 1) * cosw0));
+            b2 =  a * ((a + 1) + ((a - 1) * cosw0) - (2 * sqrtA * alpha));
+            a0 =  (a + 1) - ((a - 1) * cosw0) + (2 * sqrtA * alpha);
+            a1 =  2 * ((a - 1) - ((a + 1) * cosw0));
+            a2 =  (a + 1) - ((a - 1) * cosw0) - (2 * sqrtA * alpha);
+            break;
+        default:
+            b0 =  1 + (alpha * a);
+            b1 = -2 * cosw0;
+            b2 =  1 - (alpha * a);
+            a0 =  1 + (alpha / a);
+            a1 = -2 * cosw0;
+            a2 =  1 - (alpha / a);
+            break;
+    }
+
+    Coeffs coeffs;
+
+    coeffs.iB0 = (float)(b0 / a0);
+    coeffs.iB1 = (float)(b1 / a0);
+    coeffs.iB2 = (float)(b2 / a0);
+    coeffs.iA1 = (float)(a1 / a0);
+    coeffs.iA2 = (float)(a2 / a0);
+
+    return coeffs;
+}
+
+ParametricEq::Coeffs ParametricEq::unity()
+{
+    Coeffs coeffs = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+
+    return coeffs;
+}
+
+ParametricEq::VCoeffs ParametricEq::broadcast(const Coeffs& aCoeffs)
+{
+    VCoeffs coeffs;
+
+    coeffs.iB0 = Vec4{aCoeffs.iB0, aCoeffs.iB0, aCoeffs.iB0, aCoeffs.iB0};
+    coeffs.iB1 = Vec4{aCoeffs.iB1, aCoeffs.iB1, aCoeffs.iB1, aCoeffs.iB1};
+    coeffs.iB2 = Vec4{aCoeffs.iB2, aCoeffs.iB2, aCoeffs.iB2, aCoeffs.iB2};
+    coeffs.iA1 = Vec4{aCoeffs.iA1, aCoeffs.iA1, aCoeffs.iA1, aCoeffs.iA1};
+    coeffs.iA2 = Vec4{aCoeffs.iA2, aCoeffs.iA2, aCoeffs.iA2, aCoeffs.iA2};
+
+    return coeffs;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Thread.h>
+
+#include <atomic>
+
+namespace OpenHome {
+namespace Media {
+
+// Cascaded biquad parametric equaliser for interleaved S16_LE or S32_LE
+// audio.
+//
+// The bands are set from any thread and picked up by the audio thread
+// without locking, through a triple buffer. Coefficient changes are ramped
+// so they do not click, and a flat equaliser is bypassed entirely. The
+// output is attenuated by the largest band gain, so boosts do not clip.
+//
+// Processing is in float, with the channels of a frame filtered together
+// as vectors of four.
+class ParametricEq
+{
+public:
+    static const TUint kMaxBands    = 8;
+    static const TUint kMaxChannels = 8;
+
+    enum BandType
+    {
+        kPeaking,
+        kLowShelf,
+        kHighShelf
+    };
+
+    struct Band
+    {
+        BandType iType;
+        float    iFrequency;
+        float    iGainDb;
+        float    iQ;
+    };
+public:
+    ParametricEq();
+    // Set the bands from a specification, eg.
+    // 'peak:1000:-3:1.4;lowshelf:80:4:0.7;highshelf:8000:-2:0.7'.
+    void  SetBands(const Brx& aSpec);
+    void  SetBands(const Band* aBands, TUint aCount);
+public: // Called by the audio thread
+    TBool Active(TUint aSampleRate, TUint aChannels);
+    void  Process(const TByte* aInput, TByte* aOutput, TUint aFrames,
+                  TUint aSubsampleBytes);
+private:
+    typedef float Vec4 __attribute__((vector_size(16)));
+
+    static const TUint kLanes          = kMaxChannels / 4;
+    static const TUint kRampSteps      = 8;
+    static const TUint kRampStepFrames = 32;
+    static const TUint kDirty          = 4;
+    static const TUint kIndexMask      = 3;
+
+    struct Params
+    {
+        TUint iCount;
+        Band  iBands[kMaxBands];
+    };
+
+    struct Coeffs
+    {
+        float iB0;
+        float iB1;
+        float iB2;
+        float iA1;
+        float iA2;
+    };
+
+    struct VCoeffs
+    {
+        Vec4 iB0;
+        Vec4 iB1;
+        Vec4 iB2;
+        Vec4 iA1;
+        Vec4 iA2;
+    };
+
+    struct State
+    {
+        Vec4 iZ1[kLanes];
+        Vec4 iZ2[kLanes];
+    };
+private:
+    void   design();
+    void   resetState();
+    void   interpolate(TUint aStep);
+    void   filter(Vec4* aFrame, TUint aLanes);
+    static Coeffs  designBand(const Band& aBand, TUint aSampleRate);
+    static Coeffs  unity();
+    static VCoeffs broadcast(const Coeffs& aCoeffs);
+private:
+    Mutex              iWriterLock;
+    Params             iSlots[3];
+    std::atomic<TUint> iMiddle;   // Slot index, with kDirty once written.
+    TUint              iBack;     // Owned by the writer.
+    TUint              iFront;    // Owned by the audio thread.
+
+    TUint              iSampleRate;
+    TUint              iChannels;
+    TUint              iBands;      // Bands in the filter chain.
+    TUint              iTargetBands;
+    TBool              iFlat;       // The target response is flat.
+    TUint              iRampStep;   // kRampSteps once the ramp completes.
+    TUint              iRampFrames;
+    Coeffs             iFrom[kMaxBands];
+    Coeffs             iTarget[kMaxBands];
+    Coeffs             iApplied[kMaxBands];
+    VCoeffs            iCurrent[kMaxBands]; // iApplied, broadcast.
+    State              iState[kMaxBands];
+};
+
+} // namespace Media
+} // namespace OpenHome
@@ -0,0 +1,638 @@
+#include <OpenHome/Private/Printer.h>
+#include <OpenHome/Private/Thread.h>
+
+#include <algorithm>
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "PolyphaseResampler.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// Stopband attenuation, and the Kaiser window shape giving it.
+static const double kStopbandDb = 80.0;
+static const double kKaiserBeta = 8.0;
+
+// Audio used by Benchmark().
+static const TUint kBenchmarkSeconds = 10;
+static const TUint kBenchmarkFrames  = 4096;
+
+// Four lane float vector, mapped to SSE or NEON by the compiler.
+typedef float Vec4 __attribute__((vector_size(16)));
+
+static TUint greatestCommonDivisor(TUint aA, TUint aB)
+{
+    while (aB != 0)
+    {
+        TUint t = aA % aB;
+
+        aA = aB;
+        aB = t;
+    }
+
+    return aA;
+}
+
+// PolyphaseResampler
+
+PolyphaseResampler::PolyphaseResampler()
+    : iInputRate(0)
+    , iOutputRate(0)
+    , iChannels(0)
+    , iAdaptive(false)
+    , iPhases(0)
+    , iStep(0)
+    , iTaps(kMinTapsPerPhase)
+    , iAdaptiveStep(0)
+    , iAdaptivePhase(0)
+    , iCoeffs(NULL)
+    , iIndex(0)
+    , iPhase(0)
+{
+}
+
+// Prepare to resample a stream, retaining the filter and its history if
+// the stream format is unchanged.
+TBool PolyphaseResampler::Configure(TUint aInputRate, TUint aOutputRate,
+                                    TUint aChannels, TBool aAdaptive)
+{
+    if ((aInputRate == 0) || (aOutputRate == 0) || (aChannels == 0))
+    {
+        return false;
+    }
+
+    if ((aInputRate == iInputRate) && (aOutputRate == iOutputRate) &&
+        (aChannels == iChannels) && (aAdaptive == iAdaptive))
+    {
+        return true;
+    }
+
+    FilterKey key;
+    TUint     phases;
+    TUint     step;
+    TUint     taps;
+
+    iInputRate  = 0;
+    iOutputRate = 0;
+    iChannels   = 0;
+    iPhases     = 0;
+
+    if (! layout(aInputRate, aOutputRate, aAdaptive, key, phases, step, taps))
+    {
+        return false;
+    }
+
+    iInputRate  = aInputRate;
+    iOutputRate = aOutputRate;
+    iChannels   = aChannels;
+    iAdaptive   = aAdaptive;
+    iPhases     = phases;
+    iStep       = step;
+    iTaps       = taps;
+
+    // The filter is only designed here if it was not prepared.
+    iCoeffs = &(*cachedFilter(key, iPhases, iTaps, iOwnCoeffs))[0];
+
+    Reset();
+    SetRatioAdjust(0.0);
+
+    return true;
+}
+
+// Design the filter for a ratio ahead of its use, so Configure() for it
+// need not.
+void PolyphaseResampler::PrepareFilter(TUint aInputRate, TUint aOutputRate,
+                                       TBool aAdaptive)
+{
+    FilterKey          key;
+    TUint              phases;
+    TUint              step;
+    TUint              taps;
+    std::vector<float> uncached;
+
+    if ((aInputRate != 0) && (aOutputRate != 0) &&
+        layout(aInputRate, aOutputRate, aAdaptive, key, phases, step, taps))
+    {
+        cachedFilter(key, phases, taps, uncached);
+    }
+}
+
+// Trim the ratio of an adaptive resampler. A positive adjustment consumes
+// input faster, by aAdjust as a fraction of the nominal ratio.
+void PolyphaseResampler::SetRatioAdjust(double aAdjust)
+{
+    if (iAdaptive)
+    {
+        iAdaptiveStep = ((double)iInputRate * iPhases / iOutputRate) *
+                        (1.0 + aAdjust);
+    }
+}
+
+// Clear the filter history.
+void PolyphaseResampler::Reset()
+{
+    iHistory.assign(iChannels, std::vector<float>(iTaps - 1, 0.0f));
+
+    iIndex = iTaps - 1;
+    iPhase = 0;
+
+    iAdaptivePhase = 0;
+}
+
+TUint PolyphaseResampler::InputRate() const
+{
+    return iInputRate;
+}
+
+TUint PolyphaseResampler::Channels() const
+{
+    return iChannels;
+}
+
+// Resample aFrames interleaved frames, appending the output frames to
+// aOutput.
+void PolyphaseResampler::Process(const float* aInput, TUint aFrames,
+                                 std::vector<float>& aOutput)
+{
+    if (iPhases == 0)
+    {
+        return;
+    }
+
+    for (TUint ch=0; ch<iChannels; ch++)
+    {
+        std::vector<float>& history = iHistory[ch];
+        const float        *in      = aInput + ch;
+
+        history.reserve(history.size() + aFrames);
+
+        for (TUint i=0; i<aFrames; i++, in+=iChannels)
+        {
+            history.push_back(*in);
+        }
+    }
+
+    TUint available = (TUint)iHistory[0].size();
+
+    aOutput.reserve(aOutput.size() +
+                    ((((TUint64)aFrames * iOutputRate) / iInputRate) + 2) *
+                    iChannels);
+
+    if (iAdaptive)
+    {
+        processAdaptive(aOutput, available);
+    }
+    else
+    {
+        processRational(aOutput, available);
+    }
+
+    // Discard the input no longer required, retaining the filter history.
+    TUint consumed = std::min(iIndex, available) - (iTaps - 1);
+
+    for (TUint ch=0; ch<iChannels; ch++)
+    {
+        iHistory[ch].erase(iHistory[ch].begin(),
+                           iHistory[ch].begin() + consumed);
+    }
+
+    iIndex -= consumed;
+}
+
+// Each output sample is the dot product of the filter phase with the iTaps
+// input samples ending at iIndex.
+void PolyphaseResampler::processRational(std::vector<float>& aOutput,
+                                         TUint aAvailable)
+{
+    while (iIndex < aAvailable)
+    {
+        const float *coeffs = iCoeffs + (iPhase * iTaps);
+        TUint        first  = iIndex - (iTaps - 1);
+
+        for (TUint ch=0; ch<iChannels; ch++)
+        {
+            aOutput.push_back(dotProduct(coeffs, &iHistory[ch][first], iTaps));
+        }
+
+        iPhase += iStep;
+        iIndex += iPhase / iPhases;
+        iPhase %= iPhases;
+    }
+}
+
+// As processRational(), with the output interpolated between the two
+// phases either side of the fractional position.
+void PolyphaseResampler::processAdaptive(std::vector<float>& aOutput,
+                                         TUint aAvailable)
+{
+    while (iIndex < aAvailable)
+    {
+        TUint        phase   = (TUint)iAdaptivePhase;
+        float        frac    = (float)(iAdaptivePhase - phase);
+        const float *coeffs0 = iCoeffs + (phase * iTaps);
+        const float *coeffs1 = coeffs0 + iTaps;
+        TUint        first   = iIndex - (iTaps - 1);
+
+        for (TUint ch=0; ch<iChannels; ch++)
+        {
+            float y0 = dotProduct(coeffs0, &iHistory[ch][first], iTaps);
+            float y1 = dotProduct(coeffs1, &iHistory[ch][first], iTaps);
+
+            aOutput.push_back(y0 + (frac * (y1 - y0)));
+        }
+
+        iAdaptivePhase += iAdaptiveStep;
+
+        TUint advance = (TUint)(iAdaptivePhase / iPhases);
+
+        iIndex         += advance;
+        iAdaptivePhase -= (double)advance * iPhases;
+    }
+}
+
+// The filter of a ratio, its phases, input steps per cycle and taps per
+// phase. False if the ratio needs more than kMaxPhases phases.
+TBool PolyphaseResampler::layout(TUint aInputRate, TUint aOutputRate,
+                                 TBool aAdaptive, FilterKey& aKey,
+                                 TUint& aPhases, TUint& aStep, TUint& aTaps)
+{
+    TUint divisor = greatestCommonDivisor(aInputRate, aOutputRate);
+
+    if (! aAdaptive && (aOutputRate / divisor > kMaxPhases))
+    {
+        return false;
+    }
+
+    aKey = FilterKey(std::make_pair(aInputRate / divisor,
+                                    aOutputRate / divisor), aAdaptive);
+
+    if (aAdaptive)
+    {
+        aPhases = kAdaptivePhases;
+        aStep   = 0;
+    }
+    else
+    {
+        aPhases = aOutputRate / divisor;
+        aStep   = aInputRate / divisor;
+    }
+
+    // Downsampling narrows the filter by the ratio, so lengthen it to
+    // match, in whole vectors.
+    aTaps = kMinTapsPerPhase;
+
+    if (aInputRate > aOutputRate)
+    {
+        aTaps = (TUint)ceil((double)kMinTapsPerPhase * aInputRate /
+                            aOutputRate);
+        aTaps = (aTaps + 3) & ~3u;
+    }
+
+    return true;
+}
+
+// The shared filter for aKey, designing it if not yet cached. Once
+// kMaxFilters are cached further filters are designed into aUncached.
+//
+// Cached filters are never removed, so may be used without the lock.
+const std::vector<float>* PolyphaseResampler::cachedFilter(
+    const FilterKey& aKey, TUint aPhases, TUint aTaps,
+    std::vector<float>& aUncached)
+{
+    // Created on first use and never destroyed, as resamplers may outlive
+    // static destruction.
+    static Mutex     *lock    = new Mutex("PRFC");
+    static FilterMap *filters = new FilterMap();
+
+    {
+        AutoMutex am(*lock);
+
+        FilterMap::const_iterator it = filters->find(aKey);
+
+        if (it != filters->end())
+        {
+            return &it->second;
+        }
+    }
+
+    // Designed without the lock, so an audio thread finding a prepared
+    // filter is not held up by the design of another.
+    std::vector<float> coeffs;
+
+    designFilter(aPhases, aTaps,
+                 (double)aKey.first.second / aKey.first.first, coeffs);
+
+    AutoMutex am(*lock);
+
+    FilterMap::iterator it = filters->find(aKey);
+
+    if (it != filters->end())
+    {
+        return &it->second;
+    }
+
+    if (filters->size() >= kMaxFilters)
+    {
+        aUncached.swap(coeffs);
+        return &aUncached;
+    }
+
+    std::vector<float>& entry = (*filters)[aKey];
+
+    entry.swap(coeffs);
+
+    return &entry;
+}
+
+// Design the Kaiser windowed sinc prototype filter at the upsampled rate
+// and split it into phases. aRatio is the output rate over the input rate.
+//
+// The taps of each phase are stored in reverse so a phase is applied to
+// the input samples in time order. A further phase, the first advanced by
+// one input sample, allows adaptive resampling to interpolate beyond the
+// last phase.
+//
+// The transition band is the narrowest the Kaiser window allows at the
+// filter length, centred below the lower of the input and output Nyquist
+// frequencies so the stopband starts there.
+void PolyphaseResampler::designFilter(TUint aPhases, TUint aTaps,
+                                      double aRatio,
+                                      std::vector<float>& aCoeffs)
+{
+    const TUint  length      = aPhases * aTaps;
+    const double nyquist     = 0.5 / aPhases * std::min(1.0, aRatio);
+    const double transition  = (kStopbandDb - 7.95) /
+                               (14.36 * (length - 1));
+    const double cutoff      = std::max(nyquist - (transition / 2.0),
+                                        nyquist / 2.0);
+    const double windowScale = 1.0 / besselI0(kKaiserBeta);
+
+    aCoeffs.assign((aPhases + 1) * aTaps, 0.0f);
+
+    for (TUint phase=0; phase<=aPhases; phase++)
+    {
+        for (TUint tap=0; tap<aTaps; tap++)
+        {
+            aCoeffs[(phase * aTaps) + (aTaps - 1 - tap)] =
+                (float)prototype(phase + (tap * aPhases), length, cutoff,
+                                 aPhases, windowScale);
+        }
+    }
+}
+
+// Tap aTap of the prototype filter of aLength taps. Each phase has unity
+// gain at DC. aWindowScale normalises the Kaiser window.
+double PolyphaseResampler::prototype(TUint aTap, TUint aLength,
+                                     double aCutoff, TUint aPhases,
+                                     double aWindowScale)
+{
+    const double centre = (aLength - 1) / 2.0;
+
+    if (aTap >= aLength)
+    {
+        return 0.0;
+    }
+
+    double x      = aTap - centre;
+    double arg    = 2.0 * M_PI * aCutoff * x;
+    double sinc   = (x == 0.0) ? 1.0 : sin(arg) / arg;
+    double r      = x / centre;
+    double window = besselI0(kKaiserBeta * sqrt(1.0 - (r * r))) *
+                    aWindowScale;
+
+    return 2.0 * aCutoff * sinc * window * aPhases;
+}
+
+// Zeroth order modified Bessel function of the first kind.
+double PolyphaseResampler::besselI0(double aX)
+{
+    double sum  = 1.0;
+    double term = 1.0;
+
+    for (TUint k=1; k<50; k++)
+    {
+        term *= (aX / (2.0 * k)) * (aX / (2.0 * k));
+        sum  += term;
+
+        if (term < sum * 1e-12)
+        {
+            break;
+        }
+    }
+
+    return sum;
+}
+
+// Apply one filter phase, four taps at a time.
+float PolyphaseResampler::dotProduct(const float* aCoeffs,
+                                     const float* aSamples, TUint aTaps)
+{
+    Vec4 acc = {0.0f, 0.0f, 0.0f, 0.0f};
+
+    for (TUint i=0; i<aTaps; i+=4)
+    {
+        Vec4 coeffs;
+        Vec4 samples;
+
+        // The history is not aligned, so load through memcpy.
+        memcpy(&coeffs, aCoeffs + i, sizeof(coeffs));
+        memcpy(&samples, aSamples + i, sizeof(samples));
+
+        acc += coeffs * samples;
+    }
+
+    return acc[0] + acc[1] + acc[2] + acc[3];
+}
+
+// Fit a sine of aFrequency to the first channel of aFrames frames of
+// aAudio, returning its amplitude and the RMS of what remains.
+static double fitTone(const std::vector<float>& aAudio, TUint aChannels,
+                      TUint aFirst, TUint aFrames, double aFrequency,
+                      double aRate, double& aResidual)
+{
+    double cc = 0.0;
+    double ss = 0.0;
+    double cs = 0.0;
+    double xc = 0.0;
+    double xs = 0.0;
+
+    for (TUint i=aFirst; i<aFirst+aFrames; i++)
+    {
+        double phase = (2.0 * M_PI * aFrequency * i) / aRate;
+        double c     = cos(phase);
+        double s     = sin(phase);
+        double x     = aAudio[i * aChannels];
+
+        cc += c * c;
+        ss += s * s;
+        cs += c * s;
+        xc += x * c;
+        xs += x * s;
+    }
+
+    double det = (cc * ss) - (cs * cs);
+    double a   = ((xc * ss) - (xs * cs)) / det;
+    double b   = ((xs * cc) - (xc * cs)) / det;
+    double sum = 0.0;
+
+    for (TUint i=aFirst; i<aFirst+aFrames; i++)
+    {
+        double phase = (2.0 * M_PI * aFrequency * i) / aRate;
+        double error = aAudio[i * aChannels] -
+                       ((a * cos(phase)) + (b * sin(phase)));
+
+        sum += error * error;
+    }
+
+    aResidual = sqrt(sum / aFrames);
+
+    return sqrt((a * a) + (b * b));
+}
+
+// Resample one second of a stereo tone of aFrequency, returning the output.
+static void resampleTone(TUint aInputRate, TUint aOutputRate, TBool aAdaptive,
+                         double aFrequency, std::vector<float>& aOutput)
+{
+    PolyphaseResampler resampler;
+    std::vector<float> input(kBenchmarkFrames * 2);
+
+    resampler.Configure(aInputRate, aOutputRate, 2, aAdaptive);
+    aOutput.clear();
+
+    for (TUint f=0; f<aInputRate; f+=kBenchmarkFrames)
+    {
+        for (TUint i=0; i<kBenchmarkFrames; i++)
+        {
+            float x = (float)(0.5 * sin((2.0 * M_PI * aFrequency * (f + i)) /
+                                        aInputRate));
+
+            input[(i * 2) + 0] = x;
+            input[(i * 2) + 1] = x;
+        }
+
+        resampler.Process(&input[0], kBenchmarkFrames, aOutput);
+    }
+}
+
+static double cpuSeconds()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+
+    return now.tv_sec + (now.tv_nsec / 1e9);
+}
+
+static double dB(double aRatio)
+{
+    return 20.0 * log10(std::max(aRatio, 1e-12));
+}
+
+// For each ratio, logs the cost of designing the filter and resampling
+// stereo, and the gain, THD+N and stopband attenuation measured with tones
+// of amplitude 0.5 fitted over the output once the filter has filled.
+//
+// THD+N includes any images of the tone. The stopband tone lies midway
+// between the output and input Nyquist frequencies when downsampling, and
+// should be absent from the output.
+void PolyphaseResampler::Benchmark()
+{
+    static const struct
+    {
+        TUint inputRate;
+        TUint outputRate;
+        TBool adaptive;
+    } kRatios[] = { {  44100,  48000, false },
+                    {  48000,  44100, false },
+                    {  96000,  44100, false },
+                    { 192000,  48000, false },
+                    {  44100,  96000, false },
+                    {  44100,  44100, true  } };
+
+    for (TUint r=0; r<sizeof(kRatios)/sizeof(kRatios[0]); r++)
+    {
+        const TUint inputRate  = kRatios[r].inputRate;
+        const TUint outputRate = kRatios[r].outputRate;
+        const TBool adaptive   = kRatios[r].adaptive;
+
+        FilterKey          key;
+        TUint              phases;
+        TUint              step;
+        TUint              taps;
+        std::vector<float> coeffs;
+
+        layout(inputRate, outputRate, adaptive, key, phases, step, taps);
+
+        // The design, uncached, as on the audio thread before the filters
+        // were prepared.
+        double start = cpuSeconds();
+
+        designFilter(phases, taps, (double)outputRate / inputRate, coeffs);
+
+        double designMs = (cpuSeconds() - start) * 1e3;
+
+        // Skip the output until the filter has filled, then measure half
+        // a second.
+        const TUint first = ((taps * outputRate) / inputRate) + 64;
+        const TUint fit   = outputRate / 2;
+
+        std::vector<float> output;
+        double             residual;
+
+        resampleTone(inputRate, outputRate, adaptive, 1000.0, output);
+
+        double gain1k  = fitTone(output, 2, first, fit, 1000.0,
+                                 outputRate, residual) / 0.5;
+        double thdn1k  = residual / (0.5 * M_SQRT1_2);
+
+        resampleTone(inputRate, outputRate, adaptive, 20000.0, output);
+
+        double gain20k = fitTone(output, 2, first, fit, 20000.0,
+                                 outputRate, residual) / 0.5;
+        double thdn20k = residual / (0.5 * M_SQRT1_2);
+
+        Log::Print("PolyphaseResampler: %6u -> %6u%s %4u phases %3u taps, "
+                   "design %.2fms, gain 1kHz %+.3fdB 20kHz %+.3fdB, "
+                   "THD+N 1kHz %.1fdB 20kHz %.1fdB",
+                   inputRate, outputRate, adaptive ? " adaptive" : "",
+                   phases, taps, designMs, dB(gain1k), dB(gain20k),
+                   dB(thdn1k), dB(thdn20k));
+
+        if (inputRate > outputRate)
+        {
+            double stopband = (inputRate + outputRate) / 4.0;
+            double sum      = 0.0;
+
+            resampleTone(inputRate, outputRate, adaptive, stopband, output);
+
+            for (TUint i=first; i<first+fit; i++)
+            {
+                sum += output[i * 2] * output[i * 2];
+            }
+
+            Log::Print(", stopband %.0fHz %.1fdB",
+                       stopband, dB(sqrt(sum / fit) / (0.5 * M_SQRT1_2)));
+        }
+
+        // The cost of resampling, with the filter now cached.
+        PolyphaseResampler resampler;
+        std::vector<float> input(kBenchmarkFrames * 2, 0.25f);
+
+        resampler.Configure(inputRate, outputRate, 2, adaptive);
+
+        start = cpuSeconds();
+
+        for (TUint f=0; f<inputRate*kBenchmarkSeconds; f+=kBenchmarkFrames)
+        {
+            output.clear();
+            resampler.Process(&input[0], kBenchmarkFrames, output);
+        }
+
+        double cpu = cpuSeconds() - start;
+
+        Log::Print(", %.3f%% CPU stereo\n", (100.0 * cpu) / kBenchmarkSeconds);
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace OpenHome {
+namespace Media {
+
+// Polyphase windowed sinc sample rate converter.
+//
+// Converts between any pair of rates whose ratio, reduced to lowest terms,
+// has at most kMaxPhases output steps. Audio is processed as interleaved
+// float frames. The filter history is retained between calls so a stream
+// may be resampled in fragments.
+//
+// An adaptive resampler may have its ratio trimmed while running, eg. to
+// track a remote clock. It uses kAdaptivePhases phases, interpolating
+// between adjacent phases.
+//
+// Each phase has kMinTapsPerPhase taps, scaled by the decimation ratio when
+// downsampling so the transition band is the same fraction of the output
+// band at any ratio.
+//
+// Filters depend only on the reduced ratio, and are designed once and
+// shared by all resamplers. PrepareFilter() designs one ahead of use, so
+// Configure() on the audio thread need not.
+class PolyphaseResampler
+{
+public:
+    static const TUint kMinTapsPerPhase = 128;
+    static const TUint kMaxPhases       = 1024;
+    static const TUint kAdaptivePhases  = 256;
+    static const TUint kMaxFilters      = 32;
+public:
+    PolyphaseResampler();
+    static void PrepareFilter(TUint aInputRate, TUint aOutputRate,
+                              TBool aAdaptive);
+    // Log the response, distortion and cost of the filter at the ratios
+    // the driver uses.
+    static void Benchmark();
+    TBool Configure(TUint aInputRate, TUint aOutputRate, TUint aChannels,
+                    TBool aAdaptive);
+    void  SetRatioAdjust(double aAdjust);
+    void  Reset();
+    void  Process(const float* aInput, TUint aFrames,
+                  std::vector<float>& aOutput);
+    TUint InputRate() const;
+    TUint Channels() const;
+private:
+    // Reduced input and output rates, and adaptive.
+    typedef std::pair<std::pair<TUint, TUint>, TBool> FilterKey;
+    typedef std::map<FilterKey, std::vector<float> > FilterMap;
+
+    static TBool layout(TUint aInputRate, TUint aOutputRate, TBool aAdaptive,
+                        FilterKey& aKey, TUint& aPhases, TUint& aStep,
+                        TUint& aTaps);
+    static const std::vector<float>* cachedFilter(
+        const FilterKey& aKey, TUint aPhases, TUint aTaps,
+        std::vector<float>& aUncached);
+    static void   designFilter(TUint aPhases, TUint aTaps, double aRatio,
+                               std::vector<float>& aCoeffs);
+    static double prototype(TUint aTap, TUint aLength, double aCutoff,
+                            TUint aPhases, double aWindowScale);
+    static double besselI0(double aX);
+    void  processRational(std::vector<float>& aOutput, TUint aAvailable);
+    void  processAdaptive(std::vector<float>& aOutput, TUint aAvailable);
+    static float  dotProduct(const float* aCoeffs, const float* aSamples,
+                             TUint aTaps);
+private:
+    TUint                           iInputRate;
+    TUint                           iOutputRate;
+    TUint                           iChannels;
+    TBool                           iAdaptive;
+    TUint                           iPhases;    // Output steps per cycle.
+    TUint                           iStep;      // Input steps per cycle.
+    TUint                           iTaps;      // Per phase.
+    double                          iAdaptiveStep;
+    double                          iAdaptivePhase;
+    const float                    *iCoeffs;    // iTaps per phase.
+    std::vector<float>              iOwnCoeffs; // If the cache is full.
+    std::vector<std::vector<float> > iHistory;  // Input samples per channel.
+    TUint                           iIndex;     // Newest input sample used.
+    TUint                           iPhase;
+};
+
+} // namespace Media
+} // namespace OpenHome
@@ -0,0 +1,163 @@
+#include <algorithm>
+
+#include <math.h>
+
+#include "RealFft.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+RealFft::RealFft(TUint aBins)
+    : iSize(aBins)
+    , iReverse(aBins)
+    , iCos(aBins / 2)
+    , iSin(aBins / 2)
+    , iHalfCos(aBins / 2 + 1)
+    , iHalfSin(aBins / 2 + 1)
+{
+    TUint bits = 0;
+
+    while ((1u << bits) < iSize)
+    {
+        bits++;
+    }
+
+    for (TUint i=0; i<iSize; i++)
+    {
+        TUint reversed = 0;
+
+        for (TUint b=0; b<bits; b++)
+        {
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+
+        iReverse[i] = reversed;
+    }
+
+    for (TUint k=0; k<iSize/2; k++)
+    {
+        iCos[k] = (float)cos((2 * M_PI * k) / iSize);
+        iSin[k] = (float)sin((2 * M_PI * k) / iSize);
+    }
+
+    for (TUint k=0; k<=iSize/2; k++)
+    {
+        iHalfCos[k] = (float)cos((M_PI * k) / iSize);
+        iHalfSin[k] = (float)sin((M_PI * k) / iSize);
+    }
+}
+
+// In place radix 2 forward transform.
+void RealFft::transform(float* aRe, float* aIm)
+{
+    for (TUint i=0; i<iSize; i++)
+    {
+        TUint j = iReverse[i];
+
+        if (j > i)
+        {
+            std::swap(aRe[i], aRe[j]);
+            std::swap(aIm[i], aIm[j]);
+        }
+    }
+
+    for (TUint len=2; len<=iSize; len<<=1)
+    {
+        const TUint half = len / 2;
+        const TUint step = iSize / len;
+
+        for (TUint i=0; i<iSize; i+=len)
+        {
+            float *re0 = aRe + i;
+            float *im0 = aIm + i;
+            float *re1 = re0 + half;
+            float *im1 = im0 + half;
+
+            for (TUint j=0; j<half; j++)
+            {
+                const float wr = iCos[j * step];
+                const float wi = -iSin[j * step];
+                const float vr = (re1[j] * wr) - (im1[j] * wi);
+                const float vi = (re1[j] * wi) + (im1[j] * wr);
+
+                re1[j]  = re0[j] - vr;
+                im1[j]  = im0[j] - vi;
+                re0[j] += vr;
+                im0[j] += vi;
+            }
+        }
+    }
+}
+
+void RealFft::Forward(const float* aSamples, float* aRe,
+                                float* aIm)
+{
+    for (TUint n=0; n<iSize; n++)
+    {
+        aRe[n] = aSamples[2 * n];
+        aIm[n] = aSamples[(2 * n) + 1];
+    }
+
+    transform(aRe, aIm);
+
+    // Separate the spectra of the even and odd samples, and combine them.
+    const float dc = aRe[0];
+
+    aRe[0] = dc + aIm[0];
+    aIm[0] = dc - aIm[0];
+
+    for (TUint k=1; k<=iSize/2; k++)
+    {
+        const TUint m      = iSize - k;
+        const float evenRe = 0.5f * (aRe[k] + aRe[m]);
+        const float evenIm = 0.5f * (aIm[k] - aIm[m]);
+        const float oddRe  = 0.5f * (aIm[k] + aIm[m]);
+        const float oddIm  = -0.5f * (aRe[k] - aRe[m]);
+        const float c      = iHalfCos[k];
+        const float s      = iHalfSin[k];
+        const float tr     = (c * oddRe) + (s * oddIm);
+        const float ti     = (c * oddIm) - (s * oddRe);
+
+        aRe[k] = evenRe + tr;
+        aIm[k] = evenIm + ti;
+        aRe[m] = evenRe - tr;
+        aIm[m] = ti - evenIm;
+    }
+}
+
+void RealFft::Inverse(float* aRe, float* aIm, float* aSamples)
+{
+    const float dc      = aRe[0];
+    const float nyquist = aIm[0];
+
+    aRe[0] = 0.5f * (dc + nyquist);
+    aIm[0] = 0.5f * (dc - nyquist);
+
+    for (TUint k=1; k<=iSize/2; k++)
+    {
+        const TUint m      = iSize - k;
+        const float evenRe = 0.5f * (aRe[k] + aRe[m]);
+        const float evenIm = 0.5f * (aIm[k] - aIm[m]);
+        const float dr     = 0.5f * (aRe[k] - aRe[m]);
+        const float di     = 0.5f * (aIm[k] + aIm[m]);
+        const float c      = iHalfCos[k];
+        const float s      = iHalfSin[k];
+        const float oddRe  = (dr * c) - (di * s);
+        const float oddIm  = (dr * s) + (di * c);
+
+        aRe[k] = evenRe - oddIm;
+        aIm[k] = evenIm + oddRe;
+        aRe[m] = evenRe + oddIm;
+        aIm[m] = oddRe - evenIm;
+    }
+
+    // The inverse is the forward transform with real and imaginary
+    // swapped.
+    transform(aIm, aRe);
+
+    for (TUint n=0; n<iSize; n++)
+    {
+        aSamples[2 * n]       = aRe[n];
+        aSamples[(2 * n) + 1] = aIm[n];
+    }
+}
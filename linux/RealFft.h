@@ -0,0 +1,35 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+
+#include <vector>
+
+namespace OpenHome {
+namespace Media {
+
+// Unscaled transform of 2N real samples through a radix 2 complex
+// transform of N points.
+//
+// The spectrum is N bins, split into real and imaginary arrays, with the
+// real Nyquist bin packed as the imaginary part of the DC bin. N must be a
+// power of two.
+class RealFft
+{
+public:
+    RealFft(TUint aBins);
+    void Forward(const float* aSamples, float* aRe, float* aIm);
+    // Overwrites aRe and aIm.
+    void Inverse(float* aRe, float* aIm, float* aSamples);
+private:
+    void transform(float* aRe, float* aIm);
+private:
+    const TUint        iSize;
+    std::vector<TUint> iReverse;
+    std::vector<float> iCos;      // Of the complex transform.
+    std::vector<float> iSin;
+    std::vector<float> iHalfCos;  // Of the real transform.
+    std::vector<float> iHalfSin;
+};
+
+} // namespace Media
+} // namespace OpenHome
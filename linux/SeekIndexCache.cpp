@@ -0,0 +1,467 @@
+#include <OpenHome/Functor.h>
+#include <OpenHome/Private/Printer.h>
+
+#include <algorithm>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "OpenHomePlayer.h"
+#include "SeekIndexCache.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media::Codec;
+
+using namespace std;
+
+// Serialisation helpers.
+//
+// Entries are local to the host so are stored in native byte order.
+static void append(vector<TByte>& aData, const void* aValue, size_t aBytes)
+{
+    const TByte *ptr = (const TByte *)aValue;
+
+    aData.insert(aData.end(), ptr, ptr + aBytes);
+}
+
+static TBool extract(const vector<TByte>& aData, size_t& aOffset,
+                     void* aValue, size_t aBytes)
+{
+    if (aOffset + aBytes > aData.size())
+    {
+        return false;
+    }
+
+    memcpy(aValue, &aData[aOffset], aBytes);
+    aOffset += aBytes;
+
+    return true;
+}
+
+// Record of a cache file used when evicting entries.
+typedef struct
+{
+    string  path;
+    time_t  lastUsed;
+    off_t   bytes;
+} CacheFile;
+
+static bool leastRecentlyUsed(const CacheFile& aFile1, const CacheFile& aFile2)
+{
+    return aFile1.lastUsed < aFile2.lastUsed;
+}
+
+// SeekIndexCache
+
+SeekIndexCache::SeekIndexCache(TUint64 aMaxBytes)
+    : iMaxBytes(aMaxBytes)
+    , iLock("SICL")
+    , iWriteSem("SICW", 0)
+    , iQuit(false)
+    , iThread(NULL)
+{
+    const char *homePath = getenv("HOME");
+
+    if ((homePath == NULL) || (iMaxBytes == 0))
+    {
+        return;
+    }
+
+    // The cache lives alongside the application configuration file.
+    string configDir(homePath);
+    configDir += "/.config";
+
+    string appDir(configDir);
+    appDir += "/";
+    appDir += g_appName;
+
+    string cacheDir(appDir);
+    cacheDir += "/SeekIndexCache";
+
+    const string *dirs[] = {&configDir, &appDir, &cacheDir};
+
+    for (TUint i=0; i<sizeof(dirs)/sizeof(dirs[0]); i++)
+    {
+        struct stat buf;
+
+        if ((stat(dirs[i]->c_str(), &buf) != 0) &&
+            (mkdir(dirs[i]->c_str(), S_IRWXU | S_IRGRP | S_IXGRP |
+                                     S_IROTH | S_IXOTH) != 0))
+        {
+            Log::Print("SeekIndexCache: Cannot create '%s'\n",
+                       dirs[i]->c_str());
+            return;
+        }
+    }
+
+    iCacheDir = cacheDir;
+
+    iThread = new ThreadFunctor("SeekIndexWriter",
+                                MakeFunctor(*this,
+                                            &SeekIndexCache::writerThread),
+                                kPriorityLow);
+    iThread->Start();
+}
+
+SeekIndexCache::~SeekIndexCache()
+{
+    if (iThread == NULL)
+    {
+        return;
+    }
+
+    {
+        AutoMutex am(iLock);
+        iQuit = true;
+    }
+
+    iWriteSem.Signal();
+    delete iThread;
+}
+
+string SeekIndexCache::entryPath(TUint64 aStreamLength, TUint64 aHash) const
+{
+    char name[64];
+
+    snprintf(name, sizeof(name), "/%016llx-%016llx.idx",
+             (unsigned long long)aStreamLength, (unsigned long long)aHash);
+
+    return iCacheDir + name;
+}
+
+// FNV-1a hash of the leading aBytes of aData.
+TUint32 SeekIndexCache::checksum(const vector<TByte>& aData, size_t aBytes)
+{
+    TUint32 hash = 2166136261U;
+
+    for (size_t i=0; i<aBytes; i++)
+    {
+        hash ^= aData[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+TBool SeekIndexCache::TryLoad(TUint64 aStreamLength, TUint64 aHash,
+                              TUint64 aHashedBytes, SeekIndexEntry& aEntry)
+{
+    if (iCacheDir.empty())
+    {
+        return false;
+    }
+
+    string path = entryPath(aStreamLength, aHash);
+    FILE  *file = fopen(path.c_str(), "rb");
+
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    struct stat  buf;
+    vector<TByte> data;
+    TBool        valid = false;
+
+    if ((fstat(fileno(file), &buf) == 0) &&
+        (buf.st_size > 0) && ((TUint64)buf.st_size <= iMaxBytes))
+    {
+        data.resize(buf.st_size);
+        valid = (fread(&data[0], 1, data.size(), file) == data.size());
+    }
+
+    fclose(file);
+
+    TUint32 magic     = 0;
+    TUint32 version   = 0;
+    TUint64 length    = 0;
+    TUint64 hash      = 0;
+    TUint64 hashed    = 0;
+    TUint32 points    = 0;
+    TUint32 stored    = 0;
+    size_t  offset    = 0;
+
+    valid = valid &&
+            extract(data, offset, &magic, sizeof(magic)) &&
+            extract(data, offset, &version, sizeof(version)) &&
+            extract(data, offset, &length, sizeof(length)) &&
+            extract(data, offset, &hash, sizeof(hash)) &&
+            extract(data, offset, &hashed, sizeof(hashed)) &&
+            extract(data, offset, &aEntry.codecId, sizeof(aEntry.codecId)) &&
+            extract(data, offset, &aEntry.sampleRate, sizeof(aEntry.sampleRate)) &&
+            extract(data, offset, &aEntry.channels, sizeof(aEntry.channels)) &&
+            extract(data, offset, &aEntry.channelLayout, sizeof(aEntry.channelLayout)) &&
+            extract(data, offset, &aEntry.format, sizeof(aEntry.format)) &&
+            extract(data, offset, &aEntry.frameSize, sizeof(aEntry.frameSize)) &&
+            extract(data, offset, &aEntry.bitRate, sizeof(aEntry.bitRate)) &&
+            extract(data, offset, &aEntry.duration, sizeof(aEntry.duration)) &&
+            extract(data, offset, &aEntry.startTime, sizeof(aEntry.startTime)) &&
+            extract(data, offset, &points, sizeof(points));
+
+    valid = valid &&
+            (magic == kMagic) && (version == kVersion) &&
+            (length == aStreamLength) && (hash == aHash) &&
+            (hashed == aHashedBytes) &&
+            (data.size() == offset + (points * sizeof(SeekPoint)) +
+                                     sizeof(stored));
+
+    if (valid)
+    {
+        aEntry.index.resize(points);
+
+        for (TUint32 i=0; i<points; i++)
+        {
+            extract(data, offset, &aEntry.index[i], sizeof(SeekPoint));
+        }
+
+        extract(data, offset, &stored, sizeof(stored));
+
+        valid = (stored == checksum(data, data.size() - sizeof(stored)));
+    }
+
+    if (! valid)
+    {
+        Log::Print("SeekIndexCache: Discarding invalid entry '%s'\n",
+                   path.c_str());
+
+        unlink(path.c_str());
+        aEntry.index.clear();
+
+        return false;
+    }
+
+    // Mark the entry as recently used.
+    utime(path.c_str(), NULL);
+
+    return true;
+}
+
+void SeekIndexCache::Store(TUint64 aStreamLength, TUint64 aHash,
+                           TUint64 aHashedBytes, const SeekIndexEntry& aEntry)
+{
+    if (iCacheDir.empty())
+    {
+        return;
+    }
+
+    vector<TByte> data;
+    TUint32       magic   = kMagic;
+    TUint32       version = kVersion;
+    TUint32       points  = (TUint32)aEntry.index.size();
+
+    data.reserve(128 + (points * sizeof(SeekPoint)));
+
+    append(data, &magic, sizeof(magic));
+    append(data, &version, sizeof(version));
+    append(data, &aStreamLength, sizeof(aStreamLength));
+    append(data, &aHash, sizeof(aHash));
+    append(data, &aHashedBytes, sizeof(aHashedBytes));
+    append(data, &aEntry.codecId, sizeof(aEntry.codecId));
+    append(data, &aEntry.sampleRate, sizeof(aEntry.sampleRate));
+    append(data, &aEntry.channels, sizeof(aEntry.channels));
+    append(data, &aEntry.channelLayout, sizeof(aEntry.channelLayout));
+    append(data, &aEntry.format, sizeof(aEntry.format));
+    append(data, &aEntry.frameSize, sizeof(aEntry.frameSize));
+    append(data, &aEntry.bitRate, sizeof(aEntry.bitRate));
+    append(data, &aEntry.duration, sizeof(aEntry.duration));
+    append(data, &aEntry.startTime, sizeof(aEntry.startTime));
+    append(data, &points, sizeof(points));
+
+    for (TUint32 i=0; i<points; i++)
+    {
+        append(data, &aEntry.index[i], sizeof(SeekPoint));
+    }
+
+    TUint32 sum = checksum(data, data.size());
+    append(data, &sum, sizeof(sum));
+
+    if (data.size() > iMaxBytes)
+    {
+        return;
+    }
+
+    string path = entryPath(aStreamLength, aHash);
+
+    {
+        AutoMutex am(iLock);
+
+        // Another entry is of little value next to a disk that is not
+        // keeping up.
+        if (iPending.size() >= kMaxPending)
+        {
+            Log::Print("SeekIndexCache: Writes pending, dropping '%s'\n",
+                       path.c_str());
+            return;
+        }
+
+        iPending.push_back(PendingWrite());
+        iPending.back().path.swap(path);
+        iPending.back().data.swap(data);
+    }
+
+    iWriteSem.Signal();
+}
+
+// Remove an entry found not to describe the stream it was loaded for.
+void SeekIndexCache::Remove(TUint64 aStreamLength, TUint64 aHash)
+{
+    if (iCacheDir.empty())
+    {
+        return;
+    }
+
+    string path = entryPath(aStreamLength, aHash);
+
+    Log::Print("SeekIndexCache: Removing mismatched entry '%s'\n",
+               path.c_str());
+
+    unlink(path.c_str());
+}
+
+// Writes queued entries until destruction, completing any still pending.
+// Each entry queued signals once, as does destruction, so the queue is
+// empty when the quit is seen.
+void SeekIndexCache::writerThread()
+{
+    for (;;)
+    {
+        PendingWrite pending;
+
+        iWriteSem.Wait();
+
+        {
+            AutoMutex am(iLock);
+
+            if (iPending.empty())
+            {
+                if (iQuit)
+                {
+                    break;
+                }
+
+                continue;
+            }
+
+            pending.path.swap(iPending.front().path);
+            pending.data.swap(iPending.front().data);
+            iPending.pop_front();
+        }
+
+        writeEntry(pending);
+    }
+}
+
+// Write to a temporary file, then rename into place. The rename is atomic
+// so readers see either the previous entry or the complete new one.
+void SeekIndexCache::writeEntry(const PendingWrite& aWrite)
+{
+    const string&        path    = aWrite.path;
+    const vector<TByte>& data    = aWrite.data;
+    string               tmpPath = path + ".tmp";
+
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+    {
+        Log::Print("SeekIndexCache: Cannot create '%s'\n", tmpPath.c_str());
+        return;
+    }
+
+    size_t  written = 0;
+    TBool   success = true;
+
+    while (written < data.size())
+    {
+        ssize_t ret = write(fd, &data[written], data.size() - written);
+
+        if (ret <= 0)
+        {
+            success = false;
+            break;
+        }
+
+        written += ret;
+    }
+
+    success = success && (fsync(fd) == 0);
+    success = (close(fd) == 0) && success;
+
+    if (! success || (rename(tmpPath.c_str(), path.c_str()) != 0))
+    {
+        Log::Print("SeekIndexCache: Cannot write '%s'\n", path.c_str());
+
+        unlink(tmpPath.c_str());
+        return;
+    }
+
+    evict();
+}
+
+// Remove the least recently used entries until the cache is within its
+// bounds.
+void SeekIndexCache::evict()
+{
+    DIR *dir = opendir(iCacheDir.c_str());
+
+    if (dir == NULL)
+    {
+        return;
+    }
+
+    vector<CacheFile> files;
+    TUint64           totalBytes = 0;
+    struct dirent    *dirEntry;
+
+    while ((dirEntry = readdir(dir)) != NULL)
+    {
+        const char *name = dirEntry->d_name;
+        size_t      len  = strlen(name);
+
+        if ((len < 4) || (strcmp(name + len - 4, ".idx") != 0))
+        {
+            continue;
+        }
+
+        CacheFile   file;
+        struct stat buf;
+
+        file.path = iCacheDir + "/" + name;
+
+        if (stat(file.path.c_str(), &buf) != 0)
+        {
+            continue;
+        }
+
+        file.lastUsed = buf.st_mtime;
+        file.bytes    = buf.st_size;
+
+        totalBytes += file.bytes;
+        files.push_back(file);
+    }
+
+    closedir(dir);
+
+    if ((totalBytes <= iMaxBytes) && (files.size() <= kMaxEntries))
+    {
+        return;
+    }
+
+    sort(files.begin(), files.end(), leastRecentlyUsed);
+
+    for (size_t i=0; i<files.size(); i++)
+    {
+        if ((totalBytes <= iMaxBytes) && (files.size() - i <= kMaxEntries))
+        {
+            break;
+        }
+
+        unlink(files[i].path.c_str());
+        totalBytes -= files[i].bytes;
+    }
+}
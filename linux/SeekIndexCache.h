@@ -0,0 +1,89 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Private/Thread.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace OpenHome {
+namespace Media {
+namespace Codec {
+
+// A position in the stream recorded while decoding, used for seeking.
+typedef struct
+{
+    TUint64          sample;     // First sample of the packet.
+    TUint64          bytePos;    // Stream offset of the packet.
+} SeekPoint;
+
+// Stream parameters and seek index retained for a previously decoded
+// stream.
+typedef struct
+{
+    TUint32          codecId;
+    TInt32           sampleRate;
+    TInt32           channels;
+    TUint64          channelLayout;
+    TInt32           format;
+    TInt32           frameSize;
+    TInt64           bitRate;
+    TInt64           duration;
+    TInt64           startTime;
+    std::vector<SeekPoint> index;
+} SeekIndexEntry;
+
+// Persistent cache of stream parameters and seek indexes.
+//
+// Entries are keyed by the stream length and a hash of the stream data read
+// to open it, the count of bytes hashed being checked on loading. Entries
+// found not to match the stream are removed by the codec. Each entry is held in its own file, written to a temporary file and
+// renamed into place so a partially written entry is never read. Entries are
+// checksummed and discarded if corrupt.
+//
+// Store() only serialises the entry. The file is written, synced and
+// renamed by a low priority thread of its own, so the decoding thread never
+// waits on the disk. Writes still pending on destruction are completed.
+//
+// The cache is bounded in size, evicting the least recently used entries.
+class SeekIndexCache
+{
+    static const TUint32 kMagic      = 0x4f485349; // 'OHSI'
+    static const TUint32 kVersion    = 2;
+    static const TUint   kMaxEntries = 1024;
+    static const TUint   kMaxPending = 8;
+public:
+    SeekIndexCache(TUint64 aMaxBytes);
+    ~SeekIndexCache();
+    TBool TryLoad(TUint64 aStreamLength, TUint64 aHash, TUint64 aHashedBytes,
+                  SeekIndexEntry& aEntry);
+    void  Store(TUint64 aStreamLength, TUint64 aHash, TUint64 aHashedBytes,
+                const SeekIndexEntry& aEntry);
+    void  Remove(TUint64 aStreamLength, TUint64 aHash);
+private:
+    // A serialised entry waiting for the writer thread.
+    typedef struct
+    {
+        std::string        path;
+        std::vector<TByte> data;
+    } PendingWrite;
+
+    std::string entryPath(TUint64 aStreamLength, TUint64 aHash) const;
+    void        writerThread();
+    void        writeEntry(const PendingWrite& aWrite);
+    void        evict();
+    static TUint32 checksum(const std::vector<TByte>& aData, size_t aBytes);
+private:
+    std::string              iCacheDir;
+    TUint64                  iMaxBytes;
+    Mutex                    iLock;
+    Semaphore                iWriteSem;
+    std::deque<PendingWrite> iPending;
+    TBool                    iQuit;
+    ThreadFunctor           *iThread;
+};
+
+} // namespace Codec
+} // namespace Media
+} // namespace OpenHome
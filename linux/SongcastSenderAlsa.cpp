@@ -0,0 +1,507 @@
+#include <OpenHome/Av/Songcast/OhmSender.h>
+#include <OpenHome/Av/Songcast/ZoneHandler.h>
+#include <OpenHome/Net/Core/DvDevice.h>
+#include <OpenHome/Private/Env.h>
+#include <OpenHome/Private/Printer.h>
+#include <OpenHome/OsWrapper.h>
+#include <OpenHome/Optional.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "OhmTimestamperAlsa.h"
+#include "SongcastSenderAlsa.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Av;
+using namespace OpenHome::Media;
+
+SongcastSenderAlsa::SongcastSenderAlsa(Environment& aEnv,
+                                       Net::DvStack& aDvStack,
+                                       const Brx& aUdn,
+                                       const Brx& aName,
+                                       TIpAddress aInterface,
+                                       TBool aMulticast, TUint aPacketUs,
+                                       OhmTimestamperAlsa* aTimestamper)
+    : iEnv(aEnv)
+    , iTimestamper(aTimestamper)
+    , iMulticast(aMulticast)
+    , iPacketUs(std::min(std::max(aPacketUs, (TUint)kMinPacketUs),
+                         (TUint)kMaxPacketUs))
+    , iFree(kSlots)
+    , iPending(kSlots)
+    , iSlot(kNoSlot)
+    , iPacketBytes(0)
+    , iSubsampleBytes(0)
+    , iFrameBytes(0)
+    , iSampleRate(0)
+    , iMsgBytes(0)
+    , iDitch(true)
+    , iDropped(0)
+    , iFormatPending(false)
+    , iHaltPending(false)
+    , iPackets(0)
+    , iSendUs(0)
+    , iMaxSendUs(0)
+    , iStatsUs(0)
+{
+    Optional<IOhmTimestamper> timestamper(aTimestamper);
+
+    Bws<256> udn(aUdn);
+    Bws<256> friendlyName(aName);
+
+    udn.Append("-Sender");
+    friendlyName.Append(" (ALSA)");
+
+    iDevice = new Net::DvDeviceStandard(aDvStack, udn);
+    iDevice->SetAttribute("Upnp.Domain", "av.openhome.org");
+    iDevice->SetAttribute("Upnp.Type", "Sender");
+    iDevice->SetAttribute("Upnp.Version", "1");
+    iDevice->SetAttribute("Upnp.FriendlyName", friendlyName.PtrZ());
+    iDevice->SetAttribute("Upnp.Manufacturer", "OpenHome");
+    iDevice->SetAttribute("Upnp.ModelName", "ExampleMediaPlayer");
+
+    iZoneHandler  = new ZoneHandler(aEnv, iDevice->Udn());
+    iSenderDriver = new OhmSenderDriver(aEnv, timestamper);
+    iSender       = new OhmSender(aEnv, *iDevice, *iSenderDriver,
+                                  *iZoneHandler, timestamper, aName,
+                                  kSongcastChannel, aInterface, kSongcastTtl,
+                                  kSongcastLatencyMs, aMulticast,
+                                  true,          // enabled
+                                  Brx::Empty(),  // image
+                                  Brx::Empty(),  // image mime type
+                                  kSongcastPreset);
+
+    iDevice->SetEnabled();
+
+    // The audio buffers are allocated here, not on the animator thread.
+    iSlots = new Slot[kSlots];
+
+    for (TUint i=0; i<kSlots; i++)
+    {
+        iSlots[i].iAudio.resize(kMaxPacketBytes);
+        iSlots[i].iBytes = 0;
+        iFree.Write(i);
+    }
+
+    Log::Print("SongcastSenderAlsa: %s, %uus packets\n",
+               iMulticast ? "multicast" : "unicast", iPacketUs);
+
+    iThread = new ThreadFunctor("SongcastSender",
+                                MakeFunctor(*this,
+                                            &SongcastSenderAlsa::SenderThread),
+                                kPriorityHigh);
+    iThread->Start();
+}
+
+SongcastSenderAlsa::~SongcastSenderAlsa()
+{
+    // The sender thread returns every slot it reads, so a free slot will
+    // become available.
+    if (iSlot != kNoSlot)
+    {
+        iFree.Write(iSlot);
+        iSlot = kNoSlot;
+    }
+
+    Queue(kSlotQuit);
+
+    delete iThread;
+    delete iSender;
+    delete iSenderDriver;
+    delete iZoneHandler;
+    delete iDevice;
+    delete[] iSlots;
+}
+
+// Start sending a stream, completing the audio of the previous one.
+void SongcastSenderAlsa::Enqueue(MsgDecodedStream* aMsg)
+{
+    const DecodedStreamInfo& streamInfo = aMsg->StreamInfo();
+
+    QueuePacket();
+
+    if (streamInfo.Format() == AudioFormat::Dsd)
+    {
+        Log::Print("SongcastSenderAlsa: Cannot send DSD stream!\n");
+
+        iDitch = true;
+        return;
+    }
+
+    const TUint sampleRate = streamInfo.SampleRate();
+    const TUint channels   = streamInfo.NumChannels();
+
+    // Songcast carries at most 24 bit audio, so 32 bit streams are sent
+    // truncated.
+    iSubsampleBytes = std::min(streamInfo.BitDepth() / 8, 3u);
+
+    const TUint frameBytes = channels * iSubsampleBytes;
+
+    if ((sampleRate == 0) || (frameBytes == 0))
+    {
+        iDitch = true;
+        return;
+    }
+
+    // Whole frames per packet.
+    TUint frames = (TUint)(((TUint64)sampleRate * iPacketUs) / 1000000);
+
+    frames = std::max(frames, 1u);
+    frames = std::min(frames, kMaxPacketBytes / frameBytes);
+
+    iPacketBytes = frames * frameBytes;
+    iFrameBytes  = frameBytes;
+    iSampleRate  = sampleRate;
+    iDitch       = false;
+
+    // The format is queued with the audio, so the sender thread applies it
+    // between the packets of the two streams. A format not yet queued is
+    // replaced.
+    iFormat.iSampleRate  = sampleRate;
+    iFormat.iBitRate     = streamInfo.BitRate();
+    iFormat.iChannels    = channels;
+    iFormat.iBitDepth    = iSubsampleBytes * 8;
+    iFormat.iLossless    = streamInfo.Lossless();
+    iFormat.iSampleStart = streamInfo.SampleStart();
+    iFormat.iCodecName.Replace(streamInfo.CodecName().Split(0,
+                               std::min(streamInfo.CodecName().Bytes(),
+                                        iFormat.iCodecName.MaxBytes())));
+    iFormatPending = true;
+
+    (void)QueueControls();
+}
+
+// The receivers are halted once the audio has been sent.
+void SongcastSenderAlsa::Enqueue(MsgDrain* /*aMsg*/)
+{
+    Halt();
+}
+
+void SongcastSenderAlsa::Enqueue(MsgPlayable* aMsg)
+{
+    if (! iDitch)
+    {
+        iMsgBytes = 0;
+        aMsg->Read(*this);
+    }
+}
+
+// Send any pending audio and halt the receivers.
+void SongcastSenderAlsa::Halt()
+{
+    QueuePacket();
+
+    iHaltPending = true;
+
+    (void)QueueControls();
+}
+
+void SongcastSenderAlsa::BeginBlock()
+{
+}
+
+// The audio is big endian, as Songcast sends it.
+void SongcastSenderAlsa::ProcessFragment(const Brx& aData,
+                                         TUint /*aNumChannels*/,
+                                         TUint aSubsampleBytes)
+{
+    // The ramper may inject 32 bit audio into a stream of another bit
+    // depth, and 32 bit streams are truncated.
+    if (aSubsampleBytes != iSubsampleBytes)
+    {
+        AppendConverted(aData, aSubsampleBytes);
+        return;
+    }
+
+    const TByte *ptr       = aData.Ptr();
+    TUint        remaining = aData.Bytes();
+
+    while (remaining > 0)
+    {
+        // Dropped audio still advances the position in the message.
+        if (! AcquireSlot())
+        {
+            iMsgBytes += remaining;
+            return;
+        }
+
+        Slot& slot  = iSlots[iSlot];
+        TUint bytes = std::min(remaining, iPacketBytes - slot.iBytes);
+
+        (void)memcpy(&slot.iAudio[slot.iBytes], ptr, bytes);
+
+        slot.iBytes += bytes;
+        ptr         += bytes;
+        remaining   -= bytes;
+        iMsgBytes   += bytes;
+
+        if (slot.iBytes == iPacketBytes)
+        {
+            QueuePacket();
+        }
+    }
+}
+
+void SongcastSenderAlsa::ProcessSilence(const Brx& aData,
+                                        TUint aNumChannels,
+                                        TUint aSubsampleBytes)
+{
+    ProcessFragment(aData, aNumChannels, aSubsampleBytes);
+}
+
+void SongcastSenderAlsa::EndBlock()
+{
+}
+
+void SongcastSenderAlsa::Flush()
+{
+}
+
+// Append audio at the sent bit depth, truncating or padding each sample.
+void SongcastSenderAlsa::AppendConverted(const Brx& aData,
+                                         TUint aSubsampleBytes)
+{
+    const TByte *ptr  = aData.Ptr();
+    const TByte *endp = ptr + aData.Bytes() - (aData.Bytes() % aSubsampleBytes);
+
+    for (; ptr < endp; ptr += aSubsampleBytes)
+    {
+        if (! AcquireSlot())
+        {
+            iMsgBytes += ((endp - ptr) / aSubsampleBytes) * iSubsampleBytes;
+            return;
+        }
+
+        Slot&  slot = iSlots[iSlot];
+        TByte *out  = &slot.iAudio[slot.iBytes];
+
+        for (TUint i=0; i<iSubsampleBytes; i++)
+        {
+            out[i] = (i < aSubsampleBytes) ? ptr[i] : (TByte)0;
+        }
+
+        slot.iBytes += iSubsampleBytes;
+        iMsgBytes   += iSubsampleBytes;
+
+        if (slot.iBytes == iPacketBytes)
+        {
+            QueuePacket();
+        }
+    }
+}
+
+// Take a free slot for the next packet without waiting for the sender
+// thread, so a slow network never delays the local playback. Audio is
+// dropped while none is free, leaving kControlSlots for the commands, or
+// while a command is still to be queued.
+//
+// The packet is stamped with the time its first sample plays, which the
+// driver has reported for the start of the message being read.
+TBool SongcastSenderAlsa::AcquireSlot()
+{
+    if (iSlot != kNoSlot)
+    {
+        return true;
+    }
+
+    if ((! QueueControls()) || (iFree.SlotsUsed() <= kControlSlots))
+    {
+        if (iDropped++ == 0)
+        {
+            Log::Print("SongcastSenderAlsa: Sender overrun, dropping "
+                       "audio\n");
+        }
+
+        return false;
+    }
+
+    if (iDropped != 0)
+    {
+        Log::Print("SongcastSenderAlsa: Dropped %u fragments\n", iDropped);
+
+        iDropped = 0;
+    }
+
+    iSlot = iFree.Read();
+
+    iSlots[iSlot].iType  = kSlotAudio;
+    iSlots[iSlot].iBytes = 0;
+
+    if (iTimestamper != NULL)
+    {
+        iSlots[iSlot].iTicks = MediaClockAlsa::getInstance()->WriteTicks(
+                                   iMsgBytes / iFrameBytes, iSampleRate);
+    }
+
+    return true;
+}
+
+// Queue the packet being filled, if any.
+void SongcastSenderAlsa::QueuePacket()
+{
+    if (iSlot == kNoSlot)
+    {
+        return;
+    }
+
+    if (iSlots[iSlot].iBytes == 0)
+    {
+        iFree.Write(iSlot);
+    }
+    else
+    {
+        iPending.Write(iSlot);
+    }
+
+    iSlot = kNoSlot;
+}
+
+// Queue any pending commands, without waiting for the sender thread.
+//
+// Audio never takes the last kControlSlots slots, so commands are only
+// held while the sender thread is stalled. Meanwhile a halt is merged with
+// any halt pending and a format replaces any format pending. The halt
+// precedes the format, as no audio of the new stream has been queued.
+TBool SongcastSenderAlsa::QueueControls()
+{
+    if (iHaltPending)
+    {
+        if (iFree.SlotsUsed() == 0)
+        {
+            return false;
+        }
+
+        TUint index = iFree.Read();
+
+        iSlots[index].iType  = kSlotHalt;
+        iSlots[index].iBytes = 0;
+
+        iPending.Write(index);
+
+        iHaltPending = false;
+    }
+
+    if (iFormatPending)
+    {
+        if (iFree.SlotsUsed() == 0)
+        {
+            return false;
+        }
+
+        TUint index = iFree.Read();
+        Slot& slot  = iSlots[index];
+
+        slot.iType        = kSlotFormat;
+        slot.iBytes       = 0;
+        slot.iSampleRate  = iFormat.iSampleRate;
+        slot.iBitRate     = iFormat.iBitRate;
+        slot.iChannels    = iFormat.iChannels;
+        slot.iBitDepth    = iFormat.iBitDepth;
+        slot.iLossless    = iFormat.iLossless;
+        slot.iSampleStart = iFormat.iSampleStart;
+        slot.iCodecName.Replace(iFormat.iCodecName);
+
+        iPending.Write(index);
+
+        iFormatPending = false;
+    }
+
+    return true;
+}
+
+// Queue a command, waiting for a slot. Only used once the animator thread
+// has stopped.
+void SongcastSenderAlsa::Queue(TUint aType)
+{
+    TUint index = iFree.Read();
+
+    iSlots[index].iType  = aType;
+    iSlots[index].iBytes = 0;
+
+    iPending.Write(index);
+}
+
+// The driver paces the audio at the rate the device plays, so packets are
+// sent as they arrive.
+void SongcastSenderAlsa::SenderThread()
+{
+    for (;;)
+    {
+        TUint index = iPending.Read();
+        Slot& slot  = iSlots[index];
+        TUint type  = slot.iType;
+
+        switch (type)
+        {
+            case kSlotAudio:
+            {
+                TUint64 start = Os::TimeInUs(iEnv.OsCtx());
+
+                if (iTimestamper != NULL)
+                {
+                    iTimestamper->SetNextTimestamp(slot.iTicks);
+                }
+
+                iSenderDriver->SendAudio(&slot.iAudio[0], slot.iBytes);
+
+                TUint64 end = Os::TimeInUs(iEnv.OsCtx());
+
+                iPackets++;
+                iSendUs    += end - start;
+                iMaxSendUs  = std::max(iMaxSendUs, end - start);
+
+                LogStats(end);
+                break;
+            }
+            case kSlotFormat:
+                iSenderDriver->SetAudioFormat(slot.iSampleRate,
+                                              slot.iBitRate,
+                                              slot.iChannels,
+                                              slot.iBitDepth,
+                                              slot.iLossless,
+                                              slot.iCodecName,
+                                              slot.iSampleStart);
+                break;
+            case kSlotHalt:
+                iSenderDriver->SendAudio(&slot.iAudio[0], 0, true);
+                break;
+            default:
+                break;
+        }
+
+        iFree.Write(index);
+
+        if (type == kSlotQuit)
+        {
+            break;
+        }
+    }
+}
+
+// In unicast mode each packet is sent to every receiver, so the send cost
+// grows with the number of receivers.
+void SongcastSenderAlsa::LogStats(TUint64 aNowUs)
+{
+    if (iStatsUs == 0)
+    {
+        iStatsUs = aNowUs;
+    }
+
+    if ((aNowUs - iStatsUs < kStatsIntervalUs) || (iPackets == 0))
+    {
+        return;
+    }
+
+    Log::Print("SongcastSenderAlsa: %s, %llu packets, "
+               "send %lluus mean, %lluus max\n",
+               iMulticast ? "multicast" : "unicast",
+               (unsigned long long)iPackets,
+               (unsigned long long)(iSendUs / iPackets),
+               (unsigned long long)iMaxSendUs);
+
+    iPackets   = 0;
+    iSendUs    = 0;
+    iMaxSendUs = 0;
+    iStatsUs   = aNowUs;
+}
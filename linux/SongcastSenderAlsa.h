@@ -0,0 +1,141 @@
+#pragma once
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Media/Pipeline/Msg.h>
+#include <OpenHome/Private/Fifo.h>
+#include <OpenHome/Private/Thread.h>
+
+#include <vector>
+
+namespace OpenHome {
+class Environment;
+namespace Net {
+    class DvDeviceStandard;
+    class DvStack;
+}
+namespace Av {
+    class OhmSender;
+    class OhmSenderDriver;
+    class OhmTimestamperAlsa;
+    class ZoneHandler;
+}
+namespace Media {
+
+// Sends the audio played by DriverAlsa as a Songcast stream, so any number
+// of receivers play a stream decoded once.
+//
+// The driver passes each stream and its audio on the animator thread,
+// which paces them at the rate the device plays. Packets of aPacketUs are
+// queued for a thread of their own, which sends them either multicast or
+// unicast to each receiver, so the cost of sending does not delay the
+// local playback. The cost is measured and logged periodically. The
+// animator thread never waits for the sender thread.
+//
+// The media player device already hosts the Sender service of the Songcast
+// source, sending the pipeline's audio, so this sender is published by a
+// Sender device of its own, as a standalone Songcast sender is.
+//
+// With a timestamper, each packet is stamped with the time its first
+// sample plays through ALSA, rather than the time it is sent.
+class SongcastSenderAlsa : private IPcmProcessor, private INonCopyable
+{
+    static const TUint kSongcastTtl       = 4;
+    static const TUint kSongcastLatencyMs = 300;
+    static const TUint kSongcastChannel   = 0;
+    static const TUint kSongcastPreset    = 0;
+    static const TUint kMaxPacketBytes    = 8 * 1024;
+    static const TUint kMinPacketUs       = 1000;
+    static const TUint kMaxPacketUs       = 20000;
+    static const TUint kSlots             = 64;
+    static const TUint kControlSlots      = 4;
+    static const TUint kNoSlot            = kSlots;
+    static const TUint kStatsIntervalUs   = 60000000;
+public:
+    SongcastSenderAlsa(Environment& aEnv, Net::DvStack& aDvStack,
+                       const Brx& aUdn, const Brx& aName,
+                       TIpAddress aInterface,
+                       TBool aMulticast, TUint aPacketUs,
+                       Av::OhmTimestamperAlsa* aTimestamper);
+    ~SongcastSenderAlsa();
+public: // Called by the driver's animator thread
+    void Enqueue(MsgDecodedStream* aMsg);
+    void Enqueue(MsgDrain* aMsg);
+    void Enqueue(MsgPlayable* aMsg);
+    void Halt();
+private:
+    enum SlotType
+    {
+        kSlotAudio,
+        kSlotFormat,
+        kSlotHalt,
+        kSlotQuit
+    };
+
+    // A packet of audio, or a command, queued for the sender thread.
+    struct Slot
+    {
+        TUint              iType;
+        std::vector<TByte> iAudio;
+        TUint              iBytes;
+        TUint              iSampleRate;
+        TUint              iBitRate;
+        TUint              iChannels;
+        TUint              iBitDepth;
+        TBool              iLossless;
+        Bws<32>            iCodecName;
+        TUint64            iSampleStart;
+        TUint              iTicks;      // Media clock time of the audio.
+    };
+private: // from IPcmProcessor
+    void BeginBlock() override;
+    void ProcessFragment(const Brx& aData, TUint aNumChannels,
+                         TUint aSubsampleBytes) override;
+    void ProcessSilence(const Brx& aData, TUint aNumChannels,
+                        TUint aSubsampleBytes) override;
+    void EndBlock() override;
+    void Flush() override;
+private:
+    void  AppendConverted(const Brx& aData, TUint aSubsampleBytes);
+    TBool AcquireSlot();
+    void  QueuePacket();
+    TBool QueueControls();
+    void  Queue(TUint aType);
+    void  SenderThread();
+    void  LogStats(TUint64 aNowUs);
+private:
+    Environment&            iEnv;
+    Net::DvDeviceStandard  *iDevice;
+    Av::ZoneHandler        *iZoneHandler;
+    Av::OhmSenderDriver    *iSenderDriver;
+    Av::OhmSender          *iSender;
+    Av::OhmTimestamperAlsa *iTimestamper;
+    const TBool             iMulticast;
+    const TUint             iPacketUs;
+    Slot                   *iSlots;
+    Fifo<TUint>             iFree;
+    Fifo<TUint>             iPending;
+
+    // Owned by the animator thread.
+    TUint                   iSlot;        // Being filled, or kNoSlot.
+    TUint                   iPacketBytes;
+    TUint                   iSubsampleBytes;
+    TUint                   iFrameBytes;
+    TUint                   iSampleRate;
+    TUint                   iMsgBytes;    // Appended from the current message.
+    TBool                   iDitch;
+    TUint                   iDropped;
+    Slot                    iFormat;      // Format not yet queued.
+    TBool                   iFormatPending;
+    TBool                   iHaltPending;
+
+    // Owned by the sender thread.
+    TUint64                 iPackets;     // Statistics since the last log.
+    TUint64                 iSendUs;
+    TUint64                 iMaxSendUs;
+    TUint64                 iStatsUs;
+    ThreadFunctor          *iThread;
+};
+
+} // namespace Media
+} // namespace OpenHome
@@ -5,6 +5,8 @@
 #include <alsa/asoundlib.h>
 #include <math.h>
 
+#include <algorithm>
+
 #include "Volume.h"
 
 using namespace OpenHome;
@@ -80,6 +82,12 @@ IVolumeProfile::StartupVolume VolumeProfile::StartupVolumeConfig() const
 
 
 VolumeControl::VolumeControl()
+    : iLock("VOLC")
+    , iVolumeSet(false)
+    , iVolume(0)
+    , iHeadroomMilliDb(0)
+    , iLoudnessMilliDb(0)
+    , iUnscaledLogged(false)
 {
     const TChar *CARD          = "default";
     const TChar *SELEM_NAMES[] = {"Digital", "PCM", "Master"};
@@ -124,6 +132,44 @@ TBool VolumeControl::IsVolumeSupported()
 }
 
 void VolumeControl::SetVolume(TUint aVolume)
+{
+    AutoMutex am(iLock);
+
+    iVolumeSet = true;
+    iVolume    = aVolume;
+    applyVolume();
+}
+
+// Loudness normalisation lowers the volume range by aMilliDb, leaving room
+// to boost quiet tracks at the top of the range.
+void VolumeControl::SetLoudnessHeadroom(TUint aMilliDb)
+{
+    AutoMutex am(iLock);
+
+    iHeadroomMilliDb = aMilliDb;
+
+    if (iVolumeSet)
+    {
+        applyVolume();
+    }
+}
+
+// Loudness normalisation trims the volume by aMilliDb.
+void VolumeControl::SetLoudnessGain(TInt aMilliDb)
+{
+    AutoMutex am(iLock);
+
+    iLoudnessMilliDb = aMilliDb;
+
+    if (iVolumeSet)
+    {
+        applyVolume();
+    }
+}
+
+// Set the mixer to the volume, trimmed by the loudness gain. Called with
+// iLock held.
+void VolumeControl::applyVolume()
 {
     const long  MAX_LINEAR_DB_SCALE = 24;
     const TUint MILLI_DB_PER_STEP   = 1024;
@@ -138,7 +184,15 @@ void VolumeControl::SetVolume(TUint aVolume)
         return;
     }
 
-    volume = double((aVolume / MILLI_DB_PER_STEP)/100.0f);
+    volume = double((iVolume / MILLI_DB_PER_STEP)/100.0f);
+
+    // The mixer's dB values are in hundredths of a dB. The loudness gain is
+    // applied within the headroom reserved for it, so boosts are not
+    // clamped at the top of the range. A volume of 0 is left at the bottom
+    // of the range.
+    const long trim = (iVolume == 0)
+                          ? 0
+                          : (iLoudnessMilliDb - (TInt)iHeadroomMilliDb) / 10;
 
     // Use the dB range to map the volume to a scale more in tune
     // with the human ear, if possible.
@@ -152,7 +206,17 @@ void VolumeControl::SetVolume(TUint aVolume)
             return;
         }
 
-        value = lrint(floor(volume * (max - min))) + min;
+        // Nothing is known of the control's response, so the loudness gain
+        // cannot be converted to steps.
+        if (((iLoudnessMilliDb != 0) || (iHeadroomMilliDb != 0)) &&
+            ! iUnscaledLogged)
+        {
+            Log::Print("VolumeControl: Mixer has no dB scale, loudness "
+                       "normalisation unavailable\n");
+            iUnscaledLogged = true;
+        }
+
+        value  = lrint(floor(volume * (max - min))) + min;
         snd_mixer_selem_set_playback_volume_all(iElem, value);
 
         return;
@@ -162,6 +226,7 @@ void VolumeControl::SetVolume(TUint aVolume)
     {
         // dB range less than 24 dB, use a linear mapping
         value = lrint(floor(volume * (max - min))) + min;
+        value = std::min(std::max(value + trim, min), max);
         snd_mixer_selem_set_playback_dB_all(iElem, value, -1);
 
         return;
@@ -172,6 +237,7 @@ void VolumeControl::SetVolume(TUint aVolume)
         volume = volume * (1 - min_norm) + min_norm;
     }
     value = lrint(floor(6000.0 * log10(volume))) + max;
+    value = std::min(std::max(value + trim, min), max);
     snd_mixer_selem_set_playback_dB_all(iElem, value, -1);
 
     return;
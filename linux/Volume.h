@@ -7,6 +7,8 @@
 
 #include <alsa/asoundlib.h>
 
+#include "LoudnessNormaliser.h"
+
 namespace OpenHome {
 namespace Av {
 
@@ -44,21 +46,33 @@ private: // from IVolumeProfile
     StartupVolume StartupVolumeConfig() const override;
 };
 
-class VolumeControl : public IVolume, public IBalance, public IFade
+class VolumeControl : public IVolume, public IBalance, public IFade,
+                      public Media::ILoudnessGain
 {
 public:
     VolumeControl();
     ~VolumeControl();
     TBool IsVolumeSupported();
+private:
+    void applyVolume();
 private:
     snd_mixer_t          *iHandle;    // ALSA mixer handle.
     snd_mixer_elem_t     *iElem;      // PCM mixer element
+    Mutex                 iLock;
+    TBool                 iVolumeSet; // Guarded by iLock.
+    TUint                 iVolume;
+    TUint                 iHeadroomMilliDb;
+    TInt                  iLoudnessMilliDb;
+    TBool                 iUnscaledLogged;
 private: // from IVolume
     void SetVolume(TUint aVolume) override;
 private: // from IBalance
     void SetBalance(TInt aBalance) override;
 private: // from IFade
     void SetFade(TInt aFade) override;
+private: // from Media::ILoudnessGain
+    void SetLoudnessHeadroom(TUint aMilliDb) override;
+    void SetLoudnessGain(TInt aMilliDb) override;
 };
 
 } // namespace Av
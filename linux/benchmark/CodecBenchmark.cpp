@@ -0,0 +1,293 @@
+// Codec throughput benchmark.
+//
+// Decodes local files held in memory through the pipeline's
+// CodecController, see TimeDecode(). Each file is decoded by
+// CodecLibAV and by the native ohMediaPlayer codecs, one JSON record per
+// file and decoder, eg.
+//
+//   openhome-codec-benchmark [--threads N] [--repeat N] file...
+//
+//   {"file":"a.flac","decoder":"native","codec":"FLAC",...}
+//
+// The records give the decode speed as a multiple of real time, process
+// CPU per sample (including any decoder worker threads), heap
+// allocations per second of audio and the process peak RSS so far. Run a
+// single file per invocation for a peak RSS specific to its format.
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Media/Codec/CodecController.h>
+#include <OpenHome/Media/Codec/CodecFactory.h>
+#include <OpenHome/Media/MimeTypeList.h>
+#include <OpenHome/Media/Pipeline/Msg.h>
+#include <OpenHome/Media/Utils/AllocatorInfoLogger.h>
+#include <OpenHome/Net/Core/OhNet.h>
+#include <OpenHome/Private/Ascii.h>
+#include <OpenHome/Private/Printer.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "../CodecTiming.h"
+#include "../ConfigGTKKeyStore.h"
+#include "../Libav.h"
+#include "../OptionalFeatures.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Configuration;
+using namespace OpenHome::Media;
+using namespace OpenHome::Media::Codec;
+
+// The benchmark has its own configuration, so leaves the player's caches
+// and settings untouched.
+const gchar *g_appName = "OpenHomePlayerBenchmark";
+
+// Heap allocations, counted by interposing the glibc allocator. This
+// counts those of libavcodec and the native codecs alike, from any thread.
+static std::atomic<TUint64> g_allocs(0);
+
+extern "C"
+{
+void *__libc_malloc(size_t aBytes);
+void *__libc_calloc(size_t aCount, size_t aBytes);
+void *__libc_realloc(void *aPtr, size_t aBytes);
+void *__libc_memalign(size_t aAlign, size_t aBytes);
+
+void *malloc(size_t aBytes)
+{
+    g_allocs++;
+    return __libc_malloc(aBytes);
+}
+
+void *calloc(size_t aCount, size_t aBytes)
+{
+    g_allocs++;
+    return __libc_calloc(aCount, aBytes);
+}
+
+void *realloc(void *aPtr, size_t aBytes)
+{
+    g_allocs++;
+    return __libc_realloc(aPtr, aBytes);
+}
+
+void *memalign(size_t aAlign, size_t aBytes)
+{
+    g_allocs++;
+    return __libc_memalign(aAlign, aBytes);
+}
+
+void *aligned_alloc(size_t aAlign, size_t aBytes)
+{
+    g_allocs++;
+    return __libc_memalign(aAlign, aBytes);
+}
+
+int posix_memalign(void **aPtr, size_t aAlign, size_t aBytes)
+{
+    g_allocs++;
+
+    void *ptr = __libc_memalign(aAlign, aBytes);
+
+    if (ptr == NULL)
+    {
+        return ENOMEM;
+    }
+
+    *aPtr = ptr;
+
+    return 0;
+}
+} // extern "C"
+
+// The native codecs available in this build, each the sole codec of its
+// controller.
+static std::vector<CodecBase*> nativeCodecs(IMimeTypeList& aMimeTypes)
+{
+    std::vector<CodecBase*> codecs;
+
+    codecs.push_back(CodecFactory::NewFlac(aMimeTypes));
+    codecs.push_back(CodecFactory::NewWav(aMimeTypes));
+    codecs.push_back(CodecFactory::NewAiff(aMimeTypes));
+    codecs.push_back(CodecFactory::NewAifc(aMimeTypes));
+    codecs.push_back(CodecFactory::NewAlacApple(aMimeTypes));
+    codecs.push_back(CodecFactory::NewVorbis(aMimeTypes));
+
+#if !defined(USE_LIBAVCODEC) || defined(ROUTE_RESTRICTED_CODECS)
+#ifdef ENABLE_AAC
+    codecs.push_back(CodecFactory::NewAacFdkMp4(aMimeTypes));
+    codecs.push_back(CodecFactory::NewAacFdkAdts(aMimeTypes));
+#endif // ENABLE_AAC
+#ifdef ENABLE_MP3
+    codecs.push_back(CodecFactory::NewMp3(aMimeTypes));
+#endif // ENABLE_MP3
+#endif // !USE_LIBAVCODEC || ROUTE_RESTRICTED_CODECS
+
+    return codecs;
+}
+
+// Decode aData through a controller holding aCodecs, logging the result.
+static void benchmark(const char* aPath, const char* aDecoder,
+                      const std::vector<TByte>& aData,
+                      const std::vector<CodecBase*>& aCodecs,
+                      IInfoAggregator& aInfoAggregator)
+{
+    Brn          uri(aPath);
+    DecodeTiming timing;
+
+    if (! TimeDecode(uri, aData, aCodecs, aInfoAggregator, &g_allocs,
+                     timing))
+    {
+        Log::Print("{\"file\":\"%s\",\"decoder\":\"%s\","
+                   "\"error\":\"not decoded\"}\n", aPath, aDecoder);
+        return;
+    }
+
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    TUint64 frames   = timing.jiffies / Jiffies::PerSample(timing.sampleRate);
+    double  audioSec = (double)timing.jiffies / Jiffies::kPerSecond;
+    TUint64 wallUs   = timing.decodeUs;
+
+    Log::Print("{\"file\":\"%s\",\"decoder\":\"%s\",\"codec\":\"%.*s\","
+               "\"sample_rate\":%u,\"channels\":%u,\"frames\":%llu,"
+               "\"decode_us\":%llu,\"x_realtime\":%.1f,"
+               "\"cpu_ns_per_sample\":%.1f,\"allocs\":%llu,"
+               "\"allocs_per_audio_sec\":%.1f,\"first_audio_us\":%llu,"
+               "\"peak_rss_kb\":%ld}\n",
+               aPath, aDecoder, PBUF(timing.codecName), timing.sampleRate,
+               timing.channels, (unsigned long long)frames,
+               (unsigned long long)wallUs,
+               wallUs ? (audioSec * 1000000.0) / wallUs : 0.0,
+               frames ? (double)timing.cpuNs / frames : 0.0,
+               (unsigned long long)timing.allocs,
+               audioSec > 0 ? timing.allocs / audioSec : 0.0,
+               (unsigned long long)timing.firstAudioUs,
+               usage.ru_maxrss);
+}
+
+static TBool readFile(const char* aPath, std::vector<TByte>& aData)
+{
+    FILE *file = fopen(aPath, "rb");
+
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    TByte  buf[64 * 1024];
+    size_t bytes;
+
+    aData.clear();
+
+    while ((bytes = fread(buf, 1, sizeof(buf), file)) > 0)
+    {
+        aData.insert(aData.end(), buf, buf + bytes);
+    }
+
+    fclose(file);
+
+    return ! aData.empty();
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: openhome-codec-benchmark [--threads N] "
+                    "[--repeat N] file...\n");
+}
+
+int main(int argc, char **argv)
+{
+    TUint threads = 1;
+    TUint repeat  = 1;
+    TInt  first   = 1;
+
+    while ((first + 1 < argc) && (strncmp(argv[first], "--", 2) == 0))
+    {
+        if (strcmp(argv[first], "--threads") == 0)
+        {
+            threads = strtoul(argv[first + 1], NULL, 10);
+        }
+        else if (strcmp(argv[first], "--repeat") == 0)
+        {
+            repeat = strtoul(argv[first + 1], NULL, 10);
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+
+        first += 2;
+    }
+
+    if (first >= argc)
+    {
+        usage();
+        return 1;
+    }
+
+    Net::InitialisationParams *initParams =
+        Net::InitialisationParams::Create();
+    Net::Library *lib = new Net::Library(initParams);
+
+    // Route every format to libavcodec and disable the caches, which
+    // would otherwise skip the probe or the decode.
+    ConfigGTKKeyStore *configStore = ConfigGTKKeyStore::getInstance();
+    Bws<Ascii::kMaxUintStringBytes> threadsBuf;
+
+    Ascii::AppendDec(threadsBuf, threads);
+
+    configStore->Write(Brn("Codec.LibAV.DecodeThreads"), threadsBuf);
+    configStore->Write(Brn("Codec.LibAV.SeekIndexCacheKb"), Brn("0"));
+    configStore->Write(Brn("Codec.LibAV.PcmCacheKb"), Brn("0"));
+    configStore->Write(Brn("Codec.Route.Aac"), Brn("libav"));
+    configStore->Write(Brn("Codec.Route.Aiff"), Brn("libav"));
+    configStore->Write(Brn("Codec.Route.Flac"), Brn("libav"));
+    configStore->Write(Brn("Codec.Route.Mp3"), Brn("libav"));
+    configStore->Write(Brn("Codec.Route.Vorbis"), Brn("libav"));
+    configStore->Write(Brn("Codec.Route.Wav"), Brn("libav"));
+
+    {
+        AllocatorInfoLogger infoAggregator;
+        NullMimeTypeList    mimeTypes;
+        std::vector<TByte>  data;
+
+        for (TInt i=first; i<argc; i++)
+        {
+            if (! readFile(argv[i], data))
+            {
+                Log::Print("{\"file\":\"%s\",\"error\":\"unreadable\"}\n",
+                           argv[i]);
+                continue;
+            }
+
+            for (TUint r=0; r<repeat; r++)
+            {
+                benchmark(argv[i], "native", data, nativeCodecs(mimeTypes),
+                          infoAggregator);
+
+#ifdef USE_LIBAVCODEC
+                std::vector<CodecBase*> libav;
+
+                libav.push_back(NewCodecLibAV(mimeTypes));
+
+                benchmark(argv[i], "libav", data, libav, infoAggregator);
+#endif // USE_LIBAVCODEC
+            }
+        }
+    }
+
+    delete lib;
+
+    return 0;
+}